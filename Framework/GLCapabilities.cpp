@@ -453,7 +453,7 @@ namespace jet
 		{
 			size_t length = strlen(versionString);
 			char *pUpperVersionString = (char *)malloc(length + 1);
-			ToUppercase(pUpperVersionString, versionString);
+			ToUppercase(pUpperVersionString, versionString, static_cast<int>(length));
 			pUpperVersionString[length] = '\0';
 
 			char *p = (char *)pUpperVersionString;
@@ -491,6 +491,11 @@ namespace jet
 
 					break;
 				}
+				else
+				{
+					// Skip the vendor words before the version.
+					p += (n + 1);
+				}
 			}
 
 			free(pUpperVersionString);
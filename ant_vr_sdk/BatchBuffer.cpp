@@ -5,6 +5,7 @@ namespace jet
 	namespace util
 	{
 		extern BatchBuffer* CreateSingleBatchBuffer(SpatialManager* pManager);
+		extern BatchBuffer* CreateMultiDrawBatchBuffer(SpatialManager* pManager);
 
 		BatchBuffer* BatchBuffer::create(SpatialManager* pManager,BatchType type)
 		{
@@ -22,10 +23,13 @@ namespace jet
 			case jet::util::BatchBuffer::ELEMENT_COMBINE:
 				break;
 			case jet::util::BatchBuffer::MULTI_DRAW:
+				return CreateMultiDrawBatchBuffer(pManager);
 				break;
 			default:
 				break;
 			}
+
+			return nullptr;
 		}
 	}
 }
\ No newline at end of file
@@ -29,6 +29,8 @@ namespace jet
 				assert(pManager);
 			}
 
+			virtual ~BatchBuffer(){}
+
 			static BatchBuffer* create(SpatialManager* pManager, BatchType type = MULTI_DRAW);
 
 			virtual bool addGeometry(Geometry*) = 0;
@@ -88,6 +90,20 @@ namespace jet
 
 			virtual void update(/*arguments */) = 0;
 
+			/**
+			* Culls the geometries against the camera for the draws that follow. Only the batches
+			* culling on the GPU need it, the others are culled with the scene.
+			*/
+			virtual void cull(Camera* pCam) {}
+
+			/**
+			* Reads back the DrawElementsIndirectCommand records and the draw count of every group
+			* written by the last cull(), for the checks. drawCounts is left empty when the draws don't
+			* take their count from a buffer, the culled commands then draw no instance. Stalls the GPU.
+			* Returns false for the batches not culling on the GPU or before the first cull.
+			*/
+			virtual bool readCullResults(std::vector<uint32_t>& commands, std::vector<uint32_t>& drawCounts) { return false; }
+
 
 		protected:
 
@@ -1,17 +1,377 @@
 #include "BoundingVolume.h"
+#include <simd/geometric.h>
+#include <float.h>
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#define BOUNDING_SIMD 1
+#else
+#define BOUNDING_SIMD 0
+#endif
 
 namespace jet
 {
 	namespace util
 	{
+		// whichSide() loads the normal and the constant of a plane as one vector.
+		static_assert(sizeof(Planef) == 4 * sizeof(float), "Planef must be tightly packed");
+
+		static glm::mat4 toMatrix(const Transform& trans)
+		{
+			glm::mat4 mat = glm::mat4_cast(trans.getRotate());
+			mat[0] *= trans.getScale().x;
+			mat[1] *= trans.getScale().y;
+			mat[2] *= trans.getScale().z;
+			mat[3] = glm::vec4(trans.getTranslate(), 1.0f);
+			return mat;
+		}
 
-		BoundingVolume::BoundingVolume()
+		static Planef::Side sideOf(float distance, float radius)
 		{
+			if (distance < -radius)
+				return Planef::Side::NEGATIVE;
+			else if (distance > radius)
+				return Planef::Side::POSITIVE;
+			else
+				return Planef::Side::NONE;
 		}
 
+#if BOUNDING_SIMD
+		static inline glm_vec4 loadVec3(const glm::vec3& v, float w)
+		{
+			return _mm_setr_ps(v.x, v.y, v.z, w);
+		}
+
+		static inline glm::vec3 storeVec3(glm_vec4 v)
+		{
+			float out[4];
+			_mm_storeu_ps(out, v);
+			return glm::vec3(out[0], out[1], out[2]);
+		}
+
+		// Returns the dot product of the plane with (point, -1), i.e. the signed distance of the point.
+		static inline float planeDistance(const Planef& plane, const glm::vec3& point)
+		{
+			return _mm_cvtss_f32(glm_vec1_dot(_mm_loadu_ps(&plane.f3Normal.x), loadVec3(point, -1.0f)));
+		}
+
+		// Transforms the point by the affine matrix, M * (p, 1).
+		static inline glm_vec4 transformPoint(const glm_vec4* pColumns, const glm::vec3& p)
+		{
+			return glm_vec4_fma(pColumns[0], _mm_set1_ps(p.x), glm_vec4_fma(pColumns[1], _mm_set1_ps(p.y), glm_vec4_fma(pColumns[2], _mm_set1_ps(p.z), pColumns[3])));
+		}
+
+		static inline void loadColumns(const glm::mat4& mat, glm_vec4* pColumns)
+		{
+			for (int i = 0; i < 4; i++)
+				pColumns[i] = _mm_loadu_ps(&mat[i][0]);
+		}
+#else
+		static inline float planeDistance(const Planef& plane, const glm::vec3& point)
+		{
+			return Planef::pseudoDistance(point, plane);
+		}
+#endif
+
+		BoundingVolume::BoundingVolume() : m_iCheckPlane(0), m_f3Center(0.0f)
+		{
+		}
+
+		BoundingVolume::BoundingVolume(const glm::vec3& center) : m_iCheckPlane(0), m_f3Center(center)
+		{
+		}
 
 		BoundingVolume::~BoundingVolume()
 		{
 		}
+
+		BoundingBox::BoundingBox() : BoundingVolume(), m_f3Extent(0.0f){}
+
+		BoundingBox::BoundingBox(const glm::vec3& center, const glm::vec3& extent) : BoundingVolume(center), m_f3Extent(extent){}
+
+		BoundingBox BoundingBox::fromMinMax(const glm::vec3& min, const glm::vec3& max)
+		{
+			BoundingBox box;
+			box.setMinMax(min, max);
+			return box;
+		}
+
+		void BoundingBox::setMinMax(const glm::vec3& min, const glm::vec3& max)
+		{
+			m_f3Center = (min + max) * 0.5f;
+			m_f3Extent = (max - min) * 0.5f;
+		}
+
+		void BoundingBox::transform(const Transform& trans)
+		{
+			transform(toMatrix(trans));
+		}
+
+		void BoundingBox::transform(const glm::mat4& trans)
+		{
+			// The new extent is the extent projected onto the axes through the absolute rotation-scale part.
+#if BOUNDING_SIMD
+			glm_vec4 columns[4];
+			loadColumns(trans, columns);
+
+			const glm_vec4 center = transformPoint(columns, m_f3Center);
+			const glm_vec4 extent = glm_vec4_fma(glm_vec4_abs(columns[0]), _mm_set1_ps(m_f3Extent.x),
+									glm_vec4_fma(glm_vec4_abs(columns[1]), _mm_set1_ps(m_f3Extent.y),
+									glm_vec4_mul(glm_vec4_abs(columns[2]), _mm_set1_ps(m_f3Extent.z))));
+			m_f3Center = storeVec3(center);
+			m_f3Extent = storeVec3(extent);
+#else
+			const glm::mat3 rotScale(trans);
+			m_f3Center = glm::vec3(trans * glm::vec4(m_f3Center, 1.0f));
+			m_f3Extent = glm::abs(rotScale[0]) * m_f3Extent.x + glm::abs(rotScale[1]) * m_f3Extent.y + glm::abs(rotScale[2]) * m_f3Extent.z;
+#endif
+		}
+
+		Planef::Side BoundingBox::whichSide(const Planef& plane) const
+		{
+#if BOUNDING_SIMD
+			const glm_vec4 normal = _mm_loadu_ps(&plane.f3Normal.x);
+			const float distance = _mm_cvtss_f32(glm_vec1_dot(normal, loadVec3(m_f3Center, -1.0f)));
+			const float radius = _mm_cvtss_f32(glm_vec1_dot(glm_vec4_abs(normal), loadVec3(m_f3Extent, 0.0f)));
+#else
+			const float distance = Planef::pseudoDistance(m_f3Center, plane);
+			const float radius = glm::dot(glm::abs(plane.f3Normal), m_f3Extent);
+#endif
+			return sideOf(distance, radius);
+		}
+
+		void BoundingBox::computeFromPoints(const glm::vec3* pPoints, uint32_t count)
+		{
+			if (count == 0)
+			{
+				m_f3Center = glm::vec3(0.0f);
+				m_f3Extent = glm::vec3(0.0f);
+				return;
+			}
+
+			glm::vec3 minPos = pPoints[0];
+			glm::vec3 maxPos = pPoints[0];
+			for (uint32_t i = 1; i < count; i++)
+			{
+				minPos = glm::min(minPos, pPoints[i]);
+				maxPos = glm::max(maxPos, pPoints[i]);
+			}
+
+			setMinMax(minPos, maxPos);
+		}
+
+		void BoundingBox::mergeLocal(const BoundingVolume* pVolume)
+		{
+			if (pVolume == nullptr)
+				return;
+
+			glm::vec3 otherMin, otherMax;
+			if (pVolume->getType() == Type::AABB)
+			{
+				const BoundingBox* pBox = static_cast<const BoundingBox*>(pVolume);
+				otherMin = pBox->getMin();
+				otherMax = pBox->getMax();
+			}
+			else
+			{
+				const BoundingSphere* pSphere = static_cast<const BoundingSphere*>(pVolume);
+				otherMin = pSphere->getCenter() - glm::vec3(pSphere->getRadius());
+				otherMax = pSphere->getCenter() + glm::vec3(pSphere->getRadius());
+			}
+
+			setMinMax(glm::min(getMin(), otherMin), glm::max(getMax(), otherMax));
+		}
+
+		bool BoundingBox::contains(const glm::vec3& point) const
+		{
+			const glm::vec3 d = glm::abs(point - m_f3Center);
+			return d.x <= m_f3Extent.x && d.y <= m_f3Extent.y && d.z <= m_f3Extent.z;
+		}
+
+		bool BoundingBox::intersects(const BoundingVolume* pVolume) const
+		{
+			if (pVolume == nullptr)
+				return false;
+
+			if (pVolume->getType() == Type::AABB)
+			{
+				const BoundingBox* pBox = static_cast<const BoundingBox*>(pVolume);
+				const glm::vec3 d = glm::abs(pBox->m_f3Center - m_f3Center);
+				const glm::vec3 e = pBox->m_f3Extent + m_f3Extent;
+				return d.x <= e.x && d.y <= e.y && d.z <= e.z;
+			}
+
+			return pVolume->intersects(this);
+		}
+
+		bool BoundingBox::intersects(const Ray& ray, float& distance) const
+		{
+			distance = intersectRay(getMin(), getMax(), ray.Origin, 1.0f / ray.Direction, ray.Limit);
+			return distance != FLT_MAX;
+		}
+
+		BoundingVolume* BoundingBox::clone(BoundingVolume* pStore) const
+		{
+			if (pStore && pStore->getType() == Type::AABB)
+			{
+				*static_cast<BoundingBox*>(pStore) = *this;
+				return pStore;
+			}
+
+			return new BoundingBox(*this);
+		}
+
+		BoundingSphere::BoundingSphere() : BoundingVolume(), m_fRadius(0.0f){}
+
+		BoundingSphere::BoundingSphere(const glm::vec3& center, float radius) : BoundingVolume(center), m_fRadius(radius){}
+
+		void BoundingSphere::transform(const Transform& trans)
+		{
+			const glm::vec3 scale = glm::abs(trans.getScale());
+			m_f3Center = Transform::transform(trans, m_f3Center);
+			m_fRadius *= glm::max(scale.x, glm::max(scale.y, scale.z));
+		}
+
+		void BoundingSphere::transform(const glm::mat4& trans)
+		{
+			// The radius grows with the longest axis of the rotation-scale part.
+#if BOUNDING_SIMD
+			glm_vec4 columns[4];
+			loadColumns(trans, columns);
+
+			const glm_vec4 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+			const glm_vec4 axis0 = _mm_and_ps(columns[0], mask);
+			const glm_vec4 axis1 = _mm_and_ps(columns[1], mask);
+			const glm_vec4 axis2 = _mm_and_ps(columns[2], mask);
+			const glm_vec4 maxLength2 = _mm_max_ss(glm_vec1_dot(axis0, axis0), _mm_max_ss(glm_vec1_dot(axis1, axis1), glm_vec1_dot(axis2, axis2)));
+
+			m_f3Center = storeVec3(transformPoint(columns, m_f3Center));
+			m_fRadius *= _mm_cvtss_f32(_mm_sqrt_ss(maxLength2));
+#else
+			const float maxLength2 = glm::max(glm::dot(glm::vec3(trans[0]), glm::vec3(trans[0])),
+										glm::max(glm::dot(glm::vec3(trans[1]), glm::vec3(trans[1])), glm::dot(glm::vec3(trans[2]), glm::vec3(trans[2]))));
+			m_f3Center = glm::vec3(trans * glm::vec4(m_f3Center, 1.0f));
+			m_fRadius *= glm::sqrt(maxLength2);
+#endif
+		}
+
+		Planef::Side BoundingSphere::whichSide(const Planef& plane) const
+		{
+			return sideOf(planeDistance(plane, m_f3Center), m_fRadius);
+		}
+
+		void BoundingSphere::computeFromPoints(const glm::vec3* pPoints, uint32_t count)
+		{
+			// Centered on the box of the points, a little looser than the minimal sphere but stable.
+			BoundingBox box;
+			box.computeFromPoints(pPoints, count);
+			m_f3Center = box.getCenter();
+
+			float maxDistance2 = 0.0f;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const glm::vec3 d = pPoints[i] - m_f3Center;
+				maxDistance2 = glm::max(maxDistance2, glm::dot(d, d));
+			}
+
+			m_fRadius = glm::sqrt(maxDistance2);
+		}
+
+		void BoundingSphere::mergeSphere(const glm::vec3& center, float radius)
+		{
+			const glm::vec3 d = center - m_f3Center;
+			const float distance = glm::length(d);
+			if (distance + radius <= m_fRadius)
+			{
+				return;
+			}
+
+			if (distance + m_fRadius <= radius)
+			{
+				m_f3Center = center;
+				m_fRadius = radius;
+				return;
+			}
+
+			const float newRadius = (distance + m_fRadius + radius) * 0.5f;
+			m_f3Center += d * ((newRadius - m_fRadius) / distance);
+			m_fRadius = newRadius;
+		}
+
+		void BoundingSphere::mergeLocal(const BoundingVolume* pVolume)
+		{
+			if (pVolume == nullptr)
+				return;
+
+			if (pVolume->getType() == Type::Sphere)
+			{
+				const BoundingSphere* pSphere = static_cast<const BoundingSphere*>(pVolume);
+				mergeSphere(pSphere->m_f3Center, pSphere->m_fRadius);
+			}
+			else
+			{
+				const BoundingBox* pBox = static_cast<const BoundingBox*>(pVolume);
+				mergeSphere(pBox->getCenter(), glm::length(pBox->getExtent()));
+			}
+		}
+
+		bool BoundingSphere::contains(const glm::vec3& point) const
+		{
+			const glm::vec3 d = point - m_f3Center;
+			return glm::dot(d, d) <= m_fRadius * m_fRadius;
+		}
+
+		bool BoundingSphere::intersects(const BoundingVolume* pVolume) const
+		{
+			if (pVolume == nullptr)
+				return false;
+
+			if (pVolume->getType() == Type::Sphere)
+			{
+				const BoundingSphere* pSphere = static_cast<const BoundingSphere*>(pVolume);
+				const glm::vec3 d = pSphere->m_f3Center - m_f3Center;
+				const float r = pSphere->m_fRadius + m_fRadius;
+				return glm::dot(d, d) <= r * r;
+			}
+
+			// The point of the box closest to the center of the sphere.
+			const BoundingBox* pBox = static_cast<const BoundingBox*>(pVolume);
+			const glm::vec3 closest = glm::clamp(m_f3Center, pBox->getMin(), pBox->getMax());
+			const glm::vec3 d = closest - m_f3Center;
+			return glm::dot(d, d) <= m_fRadius * m_fRadius;
+		}
+
+		bool BoundingSphere::intersects(const Ray& ray, float& distance) const
+		{
+			// Solves |origin + t * direction - center| = radius for the entering t.
+			const glm::vec3 diff = ray.Origin - m_f3Center;
+			const float a = glm::dot(ray.Direction, ray.Direction);
+			const float b = glm::dot(diff, ray.Direction);
+			const float c = glm::dot(diff, diff) - m_fRadius * m_fRadius;
+			if (c <= 0.0f)
+			{
+				distance = 0.0f;
+				return true;
+			}
+
+			const float discriminant = b * b - a * c;
+			if (b >= 0.0f || discriminant < 0.0f)
+			{
+				return false;
+			}
+
+			distance = (-b - sqrt(discriminant)) / a;
+			return distance <= ray.Limit;
+		}
+
+		BoundingVolume* BoundingSphere::clone(BoundingVolume* pStore) const
+		{
+			if (pStore && pStore->getType() == Type::Sphere)
+			{
+				*static_cast<BoundingSphere*>(pStore) = *this;
+				return pStore;
+			}
+
+			return new BoundingSphere(*this);
+		}
 	}
 }
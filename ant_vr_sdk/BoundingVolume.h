@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include <float.h>
 #include <glm.hpp>
 #include <memory>
 #include "Transform.h"
@@ -44,6 +45,9 @@ namespace jet
 			*/
 			void setCheckPlane(int32_t value) {	m_iCheckPlane = value;}
 
+			const glm::vec3& getCenter() const { return m_f3Center; }
+			void setCenter(const glm::vec3& center) { m_f3Center = center; }
+
 			/**
 			* getType returns the type of bounding volume this is.
 			*/
@@ -66,14 +70,41 @@ namespace jet
 			*
 			* @param trans
 			*            the transform to affect the bound.
-			*/	
+			*/
 			virtual void transform(const glm::mat4& trans) = 0;
 
-			virtual Planef::Side whichSide(Planef plane) = 0;
+			/**
+			* <code>whichSide</code> returns the side of the plane the bounding volume lies on,
+			* NONE if the plane cuts through it.
+			*/
+			virtual Planef::Side whichSide(const Planef& plane) const = 0;
 
-			virtual BoundingVolume* clone(){ return this; }
+			/**
+			* <code>computeFromPoints</code> sets the bound to contain all of the given points.
+			*/
+			virtual void computeFromPoints(const glm::vec3* pPoints, uint32_t count) = 0;
 
-			~BoundingVolume();
+			/**
+			* <code>mergeLocal</code> grows this bound so it also contains the given one.
+			*/
+			virtual void mergeLocal(const BoundingVolume* pVolume) = 0;
+
+			virtual bool contains(const glm::vec3& point) const = 0;
+			virtual bool intersects(const BoundingVolume* pVolume) const = 0;
+			/**
+			* Returns true if the ray passes through the bound within its limit. distance receives
+			* where the ray enters the bound, 0 when the origin is inside.
+			*/
+			virtual bool intersects(const Ray& ray, float& distance) const = 0;
+			bool intersects(const Ray& ray) const { float distance; return intersects(ray, distance); }
+
+			/**
+			* <code>clone</code> copies this bound into pStore when it has the same type,
+			* otherwise into a new bound that the caller owns.
+			*/
+			virtual BoundingVolume* clone(BoundingVolume* pStore = nullptr) const = 0;
+
+			virtual ~BoundingVolume();
 
 		protected:
 			int32_t m_iCheckPlane;
@@ -81,6 +112,89 @@ namespace jet
 		};
 
 		typedef std::shared_ptr<BoundingVolume> BoundingVolumePtr;
+
+		/**
+		* <code>BoundingBox</code> describes a bounding volume as an axis-aligned box,
+		* stored as a center and the half sizes along each axis.
+		*/
+		class BoundingBox : public BoundingVolume
+		{
+		public:
+			BoundingBox();
+			BoundingBox(const glm::vec3& center, const glm::vec3& extent);
+
+			static BoundingBox fromMinMax(const glm::vec3& min, const glm::vec3& max);
+
+			Type getType() const override { return Type::AABB; }
+
+			void transform(const Transform& trans) override;
+			void transform(const glm::mat4& trans) override;
+			Planef::Side whichSide(const Planef& plane) const override;
+			void computeFromPoints(const glm::vec3* pPoints, uint32_t count) override;
+			void mergeLocal(const BoundingVolume* pVolume) override;
+			bool contains(const glm::vec3& point) const override;
+			bool intersects(const BoundingVolume* pVolume) const override;
+			bool intersects(const Ray& ray, float& distance) const override;
+			using BoundingVolume::intersects;
+			BoundingVolume* clone(BoundingVolume* pStore = nullptr) const override;
+
+			void setMinMax(const glm::vec3& min, const glm::vec3& max);
+			glm::vec3 getMin() const { return m_f3Center - m_f3Extent; }
+			glm::vec3 getMax() const { return m_f3Center + m_f3Extent; }
+
+			const glm::vec3& getExtent() const { return m_f3Extent; }
+			void setExtent(const glm::vec3& extent) { m_f3Extent = extent; }
+
+			/**
+			* Slab test of a ray against the box [min, max], the infinities of the zero direction components
+			* compare as expected. Returns where the ray enters the box, 0 when the origin is inside,
+			* or FLT_MAX when it misses the box before tMax.
+			*/
+			static float intersectRay(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin, const glm::vec3& invDirection, float tMax)
+			{
+				const glm::vec3 t0 = (min - origin) * invDirection;
+				const glm::vec3 t1 = (max - origin) * invDirection;
+				const glm::vec3 tNear = glm::min(t0, t1);
+				const glm::vec3 tFar = glm::max(t0, t1);
+				const float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+				const float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, tMax));
+				return enter <= exit ? enter : FLT_MAX;
+			}
+
+		private:
+			glm::vec3 m_f3Extent;
+		};
+
+		/**
+		* <code>BoundingSphere</code> describes a bounding volume as a sphere.
+		*/
+		class BoundingSphere : public BoundingVolume
+		{
+		public:
+			BoundingSphere();
+			BoundingSphere(const glm::vec3& center, float radius);
+
+			Type getType() const override { return Type::Sphere; }
+
+			void transform(const Transform& trans) override;
+			void transform(const glm::mat4& trans) override;
+			Planef::Side whichSide(const Planef& plane) const override;
+			void computeFromPoints(const glm::vec3* pPoints, uint32_t count) override;
+			void mergeLocal(const BoundingVolume* pVolume) override;
+			bool contains(const glm::vec3& point) const override;
+			bool intersects(const BoundingVolume* pVolume) const override;
+			bool intersects(const Ray& ray, float& distance) const override;
+			using BoundingVolume::intersects;
+			BoundingVolume* clone(BoundingVolume* pStore = nullptr) const override;
+
+			float getRadius() const { return m_fRadius; }
+			void setRadius(float radius) { m_fRadius = radius; }
+
+		private:
+			void mergeSphere(const glm::vec3& center, float radius);
+
+		private:
+			float m_fRadius;
+		};
 	}
 }
-
@@ -1,40 +1,208 @@
 #include "Buffer.h"
 #include <string.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 namespace jet
 {
 	namespace util
 	{
-		BufferMemory::BufferMemory() : Buffer(), m_pData(nullptr){}
+		// Page ranges are sized in multiples of this, the allocation granularity of Windows.
+		static const size_t PAGE_RANGE_GRANULARITY = 64 * 1024;
+
+		static size_t alignUp(size_t size, size_t alignment)
+		{
+			return (size + alignment - 1) / alignment * alignment;
+		}
+
+		static uint8_t* allocateHeap(size_t size)
+		{
+#if defined(_WIN32)
+			return static_cast<uint8_t*>(_aligned_malloc(size, BufferMemory::ALIGNMENT));
+#else
+			void* pData = nullptr;
+			return posix_memalign(&pData, BufferMemory::ALIGNMENT, size) == 0 ? static_cast<uint8_t*>(pData) : nullptr;
+#endif
+		}
+
+		static void freeHeap(uint8_t* pData)
+		{
+#if defined(_WIN32)
+			_aligned_free(pData);
+#else
+			free(pData);
+#endif
+		}
+
+		// Maps a range of at least commitSize bytes. reservedSize returns the size of the whole range.
+		static uint8_t* allocatePages(size_t commitSize, size_t reserveHint, size_t& reservedSize)
+		{
+#if defined(_WIN32)
+			// Set aside twice the address space, so the next grows only commit pages.
+			reservedSize = alignUp(reserveHint > commitSize * 2 ? reserveHint : commitSize * 2, PAGE_RANGE_GRANULARITY);
+			void* pRange = VirtualAlloc(nullptr, reservedSize, MEM_RESERVE, PAGE_NOACCESS);
+			if (pRange == nullptr)
+			{
+				// Not enough contiguous address space, go without the headroom.
+				reservedSize = commitSize;
+				pRange = VirtualAlloc(nullptr, reservedSize, MEM_RESERVE, PAGE_NOACCESS);
+			}
+
+			if (pRange == nullptr || VirtualAlloc(pRange, commitSize, MEM_COMMIT, PAGE_READWRITE) == nullptr)
+			{
+				if (pRange) VirtualFree(pRange, 0, MEM_RELEASE);
+				reservedSize = 0;
+				return nullptr;
+			}
+
+			return static_cast<uint8_t*>(pRange);
+#else
+			void* pRange = mmap(nullptr, commitSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			reservedSize = (pRange != MAP_FAILED) ? commitSize : 0;
+			return (pRange != MAP_FAILED) ? static_cast<uint8_t*>(pRange) : nullptr;
+#endif
+		}
+
+		// Grows a page range to commitSize bytes without copying it. Returns nullptr if the range
+		// can't grow, it is left untouched then.
+		static uint8_t* growPages(uint8_t* pRange, size_t commitSize, size_t& reservedSize)
+		{
+#if defined(_WIN32)
+			if (commitSize > reservedSize || VirtualAlloc(pRange, commitSize, MEM_COMMIT, PAGE_READWRITE) == nullptr)
+			{
+				return nullptr;
+			}
+
+			return pRange;
+#elif defined(__linux__)
+			// The kernel moves the page table entries, the contents are never copied.
+			void* pNewRange = mremap(pRange, reservedSize, commitSize, MREMAP_MAYMOVE);
+			if (pNewRange == MAP_FAILED)
+			{
+				return nullptr;
+			}
+
+			reservedSize = commitSize;
+			return static_cast<uint8_t*>(pNewRange);
+#else
+			return nullptr;
+#endif
+		}
+
+		static void freePages(uint8_t* pRange, size_t reservedSize)
+		{
+#if defined(_WIN32)
+			VirtualFree(pRange, 0, MEM_RELEASE);
+#else
+			munmap(pRange, reservedSize);
+#endif
+		}
+
+		BufferMemory::BufferMemory(uint32_t reserveSize) : Buffer(), m_pData(nullptr), m_uiCapacity(0), m_uiReservedSize(0), m_uiReserveHint(reserveSize){}
 
 		BufferMemory::~BufferMemory()
 		{
-			if (m_pData) delete[] m_pData;
+			release();
 		}
 
-		bool BufferMemory::init(uint32_t size, const uint8_t* pData)
+		void BufferMemory::release()
 		{
-			if (m_uiDataSize != size)
+			if (m_pData)
 			{
-				m_uiDataSize = size;
-				if (m_pData)
+				if (m_uiReservedSize)
+					freePages(m_pData, m_uiReservedSize);
+				else
+					freeHeap(m_pData);
+			}
+
+			m_pData = nullptr;
+			m_uiCapacity = 0;
+			m_uiReservedSize = 0;
+			m_uiDataSize = 0;
+		}
+
+		bool BufferMemory::allocate(uint32_t capacity, uint32_t keepSize)
+		{
+			assert(keepSize <= m_uiDataSize);
+
+			const bool bPages = capacity >= VIRTUAL_THRESHOLD;
+			const size_t newCapacity = alignUp(capacity, bPages ? PAGE_RANGE_GRANULARITY : ALIGNMENT);
+
+			if (bPages && m_uiReservedSize)
+			{
+				uint8_t* pData = growPages(m_pData, newCapacity, m_uiReservedSize);
+				if (pData)
 				{
-					delete[] m_pData;
+					m_pData = pData;
+					m_uiCapacity = static_cast<uint32_t>(newCapacity < UINT32_MAX ? newCapacity : UINT32_MAX);
+					return true;
 				}
+			}
+
+			size_t reservedSize = 0;
+			uint8_t* pNewData = bPages ? allocatePages(newCapacity, m_uiReserveHint, reservedSize) : allocateHeap(newCapacity);
+			if (pNewData == nullptr)
+			{
+				return false;
+			}
 
-				if (size)
+			if (keepSize)
+			{
+				memcpy(pNewData, m_pData, keepSize);
+			}
+
+			const uint32_t size = m_uiDataSize;
+			release();
+
+			m_pData = pNewData;
+			m_uiCapacity = static_cast<uint32_t>(newCapacity < UINT32_MAX ? newCapacity : UINT32_MAX);
+			m_uiReservedSize = reservedSize;
+			m_uiDataSize = size;
+			return true;
+		}
+
+		bool BufferMemory::init(uint32_t size, const uint8_t* pData)
+		{
+			if (size > m_uiCapacity)
+			{
+				// The old contents are dropped, nothing to keep.
+				m_uiDataSize = 0;
+				if (!allocate(size, 0))
 				{
-					m_pData = new uint8_t[size];
+					return false;
 				}
-				
 			}
-			
-			if (size)
+
+			m_uiDataSize = size;
+			if (size && pData)
 			{
 				memcpy(m_pData, pData, size);
 			}
-			
-			return m_pData != nullptr;
+
+			return true;
+		}
+
+		bool BufferMemory::resize(uint32_t size)
+		{
+			if (size > m_uiCapacity && !allocate(size, m_uiDataSize))
+			{
+				return false;
+			}
+
+			m_uiDataSize = size;
+			return true;
+		}
+
+		bool BufferMemory::reserve(uint32_t capacity)
+		{
+			return capacity <= m_uiCapacity || allocate(capacity, m_uiDataSize);
 		}
 
 		bool BufferMemory::update(uint32_t offset, uint32_t size, const uint8_t* pData)
@@ -1,7 +1,10 @@
+#pragma once
 
 #include <stdint.h>
 #include <assert.h>
 #include "geometry2d.h"
+#include "BufferAllocator.h"
+#include <vector>
 
 namespace jet
 {
@@ -26,6 +29,10 @@ namespace jet
 			virtual uint32_t getDynamicOffset() { return 0; }
 			virtual void unmap() = 0;
 
+			/// Changes the size but keeps the contents. Returns false if the buffer can't do that,
+			/// the caller has to init() it again and restore the contents itself.
+			virtual bool resize(uint32_t /*size*/) { return false; }
+
 			virtual void memoryCpy(uint32_t dst_offset, uint32_t src_offset, uint32_t size) = 0;
 
 		protected:
@@ -51,19 +58,42 @@ namespace jet
 			uint32_t m_uiOffset;
 		};
 
+		/// CPU memory buffer. The storage is aligned to ALIGNMENT and only reallocated when the size
+		/// goes past the capacity. Buffers of VIRTUAL_THRESHOLD bytes and more get their own range of
+		/// pages, which grows without copying the contents: mremap() moves the pages on Linux, on
+		/// Windows more pages of the reserved address range are committed.
 		class BufferMemory : public Buffer
 		{
 		public:
-			BufferMemory();
+			static const uint32_t ALIGNMENT = 64;
+			static const uint32_t VIRTUAL_THRESHOLD = 64 * 1024;
+
+			/// reserveSize: Address space to set aside for growth. Costs no memory, Windows only.
+			explicit BufferMemory(uint32_t reserveSize = 0);
 			virtual ~BufferMemory();
 			virtual bool init(uint32_t size, const uint8_t* pData = nullptr) override;
 			virtual bool update(uint32_t offset, uint32_t size, const uint8_t* pData) override;
 			virtual uint8_t* map(uint32_t offset, uint32_t length, MappingBits bits = MappingBits::READ_WRITE) override;
 			virtual void unmap() override;
 			virtual void memoryCpy(uint32_t dst_offset, uint32_t src_offset, uint32_t size) override;
+			virtual bool resize(uint32_t size) override;
+
+			/// Makes room for capacity bytes, the size and the contents stay as they are.
+			bool reserve(uint32_t capacity);
+			uint32_t getCapacity() const { return m_uiCapacity; }
+
+			/// Frees the storage, the size and the capacity drop to 0.
+			void release();
+
+		private:
+			bool allocate(uint32_t capacity, uint32_t keepSize);
 
 		protected:
 			uint8_t* m_pData;
+			uint32_t m_uiCapacity;
+			// Address space reserved for the page range, 0 if the storage is on the heap.
+			size_t   m_uiReservedSize;
+			size_t   m_uiReserveHint;
 		};
 
 		class BufferCreator
@@ -109,7 +139,7 @@ namespace jet
 			
 			virtual ~BufferSharedUniformPool()
 			{
-				BufferSharedPool::~BufferSharedPool();
+				releaseMapping();
 			}
 
 			BufferSharedUniformPool(BufferCreator* pBufCreator);
@@ -124,7 +154,7 @@ namespace jet
 			///                  act as a ring buffer, using the next set of sub-ranges for each frame
 			/// \param bPersistent Flag to indicate whether the VBO should be persistently mapped
 			/// \return True if the buffer was initialized, false if an error occurred
-			bool init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames);
+			bool init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames, bool bPersistent = false);
 
 			/// Sets the current number of sub-ranges to contain in the shared VBO
 			/// \param numSubRanges Number of sub-ranges that will be held within the VBO
@@ -154,8 +184,35 @@ namespace jet
 			///         sub-range with the given index begins.
 			uint32_t getDynamicOffset(int subRangeIndex, uint32_t subIndex);
 
+			/// Returns the pointer to the given sub-range within the frame currently being written
+			/// \note Only valid between calls to beginUpdate()/endUpdate(), or at any time in persistent mode.
+			uint8_t* map(uint32_t subRangeIndex) { return map(subRangeIndex, m_index); }
+
+			/// Returns the offset of the given sub-range within the frame currently being written
+			uint32_t getDynamicOffset(int subRangeIndex) { return getDynamicOffset(subRangeIndex, m_index); }
+
+			/// Makes the current frame's region of the ring buffer writeable. In persistent mode the
+			/// whole buffer is mapped once and kept mapped; otherwise the frame's region is mapped
+			/// with a single call until endUpdate().
+			/// \return True if the region is writeable
+			bool beginUpdate();
+
+			/// Ends writing into the current frame's region. Unmaps the region unless the buffer is persistent.
+			void endUpdate();
+
+			/// Called once the draw calls reading the current frame have been issued. Moves the
+			/// ring on to the next frame's set of sub-ranges.
+			void doneRendering();
+
+			uint32_t getFrameIndex() const { return m_index; }
+			uint32_t getNumFrames() const { return m_numFrames; }
+			uint32_t getNumSubRanges() const { return m_numSubRanges; }
+			uint32_t getSubRangeSize() const { return m_subRangeSize; }
+			bool isPersistent() const { return m_bPersistent; }
+
 		private:
 			bool initBuffers();
+			void releaseMapping();
 
 		private:
 			uint32_t    m_numSubRanges;
@@ -163,19 +220,43 @@ namespace jet
 			uint32_t    m_index;
 			uint32_t    m_numFrames;
 			uint32_t    m_bufferSize;
+			bool        m_bPersistent;
+
+			// Base pointer of the mapped region, either the whole buffer (persistent) or the current frame.
+			uint8_t*    m_pMappedData;
+			uint32_t    m_uiMappedOffset;
 		};
 
 		typedef void* BufferBean;
+
+		/// Describes a bean that was moved by BufferSharedNonUniformPool::defragment().
+		struct BufferRelocation
+		{
+			BufferBean Bean;
+			uint32_t OldOffset;
+			uint32_t NewOffset;
+		};
+
+		class BufferRelocationListener
+		{
+		public:
+			virtual ~BufferRelocationListener(){}
+
+			/// Called once per compact() or defragment() step with all the beans moved in that step.
+			virtual void onBeansRelocated(const BufferRelocation* pRelocations, uint32_t count) = 0;
+		};
+
+		/**
+		 * Shares one buffer between many variable-sized beans. The ranges are handed out by a
+		 * TLSFAllocator, so add() and remove() are O(1) and reuse the holes left by removed beans.
+		 * Data is never moved on remove; call compact() to close the holes explicitly.
+		 */
 		class BufferSharedNonUniformPool : public BufferSharedPool
 		{
 		public:
 			BufferSharedNonUniformPool(BufferCreator* pBufCreator, uint32_t);
 			BufferSharedNonUniformPool(Buffer* pBuf);
-			virtual ~BufferSharedNonUniformPool()
-			{
-				BufferSharedPool::~BufferSharedPool();
-				deleteRegions();
-			}
+			virtual ~BufferSharedNonUniformPool();
 
 			BufferBean add(uint32_t size, const uint8_t* pData);
 			bool update(BufferBean bean, uint32_t offset, uint32_t size, const uint8_t* pData);
@@ -184,57 +265,56 @@ namespace jet
 			uint8_t* map(BufferBean bean, MappingBits bits = MappingBits::READ_WRITE);
 			bool isDirty(BufferBean bean) const;
 
-		private:
-			struct BufferBeanImpl;
-			struct Region
-			{
-				Rangeui Interval;
-				Region* pLeft;
-				Region* pRight;
-				int32_t iIndex;
-				bool bDirty;
-				BufferBeanImpl* pBean;
-
-				Region() :
-					Interval(),
-					pLeft(nullptr),
-					pRight(nullptr),
-					pBean(false),
-					bDirty(false),
-					iIndex(-1)
-				{}
-			};
+			/// Moves every bean down to the front of the buffer, so all the free space ends up in one
+			/// block at the end. The listeners are told about the moved beans like by defragment().
+			void compact();
+
+			/**
+			 * Incremental version of compact(): moves beans from the end of the buffer into holes in
+			 * front of them, relocating no more than maxBytes. The listeners are told about every moved
+			 * bean in one batch at the end of the step. Meant to be called once per frame.
+			 * @return The number of bytes moved.
+			 */
+			uint32_t defragment(uint32_t maxBytes);
+
+			void addRelocationListener(BufferRelocationListener* pListener);
+			void removeRelocationListener(BufferRelocationListener* pListener);
+
+			/// Returns 1 - largest hole / free size, see TLSFAllocator::getFragmentation().
+			float getFragmentation() const { return m_Allocator.getFragmentation(); }
+
+			/// Returns the number of bytes moved by the last defragment() step.
+			uint32_t getBytesMovedLastStep() const { return m_uiBytesMoved; }
 
+			uint32_t getConsumedSize() const { return m_Allocator.getUsedSize(); }
+			const TLSFAllocator& getAllocator() const { return m_Allocator; }
+
+		private:
 			struct BufferBeanImpl
 			{
 			public:
 				uint32_t uiBufferSize;
 				const unsigned char* pBufferData;
-
-				BufferBeanImpl() :
-					pData(nullptr){}
+				TLSFAllocator::Block* pBlock;
+				bool bDirty;
 
 				BufferBeanImpl(uint32_t bufferSize, const unsigned char* pData) :
-					uiBufferSize(bufferSize), pBufferData(pData), pData(nullptr){}
-				Region* pData;
+					uiBufferSize(bufferSize), pBufferData(pData), pBlock(nullptr), bDirty(false){}
 			};
 
 		private:
-			void addBufferBeanToTail(BufferBeanImpl* bean);
-			void deleteRegions();
-			void removeRegionSpaces();
-			void mergeSapce(Region* pRegion, int32_t& iIndexShift);
-			void flushRegions();
-			void makeRegionsDirty();
+			// Resizes the proxy buffer so that at least size more bytes fit, keeping the contents.
+			bool grow(uint32_t size);
+			void deleteBeans();
+			void notifyRelocations();
 
 		private:
-			Region* m_pHeader;
-			Region* m_pTail;
-//			Region* m_FirstEmpty;
+			TLSFAllocator m_Allocator;
 
-			uint32_t m_uiRegionCount;
-//			uint32_t m_uiEmptyRegionCount;
-			uint32_t m_uiConsumedSize;
+			std::vector<BufferRelocationListener*> m_RelocationListeners;
+			// Reused by every compact() and defragment() step.
+			std::vector<BufferRelocation> m_Relocations;
+			uint32_t m_uiBytesMoved;
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,489 @@
+#include "BufferAllocator.h"
+#include <assert.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace jet
+{
+	namespace util
+	{
+		// Index of the most significant set bit, x must not be zero.
+		static inline uint32_t fls(uint32_t x)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanReverse(&index, x);
+			return index;
+#else
+			return 31 - __builtin_clz(x);
+#endif
+		}
+
+		// Index of the least significant set bit, x must not be zero.
+		static inline uint32_t ffs(uint32_t x)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, x);
+			return index;
+#else
+			return __builtin_ctz(x);
+#endif
+		}
+
+		static inline uint32_t alignUp(uint32_t size)
+		{
+			return (size + TLSFAllocator::ALIGNMENT - 1) & ~(TLSFAllocator::ALIGNMENT - 1);
+		}
+
+		TLSFAllocator::TLSFAllocator(uint32_t capacity) :
+			m_FLBitmap(0), m_pFirst(nullptr), m_pLast(nullptr),
+			m_uiCapacity(0), m_uiUsedSize(0), m_uiUsedBlockCount(0), m_uiFreeBlockCount(0)
+		{
+			memset(m_SLBitmap, 0, sizeof(m_SLBitmap));
+			memset(m_FreeLists, 0, sizeof(m_FreeLists));
+
+			if (capacity)
+			{
+				reset(capacity);
+			}
+		}
+
+		TLSFAllocator::~TLSFAllocator()
+		{
+			deleteBlocks();
+			for (size_t i = 0; i < m_BlockCache.size(); i++)
+			{
+				delete m_BlockCache[i];
+			}
+		}
+
+		void TLSFAllocator::mapping(uint32_t size, uint32_t& fl, uint32_t& sl)
+		{
+			if (size < SMALL_BLOCK_SIZE)
+			{
+				fl = 0;
+				sl = size / (SMALL_BLOCK_SIZE / SL_COUNT);
+			}
+			else
+			{
+				const uint32_t f = fls(size);
+				sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+				fl = f - (FL_SHIFT - 1);
+			}
+		}
+
+		void TLSFAllocator::mappingSearch(uint32_t size, uint32_t& fl, uint32_t& sl)
+		{
+			// Round up to the next bucket, so every block found there is large enough.
+			if (size >= SMALL_BLOCK_SIZE)
+			{
+				size += (1u << (fls(size) - SL_LOG2)) - 1;
+			}
+
+			mapping(size, fl, sl);
+		}
+
+		TLSFAllocator::Block* TLSFAllocator::findSuitable(uint32_t& fl, uint32_t& sl) const
+		{
+			if (fl >= FL_COUNT)
+			{
+				return nullptr;
+			}
+
+			uint32_t slMap = m_SLBitmap[fl] & (~0u << sl);
+			if (!slMap)
+			{
+				const uint32_t flMap = (fl + 1 < 32) ? (m_FLBitmap & (~0u << (fl + 1))) : 0;
+				if (!flMap)
+				{
+					return nullptr;
+				}
+
+				fl = ffs(flMap);
+				slMap = m_SLBitmap[fl];
+			}
+
+			assert(slMap);
+			sl = ffs(slMap);
+			return m_FreeLists[fl][sl];
+		}
+
+		void TLSFAllocator::insertFree(Block* pBlock)
+		{
+			uint32_t fl, sl;
+			mapping(pBlock->Size, fl, sl);
+
+			Block* pHead = m_FreeLists[fl][sl];
+			pBlock->bFree = true;
+			pBlock->pUserData = nullptr;
+			pBlock->pPrevFree = nullptr;
+			pBlock->pNextFree = pHead;
+			if (pHead)
+			{
+				pHead->pPrevFree = pBlock;
+			}
+
+			m_FreeLists[fl][sl] = pBlock;
+			m_FLBitmap |= 1u << fl;
+			m_SLBitmap[fl] |= 1u << sl;
+			m_uiFreeBlockCount++;
+		}
+
+		void TLSFAllocator::removeFree(Block* pBlock)
+		{
+			assert(pBlock->bFree);
+
+			uint32_t fl, sl;
+			mapping(pBlock->Size, fl, sl);
+
+			if (pBlock->pPrevFree)
+			{
+				pBlock->pPrevFree->pNextFree = pBlock->pNextFree;
+			}
+			else
+			{
+				assert(m_FreeLists[fl][sl] == pBlock);
+				m_FreeLists[fl][sl] = pBlock->pNextFree;
+				if (m_FreeLists[fl][sl] == nullptr)
+				{
+					m_SLBitmap[fl] &= ~(1u << sl);
+					if (!m_SLBitmap[fl])
+					{
+						m_FLBitmap &= ~(1u << fl);
+					}
+				}
+			}
+
+			if (pBlock->pNextFree)
+			{
+				pBlock->pNextFree->pPrevFree = pBlock->pPrevFree;
+			}
+
+			pBlock->pPrevFree = nullptr;
+			pBlock->pNextFree = nullptr;
+			pBlock->bFree = false;
+			m_uiFreeBlockCount--;
+		}
+
+		void TLSFAllocator::absorb(Block* pBlock, Block* pNext)
+		{
+			assert(pBlock->pNextPhys == pNext);
+			assert(pBlock->Offset + pBlock->Size == pNext->Offset);
+
+			pBlock->Size += pNext->Size;
+			pBlock->pNextPhys = pNext->pNextPhys;
+			if (pNext->pNextPhys)
+			{
+				pNext->pNextPhys->pPrevPhys = pBlock;
+			}
+			else
+			{
+				m_pLast = pBlock;
+			}
+
+			deleteBlock(pNext);
+		}
+
+		TLSFAllocator::Block* TLSFAllocator::newBlock()
+		{
+			Block* pBlock;
+			if (m_BlockCache.empty())
+			{
+				pBlock = new Block;
+			}
+			else
+			{
+				pBlock = m_BlockCache.back();
+				m_BlockCache.pop_back();
+			}
+
+			memset(pBlock, 0, sizeof(Block));
+			return pBlock;
+		}
+
+		void TLSFAllocator::deleteBlock(Block* pBlock)
+		{
+			m_BlockCache.push_back(pBlock);
+		}
+
+		void TLSFAllocator::deleteBlocks()
+		{
+			Block* pNext = m_pFirst;
+			while (pNext)
+			{
+				Block* pDel = pNext;
+				pNext = pNext->pNextPhys;
+				deleteBlock(pDel);
+			}
+
+			m_pFirst = nullptr;
+			m_pLast = nullptr;
+			m_FLBitmap = 0;
+			memset(m_SLBitmap, 0, sizeof(m_SLBitmap));
+			memset(m_FreeLists, 0, sizeof(m_FreeLists));
+			m_uiCapacity = 0;
+			m_uiUsedSize = 0;
+			m_uiUsedBlockCount = 0;
+			m_uiFreeBlockCount = 0;
+		}
+
+		void TLSFAllocator::reset(uint32_t capacity)
+		{
+			deleteBlocks();
+			grow(capacity);
+		}
+
+		void TLSFAllocator::grow(uint32_t newCapacity)
+		{
+			newCapacity &= ~(ALIGNMENT - 1);
+			if (newCapacity <= m_uiCapacity)
+			{
+				return;
+			}
+
+			const uint32_t extra = newCapacity - m_uiCapacity;
+			if (m_pLast && m_pLast->bFree)
+			{
+				removeFree(m_pLast);
+				m_pLast->Size += extra;
+				insertFree(m_pLast);
+			}
+			else
+			{
+				Block* pBlock = newBlock();
+				pBlock->Offset = m_uiCapacity;
+				pBlock->Size = extra;
+				pBlock->pPrevPhys = m_pLast;
+				if (m_pLast)
+				{
+					m_pLast->pNextPhys = pBlock;
+				}
+				else
+				{
+					m_pFirst = pBlock;
+				}
+
+				m_pLast = pBlock;
+				insertFree(pBlock);
+			}
+
+			m_uiCapacity = newCapacity;
+		}
+
+		TLSFAllocator::Block* TLSFAllocator::allocate(uint32_t size, void* pUserData)
+		{
+			if (size == 0)
+			{
+				return nullptr;
+			}
+
+			size = alignUp(size);
+
+			uint32_t fl, sl;
+			mappingSearch(size, fl, sl);
+			Block* pBlock = findSuitable(fl, sl);
+			if (pBlock == nullptr)
+			{
+				// The rounded search skips the size class of the request itself, which may still hold
+				// a block that is large enough, e.g. the free space right after grow().
+				mapping(size, fl, sl);
+				for (pBlock = m_FreeLists[fl][sl]; pBlock; pBlock = pBlock->pNextFree)
+				{
+					if (pBlock->Size >= size)
+						break;
+				}
+
+				if (pBlock == nullptr)
+				{
+					return nullptr;
+				}
+			}
+
+			assert(pBlock->Size >= size);
+			removeFree(pBlock);
+
+			// Split off the remainder as a new free block.
+			const uint32_t remain = pBlock->Size - size;
+			if (remain >= ALIGNMENT)
+			{
+				Block* pRemain = newBlock();
+				pRemain->Offset = pBlock->Offset + size;
+				pRemain->Size = remain;
+				pRemain->pPrevPhys = pBlock;
+				pRemain->pNextPhys = pBlock->pNextPhys;
+				if (pBlock->pNextPhys)
+				{
+					pBlock->pNextPhys->pPrevPhys = pRemain;
+				}
+				else
+				{
+					m_pLast = pRemain;
+				}
+
+				pBlock->pNextPhys = pRemain;
+				pBlock->Size = size;
+				insertFree(pRemain);
+			}
+
+			pBlock->pUserData = pUserData;
+			m_uiUsedSize += pBlock->Size;
+			m_uiUsedBlockCount++;
+			return pBlock;
+		}
+
+		void TLSFAllocator::free(Block* pBlock)
+		{
+			if (pBlock == nullptr)
+			{
+				return;
+			}
+
+			assert(!pBlock->bFree);
+			m_uiUsedSize -= pBlock->Size;
+			m_uiUsedBlockCount--;
+
+			Block* pPrev = pBlock->pPrevPhys;
+			if (pPrev && pPrev->bFree)
+			{
+				removeFree(pPrev);
+				absorb(pPrev, pBlock);
+				pBlock = pPrev;
+			}
+
+			Block* pNext = pBlock->pNextPhys;
+			if (pNext && pNext->bFree)
+			{
+				removeFree(pNext);
+				absorb(pBlock, pNext);
+			}
+
+			insertFree(pBlock);
+		}
+
+		bool TLSFAllocator::slideDown(Block* pBlock)
+		{
+			assert(pBlock && !pBlock->bFree);
+
+			Block* pHole = pBlock->pPrevPhys;
+			if (pHole == nullptr || !pHole->bFree)
+			{
+				return false;
+			}
+
+			removeFree(pHole);
+
+			// Swap the two blocks in the address order: [pHole][pBlock] -> [pBlock][pHole]
+			Block* pBefore = pHole->pPrevPhys;
+			Block* pAfter = pBlock->pNextPhys;
+
+			pBlock->Offset = pHole->Offset;
+			pHole->Offset = pBlock->Offset + pBlock->Size;
+
+			pBlock->pPrevPhys = pBefore;
+			pBlock->pNextPhys = pHole;
+			pHole->pPrevPhys = pBlock;
+			pHole->pNextPhys = pAfter;
+
+			if (pBefore)
+			{
+				pBefore->pNextPhys = pBlock;
+			}
+			else
+			{
+				m_pFirst = pBlock;
+			}
+
+			if (pAfter)
+			{
+				pAfter->pPrevPhys = pHole;
+			}
+			else
+			{
+				m_pLast = pHole;
+			}
+
+			if (pAfter && pAfter->bFree)
+			{
+				removeFree(pAfter);
+				absorb(pHole, pAfter);
+			}
+
+			insertFree(pHole);
+			return true;
+		}
+
+		TLSFAllocator::Block* TLSFAllocator::relocate(Block* pBlock)
+		{
+			assert(pBlock && !pBlock->bFree);
+
+			// Keep the free space right behind the block out of the search, it can only be reached by sliding.
+			Block* pBehind = pBlock->pNextPhys;
+			if (pBehind && pBehind->bFree)
+			{
+				removeFree(pBehind);
+			}
+			else
+			{
+				pBehind = nullptr;
+			}
+
+			Block* pNew = allocate(pBlock->Size, pBlock->pUserData);
+
+			if (pBehind)
+			{
+				insertFree(pBehind);
+			}
+
+			if (pNew && pNew->Offset > pBlock->Offset)
+			{
+				// Only found a hole further up the buffer.
+				free(pNew);
+				pNew = nullptr;
+			}
+
+			if (pNew)
+			{
+				free(pBlock);
+			}
+
+			return pNew;
+		}
+
+		uint32_t TLSFAllocator::getLargestFreeBlock() const
+		{
+			if (!m_FLBitmap)
+			{
+				return 0;
+			}
+
+			const uint32_t fl = fls(m_FLBitmap);
+			const uint32_t sl = fls(m_SLBitmap[fl]);
+
+			uint32_t largest = 0;
+			for (Block* pBlock = m_FreeLists[fl][sl]; pBlock; pBlock = pBlock->pNextFree)
+			{
+				if (pBlock->Size > largest)
+				{
+					largest = pBlock->Size;
+				}
+			}
+
+			return largest;
+		}
+
+		float TLSFAllocator::getFragmentation() const
+		{
+			const uint32_t freeSize = getFreeSize();
+			if (freeSize == 0)
+			{
+				return 0.0f;
+			}
+
+			return 1.0f - static_cast<float>(getLargestFreeBlock()) / static_cast<float>(freeSize);
+		}
+	}
+}
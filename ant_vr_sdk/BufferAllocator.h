@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * Two-level segregated fit (TLSF) allocator that hands out ranges of a linear address space,
+		 * e.g. a vertex or element buffer. It never touches the memory it manages, so the owner is
+		 * responsible for moving data when blocks are relocated.<p>
+		 * Allocation and free are O(1): free blocks are kept in 2D buckets (power of two, then 16
+		 * linear sub-divisions) that are found with two bit scans, and freed blocks are merged with
+		 * their physical neighbours immediately.
+		 */
+		class TLSFAllocator
+		{
+		public:
+			struct Block
+			{
+				uint32_t Offset;
+				uint32_t Size;
+
+				// Neighbours in address order.
+				Block* pPrevPhys;
+				Block* pNextPhys;
+
+				// Neighbours in the free list of the bucket, only valid for free blocks.
+				Block* pPrevFree;
+				Block* pNextFree;
+
+				bool  bFree;
+				void* pUserData;
+			};
+
+			/// All the offsets and sizes handed out are multiples of this.
+			static const uint32_t ALIGNMENT = 4;
+
+			TLSFAllocator(uint32_t capacity = 0);
+			~TLSFAllocator();
+
+			/// Drops every block and starts over with a single free block of the given size.
+			void reset(uint32_t capacity);
+
+			/// Extends the managed range to newCapacity, the existing blocks keep their offsets.
+			void grow(uint32_t newCapacity);
+
+			/// Returns a used block of at least size bytes or nullptr if no free block is large enough.
+			Block* allocate(uint32_t size, void* pUserData = nullptr);
+
+			/// Releases the block and merges it with the free neighbours.
+			void free(Block* pBlock);
+
+			/**
+			 * Moves the used block down into the free block directly in front of it. The free space
+			 * ends up behind the block and is merged with the following free block, if any.
+			 * @return false if the block isn't preceded by a free block.
+			 */
+			bool slideDown(Block* pBlock);
+
+			/**
+			 * Allocates a new block of the same size at a lower offset and frees the given one. The user
+			 * data moves to the new block.
+			 * @return The new block, or nullptr if there is no hole in front of the block large enough.
+			 */
+			Block* relocate(Block* pBlock);
+
+			/// Returns the first block in address order.
+			Block* getFirstBlock() const { return m_pFirst; }
+			/// Returns the last block in address order.
+			Block* getLastBlock() const { return m_pLast; }
+
+			uint32_t getCapacity() const { return m_uiCapacity; }
+			uint32_t getUsedSize() const { return m_uiUsedSize; }
+			uint32_t getFreeSize() const { return m_uiCapacity - m_uiUsedSize; }
+			uint32_t getUsedBlockCount() const { return m_uiUsedBlockCount; }
+			uint32_t getFreeBlockCount() const { return m_uiFreeBlockCount; }
+
+			/// Returns the size of the largest free block. Only scans one bucket.
+			uint32_t getLargestFreeBlock() const;
+
+			/// Returns 1 - largest free block / total free size, 0 means all the free space is in one block.
+			float getFragmentation() const;
+
+		private:
+			static const uint32_t SL_LOG2 = 4;
+			static const uint32_t SL_COUNT = 1 << SL_LOG2;
+			static const uint32_t FL_SHIFT = SL_LOG2 + 2;  // log2(ALIGNMENT) == 2
+			static const uint32_t SMALL_BLOCK_SIZE = 1 << FL_SHIFT;
+			static const uint32_t FL_COUNT = 32 - FL_SHIFT + 1;
+
+			static void mapping(uint32_t size, uint32_t& fl, uint32_t& sl);
+			static void mappingSearch(uint32_t size, uint32_t& fl, uint32_t& sl);
+
+			Block* findSuitable(uint32_t& fl, uint32_t& sl) const;
+			void insertFree(Block* pBlock);
+			void removeFree(Block* pBlock);
+
+			// Merges pNext into pBlock, both must be free and out of the free lists.
+			void absorb(Block* pBlock, Block* pNext);
+
+			Block* newBlock();
+			void deleteBlock(Block* pBlock);
+			void deleteBlocks();
+
+		private:
+			uint32_t m_FLBitmap;
+			uint32_t m_SLBitmap[FL_COUNT];
+			Block* m_FreeLists[FL_COUNT][SL_COUNT];
+
+			Block* m_pFirst;
+			Block* m_pLast;
+
+			// Recycled block nodes, so that allocate()/free() don't hit the heap.
+			std::vector<Block*> m_BlockCache;
+
+			uint32_t m_uiCapacity;
+			uint32_t m_uiUsedSize;
+			uint32_t m_uiUsedBlockCount;
+			uint32_t m_uiFreeBlockCount;
+		};
+	}
+}
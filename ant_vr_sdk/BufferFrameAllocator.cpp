@@ -0,0 +1,84 @@
+#include "BufferFrameAllocator.h"
+
+namespace jet
+{
+	namespace util
+	{
+		BufferFrameAllocator::BufferFrameAllocator(BufferGPUSharedUniformPool* pPool, uint32_t alignment) :
+			m_pPool(pPool), m_pFrameData(nullptr), m_uiFrameOffset(0), m_uiCapacity(0), m_uiAlignment(alignment),
+			m_uiCursor(0), m_uiFailedCount(0)
+		{
+			assert(m_pPool);
+
+			if (m_uiAlignment == 0)
+			{
+				m_uiAlignment = (m_pPool->getTarget() == BufferTarget::UNIFORM) ? static_cast<uint32_t>(GLStates::getUniformBufferOffsetAlignment()) : 4;
+			}
+		}
+
+		bool BufferFrameAllocator::beginFrame()
+		{
+			if (!m_pPool->beginUpdate())
+			{
+				m_pFrameData = nullptr;
+				m_uiCapacity = 0;
+				return false;
+			}
+
+			// The whole frame is the first sub-range, its start is aligned by the pool.
+			m_pFrameData = m_pPool->map(0u);
+			m_uiFrameOffset = m_pPool->getDynamicOffset(0);
+			m_uiCapacity = m_pPool->getSubRangeSize() * m_pPool->getNumSubRanges();
+
+			m_uiCursor.store(0, std::memory_order_relaxed);
+			m_uiFailedCount.store(0, std::memory_order_relaxed);
+			return m_pFrameData != nullptr;
+		}
+
+		FrameAllocation BufferFrameAllocator::allocate(uint32_t size)
+		{
+			FrameAllocation allocation;
+			if (size == 0)
+			{
+				return allocation;
+			}
+
+			// All the sizes are rounded to the alignment, so every offset handed out stays aligned.
+			const uint32_t alignedSize = (size + m_uiAlignment - 1) / m_uiAlignment * m_uiAlignment;
+			const uint64_t offset = m_uiCursor.fetch_add(alignedSize, std::memory_order_relaxed);
+			if (offset + alignedSize > m_uiCapacity)
+			{
+				m_uiFailedCount.fetch_add(1, std::memory_order_relaxed);
+				return allocation;
+			}
+
+			allocation.pData = m_pFrameData + offset;
+			allocation.Offset = m_uiFrameOffset + static_cast<uint32_t>(offset);
+			allocation.Size = size;
+			return allocation;
+		}
+
+		void BufferFrameAllocator::endFrame()
+		{
+			m_pPool->endUpdate();
+			m_pFrameData = nullptr;
+		}
+
+		void BufferFrameAllocator::bindRange(GLuint bindingIndex, const FrameAllocation& allocation)
+		{
+			assert(allocation.isValid());
+			m_pPool->bindRange(bindingIndex, allocation.Offset, allocation.Size);
+		}
+
+		void BufferFrameAllocator::doneRendering()
+		{
+			m_pPool->doneRendering();
+		}
+
+		uint32_t BufferFrameAllocator::getUsedSize() const
+		{
+			const uint64_t cursor = m_uiCursor.load(std::memory_order_relaxed);
+			return cursor < m_uiCapacity ? static_cast<uint32_t>(cursor) : m_uiCapacity;
+		}
+	}
+}
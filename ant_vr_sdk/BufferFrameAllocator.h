@@ -0,0 +1,74 @@
+#pragma once
+
+#include "BufferGL.h"
+#include <atomic>
+
+namespace jet
+{
+	namespace util
+	{
+		typedef struct FrameAllocation
+		{
+			// Where to write the data, nullptr if the allocation failed.
+			uint8_t* pData;
+			// Offset in the pool's buffer, for BufferFrameAllocator::bindRange().
+			uint32_t Offset;
+			uint32_t Size;
+
+			FrameAllocation() : pData(nullptr), Offset(0), Size(0){}
+			bool isValid() const { return pData != nullptr; }
+		}FrameAllocation;
+
+		/**
+		 * Hands out per-frame ranges of a BufferGPUSharedUniformPool with an atomic bump pointer.
+		 * allocate() is lock-free and may be called from any number of threads at once, which then
+		 * write straight into the mapped memory (matrices, skinning palettes and so on). Only
+		 * beginFrame(), endFrame(), bindRange() and doneRendering() need the GL thread.<p>
+		 * The pool should be initialized with one sub-range per frame, e.g.
+		 * <code>pool.init(frameSize, 1, 3, true)</code>, on a proxy created as PersistentUniformBufferGL,
+		 * so the frame stays mapped and no flush is needed when the workers are done.
+		 */
+		class BufferFrameAllocator
+		{
+		public:
+			/// alignment: Every allocation starts on a multiple of it. 0 picks GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+			///            for uniform pools and 4 otherwise.
+			BufferFrameAllocator(BufferGPUSharedUniformPool* pPool, uint32_t alignment = 0);
+
+			/// Waits until the frame slot is free on the GPU and resets the bump pointer. GL thread only.
+			bool beginFrame();
+
+			/// Returns size bytes of the current frame. Thread safe and lock-free.
+			FrameAllocation allocate(uint32_t size);
+
+			/// Ends the writes into the current frame. All the worker threads must be done by now. GL thread only.
+			void endFrame();
+
+			/// Binds an allocation of the current frame to an indexed binding point. GL thread only.
+			void bindRange(GLuint bindingIndex, const FrameAllocation& allocation);
+
+			/// Fences the frame and moves on to the next slot of the ring. GL thread only.
+			void doneRendering();
+
+			uint32_t getCapacity() const { return m_uiCapacity; }
+
+			/// Returns the bytes handed out in the current frame.
+			uint32_t getUsedSize() const;
+
+			/// Returns how many allocate() calls failed in the current frame because it was full.
+			uint32_t getFailedCount() const { return m_uiFailedCount.load(std::memory_order_relaxed); }
+
+		private:
+			BufferGPUSharedUniformPool* m_pPool;
+
+			uint8_t* m_pFrameData;
+			uint32_t m_uiFrameOffset;
+			uint32_t m_uiCapacity;
+			uint32_t m_uiAlignment;
+
+			// 64 bits, so failed allocations past the end can't wrap the cursor around.
+			std::atomic<uint64_t> m_uiCursor;
+			std::atomic<uint32_t> m_uiFailedCount;
+		};
+	}
+}
@@ -1,6 +1,7 @@
 
 
 #include "BufferGL.h"
+#include "BufferUpload.h"
 
 namespace jet
 {
@@ -10,12 +11,42 @@ namespace jet
 		{
 			bind();
 			CHECK_GL(glBufferSubData(getGLTarget(), static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size), reinterpret_cast<const GLvoid*>(pData)));
+			BufferStatistics::get().onUpdate(size);
 			return true;
 		}
 
+		void BufferGPU::trackAllocation(uint32_t size, BufferUsage usage, bool bUploaded)
+		{
+			BufferStatistics& stats = BufferStatistics::get();
+			if (m_uiAllocatedSize)
+			{
+				stats.onRelease(m_AllocatedTarget, m_AllocatedUsage, m_uiAllocatedSize);
+			}
+
+			m_uiAllocatedSize = size;
+			m_AllocatedTarget = getTarget();
+			m_AllocatedUsage = usage;
+			stats.onAllocate(m_AllocatedTarget, m_AllocatedUsage, size);
+
+			if (bUploaded)
+			{
+				stats.onUpdate(size);
+			}
+		}
+
 		void BufferGPU::dispose()
 		{
+			if (m_uiAllocatedSize)
+			{
+				BufferStatistics::get().onRelease(m_AllocatedTarget, m_AllocatedUsage, m_uiAllocatedSize);
+				m_uiAllocatedSize = 0;
+			}
+
+			// Deleting the buffer object also releases any mapping of it.
 			SAFE_RELEASE_BUFFER(m_Buffer);
+			m_MappedPointer = nullptr;
+			m_MappedOffset = 0;
+			m_MappedSize = 0;
 		}
 
 		uint8_t* BufferGPU::map(uint32_t offset, uint32_t length, MappingBits bits)
@@ -60,6 +91,7 @@ namespace jet
 			m_MappedPointer = reinterpret_cast<uint8_t*>(p);
 			m_MappedOffset = offset;
 			m_MappedSize = length;
+			BufferStatistics::get().onMap(length, bits != MappingBits::READ);
 			return m_MappedPointer;
 		}
 
@@ -80,6 +112,10 @@ namespace jet
 			}
 #endif
 			glUnmapBuffer(getGLTarget());
+			BufferStatistics::get().onUnmap();
+			m_MappedPointer = nullptr;
+			m_MappedOffset = 0;
+			m_MappedSize = 0;
 		}
 
 		void BufferGPU::memoryCpy(uint32_t dst_offset, uint32_t src_offset, uint32_t size)
@@ -89,34 +125,42 @@ namespace jet
 				return;
 			}
 
-			const uint32_t strider = dst_offset < src_offset ? src_offset - dst_offset : dst_offset - src_offset;
-			uint32_t count = (size + strider - 1) / strider;
-			uint32_t copyed_size = 0;
-			if (glCopyNamedBufferSubData)
-			{
-				for (uint32_t i = 0; i < count; i++)
-				{
-					uint32_t remain_size = (size - copyed_size);
-					uint32_t copy_size = remain_size > strider ? strider : remain_size;
-					CHECK_GL(glCopyNamedBufferSubData(m_Buffer, m_Buffer, src_offset + i * strider, dst_offset + i * strider, copyed_size));
-				}
-			}
-			else
+			// The source and destination of a copy within the same buffer must not overlap, so the
+			// range is copied in chunks no longer than the distance between them. When moving up the
+			// chunks are copied from the end, so no chunk reads data that has already been overwritten.
+			const bool bForward = dst_offset < src_offset;
+			const uint32_t strider = bForward ? src_offset - dst_offset : dst_offset - src_offset;
+			const uint32_t count = (size + strider - 1) / strider;
+
+			GLenum readTarget = 0, writeTarget = 0;
+			if (!glCopyNamedBufferSubData)
 			{
 				GLStates& state = GLStates::get();
 				state.bindBuffer(m_Buffer, BufferTarget::COPY_READ);
 				state.bindBuffer(m_Buffer, BufferTarget::COPY_WRITE);
 
-				const GLenum readTarget = ConvertBufferTargetToGLenum(BufferTarget::COPY_READ);
-				const GLenum writeTarget = ConvertBufferTargetToGLenum(BufferTarget::COPY_WRITE);
+				readTarget = ConvertBufferTargetToGLenum(BufferTarget::COPY_READ);
+				writeTarget = ConvertBufferTargetToGLenum(BufferTarget::COPY_WRITE);
+			}
 
-				for (uint32_t i = 0; i < count; i++)
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const uint32_t chunk = bForward ? i : count - 1 - i;
+				const uint32_t chunk_offset = chunk * strider;
+				const uint32_t remain_size = size - chunk_offset;
+				const uint32_t copy_size = remain_size > strider ? strider : remain_size;
+
+				if (glCopyNamedBufferSubData)
+				{
+					CHECK_GL(glCopyNamedBufferSubData(m_Buffer, m_Buffer, src_offset + chunk_offset, dst_offset + chunk_offset, copy_size));
+				}
+				else
 				{
-					uint32_t remain_size = (size - copyed_size);
-					uint32_t copy_size = remain_size > strider ? strider : remain_size;
-					CHECK_GL(glCopyBufferSubData(readTarget, writeTarget, src_offset + i * strider, dst_offset + i * strider, copyed_size));
+					CHECK_GL(glCopyBufferSubData(readTarget, writeTarget, src_offset + chunk_offset, dst_offset + chunk_offset, copy_size));
 				}
 			}
+
+			BufferStatistics::get().onCopy(size);
 		}
 
 		void BufferGPU::bind()
@@ -139,6 +183,7 @@ namespace jet
 			if (!m_VAO)
 			{
 				glGenVertexArrays(1, &m_VAO);
+				BufferStatistics::get().onVertexArrayCreated();
 			}
 
 			GLStates& state = GLStates::get();
@@ -219,6 +264,11 @@ namespace jet
 
 		void VertexArrayGL::dispose()
 		{
+			if (m_VAO)
+			{
+				BufferStatistics::get().onVertexArrayDeleted();
+			}
+
 			SAFE_RELEASE_VERTEX_ARRAY(m_VAO);
 		}
 
@@ -282,35 +332,61 @@ namespace jet
 			return new BufferSharedPool(pBuf);
 		}
 
-		BufferGPUSharedUniformPool::BufferGPUSharedUniformPool(BufferCreator* pBufCreator) :BufferGPUSharedPool(pBufCreator)
+		BufferGPUSharedUniformPool::BufferGPUSharedUniformPool(BufferCreator* pBufCreator) :BufferGPUSharedPool(new BufferSharedUniformPool(pBufCreator)), m_uiStallCount(0)
 		{
 			m_SharedUniformPool = dynamic_cast<BufferSharedUniformPool*>(m_Pool);
 			assert(m_SharedUniformPool);
 		}
 
-		BufferGPUSharedUniformPool::BufferGPUSharedUniformPool(BufferGPU* pBuf) :BufferGPUSharedPool(pBuf)
+		BufferGPUSharedUniformPool::BufferGPUSharedUniformPool(BufferGPU* pBuf) :BufferGPUSharedPool(new BufferSharedUniformPool(pBuf)), m_uiStallCount(0)
 		{
 			m_SharedUniformPool = dynamic_cast<BufferSharedUniformPool*>(m_Pool);
 			assert(m_SharedUniformPool);
 		}
 
-		bool BufferGPUSharedUniformPool::init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames)
+		BufferGPUSharedUniformPool::~BufferGPUSharedUniformPool()
 		{
-			return m_SharedUniformPool->init(dataSize, numSubRanges, numFrames);
+			resetFences();
+		}
+
+		uint32_t BufferGPUSharedUniformPool::alignSubRangeSize(uint32_t subRangeSize) const
+		{
+			if (getTarget() == BufferTarget::UNIFORM)
+			{
+				// glBindBufferRange requires every sub-range to start on the uniform offset alignment.
+				const uint32_t alignment = static_cast<uint32_t>(GLStates::getUniformBufferOffsetAlignment());
+				if (alignment > 1)
+				{
+					subRangeSize = (subRangeSize + alignment - 1) / alignment * alignment;
+				}
+			}
+
+			return subRangeSize;
+		}
+
+		bool BufferGPUSharedUniformPool::init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames, bool bPersistent)
+		{
+			finish();
+			m_Fences.assign(numFrames, nullptr);
+			return m_SharedUniformPool->init(alignSubRangeSize(dataSize), numSubRanges, numFrames, bPersistent);
 		}
 
 		void BufferGPUSharedUniformPool::setNumSubRanges(uint32_t numSubRanges)
 		{
+			finish();
 			m_SharedUniformPool->setNumSubRanges(numSubRanges);
 		}
 
 		void BufferGPUSharedUniformPool::setSubRangeSize(uint32_t subRangeSize)
 		{
-			m_SharedUniformPool->setSubRangeSize(subRangeSize);
+			finish();
+			m_SharedUniformPool->setSubRangeSize(alignSubRangeSize(subRangeSize));
 		}
 
 		void BufferGPUSharedUniformPool::setNumFrames(uint32_t numFrames)
 		{
+			finish();
+			m_Fences.assign(numFrames, nullptr);
 			m_SharedUniformPool->setNumFrames(numFrames);
 		}
 
@@ -324,6 +400,104 @@ namespace jet
 			return m_SharedUniformPool->getDynamicOffset(subRangeIndex, subIndex);
 		}
 
+		uint8_t* BufferGPUSharedUniformPool::map(uint32_t subRangeIndex)
+		{
+			return m_SharedUniformPool->map(subRangeIndex);
+		}
+
+		uint32_t BufferGPUSharedUniformPool::getDynamicOffset(int subRangeIndex)
+		{
+			return m_SharedUniformPool->getDynamicOffset(subRangeIndex);
+		}
+
+		bool BufferGPUSharedUniformPool::beginUpdate()
+		{
+			waitFence(m_SharedUniformPool->getFrameIndex());
+			return m_SharedUniformPool->beginUpdate();
+		}
+
+		void BufferGPUSharedUniformPool::endUpdate()
+		{
+			m_SharedUniformPool->endUpdate();
+		}
+
+		void BufferGPUSharedUniformPool::bindRange(GLuint bindingIndex, uint32_t subRangeIndex)
+		{
+			bindRange(bindingIndex, m_SharedUniformPool->getDynamicOffset(subRangeIndex), m_SharedUniformPool->getSubRangeSize());
+		}
+
+		void BufferGPUSharedUniformPool::bindRange(GLuint bindingIndex, uint32_t offset, uint32_t size)
+		{
+			const GLuint buffer = getBufferID();
+
+			// glBindBufferRange also changes the generic binding point, keep the state cache in sync.
+			GLStates::get().bindBuffer(buffer, getTarget());
+			CHECK_GL(glBindBufferRange(getGLTarget(), bindingIndex, buffer, offset, size));
+		}
+
+		void BufferGPUSharedUniformPool::doneRendering()
+		{
+			const uint32_t frameIndex = m_SharedUniformPool->getFrameIndex();
+			if (frameIndex < m_Fences.size())
+			{
+				GLsync& fence = m_Fences[frameIndex];
+				if (fence)
+				{
+					glDeleteSync(fence);
+				}
+				fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+
+			m_SharedUniformPool->doneRendering();
+		}
+
+		void BufferGPUSharedUniformPool::finish()
+		{
+			for (uint32_t i = 0; i < m_Fences.size(); i++)
+			{
+				waitFence(i);
+			}
+		}
+
+		void BufferGPUSharedUniformPool::waitFence(uint32_t frameIndex)
+		{
+			if (frameIndex >= m_Fences.size() || m_Fences[frameIndex] == nullptr)
+			{
+				return;
+			}
+
+			GLsync& fence = m_Fences[frameIndex];
+
+			// Poll first, the common case is that the GPU finished this frame long ago.
+			GLenum result = glClientWaitSync(fence, 0, 0);
+			if (result == GL_TIMEOUT_EXPIRED)
+			{
+				m_uiStallCount++;
+
+				const GLuint64 ONE_SECOND_IN_NS = 1000000000;
+				do
+				{
+					result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, ONE_SECOND_IN_NS);
+				} while (result == GL_TIMEOUT_EXPIRED);
+			}
+			assert(result != GL_WAIT_FAILED);
+
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		void BufferGPUSharedUniformPool::resetFences()
+		{
+			for (uint32_t i = 0; i < m_Fences.size(); i++)
+			{
+				if (m_Fences[i])
+				{
+					glDeleteSync(m_Fences[i]);
+					m_Fences[i] = nullptr;
+				}
+			}
+		}
+
 		BufferSharedPool* BufferGPUSharedUniformPool::createPool(BufferCreator* pBufCreator, uint32_t) const
 		{
 			return new BufferSharedUniformPool(pBufCreator);
@@ -379,24 +553,63 @@ namespace jet
 			return ConvertBufferTargetToGLenum(m_pBuffer->getTarget());
 		}
 
-		BufferGPUSharedNonUniformPool::BufferGPUSharedNonUniformPool(BufferCreator* pBufCreator, uint32_t capacity) : BufferGPUSharedPool(pBufCreator, capacity)
+		BufferGPUSharedNonUniformPool::BufferGPUSharedNonUniformPool(BufferCreator* pBufCreator, uint32_t capacity) : BufferGPUSharedPool(new BufferSharedNonUniformPool(pBufCreator, capacity)),
+			m_pUploadScheduler(nullptr)
 		{
 			m_SharedNonUniformPool = dynamic_cast<BufferSharedNonUniformPool*>(m_Pool);
 			assert(m_SharedNonUniformPool);
 		}
-		BufferGPUSharedNonUniformPool::BufferGPUSharedNonUniformPool(BufferGPU* pBuf) : BufferGPUSharedPool(pBuf)
+		BufferGPUSharedNonUniformPool::BufferGPUSharedNonUniformPool(BufferGPU* pBuf) : BufferGPUSharedPool(new BufferSharedNonUniformPool(pBuf)),
+			m_pUploadScheduler(nullptr)
 		{
 			m_SharedNonUniformPool = dynamic_cast<BufferSharedNonUniformPool*>(m_Pool);
 			assert(m_SharedNonUniformPool);
 		}
 
+		BufferGPUSharedNonUniformPool::~BufferGPUSharedNonUniformPool()
+		{
+			setUploadScheduler(nullptr);
+		}
+
 		BufferBean BufferGPUSharedNonUniformPool::add(uint32_t size, const uint8_t* pData)
 		{
-			return m_SharedNonUniformPool->add(size, pData);
+			if (m_pUploadScheduler == nullptr)
+			{
+				return m_SharedNonUniformPool->add(size, pData);
+			}
+
+			BufferBean bean = m_SharedNonUniformPool->add(size, nullptr);
+			if (bean)
+			{
+				m_pUploadScheduler->update(m_pProxyBuffer, m_SharedNonUniformPool->getOffset(bean), size, pData);
+			}
+			return bean;
 		}
 		bool BufferGPUSharedNonUniformPool::update(BufferBean bean, uint32_t offset, uint32_t size, const uint8_t* pData)
 		{
-			return m_SharedNonUniformPool->update(bean, offset, size, pData);
+			if (m_pUploadScheduler == nullptr)
+			{
+				return m_SharedNonUniformPool->update(bean, offset, size, pData);
+			}
+
+			if (bean == nullptr)
+			{
+				return false;
+			}
+
+			m_pUploadScheduler->update(m_pProxyBuffer, m_SharedNonUniformPool->getOffset(bean) + offset, size, pData);
+			return true;
+		}
+
+		void BufferGPUSharedNonUniformPool::setUploadScheduler(BufferUploadScheduler* pScheduler)
+		{
+			if (m_pUploadScheduler && m_pUploadScheduler != pScheduler)
+			{
+				// The pending data has to land before the pool is written directly again.
+				m_pUploadScheduler->flush();
+			}
+
+			m_pUploadScheduler = pScheduler;
 		}
 		void BufferGPUSharedNonUniformPool::remove(BufferBean bean)
 		{
@@ -416,6 +629,10 @@ namespace jet
 		{
 			return m_SharedNonUniformPool->isDirty(bean);
 		}
+		void BufferGPUSharedNonUniformPool::compact()
+		{
+			m_SharedNonUniformPool->compact();
+		}
 		
 		BufferSharedPool* BufferGPUSharedNonUniformPool::createPool(BufferCreator* pBufCreator, uint32_t capacity) const
 		{
@@ -3,6 +3,8 @@
 #include "GLUtil.h"
 #include "GLStates.h"
 #include "Buffer.h"
+#include "BufferStatistics.h"
+#include <vector>
 
 namespace jet
 {
@@ -12,7 +14,8 @@ namespace jet
 		class BufferGPU : public Buffer, public Disposeable
 		{
 		public:
-			BufferGPU() : m_Buffer(0), m_MappedPointer(nullptr), m_MappedOffset(0), m_MappedSize(0){}
+			BufferGPU() : m_Buffer(0), m_MappedPointer(nullptr), m_MappedOffset(0), m_MappedSize(0),
+				m_uiAllocatedSize(0), m_AllocatedTarget(BufferTarget::ARRAY), m_AllocatedUsage(BufferUsage::STATIC_DRAW){}
 			virtual ~BufferGPU() { dispose(); }
 
 			virtual bool init(uint32_t size, const uint8_t* pData = nullptr) = 0;
@@ -27,17 +30,30 @@ namespace jet
 			virtual void bind();
 			virtual void unbind();
 			virtual BufferTarget getTarget() const = 0;
+
+			virtual GLuint getBufferID() const { return m_Buffer; }
 		protected:
 			virtual GLenum getGLTarget() const = 0;
 
+			// Reports a new data store of the buffer object to the BufferStatistics, replacing the old one.
+			void trackAllocation(uint32_t size, BufferUsage usage, bool bUploaded);
+
 		protected:
 			// The OpenGL buffer object ID
 			GLuint m_Buffer;
 			uint8_t* m_MappedPointer;
 			uint32_t m_MappedOffset;
 			uint32_t m_MappedSize;
+
+			// The data store as reported to the BufferStatistics. The target is kept because dispose()
+			// runs from the destructor, where getTarget() can't be called.
+			uint32_t m_uiAllocatedSize;
+			BufferTarget m_AllocatedTarget;
+			BufferUsage m_AllocatedUsage;
 		};
 
+		class BufferUploadScheduler;
+
 		class BufferGPUSubRange : public BufferGPU
 		{
 		public:
@@ -56,6 +72,7 @@ namespace jet
 			void bind() override;
 			void unbind() override;
 			BufferTarget getTarget() const override;
+			GLuint getBufferID() const override { return m_pBuffer->getBufferID(); }
 		protected:
 			GLenum getGLTarget() const override;
 
@@ -68,7 +85,7 @@ namespace jet
 		{
 		public:
 			BufferGPUSharedPool(BufferCreator* pBufCreator, uint32_t capacity = 0) : m_Pool(createPool(pBufCreator, capacity)){
-				m_pProxyBuffer = dynamic_cast<BufferGPU*>(pBufCreator->create());
+				m_pProxyBuffer = dynamic_cast<BufferGPU*>(m_Pool->getProxyBuffer());
 				assert(m_pProxyBuffer);
 			}
 			BufferGPUSharedPool(BufferGPU* pBuf) : m_Pool(createPool(pBuf)), m_pProxyBuffer(pBuf){ assert(m_pProxyBuffer); }
@@ -82,6 +99,7 @@ namespace jet
 			virtual void bind();
 			virtual void unbind();
 			BufferTarget getTarget() const override;
+			GLuint getBufferID() const override { return m_pProxyBuffer->getBufferID(); }
 
 			virtual ~BufferGPUSharedPool()
 			{
@@ -91,6 +109,13 @@ namespace jet
 				}
 			}
 		protected:
+			// The virtual createPool() can't be dispatched to subclasses from the constructor above,
+			// so subclasses hand over their concrete pool through this one.
+			BufferGPUSharedPool(BufferSharedPool* pPool) : m_Pool(pPool){
+				m_pProxyBuffer = dynamic_cast<BufferGPU*>(m_Pool->getProxyBuffer());
+				assert(m_pProxyBuffer);
+			}
+
 			GLenum getGLTarget() const override;
 
 			virtual BufferSharedPool* createPool(BufferCreator* pBufCreator, uint32_t) const;
@@ -105,10 +130,7 @@ namespace jet
 		{
 		public:
 
-			virtual ~BufferGPUSharedUniformPool()
-			{
-				BufferGPUSharedPool::~BufferGPUSharedPool();
-			}
+			virtual ~BufferGPUSharedUniformPool();
 
 			BufferGPUSharedUniformPool(BufferCreator* pBufCreator);
 			BufferGPUSharedUniformPool(BufferGPU* pBuf);
@@ -120,9 +142,11 @@ namespace jet
 			///                     within the shared VBO
 			/// \param numFrames Number of frames worth of data contained in the VBO, which will
 			///                  act as a ring buffer, using the next set of sub-ranges for each frame
-			/// \param bPersistent Flag to indicate whether the VBO should be persistently mapped
+			/// \param bPersistent Flag to indicate whether the VBO should be persistently mapped. The proxy
+			///                    buffer must then be created with GL_MAP_PERSISTENT_BIT, e.g. PersistentUniformBufferGL.
 			/// \return True if the buffer was initialized, false if an error occurred
-			bool init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames);
+			/// \note For the UNIFORM target, dataSize is rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+			bool init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames, bool bPersistent = false);
 
 			/// Sets the current number of sub-ranges to contain in the shared VBO
 			/// \param numSubRanges Number of sub-ranges that will be held within the VBO
@@ -131,7 +155,7 @@ namespace jet
 
 			/// Sets the size of each sub-range contained in the shared VBO
 			/// \param subRangeSize Size, in bytes, of each sub-range that will be held within the VBO
-			/// \note Must not be called between calls to BeginUpdate()/EndUpdate().
+			/// \note Must not be called between calls to BeginUpdate()/EndUpdate(). Rounded up like in init().
 			void setSubRangeSize(uint32_t subRangeSize);
 
 			/// Sets the number of frames worth of data contained in the shared VBO
@@ -152,15 +176,59 @@ namespace jet
 			///         sub-range with the given index begins.
 			uint32_t getDynamicOffset(int subRangeIndex, uint32_t subIndex);
 
+			/// Returns the pointer to the given sub-range within the frame currently being written
+			uint8_t* map(uint32_t subRangeIndex);
+
+			/// Returns the offset of the given sub-range within the frame currently being written
+			uint32_t getDynamicOffset(int subRangeIndex);
+
+			/// Waits until the GPU has finished reading the frame slot about to be rewritten, then
+			/// makes it writeable. Only blocks when the ring has wrapped around onto a frame that is
+			/// still in flight.
+			/// \return True if the current frame's sub-ranges can be written
+			bool beginUpdate();
+
+			/// Ends writing into the current frame's sub-ranges.
+			void endUpdate();
+
+			/// Binds the given sub-range of the current frame to an indexed binding point,
+			/// e.g. a uniform block binding.
+			void bindRange(GLuint bindingIndex, uint32_t subRangeIndex);
+
+			/// Binds size bytes at the given offset of the pool to an indexed binding point.
+			void bindRange(GLuint bindingIndex, uint32_t offset, uint32_t size);
+
+			/// Places a fence behind the draw calls of the current frame and moves the ring on.
+			/// Must be called once per frame after the last draw call that reads from the pool.
+			void doneRendering();
+
+			/// Blocks until the GPU has finished with every frame in the ring.
+			void finish();
+
+			uint32_t getFrameIndex() const { return m_SharedUniformPool->getFrameIndex(); }
+			uint32_t getSubRangeSize() const { return m_SharedUniformPool->getSubRangeSize(); }
+			uint32_t getNumSubRanges() const { return m_SharedUniformPool->getNumSubRanges(); }
+			bool isPersistent() const { return m_SharedUniformPool->isPersistent(); }
+
+			/// Returns how many times beginUpdate() had to block on a fence.
+			uint32_t getStallCount() const { return m_uiStallCount; }
+
 		protected:
 			BufferSharedPool* createPool(BufferCreator* pBufCreator, uint32_t) const override;
 			BufferSharedPool* createPool(BufferGPU* pBuf) const override;
 
 		private:
 			bool initBuffers();
+			void waitFence(uint32_t frameIndex);
+			void resetFences();
+			uint32_t alignSubRangeSize(uint32_t subRangeSize) const;
 
 		private:
 			BufferSharedUniformPool* m_SharedUniformPool;
+
+			// One fence per frame slot in the ring, placed by doneRendering().
+			std::vector<GLsync> m_Fences;
+			uint32_t m_uiStallCount;
 		};
 
 		class BufferGPUSharedNonUniformPool : public BufferGPUSharedPool
@@ -168,10 +236,7 @@ namespace jet
 		public:
 			BufferGPUSharedNonUniformPool(BufferCreator* pBufCreator, uint32_t);
 			BufferGPUSharedNonUniformPool(BufferGPU* pBuf);
-			virtual ~BufferGPUSharedNonUniformPool()
-			{
-				BufferGPUSharedPool::~BufferGPUSharedPool();
-			}
+			virtual ~BufferGPUSharedNonUniformPool();
 
 			BufferBean add(uint32_t size, const uint8_t* pData);
 			bool update(BufferBean bean, uint32_t offset, uint32_t size, const uint8_t* pData);
@@ -179,12 +244,33 @@ namespace jet
 			uint32_t getOffset(BufferBean bean) const;
 			uint8_t* map(BufferBean bean, MappingBits bits = MappingBits::READ_WRITE);
 			bool isDirty(BufferBean bean) const;
+
+			/// Closes all the holes left by removed beans, see BufferSharedNonUniformPool::compact().
+			void compact();
+
+			/// Moves at most maxBytes into holes, see BufferSharedNonUniformPool::defragment().
+			uint32_t defragment(uint32_t maxBytes) { return m_SharedNonUniformPool->defragment(maxBytes); }
+
+			void addRelocationListener(BufferRelocationListener* pListener) { m_SharedNonUniformPool->addRelocationListener(pListener); }
+			void removeRelocationListener(BufferRelocationListener* pListener) { m_SharedNonUniformPool->removeRelocationListener(pListener); }
+
+			float getFragmentation() const { return m_SharedNonUniformPool->getFragmentation(); }
+			uint32_t getBytesMovedLastStep() const { return m_SharedNonUniformPool->getBytesMovedLastStep(); }
+
+			/// Routes the data passed to add() and update() through the scheduler instead of writing
+			/// it immediately. Pass nullptr to write immediately again.
+			void setUploadScheduler(BufferUploadScheduler* pScheduler);
+			BufferUploadScheduler* getUploadScheduler() const { return m_pUploadScheduler; }
+
+			uint32_t getConsumedSize() const { return m_SharedNonUniformPool->getConsumedSize(); }
+			const TLSFAllocator& getAllocator() const { return m_SharedNonUniformPool->getAllocator(); }
 		protected:
 			BufferSharedPool* createPool(BufferCreator* pBufCreator, uint32_t) const override;
 			BufferSharedPool* createPool(BufferGPU* pBuf) const override;
 
 		private:
 			BufferSharedNonUniformPool* m_SharedNonUniformPool;
+			BufferUploadScheduler* m_pUploadScheduler;
 		};
 
 		template<BufferTarget Target, BufferUsage Usage, GLenum MapBits>
@@ -211,23 +297,28 @@ namespace jet
 #endif
 				CHECK_GL(glBufferData(__TARGET, size, pData, __USAGE));
 				m_uiDataSize = size;
+				trackAllocation(size, Usage, pData != nullptr);
 				return true;
 			}
 
 			uint8_t* map(uint32_t offset, uint32_t length, MappingBits bits = MappingBits::READ_WRITE) override
 			{
-#if __PERSISTENT
-				if(m_MappedPointer == nullptr)
+				if (__PERSISTENT)
 				{
-					CHECK_GL(m_MappedPointer = glMapBufferRange(__TARGET, 0, m_uiDataSize, bits));
-					if (m_MappedPointer)
+					// Persistent buffers are mapped once in full and stay mapped until they are disposed.
+					if (m_MappedPointer == nullptr)
 					{
+						bind();
+						CHECK_GL(GLvoid* p = glMapBufferRange(__TARGET, 0, m_uiDataSize, MapBits));
+						m_MappedPointer = reinterpret_cast<uint8_t*>(p);
 						m_MappedOffset = 0;
-						m_MappedSize = m_uiDataSize;
-						return m_MappedPointer + offset;
+						m_MappedSize = m_MappedPointer ? m_uiDataSize : 0;
+						BufferStatistics::get().onMap(m_MappedSize, (MapBits & GL_MAP_WRITE_BIT) != 0);
 					}
+
+					return m_MappedPointer ? m_MappedPointer + offset : nullptr;
 				}
-#else
+
 				if (m_MappedPointer && m_MappedOffset == offset && m_MappedSize == length)
 				{
 					return m_MappedPointer;
@@ -246,31 +337,35 @@ namespace jet
 					assert(false);
 				}
 #endif
-#define MAP_BITS MapBits
-#if MAP_BITS
-				CHECK_GL(GLvoid* p = glMapBufferRange(getGLTarget(), offset, length, MapBits));
-#else
-				CHECK_GL(GLvoid* p = glMapBuffer(getGLTarget(), GL_READ_WRITE));
-				offset = 0;
-				length = m_uiDataSize;
-#endif
-
-#undef MAP_BITS
+				GLvoid* p;
+				uint32_t rangeOffset = 0;
+				if (MapBits)
+				{
+					CHECK_GL(p = glMapBufferRange(getGLTarget(), offset, length, MapBits));
+				}
+				else
+				{
+					// glMapBuffer maps the whole buffer, the caller still gets the range it asked for.
+					CHECK_GL(p = glMapBuffer(getGLTarget(), GL_READ_WRITE));
+					rangeOffset = offset;
+					offset = 0;
+					length = m_uiDataSize;
+				}
 
 				m_MappedPointer = reinterpret_cast<uint8_t*>(p);
 				m_MappedOffset = offset;
 				m_MappedSize = length;
-				return m_MappedPointer;
-#endif
+				BufferStatistics::get().onMap(length, MapBits == 0 || (MapBits & GL_MAP_WRITE_BIT) != 0);
+				return m_MappedPointer ? m_MappedPointer + rangeOffset : nullptr;
 			}
 
 			void unmap() override
 			{
-#if __PERSISTENT
-				// Nothing need to do.
-#else
-				BufferGPU::unmap();
-#endif
+				// Nothing need to do for the persistent buffer.
+				if (!__PERSISTENT)
+				{
+					BufferGPU::unmap();
+				}
 			}
 
 			BufferTarget getTarget() const override
@@ -301,6 +396,17 @@ namespace jet
 			bool init(uint32_t size, const uint8_t* pData = nullptr) override
 			{
 				assert(size);
+				if (m_Buffer)
+				{
+					// The storage is immutable, so re-initializing needs a new buffer object.
+					GLStates& state = GLStates::get();
+					if (state.getBindingBuffer(Target) == m_Buffer)
+					{
+						state.resetBuffer(Target);
+					}
+					dispose();
+				}
+
 				bind();
 #if defined(_DEBUG)
 				GLStates& state = GLStates::get();
@@ -313,6 +419,10 @@ namespace jet
 				CHECK_GL(glBufferStorage(getGLTarget(), size, pData, StorageBits));
 				m_uiDataSize = size;
 
+				// Immutable storage has no usage hint, count the writable stores as dynamic.
+				const bool bWritable = (StorageBits & (GL_DYNAMIC_STORAGE_BIT | GL_MAP_WRITE_BIT)) != 0;
+				trackAllocation(size, bWritable ? BufferUsage::DYNAMIC_DRAW : BufferUsage::STATIC_DRAW, pData != nullptr);
+
 				return true;
 			}
 		};
@@ -326,6 +436,13 @@ namespace jet
 
 		template<BufferUsage Usage, GLenum MapBits>
 		class UniformBufferGL : public BufferGL < BufferTarget::UNIFORM, Usage, MapBits > {};
+
+		template<GLenum StorageBits, GLenum MapBits>
+		class UniformBufferGLStorage : public BufferGLStorage < BufferTarget::UNIFORM, StorageBits, MapBits > {};
+
+#define PERSISTENT_WRITE_BITS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+		typedef UniformBufferGLStorage<PERSISTENT_WRITE_BITS, PERSISTENT_WRITE_BITS> PersistentUniformBufferGL;
+#undef PERSISTENT_WRITE_BITS
 		
 //		typedef BufferGL<BufferTarget::ELEMENT> ElementBufferGL;
 //		typedef BufferGL<BufferTarget::UNIFORM> UniformBufferGL;
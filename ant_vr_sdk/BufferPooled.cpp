@@ -1,5 +1,7 @@
 #include "Buffer.h"
 #include "geometry2d.h"
+#include <string.h>
+#include <vector>
 
 namespace jet
 {
@@ -13,14 +15,16 @@ namespace jet
 //		uint32_t    m_bufferSize;
 		BufferSharedUniformPool::BufferSharedUniformPool(BufferCreator* pBufCreator):
 			BufferSharedPool(pBufCreator), m_numSubRanges(0), 
-			m_subRangeSize(0), m_index(0), m_numFrames(0), m_bufferSize(0)
+			m_subRangeSize(0), m_index(0), m_numFrames(0), m_bufferSize(0),
+			m_bPersistent(false), m_pMappedData(nullptr), m_uiMappedOffset(0)
 		{}
 		BufferSharedUniformPool::BufferSharedUniformPool(Buffer* pBuf):
 			BufferSharedPool(pBuf), m_numSubRanges(0),
-			m_subRangeSize(0), m_index(0), m_numFrames(0), m_bufferSize(0)
+			m_subRangeSize(0), m_index(0), m_numFrames(0), m_bufferSize(0),
+			m_bPersistent(false), m_pMappedData(nullptr), m_uiMappedOffset(0)
 		{}
 
-		bool BufferSharedUniformPool::init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames)
+		bool BufferSharedUniformPool::init(uint32_t dataSize, uint32_t numSubRanges, uint32_t numFrames, bool bPersistent)
 		{
 			// Use dataSize as the size of a single sub-range...
 			m_subRangeSize = dataSize;
@@ -35,6 +39,8 @@ namespace jet
 			m_numFrames = numFrames;
 			m_bufferSize = m_uiDataSize * m_numFrames;
 
+			m_bPersistent = bPersistent;
+
 			return initBuffers();
 		}
 
@@ -83,7 +89,15 @@ namespace jet
 
 		uint8_t* BufferSharedUniformPool::map(uint32_t subRangeIndex, uint32_t subIndex)
 		{
-			uint8_t* pData = m_pProxyBuffer->map((subIndex * m_uiDataSize) + (subRangeIndex * m_subRangeSize), m_uiDataSize, MappingBits::READ_WRITE);
+			const uint32_t offset = (subIndex * m_uiDataSize) + (subRangeIndex * m_subRangeSize);
+			if (m_pMappedData)
+			{
+				// The region is already mapped, so this is just pointer arithmetic.
+				assert(offset >= m_uiMappedOffset);
+				return m_pMappedData + (offset - m_uiMappedOffset);
+			}
+
+			uint8_t* pData = m_pProxyBuffer->map(offset, m_subRangeSize, MappingBits::READ_WRITE);
 			return pData;
 		}
 
@@ -92,14 +106,66 @@ namespace jet
 			return Buffer::getDynamicOffset() + (subRangeIndex * m_subRangeSize) + (subIndex * m_uiDataSize);
 		}
 
+		bool BufferSharedUniformPool::beginUpdate()
+		{
+			if (m_bPersistent)
+			{
+				return m_pMappedData != nullptr;
+			}
+
+			assert(m_pMappedData == nullptr);
+			m_uiMappedOffset = m_index * m_uiDataSize;
+			m_pMappedData = m_pProxyBuffer->map(m_uiMappedOffset, m_uiDataSize, MappingBits::WRITE);
+			return m_pMappedData != nullptr;
+		}
+
+		void BufferSharedUniformPool::endUpdate()
+		{
+			if (!m_bPersistent)
+			{
+				releaseMapping();
+			}
+		}
+
+		void BufferSharedUniformPool::doneRendering()
+		{
+			m_index = (m_index + 1) % m_numFrames;
+		}
+
+		void BufferSharedUniformPool::releaseMapping()
+		{
+			if (m_pMappedData)
+			{
+				m_pProxyBuffer->unmap();
+				m_pMappedData = nullptr;
+				m_uiMappedOffset = 0;
+			}
+		}
+
 		bool BufferSharedUniformPool::initBuffers()
 		{
+			releaseMapping();
+			m_index = 0;
+
 			if (m_bufferSize == 0)
 			{
 				return false;
 			}
 
-			return m_pProxyBuffer->init(m_bufferSize);
+			if (!m_pProxyBuffer->init(m_bufferSize))
+			{
+				return false;
+			}
+
+			if (m_bPersistent)
+			{
+				// Map the whole ring once; the mapping stays valid for the lifetime of the buffer.
+				m_uiMappedOffset = 0;
+				m_pMappedData = m_pProxyBuffer->map(0, m_bufferSize, MappingBits::WRITE);
+				return m_pMappedData != nullptr;
+			}
+
+			return true;
 		}
 #if 0
 		enum class  BatchAddingBehavior
@@ -126,56 +192,34 @@ namespace jet
 
 		
 		BufferSharedNonUniformPool::BufferSharedNonUniformPool(BufferCreator* pBufCreator, uint32_t capacity) :BufferSharedPool(pBufCreator),
-			m_pHeader(nullptr), m_uiRegionCount(0), m_uiConsumedSize(0)
+			m_Allocator(), m_uiBytesMoved(0)
 		{
 			if (capacity)
 			{
-				assert(m_pProxyBuffer->init(capacity));
+				bool bInited = m_pProxyBuffer->init(capacity);
+				assert(bInited);
 
-				m_pTail = new Region;
-				m_pTail->Interval = { 0, capacity };
-				m_pTail->iIndex++;
-			}
-			else
-			{
-				m_pTail = nullptr;
+				m_Allocator.reset(m_pProxyBuffer->getSize());
 			}
 		}
 		BufferSharedNonUniformPool::BufferSharedNonUniformPool(Buffer* pBuf) : BufferSharedPool(pBuf),
-			m_pHeader(nullptr), m_uiRegionCount(0), m_uiConsumedSize(0)
+			m_Allocator(pBuf->getSize()), m_uiBytesMoved(0)
 		{
-			if (pBuf->getSize())
-			{
-//				assert(m_pProxyBuffer->init(capacity));
-
-				m_pTail = new Region;
-				m_pTail->Interval = { 0, pBuf->getSize() };
-				m_pTail->iIndex++;
-			}
-			else
-			{
-				m_pTail = nullptr;
-			}
 		}
 
-		bool BufferSharedNonUniformPool::isDirty(BufferBean bean) const
+		BufferSharedNonUniformPool::~BufferSharedNonUniformPool()
 		{
-			return reinterpret_cast<BufferBeanImpl*>(bean)->pData->bDirty;
+			deleteBeans();
 		}
 
-		uint32_t BufferSharedNonUniformPool::getOffset(BufferBean bean) const
+		bool BufferSharedNonUniformPool::isDirty(BufferBean bean) const
 		{
-			return reinterpret_cast<BufferBeanImpl*>(bean)->pData->Interval.Min;
+			return reinterpret_cast<BufferBeanImpl*>(bean)->bDirty;
 		}
 
-		void BufferSharedNonUniformPool::makeRegionsDirty()
+		uint32_t BufferSharedNonUniformPool::getOffset(BufferBean bean) const
 		{
-			Region* pNext = m_pHeader;
-			while (pNext && pNext->pBean)
-			{
-				pNext->bDirty = true;
-				pNext = pNext->pRight;
-			}
+			return reinterpret_cast<BufferBeanImpl*>(bean)->pBlock->Offset;
 		}
 
 		BufferBean BufferSharedNonUniformPool::add(uint32_t size, const uint8_t* pData)
@@ -185,82 +229,23 @@ namespace jet
 				return nullptr;
 			}
 
-			if (size && pData == nullptr)
+			BufferBeanImpl* pBean = new BufferBeanImpl(size, pData);
+			pBean->pBlock = m_Allocator.allocate(size, pBean);
+			if (pBean->pBlock == nullptr)
 			{
-//				assert(m_pTail);
-//				assert(m_pProxyBuffer->getSize() > m_uiConsumedSize);
-
-				const uint32_t uiRemainCapacity = m_pProxyBuffer->getSize() - m_uiConsumedSize;
-				bool bReallocated = false;
-				if (uiRemainCapacity < size)
+				if (!grow(size) || (pBean->pBlock = m_Allocator.allocate(size, pBean)) == nullptr)
 				{
-//					m_pBuffer->bind();
-
-					uint32_t bufferSize = m_pProxyBuffer->getSize();
-					uint32_t deserdSize = m_uiConsumedSize + size;
-					while (bufferSize < deserdSize)
-						bufferSize *= 2;
-
-					if (m_pBufferCreator)
-					{
-						if (m_pTail == nullptr || m_pHeader == nullptr)
-						{
-							m_pProxyBuffer->init(bufferSize, nullptr/*, m_pBuffer->getUsage()*/);
-						}
-						else
-						{
-							Buffer* newBuf = m_pBufferCreator->create();
-							assert(newBuf->init(bufferSize));
-							uint8_t* pSrcData = m_pProxyBuffer->map(0, m_pProxyBuffer->getSize(), MappingBits::READ);
-							if (pSrcData)
-							{
-								uint8_t* pDstData = newBuf->map(0, m_pProxyBuffer->getSize(), MappingBits::WRITE);
-								memcpy(pDstData, pSrcData, m_pProxyBuffer->getSize());
-								m_pProxyBuffer->unmap();
-								newBuf->unmap();
-							}
-							else
-							{
-								m_pProxyBuffer->unmap();
-								makeRegionsDirty();
-							}
-						}
-					}
-
-					if (m_pTail == nullptr)
-					{
-						m_pTail = new Region;
-						m_pTail->Interval = { 0, bufferSize };
-						m_pTail->iIndex++;
-					}
-
-					bReallocated = true;
+					delete pBean;
+					return nullptr;
 				}
-				
-#if 0
-				if (!bReallocated && (behavior == BatchAddingBehavior::APPEND_COMPACT /*|| behavior == BatchAddingBehavior::INSERT_COMPACT*/))
-				{
-//					bReallocated = true;
-				}
-#endif			
-				if (bReallocated /*|| m_pTail->Interval.length() < pBean->uiBufferSize*/)
-				{
-//					result = BatchAddingBehavior::APPEND_COMPACT;
-//					flushRegions();  // TODO Do not neeed this
-				}
-
-//				assert(m_pTail->pBean == nullptr && m_pTail->Interval.length() >= pBean->uiBufferSize);
-				m_pProxyBuffer->update(m_pTail->Interval.Min, size, pData);  // TODO bad performance.  Can be optimise in buffer.
-				m_uiConsumedSize += size;
-
-				BufferBeanImpl* pBean = new BufferBeanImpl(size, pData);
-				addBufferBeanToTail(pBean);
+			}
 
-				// TODO ĿǰδʵֵĹܣ
-				// 1мհĲ빦
-				// 2Element BaseVertexĹ 
-				return pBean;
+			if (pData)
+			{
+				m_pProxyBuffer->update(pBean->pBlock->Offset, size, pData);
 			}
+
+			return pBean;
 		}
 
 		bool BufferSharedNonUniformPool::update(BufferBean bean, uint32_t offset, uint32_t size, const uint8_t* pData)
@@ -268,19 +253,18 @@ namespace jet
 			BufferBeanImpl* pBean = reinterpret_cast<BufferBeanImpl*>(bean);
 			if (pBean)
 			{
-				Region* pRegion = pBean->pData;
-				uint8_t* pDst = m_pProxyBuffer->map(pRegion->Interval.Min + offset, size, MappingBits::WRITE);
+				const uint32_t uiOffset = pBean->pBlock->Offset + offset;
+				uint8_t* pDst = m_pProxyBuffer->map(uiOffset, size, MappingBits::WRITE);
+				pBean->bDirty = false;
 				if (pDst)
 				{
 					memcpy(pDst, pData, size);
 					m_pProxyBuffer->unmap();
-					pRegion->bDirty = false;
 					return true;
 				}
 				else
 				{
-					pRegion->bDirty = false;
-					return m_pProxyBuffer->update(pRegion->Interval.Min + offset, size, pData);
+					return m_pProxyBuffer->update(uiOffset, size, pData);
 				}
 			}
 			return false;
@@ -288,295 +272,215 @@ namespace jet
 
 		void BufferSharedNonUniformPool::remove(BufferBean bean)
 		{
-//			assert(m_pBuffer);
 			BufferBeanImpl* pBean = reinterpret_cast<BufferBeanImpl*>(bean);
-			if (pBean && pBean->pData)
+			if (pBean)
 			{
-				Region* const pRegion = pBean->pData;
-				delete pRegion->pBean;
-				pRegion->pBean = nullptr;
-
-				uint32_t length = pRegion->Interval.length();
-				m_uiConsumedSize -= length;
-
-				// merge the sapce
-				Region* pLeft = pRegion->pLeft;
-				Region* const pRight = pRegion->pRight;
-
-				if (pRight == nullptr)
-				{
-					assert(false);  // The tail must be non-null
-				}
-
-				
-				if (pLeft == nullptr)
-				{ // This is the head.
-					m_pHeader = pRight;
-					pRight->pLeft = nullptr;
-				}
-				else
-				{
-					pLeft->pRight = pRight;
-					pRight->pLeft = pLeft;
-				}
-
-				Region* pNext = pRight;
-				while (pNext)
-				{
-					pNext->Interval -= length;
-					pNext = pNext->pRight;
-				}
-
-				// move the buffer data.
-				m_pProxyBuffer->memoryCpy(pRegion->Interval.Min, pRight->Interval.Min, length);
-				delete pRegion;
+				// The hole is left in place and reused by later adds.
+				m_Allocator.free(pBean->pBlock);
+				delete pBean;
 			}
 		}
 
 		uint8_t* BufferSharedNonUniformPool::map(BufferBean bean, MappingBits bits)
 		{
 			BufferBeanImpl* pBean = reinterpret_cast<BufferBeanImpl*>(bean);
-			return m_pProxyBuffer->map(pBean->pData->Interval.Min, pBean->uiBufferSize, bits);
+			return m_pProxyBuffer->map(pBean->pBlock->Offset, pBean->uiBufferSize, bits);
 		}
 
-		void BufferSharedNonUniformPool::addBufferBeanToTail(BufferBeanImpl* pBean)
+		void BufferSharedNonUniformPool::compact()
 		{
-			Region* pRegion = new Region;
-			pRegion->Interval = { m_pTail->Interval.Min, m_pTail->Interval.Min + pBean->uiBufferSize };
-			pRegion->pBean = pBean;
-			pBean->pData = pRegion;
+			m_Relocations.clear();
 
-			const Rangeui oldValue = m_pTail->Interval;
-			Region* pLeft = m_pTail->pLeft;
-
-			//				m_pTail = new Region;
-			m_pTail->Interval.Min = pRegion->Interval.Max;
-			m_pTail->Interval.Max = oldValue.Max;
-			m_pTail->iIndex++;
+			TLSFAllocator::Block* pBlock = m_Allocator.getFirstBlock();
+			while (pBlock)
+			{
+				if (!pBlock->bFree)
+				{
+					const uint32_t uiSrcOffset = pBlock->Offset;
+					if (m_Allocator.slideDown(pBlock))
+					{
+						m_pProxyBuffer->memoryCpy(pBlock->Offset, uiSrcOffset, pBlock->Size);
 
-			pRegion->pRight = m_pTail;
-			pRegion->pLeft = pLeft;
-			m_pTail->pLeft = pRegion;
+						BufferRelocation relocation = { pBlock->pUserData, uiSrcOffset, pBlock->Offset };
+						m_Relocations.push_back(relocation);
+					}
+				}
 
-			if (pLeft == nullptr)
-			{
-				assert(m_pHeader == nullptr);
-				m_pHeader = pRegion;
-				pRegion->iIndex = 0;
-			}
-			else
-			{
-				pLeft->pRight = pRegion;
-				pRegion->iIndex = pLeft->iIndex + 1;
-				assert(pRegion->iIndex == m_pTail->iIndex - 1);
+				pBlock = pBlock->pNextPhys;
 			}
+
+			notifyRelocations();
 		}
 
-		void BufferSharedNonUniformPool::deleteRegions()
+		void BufferSharedNonUniformPool::notifyRelocations()
 		{
-			if (m_pHeader)
+			if (!m_Relocations.empty())
 			{
-				Region* pNext = m_pHeader;
-				while (pNext)
+				for (size_t i = 0; i < m_RelocationListeners.size(); i++)
 				{
-					Region* pDel = pNext;
-					pNext = pNext->pRight;
-
-					delete pDel;
+					m_RelocationListeners[i]->onBeansRelocated(m_Relocations.data(), static_cast<uint32_t>(m_Relocations.size()));
 				}
-
-				m_pHeader = nullptr;
 			}
 		}
 
-		void BufferSharedNonUniformPool::removeRegionSpaces()
+		uint32_t BufferSharedNonUniformPool::defragment(uint32_t maxBytes)
 		{
-			uint32_t uiTotalShift = 0;
-			int32_t iIndexShift = 0;
-			if (!m_uiConsumedSize)
+			m_uiBytesMoved = 0;
+			m_Relocations.clear();
+
+			// Nothing to do if all the free space is already in one piece.
+			if (m_Allocator.getFreeBlockCount() <= 1)
 			{
-				return;
+				return 0;
 			}
 
-			while (m_pHeader)
+			TLSFAllocator::Block* pBlock = m_Allocator.getLastBlock();
+			while (pBlock)
 			{
-				if (m_pHeader->pBean == nullptr)
+				TLSFAllocator::Block* pPrev = pBlock->pPrevPhys;
+				if (pBlock->bFree || pBlock->Size > maxBytes - m_uiBytesMoved)
+				{
+					pBlock = pPrev;
+					continue;
+				}
+
+				BufferBeanImpl* pBean = reinterpret_cast<BufferBeanImpl*>(pBlock->pUserData);
+				const uint32_t uiOldOffset = pBlock->Offset;
+				const uint32_t uiSize = pBlock->Size;
+
+				// Prefer a hole that fits the whole bean, otherwise slide it into the hole right in front of it.
+				TLSFAllocator::Block* pNew = m_Allocator.relocate(pBlock);
+				if (pNew)
 				{
-					uiTotalShift += m_pHeader->Interval.length();
-					iIndexShift++;
-					Region* pNext = m_pHeader->pRight;
-					if (pNext)
+					pBean->pBlock = pNew;
+					if (pPrev == pNew)
 					{
-						pNext->pLeft = nullptr;
+						// Moved into the hole right in front, don't visit it again.
+						pPrev = pNew->pPrevPhys;
 					}
-
-					delete m_pHeader;
-					m_pHeader = pNext;
 				}
-				else
+				else if (m_Allocator.slideDown(pBlock))
 				{
-					break;
+					pNew = pBlock;
+					pPrev = pBlock->pPrevPhys;
 				}
-			}
-
-			if (!m_pHeader)
-			{
-				assert(false);  // Internal Error.
-			}
-
-			m_pHeader->Interval.Max -= uiTotalShift;
-			m_pHeader->Interval.Min -= uiTotalShift;
-			assert(m_pHeader->iIndex == iIndexShift);
-			assert(m_pHeader->Interval.Min == 0);
 
-			m_pHeader->iIndex = 0;
-			Region* pCurrent = m_pHeader;
-
-			while (pCurrent)
-			{
-				m_pTail = pCurrent;
-				if (pCurrent->pBean)
+				if (pNew)
 				{
-					pCurrent->Interval.Max -= uiTotalShift;
-					pCurrent->Interval.Min -= uiTotalShift;
-					pCurrent->iIndex -= iIndexShift;
-					pCurrent = pCurrent->pRight;
-				}
-				else
-				{
-					uiTotalShift += pCurrent->Interval.length();
-					// delete this node
-					Region* pLeft = pCurrent->pLeft;
-					Region* pRight = pCurrent->pRight;
+					m_pProxyBuffer->memoryCpy(pNew->Offset, uiOldOffset, uiSize);
+					m_uiBytesMoved += uiSize;
 
-					pLeft->pRight = pRight;
-					if (pRight)
+					BufferRelocation relocation = { pBean, uiOldOffset, pNew->Offset };
+					m_Relocations.push_back(relocation);
+
+					if (m_Allocator.getFreeBlockCount() <= 1)
 					{
-						pRight->pLeft = pLeft;
+						break;
 					}
-
-					delete pCurrent;
-					pCurrent = pRight;
 				}
+
+				pBlock = pPrev;
 			}
+
+			notifyRelocations();
+			return m_uiBytesMoved;
 		}
 
-		void BufferSharedNonUniformPool::mergeSapce(Region* pRegion, int32_t& iIndexShift)
+		void BufferSharedNonUniformPool::addRelocationListener(BufferRelocationListener* pListener)
 		{
-			Region* pStart = pRegion;
-			if (pStart == nullptr || pStart->pBean)
-				return;
-			pRegion = pStart->pRight;
-			while (pRegion)
+			for (size_t i = 0; i < m_RelocationListeners.size(); i++)
 			{
-				if (pRegion->pBean == nullptr)
-				{
-					assert(pStart->Interval.Max == pRegion->Interval.Min);
-					// combine the interval
-					pStart->Interval.Max = pRegion->Interval.Max;
-					Region* pNext = pRegion->pRight;
-					pStart->pRight = pNext;
-					if (pNext)
-					{
-						pNext->pLeft = pStart;
-					}
+				if (m_RelocationListeners[i] == pListener)
+					return;
+			}
 
-					delete pRegion;
-					pRegion = pNext;
-					iIndexShift++;
-				}
-				else
+			m_RelocationListeners.push_back(pListener);
+		}
+
+		void BufferSharedNonUniformPool::removeRelocationListener(BufferRelocationListener* pListener)
+		{
+			for (size_t i = 0; i < m_RelocationListeners.size(); i++)
+			{
+				if (m_RelocationListeners[i] == pListener)
 				{
-					break;
+					m_RelocationListeners.erase(m_RelocationListeners.begin() + i);
+					return;
 				}
 			}
 		}
 
-		void BufferSharedNonUniformPool::flushRegions()
+		bool BufferSharedNonUniformPool::grow(uint32_t size)
 		{
-			uint32_t uiLastOffset = 0;
-			int32_t iIndexShift = 0;
-			Region* pCurrent = m_pHeader;
-			Region* new_pHeader = nullptr;
+			const uint32_t uiOldSize = m_pProxyBuffer->getSize();
+			const uint32_t uiRequired = uiOldSize + size;
+
+			uint32_t uiNewSize = uiOldSize ? uiOldSize : size;
+			while (uiNewSize < uiRequired)
+				uiNewSize *= 2;
 
-			if (m_uiConsumedSize == 0 /*|| m_uiEmptyRegionCount == 0*/)
+			if (m_Allocator.getUsedBlockCount() == 0)
 			{
-				// no data
-				return;
+				if (!m_pProxyBuffer->init(uiNewSize))
+				{
+					return false;
+				}
+
+				m_Allocator.reset(m_pProxyBuffer->getSize());
+				return true;
 			}
 
-			// TODO: ûõܵglCopyBufferSubData
+			// Buffers that grow in place keep the beans where they are, nothing to copy or upload again.
+			if (m_pProxyBuffer->resize(uiNewSize))
+			{
+				m_Allocator.grow(m_pProxyBuffer->getSize());
+				return true;
+			}
 
-			while (pCurrent)
+			// Re-initializing the buffer drops its contents, so keep a copy of them.
+			std::vector<uint8_t> content(uiNewSize);
+			uint8_t* pSrcData = m_pProxyBuffer->map(0, uiOldSize, MappingBits::READ);
+			if (pSrcData)
 			{
-				pCurrent->iIndex -= iIndexShift;
-				m_pTail = pCurrent;
+				memcpy(content.data(), pSrcData, uiOldSize);
+			}
+			m_pProxyBuffer->unmap();
 
-				if (pCurrent->pBean)
-				{
-					m_pProxyBuffer->update(uiLastOffset, pCurrent->pBean->uiBufferSize, (uint8_t*)pCurrent->pBean->pBufferData);
-					uiLastOffset += pCurrent->pBean->uiBufferSize;
-					pCurrent = pCurrent->pRight;
+			if (!m_pProxyBuffer->init(uiNewSize, pSrcData ? content.data() : nullptr))
+			{
+				return false;
+			}
 
-					if (new_pHeader == nullptr)
-					{
-						new_pHeader = pCurrent;
-					}
-				}
-				else
+			if (pSrcData == nullptr)
+			{
+				// The buffer can't be read back, upload the beans again from their source data.
+				for (TLSFAllocator::Block* pBlock = m_Allocator.getFirstBlock(); pBlock; pBlock = pBlock->pNextPhys)
 				{
-					// removed the empty regions
-					Region* pLeft = pCurrent->pLeft;
-					// merge the spaces
-					mergeSapce(pCurrent, iIndexShift);
-
-					// switch the current and right
-					Region* pRight = pCurrent->pRight;
-					if (pRight == nullptr)
-					{
-						break;
-					}
+					BufferBeanImpl* pBean = reinterpret_cast<BufferBeanImpl*>(pBlock->pUserData);
+					if (pBean == nullptr)
+						continue;
 
-					Region* pRR = pRight->pRight;
-					pCurrent->pRight = pRR;
-					if (pRR)
+					if (pBean->pBufferData)
 					{
-						pRR->pLeft = pCurrent;
+						m_pProxyBuffer->update(pBlock->Offset, pBean->uiBufferSize, pBean->pBufferData);
 					}
-
-					pRight->pRight = pCurrent;
-					pRight->pLeft = pLeft;
-					if (pLeft)
+					else
 					{
-						pLeft->pRight = pRight;
+						pBean->bDirty = true;
 					}
-
-					pCurrent->pLeft = pRight;
-
-					// shift the intervals. 
-					uint32_t uiCurrentLength = pCurrent->Interval.length();
-					uint32_t uiRightLength = pRight->Interval.length();
-					pCurrent->Interval.Min += uiRightLength;
-					pCurrent->Interval.Max += uiRightLength;
-					pRight->Interval.Min -= uiCurrentLength;
-					pRight->Interval.Max -= uiCurrentLength;
-
-					// index
-					int32_t iOldIndex = pCurrent->iIndex;
-					pCurrent->iIndex = pRight->iIndex;
-					pRight->iIndex = iOldIndex;
-
-					pCurrent = pRight;
 				}
 			}
 
-			if (new_pHeader)
+			m_Allocator.grow(m_pProxyBuffer->getSize());
+			return true;
+		}
+
+		void BufferSharedNonUniformPool::deleteBeans()
+		{
+			for (TLSFAllocator::Block* pBlock = m_Allocator.getFirstBlock(); pBlock; pBlock = pBlock->pNextPhys)
 			{
-				m_pHeader = new_pHeader;
+				delete reinterpret_cast<BufferBeanImpl*>(pBlock->pUserData);
+				pBlock->pUserData = nullptr;
 			}
-
-//			m_uiEmptyRegionCount = 0;
-			m_pTail->Interval.Max = m_pProxyBuffer->getSize();
 		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "BufferStatistics.h"
+#include <sstream>
+
+namespace jet
+{
+	namespace util
+	{
+		static const char* TARGET_NAMES[] =
+		{
+			"ARRAY", "COPY_READ", "COPY_WRITE", "DISPATCH_INDIRECT", "DRAW_INDIRECT", "ELEMENT", "PIXEL_PACK",
+			"PIXEL_UNPACK", "TEXTURE", "QUERY", "ATOMIC_COUNTER", "SHADER_STORAGE", "TRANSFORM_FEEDBACK", "UNIFORM",
+		};
+
+		static const char* USAGE_NAMES[] =
+		{
+			"STREAM_DRAW", "STREAM_READ", "STREAM_COPY", "STATIC_DRAW", "STATIC_READ", "STATIC_COPY",
+			"DYNAMIC_DRAW", "DYNAMIC_READ", "DYNAMIC_COPY",
+		};
+
+		BufferStatistics& BufferStatistics::get()
+		{
+			static BufferStatistics instance;
+			return instance;
+		}
+
+		BufferStatistics::BufferStatistics() : m_uiVertexArrays(0), m_uiFrameIndex(0), m_pFrameDumpFile(nullptr)
+		{
+			static_assert(_countof(TARGET_NAMES) == static_cast<int>(BufferTarget::COUNT), "TARGET_NAMES is out of date");
+			static_assert(_countof(USAGE_NAMES) == USAGE_COUNT, "USAGE_NAMES is out of date");
+		}
+
+		void BufferStatistics::add(BufferMemoryStats& stats, uint64_t size)
+		{
+			stats.LiveBytes += size;
+			stats.LiveBuffers++;
+			if (stats.LiveBytes > stats.PeakBytes)
+				stats.PeakBytes = stats.LiveBytes;
+		}
+
+		void BufferStatistics::remove(BufferMemoryStats& stats, uint64_t size)
+		{
+			assert(stats.LiveBytes >= size && stats.LiveBuffers > 0);
+			stats.LiveBytes -= size;
+			stats.LiveBuffers--;
+		}
+
+		void BufferStatistics::onAllocate(BufferTarget target, BufferUsage usage, uint64_t size)
+		{
+			add(m_Total, size);
+			add(m_Targets[static_cast<int>(target)], size);
+			add(m_Usages[static_cast<int>(usage)], size);
+		}
+
+		void BufferStatistics::onRelease(BufferTarget target, BufferUsage usage, uint64_t size)
+		{
+			remove(m_Total, size);
+			remove(m_Targets[static_cast<int>(target)], size);
+			remove(m_Usages[static_cast<int>(usage)], size);
+		}
+
+		void BufferStatistics::onUpdate(uint64_t size)
+		{
+			m_CurrentFrame.UpdateCount++;
+			m_CurrentFrame.UploadBytes += size;
+			m_TotalTraffic.UpdateCount++;
+			m_TotalTraffic.UploadBytes += size;
+		}
+
+		void BufferStatistics::onMap(uint64_t size, bool bWrite)
+		{
+			m_CurrentFrame.MapCount++;
+			m_TotalTraffic.MapCount++;
+			if (bWrite)
+			{
+				m_CurrentFrame.MappedWriteBytes += size;
+				m_TotalTraffic.MappedWriteBytes += size;
+			}
+		}
+
+		void BufferStatistics::onUnmap()
+		{
+			m_CurrentFrame.UnmapCount++;
+			m_TotalTraffic.UnmapCount++;
+		}
+
+		void BufferStatistics::onCopy(uint64_t size)
+		{
+			m_CurrentFrame.CopyBytes += size;
+			m_TotalTraffic.CopyBytes += size;
+		}
+
+		void BufferStatistics::beginFrame()
+		{
+			m_LastFrame = m_CurrentFrame;
+			m_CurrentFrame = BufferTrafficStats();
+
+			if (m_pFrameDumpFile)
+			{
+				dumpJSON(m_pFrameDumpFile);
+			}
+
+			m_uiFrameIndex++;
+		}
+
+		static void writeMemoryStats(std::stringstream& out, const BufferMemoryStats& stats)
+		{
+			out << "{\"live_bytes\":" << stats.LiveBytes << ",\"peak_bytes\":" << stats.PeakBytes << ",\"live_buffers\":" << stats.LiveBuffers << "}";
+		}
+
+		static void writeTrafficStats(std::stringstream& out, const BufferTrafficStats& stats)
+		{
+			out << "{\"updates\":" << stats.UpdateCount << ",\"maps\":" << stats.MapCount << ",\"unmaps\":" << stats.UnmapCount
+				<< ",\"upload_bytes\":" << stats.UploadBytes << ",\"mapped_write_bytes\":" << stats.MappedWriteBytes
+				<< ",\"copy_bytes\":" << stats.CopyBytes << "}";
+		}
+
+		std::string BufferStatistics::toJSON() const
+		{
+			std::stringstream out;
+			out << "{\"frame\":" << m_uiFrameIndex << ",\"total\":";
+			writeMemoryStats(out, m_Total);
+
+			// Only the targets and usages that ever held a buffer, to keep the per-frame dumps short.
+			out << ",\"targets\":{";
+			bool bFirst = true;
+			for (int i = 0; i < static_cast<int>(BufferTarget::COUNT); i++)
+			{
+				if (m_Targets[i].PeakBytes == 0 && m_Targets[i].LiveBuffers == 0)
+					continue;
+
+				out << (bFirst ? "\"" : ",\"") << TARGET_NAMES[i] << "\":";
+				writeMemoryStats(out, m_Targets[i]);
+				bFirst = false;
+			}
+
+			out << "},\"usages\":{";
+			bFirst = true;
+			for (int i = 0; i < USAGE_COUNT; i++)
+			{
+				if (m_Usages[i].PeakBytes == 0 && m_Usages[i].LiveBuffers == 0)
+					continue;
+
+				out << (bFirst ? "\"" : ",\"") << USAGE_NAMES[i] << "\":";
+				writeMemoryStats(out, m_Usages[i]);
+				bFirst = false;
+			}
+
+			out << "},\"vertex_arrays\":" << m_uiVertexArrays << ",\"last_frame\":";
+			writeTrafficStats(out, m_LastFrame);
+			out << ",\"total_traffic\":";
+			writeTrafficStats(out, m_TotalTraffic);
+			out << "}";
+
+			return out.str();
+		}
+
+		void BufferStatistics::dumpJSON(FILE* pFile) const
+		{
+			const std::string json = toJSON();
+			fprintf(pFile, "%s\n", json.c_str());
+		}
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "gl_state_define.h"
+#include <stdio.h>
+#include <string>
+
+namespace jet
+{
+	namespace util
+	{
+		typedef struct BufferMemoryStats
+		{
+			uint64_t LiveBytes;
+			uint64_t PeakBytes;
+			uint32_t LiveBuffers;
+
+			BufferMemoryStats() : LiveBytes(0), PeakBytes(0), LiveBuffers(0){}
+		}BufferMemoryStats;
+
+		typedef struct BufferTrafficStats
+		{
+			uint32_t UpdateCount;
+			uint32_t MapCount;
+			uint32_t UnmapCount;
+			// Bytes passed to init() and update().
+			uint64_t UploadBytes;
+			// Bytes of the ranges mapped for writing.
+			uint64_t MappedWriteBytes;
+			// Bytes copied between buffers on the GPU.
+			uint64_t CopyBytes;
+
+			BufferTrafficStats() : UpdateCount(0), MapCount(0), UnmapCount(0), UploadBytes(0), MappedWriteBytes(0), CopyBytes(0){}
+		}BufferTrafficStats;
+
+		/**
+		 * Process-wide registry of the GPU buffer memory. Every BufferGPU reports its allocations,
+		 * releases, updates and mappings here, so the pools, the per-geometry buffers and the
+		 * staging buffers are all accounted for. Only the GL thread may touch it.<p>
+		 * Call beginFrame() once per frame to start the per-frame traffic counters.
+		 */
+		class BufferStatistics
+		{
+		public:
+			static BufferStatistics& get();
+
+			void onAllocate(BufferTarget target, BufferUsage usage, uint64_t size);
+			void onRelease(BufferTarget target, BufferUsage usage, uint64_t size);
+			void onUpdate(uint64_t size);
+			void onMap(uint64_t size, bool bWrite);
+			void onUnmap();
+			void onCopy(uint64_t size);
+			void onVertexArrayCreated() { m_uiVertexArrays++; }
+			void onVertexArrayDeleted() { m_uiVertexArrays--; }
+
+			/// Moves the frame counters into the last frame and starts a new frame.
+			void beginFrame();
+
+			/// When set, beginFrame() dumps the statistics of every finished frame into the file.
+			void setFrameDumpFile(FILE* pFile) { m_pFrameDumpFile = pFile; }
+
+			const BufferMemoryStats& getTotal() const { return m_Total; }
+			const BufferMemoryStats& getTargetStats(BufferTarget target) const { return m_Targets[static_cast<int>(target)]; }
+			const BufferMemoryStats& getUsageStats(BufferUsage usage) const { return m_Usages[static_cast<int>(usage)]; }
+			uint32_t getVertexArrayCount() const { return m_uiVertexArrays; }
+
+			/// Returns the traffic of the last complete frame.
+			const BufferTrafficStats& getLastFrameTraffic() const { return m_LastFrame; }
+			/// Returns the traffic since the process started.
+			const BufferTrafficStats& getTotalTraffic() const { return m_TotalTraffic; }
+			uint64_t getFrameIndex() const { return m_uiFrameIndex; }
+
+			/// Returns all the statistics as a JSON object.
+			std::string toJSON() const;
+			/// Writes toJSON() followed by a new line, e.g. once per frame into a log file.
+			void dumpJSON(FILE* pFile) const;
+
+		private:
+			BufferStatistics();
+			BufferStatistics(const BufferStatistics&) = delete;
+			BufferStatistics& operator=(const BufferStatistics&) = delete;
+
+			static void add(BufferMemoryStats& stats, uint64_t size);
+			static void remove(BufferMemoryStats& stats, uint64_t size);
+
+		private:
+			static const int USAGE_COUNT = static_cast<int>(BufferUsage::DYNAMIC_COPY) + 1;
+
+			BufferMemoryStats m_Total;
+			BufferMemoryStats m_Targets[static_cast<int>(BufferTarget::COUNT)];
+			BufferMemoryStats m_Usages[USAGE_COUNT];
+			uint32_t m_uiVertexArrays;
+
+			BufferTrafficStats m_CurrentFrame;
+			BufferTrafficStats m_LastFrame;
+			BufferTrafficStats m_TotalTraffic;
+			uint64_t m_uiFrameIndex;
+
+			FILE* m_pFrameDumpFile;
+		};
+	}
+}
@@ -0,0 +1,153 @@
+#include "BufferUpload.h"
+#include "Numeric.h"
+#include <algorithm>
+#include <string.h>
+
+namespace jet
+{
+	namespace util
+	{
+		BufferUploadScheduler::BufferUploadScheduler(){}
+
+		BufferUploadScheduler::~BufferUploadScheduler(){}
+
+		void BufferUploadScheduler::update(BufferGPU* pDst, uint32_t offset, uint32_t size, const uint8_t* pData)
+		{
+			if (pDst == nullptr || size == 0 || pData == nullptr)
+			{
+				return;
+			}
+
+			Request request;
+			request.pDst = pDst;
+			request.Offset = offset;
+			request.Size = size;
+			request.DataOffset = static_cast<uint32_t>(m_PendingData.size());
+			request.Sequence = static_cast<uint32_t>(m_Requests.size());
+			m_Requests.push_back(request);
+
+			m_PendingData.insert(m_PendingData.end(), pData, pData + size);
+		}
+
+		void BufferUploadScheduler::discard(BufferGPU* pDst)
+		{
+			// The data of the dropped requests stays in m_PendingData until the next flush.
+			auto it = std::remove_if(m_Requests.begin(), m_Requests.end(), [pDst](const Request& r){ return r.pDst == pDst; });
+			m_Requests.erase(it, m_Requests.end());
+		}
+
+		void BufferUploadScheduler::flush()
+		{
+			m_Stats = BufferUploadStats();
+			if (m_Requests.empty())
+			{
+				m_PendingData.clear();
+				return;
+			}
+
+			m_Stats.RequestCount = static_cast<uint32_t>(m_Requests.size());
+
+			// Group the requests by destination and order them by offset, so the mergeable ones are neighbours.
+			std::sort(m_Requests.begin(), m_Requests.end(), [](const Request& a, const Request& b)
+			{
+				if (a.pDst != b.pDst)
+					return a.pDst < b.pDst;
+				if (a.Offset != b.Offset)
+					return a.Offset < b.Offset;
+				return a.Sequence < b.Sequence;
+			});
+
+			// Merge the requests that touch or overlap. The requests of a merged range are written in
+			// submission order below, so the later one wins where they overlap.
+			m_MergedRanges.clear();
+			m_RangeStarts.clear();
+			uint32_t stagingSize = 0;
+			size_t first = 0;
+			uint32_t rangeEnd = m_Requests[0].Offset + m_Requests[0].Size;
+			for (size_t i = 1; i <= m_Requests.size(); i++)
+			{
+				if (i < m_Requests.size() && m_Requests[i].pDst == m_Requests[first].pDst && m_Requests[i].Offset <= rangeEnd)
+				{
+					rangeEnd = Numeric::max(rangeEnd, m_Requests[i].Offset + m_Requests[i].Size);
+					continue;
+				}
+
+				MergedRange range;
+				range.pDst = m_Requests[first].pDst;
+				range.Offset = m_Requests[first].Offset;
+				range.Size = rangeEnd - range.Offset;
+				range.StagingOffset = stagingSize;
+				m_MergedRanges.push_back(range);
+				m_RangeStarts.push_back(first);
+
+				stagingSize += range.Size;
+
+				if (i < m_Requests.size())
+				{
+					first = i;
+					rangeEnd = m_Requests[i].Offset + m_Requests[i].Size;
+				}
+			}
+			m_RangeStarts.push_back(m_Requests.size());
+
+			if (m_StagingBuffer.getSize() < stagingSize)
+			{
+				uint32_t capacity = Numeric::max(m_StagingBuffer.getSize(), 64u * 1024u);
+				while (capacity < stagingSize)
+					capacity *= 2;
+
+				m_StagingBuffer.init(capacity);
+			}
+
+			uint8_t* pStaging = m_StagingBuffer.map(0, stagingSize, MappingBits::WRITE);
+			assert(pStaging);
+			for (size_t r = 0; r < m_MergedRanges.size(); r++)
+			{
+				const MergedRange& range = m_MergedRanges[r];
+				auto begin = m_Requests.begin() + m_RangeStarts[r];
+				auto end = m_Requests.begin() + m_RangeStarts[r + 1];
+				std::sort(begin, end, [](const Request& a, const Request& b){ return a.Sequence < b.Sequence; });
+
+				for (auto it = begin; it != end; ++it)
+				{
+					memcpy(pStaging + range.StagingOffset + (it->Offset - range.Offset), m_PendingData.data() + it->DataOffset, it->Size);
+					m_Stats.RequestedBytes += it->Size;
+				}
+			}
+			m_StagingBuffer.unmap();
+
+			for (size_t r = 0; r < m_MergedRanges.size(); r++)
+			{
+				copyToDestination(m_MergedRanges[r]);
+				m_Stats.UploadedBytes += m_MergedRanges[r].Size;
+			}
+
+			m_Stats.CopyCount = static_cast<uint32_t>(m_MergedRanges.size());
+			m_Requests.clear();
+			m_PendingData.clear();
+		}
+
+		void BufferUploadScheduler::copyToDestination(const MergedRange& range)
+		{
+			BufferStatistics::get().onCopy(range.Size);
+
+			const GLuint staging = m_StagingBuffer.getBufferID();
+			const GLuint dst = range.pDst->getBufferID();
+			const GLintptr dstOffset = static_cast<GLintptr>(range.Offset + range.pDst->getDynamicOffset());
+			assert(dst);
+
+			if (glCopyNamedBufferSubData)
+			{
+				CHECK_GL(glCopyNamedBufferSubData(staging, dst, range.StagingOffset, dstOffset, range.Size));
+			}
+			else
+			{
+				GLStates& state = GLStates::get();
+				state.bindBuffer(staging, BufferTarget::COPY_READ);
+				state.bindBuffer(dst, BufferTarget::COPY_WRITE);
+
+				CHECK_GL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, range.StagingOffset, dstOffset, range.Size));
+			}
+		}
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "BufferGL.h"
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		typedef struct BufferUploadStats
+		{
+			// Number of update() calls recorded.
+			uint32_t RequestCount;
+			// Bytes passed to update().
+			uint32_t RequestedBytes;
+			// Ranges left after merging the adjacent and overlapping requests, one copy call each.
+			uint32_t CopyCount;
+			// Bytes written through the staging buffer.
+			uint32_t UploadedBytes;
+
+			BufferUploadStats() : RequestCount(0), RequestedBytes(0), CopyCount(0), UploadedBytes(0){}
+		}BufferUploadStats;
+
+		/**
+		 * Collects the buffer updates of a frame and uploads them in one go. Requests to the same
+		 * destination buffer that touch or overlap are merged, written into a single staging buffer
+		 * and copied to their destinations with one glCopyBufferSubData per merged range. Where
+		 * requests overlap, the later one wins.<p>
+		 * The data is copied on update(), so the caller may reuse its memory right away. Nothing
+		 * reaches the destination buffers before flush(), so flush before anything reads or moves
+		 * them (draw calls, BufferSharedNonUniformPool::defragment()).
+		 */
+		class BufferUploadScheduler
+		{
+		public:
+			BufferUploadScheduler();
+			~BufferUploadScheduler();
+
+			/// Schedules size bytes of pData to be written to pDst at offset.
+			void update(BufferGPU* pDst, uint32_t offset, uint32_t size, const uint8_t* pData);
+
+			/// Drops the pending requests to pDst, e.g. before the buffer is deleted.
+			void discard(BufferGPU* pDst);
+
+			/// Uploads all the pending requests. The statistics of this flush replace the last ones.
+			void flush();
+
+			bool hasPendingUploads() const { return !m_Requests.empty(); }
+
+			/// Returns the statistics of the last flush().
+			const BufferUploadStats& getStats() const { return m_Stats; }
+
+		private:
+			struct Request
+			{
+				BufferGPU* pDst;
+				uint32_t Offset;
+				uint32_t Size;
+				// Where the data is stored in m_PendingData.
+				uint32_t DataOffset;
+				// Submission order, decides which request wins on overlap.
+				uint32_t Sequence;
+			};
+
+			struct MergedRange
+			{
+				BufferGPU* pDst;
+				uint32_t Offset;
+				uint32_t Size;
+				uint32_t StagingOffset;
+			};
+
+			void copyToDestination(const MergedRange& range);
+
+		private:
+			std::vector<Request> m_Requests;
+			std::vector<uint8_t> m_PendingData;
+			std::vector<MergedRange> m_MergedRanges;
+			// Index of the first request of each merged range, plus one past the last request.
+			std::vector<size_t> m_RangeStarts;
+
+			BufferGL<BufferTarget::COPY_READ, BufferUsage::STREAM_DRAW, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT> m_StagingBuffer;
+
+			BufferUploadStats m_Stats;
+		};
+	}
+}
@@ -19,15 +19,16 @@ namespace jet
 			m_fViewPortTop(1.0f),
 			m_fViewPortBottom(0.0f),
 			m_iWidth(width),
-			m_iHeight(height)
+			m_iHeight(height),
+			m_PlaneState(0),
+			m_bOverrideProjection(false)
 		{
-			onFrustumChange();
-			onFrameChange();
-
 			memset(m_fCoeffLeft, 0, sizeof(m_fCoeffLeft));
 			memset(m_fCoeffRight, 0, sizeof(m_fCoeffRight));
 			memset(m_fCoeffBottom, 0, sizeof(m_fCoeffBottom));
 			memset(m_fCoeffTop, 0, sizeof(m_fCoeffTop));
+
+			onFrustumChange();
 		}
 
 #if 0
@@ -233,7 +234,7 @@ namespace jet
 			{
 				m_ProjectionMatrixOverride = mat;
 				m_bOverrideProjection = true;
-				updateViewProjection();
+				onFrameChange();
 			}
 		}
 
@@ -243,7 +244,7 @@ namespace jet
 			if (m_bOverrideProjection)
 			{
 				m_bOverrideProjection = false;
-				updateViewProjection();
+				onFrameChange();
 			}
 		}
 
@@ -310,11 +311,39 @@ namespace jet
 
 				m_ProjectionMatrix = glm::orthoLH(m_fFrustumeLeft, m_fFrustumeRight, m_fFrustumeBottom, m_fFrustumeTop, m_fFrustumeNear, m_fFrustumeFar);
 			}
+
+			onFrameChange();
 		}
 		// onFrameChange updates the view frame of the camera.
 		void Camera::onFrameChange()
 		{
-			// TODO
+			updateViewProjection();
+
+			// Extract the world planes from the rows of the view projection matrix, a point p is
+			// inside when dot(row3 +/- rowN, (p, 1)) >= 0. Planef keeps dot(normal, p) - constant.
+			const glm::mat4& m = m_ViewProjectionMatrix;
+			glm::vec4 rows[4];
+			for (int i = 0; i < 4; i++)
+			{
+				rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+			}
+
+			const glm::vec4 planes[FRUSTUM_PLANES] =
+			{
+				rows[3] + rows[0],  // LEFT_PLANE
+				rows[3] - rows[0],  // RIGHT_PLANE
+				rows[3] + rows[1],  // BOTTOM_PLANE
+				rows[3] - rows[1],  // TOP_PLANE
+				rows[3] - rows[2],  // FAR_PLANE
+				rows[3] + rows[2],  // NEAR_PLANE
+			};
+
+			for (int i = 0; i < FRUSTUM_PLANES; i++)
+			{
+				const glm::vec3 normal(planes[i]);
+				const float inverseLength = glm::inversesqrt(glm::dot(normal, normal));
+				m_WorldPlanes[i] = Planef(normal * inverseLength, -planes[i].w * inverseLength);
+			}
 		}
 
 		void Camera::setParallelProjection(bool value)
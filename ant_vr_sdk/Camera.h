@@ -15,7 +15,7 @@ namespace jet
 		* of a culling check operation,
 		* see {@link #contains(com.jme3.bounding.BoundingVolume) }
 		*/
-		enum class FrustumIntersect 
+		enum class FrustumIntersect : uint8_t
 		{
 
 			/**
@@ -105,6 +105,9 @@ namespace jet
 			FrustumIntersect contains(BoundingVolume* pBound);
 
 			const Planef& getWorldPlane(int32_t planeId) const { return m_WorldPlanes[planeId];}
+			// All the world planes at once, for the culling passes that test many bounds against them.
+			const Planef* getWorldPlanes() const { return m_WorldPlanes; }
+			int32_t getWorldPlaneCount() const { return FRUSTUM_PLANES; }
 
 			// The view matrix transforms world space into eye space.
 			// This matrix is usually defined by the position and orientation of the camera with the given parentCameraView matrix.
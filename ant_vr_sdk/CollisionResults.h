@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glm.hpp>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		class Geometry;
+
+		/**
+		* A <code>CollisionResult</code> represents a single collision instance
+		* between two {@link Collidable}. A collision check can result in many
+		* collision instances (places where collision has occured).
+		*
+		* @author Kirill Vainer
+		*/
+		typedef struct CollisionResult
+		{
+			Geometry* pGeometry;
+			// The hit point and the normal of the hit triangle, in world space.
+			glm::vec3 ContactPoint;
+			glm::vec3 ContactNormal;
+			// The distance along the ray, in units of its direction.
+			float Distance;
+			uint32_t TriangleIndex;
+
+			CollisionResult() : pGeometry(nullptr), ContactPoint(0.0f), ContactNormal(0.0f), Distance(0.0f), TriangleIndex(0){}
+			CollisionResult(Geometry* geometry, const glm::vec3& point, const glm::vec3& normal, float distance, uint32_t triangle) :
+				pGeometry(geometry), ContactPoint(point), ContactNormal(normal), Distance(distance), TriangleIndex(triangle){}
+		}CollisionResult;
+
+		/**
+		* <code>CollisionResults</code> is a collection returned as a result of a
+		* collision detection operation done by {@link Collidable}. The results are
+		* sorted by distance when first accessed after a collision was added.
+		*
+		* @author Kirill Vainer
+		*/
+		class CollisionResults
+		{
+		public:
+			CollisionResults() : m_bSorted(true){}
+
+			void clear() { m_Results.clear(); m_bSorted = true; }
+
+			void addCollision(const CollisionResult& result)
+			{
+				m_Results.push_back(result);
+				m_bSorted = false;
+			}
+
+			uint32_t size() const { return static_cast<uint32_t>(m_Results.size()); }
+
+			const CollisionResult* getClosestCollision()
+			{
+				if (m_Results.empty())
+					return nullptr;
+
+				sort();
+				return &m_Results.front();
+			}
+
+			const CollisionResult* getFarthestCollision()
+			{
+				if (m_Results.empty())
+					return nullptr;
+
+				sort();
+				return &m_Results.back();
+			}
+
+			const CollisionResult& getCollision(uint32_t index)
+			{
+				sort();
+				return m_Results[index];
+			}
+
+			/// Returns the collision at the index without sorting, used while the results are being filled.
+			CollisionResult& getCollisionDirect(uint32_t index) { return m_Results[index]; }
+
+		private:
+			void sort()
+			{
+				if (!m_bSorted)
+				{
+					std::sort(m_Results.begin(), m_Results.end(), [](const CollisionResult& a, const CollisionResult& b)
+					{
+						return a.Distance < b.Distance;
+					});
+					m_bSorted = true;
+				}
+			}
+
+		private:
+			std::vector<CollisionResult> m_Results;
+			bool m_bSorted;
+		};
+	}
+}
@@ -0,0 +1,257 @@
+#include "ControlRegistry.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <mutex>
+
+namespace jet
+{
+	namespace util
+	{
+		// The controls run by one job.
+		static const uint32_t CONTROLS_PER_JOB = 64;
+
+		typedef struct PendingChange
+		{
+			Spatial* pSpatial;
+			ControlPtr Control;
+			bool bAdd;
+		}PendingChange;
+
+		// The updates running and the control changes they queued. The controls updating
+		// in parallel queue from the workers, so it is all guarded by g_PendingMutex.
+		static std::mutex g_PendingMutex;
+		static int32_t g_iUpdateDepth = 0;
+		static std::vector<PendingChange> g_PendingChanges;
+		// The changes being applied, kept to reuse the memory.
+		static std::vector<PendingChange> g_AppliedChanges;
+		// The registries updating, innermost last.
+		static std::vector<ControlRegistry*> g_UpdatingRegistries;
+
+		static bool deferChange(Spatial* pSpatial, const ControlPtr& control, bool bAdd)
+		{
+			std::lock_guard<std::mutex> lock(g_PendingMutex);
+			if (g_iUpdateDepth == 0)
+			{
+				return false;
+			}
+
+			PendingChange change;
+			change.pSpatial = pSpatial;
+			change.Control = control;
+			change.bAdd = bAdd;
+			g_PendingChanges.push_back(change);
+			return true;
+		}
+
+		ControlRegistry::ControlRegistry() : m_bValid(false)
+		{
+		}
+
+		void ControlRegistry::build(Node* pRoot)
+		{
+			m_Controls.clear();
+			m_IndependentControls.clear();
+			m_Spatials.clear();
+
+			m_Traverser.depthFirst(pRoot, [this, pRoot](Spatial* pSpatial)
+			{
+				// The root's own updateLogicalState() is the one running the registry.
+				if (pSpatial->m_bRequiresUpdates && pSpatial != pRoot)
+				{
+					m_Spatials.push_back(pSpatial);
+				}
+
+				if (pSpatial->m_uiSparseFlags & Spatial::SPARSE_CONTROLS)
+				{
+					for (const ControlPtr& control : pSpatial->getSparseData()->Controls)
+					{
+						ControlEntry entry;
+						entry.Control = control;
+						entry.pSpatial = pSpatial;
+						(control->isIndependent() ? m_IndependentControls : m_Controls).push_back(entry);
+					}
+				}
+				return true;
+			});
+
+			m_bValid = true;
+		}
+
+		void ControlRegistry::update(Node* pRoot, float tpf, bool bParallelSpatials)
+		{
+			if (!m_bValid)
+			{
+				build(pRoot);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(g_PendingMutex);
+				g_iUpdateDepth++;
+				g_UpdatingRegistries.push_back(this);
+			}
+
+			// The arrays are not rebuilt before the next update, the controls may change the scene meanwhile.
+			// The entries of the spatials deleted meanwhile are cleared by forgetSpatial().
+			for (const ControlEntry& entry : m_Controls)
+			{
+				if (entry.pSpatial)
+				{
+					entry.Control->update(tpf);
+				}
+			}
+
+			std::vector<ControlEntry>& independent = m_IndependentControls;
+			JobSystem::get().parallelFor(static_cast<uint32_t>(independent.size()), CONTROLS_PER_JOB, [&independent, tpf](uint32_t first, uint32_t count)
+			{
+				for (uint32_t i = first; i < first + count; i++)
+				{
+					if (independent[i].pSpatial)
+					{
+						independent[i].Control->update(tpf);
+					}
+				}
+			});
+
+			std::vector<Spatial*>& spatials = m_Spatials;
+			if (bParallelSpatials)
+			{
+				JobSystem::get().parallelFor(static_cast<uint32_t>(spatials.size()), CONTROLS_PER_JOB, [&spatials, tpf](uint32_t first, uint32_t count)
+				{
+					for (uint32_t i = first; i < first + count; i++)
+					{
+						if (spatials[i])
+						{
+							spatials[i]->updateLogicalState(tpf);
+						}
+					}
+				});
+			}
+			else
+			{
+				for (size_t i = 0; i < spatials.size(); i++)
+				{
+					if (spatials[i])
+					{
+						spatials[i]->updateLogicalState(tpf);
+					}
+				}
+			}
+
+			endUpdate();
+		}
+
+		void ControlRegistry::endUpdate()
+		{
+			{
+				std::lock_guard<std::mutex> lock(g_PendingMutex);
+				assert(g_iUpdateDepth > 0 && g_UpdatingRegistries.back() == this);
+				g_UpdatingRegistries.pop_back();
+				if (--g_iUpdateDepth > 0 || g_PendingChanges.empty())
+				{
+					return;
+				}
+				g_AppliedChanges.swap(g_PendingChanges);
+			}
+
+			// No update runs anymore, the spatials apply the changes right away and invalidate the registries.
+			for (size_t i = 0; i < g_AppliedChanges.size(); i++)
+			{
+				// Cleared when a control told about the change deleted the spatial.
+				const PendingChange change = g_AppliedChanges[i];
+				if (change.pSpatial == nullptr)
+				{
+					continue;
+				}
+
+				if (change.bAdd)
+				{
+					change.pSpatial->addControl(change.Control);
+				}
+				else
+				{
+					change.pSpatial->removeControl(change.Control);
+				}
+			}
+			g_AppliedChanges.clear();
+		}
+
+		void ControlRegistry::forgetSpatial(Spatial* pSpatial)
+		{
+			for (ControlEntry& entry : m_Controls)
+			{
+				if (entry.pSpatial == pSpatial)
+				{
+					entry.pSpatial = nullptr;
+				}
+			}
+			for (ControlEntry& entry : m_IndependentControls)
+			{
+				if (entry.pSpatial == pSpatial)
+				{
+					entry.pSpatial = nullptr;
+				}
+			}
+			std::replace(m_Spatials.begin(), m_Spatials.end(), pSpatial, static_cast<Spatial*>(nullptr));
+			m_bValid = false;
+		}
+
+		void ControlRegistry::onSpatialDestroyed(Spatial* pSpatial)
+		{
+			std::lock_guard<std::mutex> lock(g_PendingMutex);
+			g_PendingChanges.erase(std::remove_if(g_PendingChanges.begin(), g_PendingChanges.end(), [pSpatial](const PendingChange& change)
+			{
+				return change.pSpatial == pSpatial;
+			}), g_PendingChanges.end());
+
+			for (PendingChange& change : g_AppliedChanges)
+			{
+				if (change.pSpatial == pSpatial)
+				{
+					change.pSpatial = nullptr;
+				}
+			}
+
+			for (ControlRegistry* pRegistry : g_UpdatingRegistries)
+			{
+				pRegistry->forgetSpatial(pSpatial);
+			}
+		}
+
+		bool ControlRegistry::isUpdating()
+		{
+			std::lock_guard<std::mutex> lock(g_PendingMutex);
+			return g_iUpdateDepth > 0;
+		}
+
+		bool ControlRegistry::deferAddControl(Spatial* pSpatial, const ControlPtr& control)
+		{
+			return deferChange(pSpatial, control, true);
+		}
+
+		bool ControlRegistry::deferRemoveControl(Spatial* pSpatial, const ControlPtr& control)
+		{
+			return deferChange(pSpatial, control, false);
+		}
+
+		bool ControlRegistry::cancelAddControl(Spatial* pSpatial, const ControlPtr& control)
+		{
+			std::lock_guard<std::mutex> lock(g_PendingMutex);
+			for (size_t i = g_PendingChanges.size(); i-- > 0;)
+			{
+				const PendingChange& change = g_PendingChanges[i];
+				if (change.pSpatial == pSpatial && change.Control == control)
+				{
+					// The last change queued for the control decides, a queued remove means it is not pending anymore.
+					if (!change.bAdd)
+					{
+						return false;
+					}
+
+					g_PendingChanges.erase(g_PendingChanges.begin() + i);
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+}
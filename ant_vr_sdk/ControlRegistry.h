@@ -0,0 +1,81 @@
+#pragma once
+
+#include "SceneGraphVisitor.h"
+#include <stdint.h>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * The logical update of a root node. The controls under the root and the spatials that override
+		 * updateLogicalState() are kept in flat arrays, so a frame runs over them without walking the
+		 * scene or copying the control lists. The arrays are rebuilt by the next update once the scene
+		 * under the root or its controls changed.<p>
+		 * Controls added or removed while an update runs are queued and applied when it is done, a
+		 * control may thus change the controls of any spatial from its update(). The controls whose
+		 * {@link Control#isIndependent()} returns true update in parallel on the {@link JobSystem},
+		 * after the other ones.
+		 */
+		class ControlRegistry
+		{
+		public:
+			ControlRegistry();
+
+			/// The scene under the root changed, the arrays are rebuilt by the next update.
+			void invalidate() { m_bValid = false; }
+
+			/**
+			 * Updates the controls under pRoot, then calls updateLogicalState() of the spatials under it
+			 * that require it. bParallelSpatials runs the latter as jobs too.
+			 */
+			void update(Node* pRoot, float tpf, bool bParallelSpatials);
+
+			/// The controls updated by the last update(), the independent ones included.
+			uint32_t getControlCount() const { return static_cast<uint32_t>(m_Controls.size() + m_IndependentControls.size()); }
+			uint32_t getIndependentControlCount() const { return static_cast<uint32_t>(m_IndependentControls.size()); }
+			uint32_t getSpatialCount() const { return static_cast<uint32_t>(m_Spatials.size()); }
+
+			/// True while a registry updates, the control changes are queued then.
+			static bool isUpdating();
+
+			/**
+			 * Queues the change of the controls of pSpatial when an update runs and returns true.
+			 * Returns false when no update runs, the caller applies the change itself.
+			 */
+			static bool deferAddControl(Spatial* pSpatial, const ControlPtr& control);
+			static bool deferRemoveControl(Spatial* pSpatial, const ControlPtr& control);
+			/// Drops the add of the control queued by the running update and returns true, false if none is queued.
+			static bool cancelAddControl(Spatial* pSpatial, const ControlPtr& control);
+
+			/**
+			 * Called by the destructor of pSpatial. Drops the changes queued for it, and the registries updating
+			 * skip its controls and itself for the rest of the update. A control may thus delete spatials from its
+			 * update(), the controls updating in parallel may not.
+			 */
+			static void onSpatialDestroyed(Spatial* pSpatial);
+
+		private:
+			void build(Node* pRoot);
+
+			// Ends the update started last, the outermost one applies the queued changes.
+			void endUpdate();
+			// pSpatial is deleted during the update, its entries are cleared.
+			void forgetSpatial(Spatial* pSpatial);
+
+			// The arrays hold the controls, a control deleting its spatial is released after the update.
+			typedef struct ControlEntry
+			{
+				ControlPtr Control;
+				Spatial* pSpatial;
+			}ControlEntry;
+
+			std::vector<ControlEntry> m_Controls;
+			std::vector<ControlEntry> m_IndependentControls;
+			std::vector<Spatial*> m_Spatials;
+			SceneGraphTraverser m_Traverser;
+			bool m_bValid;
+		};
+	}
+}
@@ -0,0 +1,567 @@
+#include "DynamicAABBTree.h"
+#include "MultiFrustum.h"
+#include <algorithm>
+#include <float.h>
+
+namespace jet
+{
+	namespace util
+	{
+		static inline float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+		{
+			const glm::vec3 d = max - min;
+			return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+		}
+
+		static inline float unionArea(const glm::vec3& minA, const glm::vec3& maxA, const glm::vec3& minB, const glm::vec3& maxB)
+		{
+			return surfaceArea(glm::min(minA, minB), glm::max(maxA, maxB));
+		}
+
+		static inline bool containsBox(const glm::vec3& outerMin, const glm::vec3& outerMax, const glm::vec3& min, const glm::vec3& max)
+		{
+			return outerMin.x <= min.x && outerMin.y <= min.y && outerMin.z <= min.z &&
+				max.x <= outerMax.x && max.y <= outerMax.y && max.z <= outerMax.z;
+		}
+
+		static inline bool overlaps(const glm::vec3& minA, const glm::vec3& maxA, const glm::vec3& minB, const glm::vec3& maxB)
+		{
+			return minA.x <= maxB.x && minB.x <= maxA.x && minA.y <= maxB.y && minB.y <= maxA.y && minA.z <= maxB.z && minB.z <= maxA.z;
+		}
+
+		static void boundToMinMax(const BoundingVolume* pBound, glm::vec3& min, glm::vec3& max)
+		{
+			if (pBound->getType() == BoundingVolume::Type::AABB)
+			{
+				const BoundingBox* pBox = static_cast<const BoundingBox*>(pBound);
+				min = pBox->getMin();
+				max = pBox->getMax();
+			}
+			else
+			{
+				const glm::vec3 radius(static_cast<const BoundingSphere*>(pBound)->getRadius());
+				min = pBound->getCenter() - radius;
+				max = pBound->getCenter() + radius;
+			}
+		}
+
+		DynamicAABBTree::DynamicAABBTree(float fMargin) :
+			m_iRoot(NULL_NODE), m_iFreeList(NULL_NODE), m_uiProxyCount(0), m_fMargin(fMargin)
+		{
+		}
+
+		void DynamicAABBTree::clear()
+		{
+			m_Nodes.clear();
+			m_iRoot = NULL_NODE;
+			m_iFreeList = NULL_NODE;
+			m_uiProxyCount = 0;
+		}
+
+		int32_t DynamicAABBTree::allocateNode()
+		{
+			int32_t index;
+			if (m_iFreeList != NULL_NODE)
+			{
+				index = m_iFreeList;
+				m_iFreeList = m_Nodes[index].Parent;
+			}
+			else
+			{
+				index = static_cast<int32_t>(m_Nodes.size());
+				m_Nodes.push_back(TreeNode());
+			}
+
+			TreeNode& node = m_Nodes[index];
+			node.pUserData = nullptr;
+			node.Parent = NULL_NODE;
+			node.Child1 = NULL_NODE;
+			node.Child2 = NULL_NODE;
+			node.Height = 0;
+			return index;
+		}
+
+		void DynamicAABBTree::freeNode(int32_t index)
+		{
+			m_Nodes[index].Parent = m_iFreeList;
+			m_Nodes[index].Height = -1;
+			m_iFreeList = index;
+		}
+
+		void DynamicAABBTree::setFatBox(int32_t leaf, const BoundingVolume* pBound)
+		{
+			glm::vec3 min, max;
+			boundToMinMax(pBound, min, max);
+			m_Nodes[leaf].Min = min - glm::vec3(m_fMargin);
+			m_Nodes[leaf].Max = max + glm::vec3(m_fMargin);
+		}
+
+		int32_t DynamicAABBTree::createProxy(const BoundingVolume* pBound, void* pUserData)
+		{
+			assert(pBound);
+			const int32_t proxyId = allocateNode();
+			setFatBox(proxyId, pBound);
+			m_Nodes[proxyId].pUserData = pUserData;
+
+			insertLeaf(proxyId);
+			m_uiProxyCount++;
+			return proxyId;
+		}
+
+		void DynamicAABBTree::destroyProxy(int32_t proxyId)
+		{
+			assert(0 <= proxyId && proxyId < static_cast<int32_t>(m_Nodes.size()));
+			assert(m_Nodes[proxyId].isLeaf());
+
+			removeLeaf(proxyId);
+			freeNode(proxyId);
+			m_uiProxyCount--;
+		}
+
+		bool DynamicAABBTree::moveProxy(int32_t proxyId, const BoundingVolume* pBound)
+		{
+			assert(0 <= proxyId && proxyId < static_cast<int32_t>(m_Nodes.size()));
+			assert(m_Nodes[proxyId].isLeaf());
+
+			glm::vec3 min, max;
+			boundToMinMax(pBound, min, max);
+
+			TreeNode& leaf = m_Nodes[proxyId];
+			if (containsBox(leaf.Min, leaf.Max, min, max))
+			{
+				return false;
+			}
+
+			const glm::vec3 fatMin = min - glm::vec3(m_fMargin);
+			const glm::vec3 fatMax = max + glm::vec3(m_fMargin);
+			if (overlaps(leaf.Min, leaf.Max, fatMin, fatMax))
+			{
+				// Refit: the leaf keeps its place, only the boxes of the ancestors change.
+				leaf.Min = fatMin;
+				leaf.Max = fatMax;
+
+				int32_t index = leaf.Parent;
+				while (index != NULL_NODE)
+				{
+					TreeNode& node = m_Nodes[index];
+					const glm::vec3 nodeMin = glm::min(m_Nodes[node.Child1].Min, m_Nodes[node.Child2].Min);
+					const glm::vec3 nodeMax = glm::max(m_Nodes[node.Child1].Max, m_Nodes[node.Child2].Max);
+					if (nodeMin == node.Min && nodeMax == node.Max)
+					{
+						break;
+					}
+
+					node.Min = nodeMin;
+					node.Max = nodeMax;
+					index = node.Parent;
+				}
+			}
+			else
+			{
+				removeLeaf(proxyId);
+				m_Nodes[proxyId].Min = fatMin;
+				m_Nodes[proxyId].Max = fatMax;
+				insertLeaf(proxyId);
+			}
+
+			return true;
+		}
+
+		BoundingBox DynamicAABBTree::getFatBox(int32_t proxyId) const
+		{
+			return BoundingBox::fromMinMax(m_Nodes[proxyId].Min, m_Nodes[proxyId].Max);
+		}
+
+		void DynamicAABBTree::insertLeaf(int32_t leaf)
+		{
+			if (m_iRoot == NULL_NODE)
+			{
+				m_iRoot = leaf;
+				m_Nodes[leaf].Parent = NULL_NODE;
+				return;
+			}
+
+			// Descend to the sibling that makes the tree grow the least. Every node on the way grows
+			// by the union with the leaf, that cost is inherited by the children.
+			const glm::vec3 leafMin = m_Nodes[leaf].Min;
+			const glm::vec3 leafMax = m_Nodes[leaf].Max;
+			int32_t index = m_iRoot;
+			while (!m_Nodes[index].isLeaf())
+			{
+				const TreeNode& node = m_Nodes[index];
+				const float area = surfaceArea(node.Min, node.Max);
+				const float combinedArea = unionArea(node.Min, node.Max, leafMin, leafMax);
+
+				// Cost of making a new parent for this node and the leaf.
+				const float cost = 2.0f * combinedArea;
+				// Minimum cost of pushing the leaf further down the tree.
+				const float inheritanceCost = 2.0f * (combinedArea - area);
+
+				float childCosts[2];
+				const int32_t children[2] = { node.Child1, node.Child2 };
+				for (int i = 0; i < 2; i++)
+				{
+					const TreeNode& child = m_Nodes[children[i]];
+					const float childArea = unionArea(child.Min, child.Max, leafMin, leafMax);
+					childCosts[i] = (child.isLeaf() ? childArea : childArea - surfaceArea(child.Min, child.Max)) + inheritanceCost;
+				}
+
+				if (cost < childCosts[0] && cost < childCosts[1])
+				{
+					break;
+				}
+
+				index = childCosts[0] < childCosts[1] ? children[0] : children[1];
+			}
+
+			const int32_t sibling = index;
+			const int32_t oldParent = m_Nodes[sibling].Parent;
+			const int32_t newParent = allocateNode();
+
+			// allocateNode() may grow the node array, take the references after it.
+			TreeNode& parentNode = m_Nodes[newParent];
+			TreeNode& siblingNode = m_Nodes[sibling];
+			parentNode.Parent = oldParent;
+			parentNode.Min = glm::min(siblingNode.Min, leafMin);
+			parentNode.Max = glm::max(siblingNode.Max, leafMax);
+			parentNode.Height = siblingNode.Height + 1;
+			parentNode.Child1 = sibling;
+			parentNode.Child2 = leaf;
+			siblingNode.Parent = newParent;
+			m_Nodes[leaf].Parent = newParent;
+
+			if (oldParent != NULL_NODE)
+			{
+				if (m_Nodes[oldParent].Child1 == sibling)
+					m_Nodes[oldParent].Child1 = newParent;
+				else
+					m_Nodes[oldParent].Child2 = newParent;
+			}
+			else
+			{
+				m_iRoot = newParent;
+			}
+
+			fixUpwards(newParent);
+		}
+
+		void DynamicAABBTree::removeLeaf(int32_t leaf)
+		{
+			if (leaf == m_iRoot)
+			{
+				m_iRoot = NULL_NODE;
+				return;
+			}
+
+			const int32_t parent = m_Nodes[leaf].Parent;
+			const int32_t grandParent = m_Nodes[parent].Parent;
+			const int32_t sibling = (m_Nodes[parent].Child1 == leaf) ? m_Nodes[parent].Child2 : m_Nodes[parent].Child1;
+
+			// The sibling takes the place of the parent.
+			if (grandParent != NULL_NODE)
+			{
+				if (m_Nodes[grandParent].Child1 == parent)
+					m_Nodes[grandParent].Child1 = sibling;
+				else
+					m_Nodes[grandParent].Child2 = sibling;
+			}
+			else
+			{
+				m_iRoot = sibling;
+			}
+
+			m_Nodes[sibling].Parent = grandParent;
+			freeNode(parent);
+			fixUpwards(grandParent);
+		}
+
+		void DynamicAABBTree::fixUpwards(int32_t index)
+		{
+			while (index != NULL_NODE)
+			{
+				index = balance(index);
+
+				TreeNode& node = m_Nodes[index];
+				const TreeNode& child1 = m_Nodes[node.Child1];
+				const TreeNode& child2 = m_Nodes[node.Child2];
+				node.Height = 1 + glm::max(child1.Height, child2.Height);
+				node.Min = glm::min(child1.Min, child2.Min);
+				node.Max = glm::max(child1.Max, child2.Max);
+
+				index = node.Parent;
+			}
+		}
+
+		int32_t DynamicAABBTree::balance(int32_t iA)
+		{
+			TreeNode& A = m_Nodes[iA];
+			if (A.isLeaf() || A.Height < 2)
+			{
+				return iA;
+			}
+
+			const int32_t iB = A.Child1;
+			const int32_t iC = A.Child2;
+			TreeNode& B = m_Nodes[iB];
+			TreeNode& C = m_Nodes[iC];
+			const int32_t diff = C.Height - B.Height;
+
+			// Rotate the taller child up, A takes the place of its shorter grandchild.
+			if (diff > 1 || diff < -1)
+			{
+				const int32_t iUp = diff > 1 ? iC : iB;
+				const int32_t iStay = diff > 1 ? iB : iC;
+				TreeNode& Up = m_Nodes[iUp];
+				TreeNode& Stay = m_Nodes[iStay];
+
+				const int32_t iF = Up.Child1;
+				const int32_t iG = Up.Child2;
+				TreeNode& F = m_Nodes[iF];
+				TreeNode& G = m_Nodes[iG];
+
+				// Up replaces A under the parent of A.
+				Up.Child1 = iA;
+				Up.Parent = A.Parent;
+				A.Parent = iUp;
+				if (Up.Parent != NULL_NODE)
+				{
+					if (m_Nodes[Up.Parent].Child1 == iA)
+						m_Nodes[Up.Parent].Child1 = iUp;
+					else
+						m_Nodes[Up.Parent].Child2 = iUp;
+				}
+				else
+				{
+					m_iRoot = iUp;
+				}
+
+				// The taller grandchild stays under Up, the shorter one moves under A.
+				const bool bKeepF = F.Height > G.Height;
+				const int32_t iKeep = bKeepF ? iF : iG;
+				const int32_t iMove = bKeepF ? iG : iF;
+				TreeNode& Keep = m_Nodes[iKeep];
+				TreeNode& Move = m_Nodes[iMove];
+
+				Up.Child2 = iKeep;
+				if (diff > 1)
+					A.Child2 = iMove;
+				else
+					A.Child1 = iMove;
+				Move.Parent = iA;
+
+				A.Min = glm::min(Stay.Min, Move.Min);
+				A.Max = glm::max(Stay.Max, Move.Max);
+				A.Height = 1 + glm::max(Stay.Height, Move.Height);
+				Up.Min = glm::min(A.Min, Keep.Min);
+				Up.Max = glm::max(A.Max, Keep.Max);
+				Up.Height = 1 + glm::max(A.Height, Keep.Height);
+
+				return iUp;
+			}
+
+			return iA;
+		}
+
+		void DynamicAABBTree::queryFrustum(const Planef* pPlanes, uint32_t planeCount, std::vector<void*>& results) const
+		{
+			if (m_iRoot == NULL_NODE)
+			{
+				return;
+			}
+
+			assert(planeCount <= 32);
+			const uint32_t allInside = planeCount == 32 ? 0xFFFFFFFFu : (1u << planeCount) - 1;
+
+			// A node fully on the positive side of a plane passes the plane for all its descendants,
+			// the mask of such planes is carried down the stack with the node.
+			struct Entry { int32_t Node; uint32_t InsideMask; };
+			std::vector<Entry> stack;
+			stack.reserve(64);
+			stack.push_back({ m_iRoot, 0 });
+
+			while (!stack.empty())
+			{
+				const Entry entry = stack.back();
+				stack.pop_back();
+
+				const TreeNode& node = m_Nodes[entry.Node];
+				uint32_t insideMask = entry.InsideMask;
+				if (insideMask != allInside)
+				{
+					const glm::vec3 center = (node.Min + node.Max) * 0.5f;
+					const glm::vec3 extent = (node.Max - node.Min) * 0.5f;
+
+					bool bOutside = false;
+					for (uint32_t i = 0; i < planeCount; i++)
+					{
+						if (insideMask & (1u << i))
+							continue;
+
+						const float distance = glm::dot(pPlanes[i].f3Normal, center) - pPlanes[i].fConstant;
+						const float radius = glm::dot(glm::abs(pPlanes[i].f3Normal), extent);
+						if (distance < -radius)
+						{
+							bOutside = true;
+							break;
+						}
+						else if (distance > radius)
+						{
+							insideMask |= 1u << i;
+						}
+					}
+
+					if (bOutside)
+						continue;
+				}
+
+				if (node.isLeaf())
+				{
+					results.push_back(node.pUserData);
+				}
+				else
+				{
+					stack.push_back({ node.Child1, insideMask });
+					stack.push_back({ node.Child2, insideMask });
+				}
+			}
+		}
+
+		void DynamicAABBTree::queryFrustums(const MultiFrustum& frustum, std::vector<void*>& results, std::vector<uint32_t>& masks) const
+		{
+			if (m_iRoot == NULL_NODE)
+			{
+				return;
+			}
+
+			struct Entry { int32_t Node; MultiFrustum::State State; };
+			std::vector<Entry> stack;
+			stack.reserve(64);
+			stack.push_back({ m_iRoot, frustum.getRootState() });
+
+			while (!stack.empty())
+			{
+				Entry entry = stack.back();
+				stack.pop_back();
+
+				const TreeNode& node = m_Nodes[entry.Node];
+				if (!frustum.test((node.Min + node.Max) * 0.5f, (node.Max - node.Min) * 0.5f, entry.State))
+					continue;
+
+				if (node.isLeaf())
+				{
+					results.push_back(node.pUserData);
+					masks.push_back(entry.State.VisibleMask);
+				}
+				else
+				{
+					stack.push_back({ node.Child1, entry.State });
+					stack.push_back({ node.Child2, entry.State });
+				}
+			}
+		}
+
+		void DynamicAABBTree::queryOverlap(const BoundingVolume* pBound, std::vector<void*>& results) const
+		{
+			if (m_iRoot == NULL_NODE)
+			{
+				return;
+			}
+
+			glm::vec3 min, max;
+			boundToMinMax(pBound, min, max);
+
+			std::vector<int32_t> stack;
+			stack.reserve(64);
+			stack.push_back(m_iRoot);
+			while (!stack.empty())
+			{
+				const TreeNode& node = m_Nodes[stack.back()];
+				stack.pop_back();
+
+				if (!overlaps(node.Min, node.Max, min, max))
+					continue;
+
+				if (node.isLeaf())
+				{
+					// The box of a sphere overlaps more than the sphere does.
+					const BoundingBox box = BoundingBox::fromMinMax(node.Min, node.Max);
+					if (pBound->getType() == BoundingVolume::Type::AABB || pBound->intersects(&box))
+					{
+						results.push_back(node.pUserData);
+					}
+				}
+				else
+				{
+					stack.push_back(node.Child1);
+					stack.push_back(node.Child2);
+				}
+			}
+		}
+
+		void DynamicAABBTree::queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<RayHit>& results) const
+		{
+			if (m_iRoot == NULL_NODE)
+			{
+				return;
+			}
+
+			const glm::vec3 invDirection = 1.0f / direction;
+			const size_t firstResult = results.size();
+
+			std::vector<int32_t> stack;
+			stack.reserve(64);
+			stack.push_back(m_iRoot);
+			while (!stack.empty())
+			{
+				const TreeNode& node = m_Nodes[stack.back()];
+				stack.pop_back();
+
+				const float enter = BoundingBox::intersectRay(node.Min, node.Max, origin, invDirection, maxDistance);
+				if (enter == FLT_MAX)
+					continue;
+
+				if (node.isLeaf())
+				{
+					results.push_back({ node.pUserData, enter });
+				}
+				else
+				{
+					stack.push_back(node.Child1);
+					stack.push_back(node.Child2);
+				}
+			}
+
+			std::sort(results.begin() + firstResult, results.end(), [](const RayHit& a, const RayHit& b) { return a.Distance < b.Distance; });
+		}
+
+		bool DynamicAABBTree::validate() const
+		{
+			if (m_iRoot == NULL_NODE)
+			{
+				return m_uiProxyCount == 0;
+			}
+
+			return m_Nodes[m_iRoot].Parent == NULL_NODE && validate(m_iRoot);
+		}
+
+		bool DynamicAABBTree::validate(int32_t index) const
+		{
+			const TreeNode& node = m_Nodes[index];
+			if (node.isLeaf())
+			{
+				return node.Height == 0;
+			}
+
+			const TreeNode& child1 = m_Nodes[node.Child1];
+			const TreeNode& child2 = m_Nodes[node.Child2];
+			if (child1.Parent != index || child2.Parent != index)
+				return false;
+			if (node.Height != 1 + glm::max(child1.Height, child2.Height))
+				return false;
+			if (!containsBox(node.Min, node.Max, child1.Min, child1.Max) || !containsBox(node.Min, node.Max, child2.Min, child2.Max))
+				return false;
+
+			return validate(node.Child1) && validate(node.Child2);
+		}
+	}
+}
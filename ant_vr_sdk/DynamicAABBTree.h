@@ -0,0 +1,107 @@
+#pragma once
+
+#include "BoundingVolume.h"
+#include <stdint.h>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		class MultiFrustum;
+
+		/**
+		 * A dynamic bounding volume hierarchy of axis-aligned boxes. Every proxy is a leaf whose box
+		 * is the bound of the proxy enlarged by a margin, so small motions don't touch the tree.
+		 * A leaf is inserted next to the sibling that adds the least surface area, and the ancestors
+		 * of every inserted or removed leaf are rebalanced by tree rotations.<p>
+		 * The queries only descend into the subtrees whose boxes pass, so they cost about the log of
+		 * the proxy count plus the number of results.
+		 */
+		class DynamicAABBTree
+		{
+		public:
+			static const int32_t NULL_NODE = -1;
+
+			typedef struct RayHit
+			{
+				void* pUserData;
+				// The distance along the ray where it enters the box of the proxy.
+				float Distance;
+			}RayHit;
+
+			explicit DynamicAABBTree(float fMargin = 0.1f);
+
+			/// Adds a proxy for the bound and returns its id.
+			int32_t createProxy(const BoundingVolume* pBound, void* pUserData);
+			void destroyProxy(int32_t proxyId);
+
+			/**
+			 * Updates the box of the proxy after its bound changed. Nothing happens while the bound
+			 * stays inside the enlarged box. A box that still overlaps its old one is refit in place,
+			 * up to the root. A box that jumped away is removed and inserted again.
+			 * Returns true when the tree changed.
+			 */
+			bool moveProxy(int32_t proxyId, const BoundingVolume* pBound);
+
+			void* getUserData(int32_t proxyId) const { return m_Nodes[proxyId].pUserData; }
+			/// Returns the enlarged box the tree keeps for the proxy.
+			BoundingBox getFatBox(int32_t proxyId) const;
+
+			/// Collects the proxies not fully on the negative side of any plane.
+			void queryFrustum(const Planef* pPlanes, uint32_t planeCount, std::vector<void*>& results) const;
+			/**
+			 * Collects the proxies seen by any camera of the frustum in one walk of the tree, masks
+			 * receives the cameras seeing each of them, bit i for camera i.
+			 */
+			void queryFrustums(const MultiFrustum& frustum, std::vector<void*>& results, std::vector<uint32_t>& masks) const;
+			/// Collects the proxies whose boxes overlap the bound.
+			void queryOverlap(const BoundingVolume* pBound, std::vector<void*>& results) const;
+			/// Collects the proxies whose boxes the ray hits within maxDistance, nearest first.
+			void queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<RayHit>& results) const;
+
+			uint32_t getProxyCount() const { return m_uiProxyCount; }
+			int32_t getHeight() const { return m_iRoot == NULL_NODE ? 0 : m_Nodes[m_iRoot].Height; }
+			void clear();
+
+			/// Checks the links, heights and boxes of the whole tree. For debugging.
+			bool validate() const;
+
+		private:
+			typedef struct TreeNode
+			{
+				glm::vec3 Min;
+				glm::vec3 Max;
+				void* pUserData;
+				// The parent, or the next free node while the node is in the free list.
+				int32_t Parent;
+				int32_t Child1;
+				int32_t Child2;
+				// 0 for the leaves, -1 for the free nodes.
+				int32_t Height;
+
+				bool isLeaf() const { return Child1 == NULL_NODE; }
+			}TreeNode;
+
+			int32_t allocateNode();
+			void freeNode(int32_t index);
+
+			void insertLeaf(int32_t leaf);
+			void removeLeaf(int32_t leaf);
+			// Rotates the subtree at index when its children heights differ by more than one. Returns the new subtree root.
+			int32_t balance(int32_t index);
+			// Recomputes the boxes and the heights of index and its ancestors, rebalancing them on the way.
+			void fixUpwards(int32_t index);
+			void setFatBox(int32_t leaf, const BoundingVolume* pBound);
+
+			bool validate(int32_t index) const;
+
+		private:
+			std::vector<TreeNode> m_Nodes;
+			int32_t m_iRoot;
+			int32_t m_iFreeList;
+			uint32_t m_uiProxyCount;
+			float m_fMargin;
+		};
+	}
+}
@@ -0,0 +1,288 @@
+#include "FrustumCuller.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <string.h>
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#define FRUSTUM_CULLER_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC emits the VEX encoded instructions for the AVX intrinsics without /arch:AVX.
+#define FRUSTUM_CULLER_AVX_TARGET
+#else
+#define FRUSTUM_CULLER_AVX_TARGET __attribute__((target("avx")))
+#endif
+#else
+#define FRUSTUM_CULLER_SIMD 0
+#endif
+
+namespace jet
+{
+	namespace util
+	{
+		// The six planes of a camera, plus user clip planes.
+		static const uint32_t MAX_CULL_PLANES = 16;
+		// The boxes culled by one job, a multiple of BATCH_SIZE.
+		static const uint32_t BOXES_PER_JOB = 4096;
+
+		void FrustumCuller::reserve(uint32_t count)
+		{
+			for (int i = 0; i < COMPONENT_COUNT; i++)
+			{
+				m_Components[i].reserve(count + BATCH_SIZE);
+			}
+		}
+
+		uint32_t FrustumCuller::add(const glm::vec3& center, const glm::vec3& extent)
+		{
+			const uint32_t index = m_uiCount++;
+			if (m_Components[0].size() < m_uiCount + BATCH_SIZE)
+			{
+				for (int i = 0; i < COMPONENT_COUNT; i++)
+				{
+					m_Components[i].resize(m_uiCount + BATCH_SIZE, 0.0f);
+				}
+			}
+
+			set(index, center, extent);
+			return index;
+		}
+
+		uint32_t FrustumCuller::add(const BoundingVolume* pBound)
+		{
+			assert(pBound);
+			if (pBound->getType() == BoundingVolume::Type::AABB)
+			{
+				return add(pBound->getCenter(), static_cast<const BoundingBox*>(pBound)->getExtent());
+			}
+			else
+			{
+				return add(pBound->getCenter(), glm::vec3(static_cast<const BoundingSphere*>(pBound)->getRadius()));
+			}
+		}
+
+		void FrustumCuller::set(uint32_t index, const glm::vec3& center, const glm::vec3& extent)
+		{
+			assert(index < m_uiCount);
+			m_Components[CENTER_X][index] = center.x;
+			m_Components[CENTER_Y][index] = center.y;
+			m_Components[CENTER_Z][index] = center.z;
+			m_Components[EXTENT_X][index] = extent.x;
+			m_Components[EXTENT_Y][index] = extent.y;
+			m_Components[EXTENT_Z][index] = extent.z;
+		}
+
+		// A box is outside a plane when dot(n, c) - d + dot(|n|, e) < 0. The plane is stored as
+		// (nx, ny, nz, |nx|, |ny|, |nz|, d) so the kernels only broadcast it.
+		typedef struct CullPlane
+		{
+			float Normal[3];
+			float AbsNormal[3];
+			float Constant;
+		}CullPlane;
+
+		static void preparePlanes(const Planef* pPlanes, uint32_t planeCount, CullPlane* pOut)
+		{
+			for (uint32_t i = 0; i < planeCount; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					pOut[i].Normal[j] = pPlanes[i].f3Normal[j];
+					pOut[i].AbsNormal[j] = glm::abs(pPlanes[i].f3Normal[j]);
+				}
+				pOut[i].Constant = pPlanes[i].fConstant;
+			}
+		}
+
+		// Writes base + i for every set bit i < width of the mask without branching on the bits.
+		// Only the slots up to the last visible index are touched, so pOut needs no extra room.
+		static inline uint32_t compactIndices(uint32_t mask, uint32_t base, uint32_t width, uint32_t* pOut)
+		{
+			uint32_t written = 0;
+			for (uint32_t i = 0; i < width; i++)
+			{
+				pOut[written] = base + i;
+				written += (mask >> i) & 1;
+			}
+			return written;
+		}
+
+#if FRUSTUM_CULLER_SIMD
+		FRUSTUM_CULLER_AVX_TARGET
+		static uint32_t cullAVX(const float* const* pComponents, const CullPlane* pPlanes, uint32_t planeCount, uint32_t first, uint32_t count, uint32_t* pVisible)
+		{
+			uint32_t written = 0;
+			for (uint32_t i = 0; i < count; i += 8)
+			{
+				const uint32_t index = first + i;
+				const __m256 cx = _mm256_loadu_ps(pComponents[0] + index);
+				const __m256 cy = _mm256_loadu_ps(pComponents[1] + index);
+				const __m256 cz = _mm256_loadu_ps(pComponents[2] + index);
+				const __m256 ex = _mm256_loadu_ps(pComponents[3] + index);
+				const __m256 ey = _mm256_loadu_ps(pComponents[4] + index);
+				const __m256 ez = _mm256_loadu_ps(pComponents[5] + index);
+
+				__m256 outside = _mm256_setzero_ps();
+				for (uint32_t p = 0; p < planeCount; p++)
+				{
+					const CullPlane& plane = pPlanes[p];
+					__m256 distance = _mm256_mul_ps(cx, _mm256_set1_ps(plane.Normal[0]));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(cy, _mm256_set1_ps(plane.Normal[1])));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(cz, _mm256_set1_ps(plane.Normal[2])));
+					distance = _mm256_sub_ps(distance, _mm256_set1_ps(plane.Constant));
+
+					__m256 radius = _mm256_mul_ps(ex, _mm256_set1_ps(plane.AbsNormal[0]));
+					radius = _mm256_add_ps(radius, _mm256_mul_ps(ey, _mm256_set1_ps(plane.AbsNormal[1])));
+					radius = _mm256_add_ps(radius, _mm256_mul_ps(ez, _mm256_set1_ps(plane.AbsNormal[2])));
+
+					outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+				}
+
+				const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_ps(outside));
+				written += compactIndices(mask, index, glm::min(count - i, 8u), pVisible + written);
+			}
+
+			return written;
+		}
+
+		static uint32_t cullSSE(const float* const* pComponents, const CullPlane* pPlanes, uint32_t planeCount, uint32_t first, uint32_t count, uint32_t* pVisible)
+		{
+			uint32_t written = 0;
+			for (uint32_t i = 0; i < count; i += 4)
+			{
+				const uint32_t index = first + i;
+				const __m128 cx = _mm_loadu_ps(pComponents[0] + index);
+				const __m128 cy = _mm_loadu_ps(pComponents[1] + index);
+				const __m128 cz = _mm_loadu_ps(pComponents[2] + index);
+				const __m128 ex = _mm_loadu_ps(pComponents[3] + index);
+				const __m128 ey = _mm_loadu_ps(pComponents[4] + index);
+				const __m128 ez = _mm_loadu_ps(pComponents[5] + index);
+
+				__m128 outside = _mm_setzero_ps();
+				for (uint32_t p = 0; p < planeCount; p++)
+				{
+					const CullPlane& plane = pPlanes[p];
+					__m128 distance = _mm_mul_ps(cx, _mm_set1_ps(plane.Normal[0]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(cy, _mm_set1_ps(plane.Normal[1])));
+					distance = _mm_add_ps(distance, _mm_mul_ps(cz, _mm_set1_ps(plane.Normal[2])));
+					distance = _mm_sub_ps(distance, _mm_set1_ps(plane.Constant));
+
+					__m128 radius = _mm_mul_ps(ex, _mm_set1_ps(plane.AbsNormal[0]));
+					radius = _mm_add_ps(radius, _mm_mul_ps(ey, _mm_set1_ps(plane.AbsNormal[1])));
+					radius = _mm_add_ps(radius, _mm_mul_ps(ez, _mm_set1_ps(plane.AbsNormal[2])));
+
+					outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+				}
+
+				const uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_ps(outside));
+				written += compactIndices(mask, index, glm::min(count - i, 4u), pVisible + written);
+			}
+
+			return written;
+		}
+#else
+		static uint32_t cullScalar(const float* const* pComponents, const CullPlane* pPlanes, uint32_t planeCount, uint32_t first, uint32_t count, uint32_t* pVisible)
+		{
+			uint32_t written = 0;
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				bool bOutside = false;
+				for (uint32_t p = 0; p < planeCount && !bOutside; p++)
+				{
+					const CullPlane& plane = pPlanes[p];
+					const float distance = pComponents[0][i] * plane.Normal[0] + pComponents[1][i] * plane.Normal[1] + pComponents[2][i] * plane.Normal[2] - plane.Constant;
+					const float radius = pComponents[3][i] * plane.AbsNormal[0] + pComponents[4][i] * plane.AbsNormal[1] + pComponents[5][i] * plane.AbsNormal[2];
+					bOutside = distance + radius < 0.0f;
+				}
+
+				if (!bOutside)
+				{
+					pVisible[written++] = i;
+				}
+			}
+
+			return written;
+		}
+#endif
+
+		uint32_t FrustumCuller::cull(const Planef* pPlanes, uint32_t planeCount, uint32_t first, uint32_t count, uint32_t* pVisible) const
+		{
+			assert(planeCount <= MAX_CULL_PLANES);
+			assert(first + count <= m_uiCount);
+			if (count == 0)
+			{
+				return 0;
+			}
+
+			CullPlane planes[MAX_CULL_PLANES];
+			preparePlanes(pPlanes, planeCount, planes);
+
+			const float* pComponents[COMPONENT_COUNT];
+			for (int i = 0; i < COMPONENT_COUNT; i++)
+			{
+				pComponents[i] = m_Components[i].data();
+			}
+
+#if FRUSTUM_CULLER_SIMD
+			static const bool bAVX = isAVXSupported();
+			if (bAVX)
+			{
+				return cullAVX(pComponents, planes, planeCount, first, count, pVisible);
+			}
+			else
+			{
+				return cullSSE(pComponents, planes, planeCount, first, count, pVisible);
+			}
+#else
+			return cullScalar(pComponents, planes, planeCount, first, count, pVisible);
+#endif
+		}
+
+		void FrustumCuller::cull(const Planef* pPlanes, uint32_t planeCount, std::vector<uint32_t>& visible) const
+		{
+			visible.resize(m_uiCount);
+			const uint32_t chunkCount = (m_uiCount + BOXES_PER_JOB - 1) / BOXES_PER_JOB;
+			if (chunkCount <= 1)
+			{
+				visible.resize(cull(pPlanes, planeCount, 0, m_uiCount, visible.data()));
+				return;
+			}
+
+			// Every chunk writes its indices at its own offset, they are packed afterwards.
+			std::vector<uint32_t> chunkVisibles(chunkCount);
+			JobSystem::get().parallelFor(chunkCount, 1, [&](uint32_t first, uint32_t count)
+			{
+				for (uint32_t chunk = first; chunk < first + count; chunk++)
+				{
+					const uint32_t begin = chunk * BOXES_PER_JOB;
+					chunkVisibles[chunk] = cull(pPlanes, planeCount, begin, std::min(BOXES_PER_JOB, m_uiCount - begin), visible.data() + begin);
+				}
+			});
+
+			uint32_t written = chunkVisibles[0];
+			for (uint32_t chunk = 1; chunk < chunkCount; chunk++)
+			{
+				memmove(visible.data() + written, visible.data() + chunk * BOXES_PER_JOB, chunkVisibles[chunk] * sizeof(uint32_t));
+				written += chunkVisibles[chunk];
+			}
+			visible.resize(written);
+		}
+
+		bool FrustumCuller::isAVXSupported()
+		{
+#if FRUSTUM_CULLER_SIMD && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 1);
+			const bool bOSXSave = (info[2] & (1 << 27)) != 0;
+			const bool bAVX = (info[2] & (1 << 28)) != 0;
+			// The OS must also save the upper halves of the ymm registers.
+			return bOSXSave && bAVX && (_xgetbv(0) & 0x6) == 0x6;
+#elif FRUSTUM_CULLER_SIMD && defined(__GNUC__)
+			return __builtin_cpu_supports("avx") != 0;
+#else
+			return false;
+#endif
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "BoundingVolume.h"
+#include <stdint.h>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * Culls many axis-aligned boxes against a set of planes at once. The boxes are stored as
+		 * structure of arrays, one array per center and extent component, so one plane is tested
+		 * against 8 boxes per AVX instruction, or 4 per SSE2 instruction when the CPU has no AVX.<p>
+		 * cull() only reads the boxes, so disjoint ranges can be culled on several threads at once.
+		 */
+		class FrustumCuller
+		{
+		public:
+			/// The number of boxes tested together by the widest kernel. Chunks of a multiple of it split evenly.
+			static const uint32_t BATCH_SIZE = 8;
+
+			FrustumCuller() : m_uiCount(0){}
+
+			void clear() { m_uiCount = 0; }
+			void reserve(uint32_t count);
+			uint32_t getCount() const { return m_uiCount; }
+
+			/// Appends a box and returns its index.
+			uint32_t add(const glm::vec3& center, const glm::vec3& extent);
+			/// Appends the box enclosing the bound and returns its index.
+			uint32_t add(const BoundingVolume* pBound);
+			void set(uint32_t index, const glm::vec3& center, const glm::vec3& extent);
+
+			/**
+			 * Tests the boxes [first, first + count) and writes the indices of the boxes that are
+			 * not fully on the negative side of any plane into pVisible, in increasing order.
+			 * pVisible must have room for count indices. Returns the number of indices written.
+			 */
+			uint32_t cull(const Planef* pPlanes, uint32_t planeCount, uint32_t first, uint32_t count, uint32_t* pVisible) const;
+
+			/// Tests all the boxes, in chunks run as jobs of the {@link JobSystem}. visible receives the indices of the visible ones.
+			void cull(const Planef* pPlanes, uint32_t planeCount, std::vector<uint32_t>& visible) const;
+
+			/// Returns true when the CPU and the OS support the AVX kernel.
+			static bool isAVXSupported();
+
+		private:
+			enum Component
+			{
+				CENTER_X, CENTER_Y, CENTER_Z,
+				EXTENT_X, EXTENT_Y, EXTENT_Z,
+				COMPONENT_COUNT
+			};
+
+			// Every array keeps BATCH_SIZE floats of padding after the last box, so the kernels
+			// always load full batches and only mask the results.
+			std::vector<float> m_Components[COMPONENT_COUNT];
+			uint32_t m_uiCount;
+		};
+	}
+}
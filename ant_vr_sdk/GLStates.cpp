@@ -1747,7 +1747,11 @@ namespace jet
 		
 		void GLStates::restoreSampler(GLuint unit)
 		{
-			glGetIntegeri_v(GL_SAMPLER_BINDING, unit, (GLint*)&m_SamplerStates[unit]);
+			// The binding belongs to the active texture unit, it has no indexed query.
+			const GLuint activeUnit = m_ActiveTextureUnit;
+			setActiveTexture(unit);
+			glGetIntegerv(GL_SAMPLER_BINDING, (GLint*)&m_SamplerStates[unit]);
+			setActiveTexture(activeUnit);
 		}
 
 		void GLStates::resetSampler(GLuint unit, bool force)
@@ -2661,6 +2665,15 @@ namespace jet
 			return out;
 		}
 
+		GLint GLStates::getUniformBufferOffsetAlignment()
+		{
+			static GLint out = -1;
+			if (out == -1){
+				glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &out);
+			}
+			return out;
+		}
+
 		GLint GLStates::getMaxVertexAttribRelativeOffset()
 		{
 			static GLint out = -1;
@@ -349,6 +349,8 @@ namespace jet
 			static GLint getShaderStorageBufferOffsetAlignment();
 			//data returns a single value, the minimum required alignment for texture buffer sizes and offset. The initial value is 1. See glUniformBlockBinding.
 			static GLint getTextureBufferOffsetAlignment();
+			//data returns a single value, the minimum required alignment for uniform buffer sizes and offset. The initial value is 1. See glUniformBlockBinding.
+			static GLint getUniformBufferOffsetAlignment();
 			//data returns a single integer value containing the maximum offset that may be added to a vertex binding offset.
 			static GLint getMaxVertexAttribRelativeOffset();
 
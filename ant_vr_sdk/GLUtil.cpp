@@ -76,7 +76,7 @@ namespace jet
 			{
 				assert(false);
 			}
-			ToUppercase(pUpperVersionString, versionString);
+			ToUppercase(pUpperVersionString, versionString, static_cast<int>(length));
 			pUpperVersionString[length] = '\0';
 
 			char *p = (char *)pUpperVersionString;
@@ -114,6 +114,11 @@ namespace jet
 
 					break;
 				}
+				else
+				{
+					// Skip the vendor words before the version.
+					p += (n + 1);
+				}
 			}
 
 			free(pUpperVersionString);
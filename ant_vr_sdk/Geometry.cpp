@@ -1,5 +1,6 @@
 #include "Geometry.h"
 #include "SpatialManager.h"
+#include "TriangleBVH.h"
 
 namespace jet
 {
@@ -93,6 +94,10 @@ namespace jet
 			}
 #endif
 			assert(m_pMesh.get());
+			if (m_pWorldBound == nullptr)
+			{
+				m_pWorldBound = std::make_shared<BoundingBox>();
+			}
 			m_pMesh->getBound(m_pWorldBound.get());
 
 #if 0
@@ -218,5 +223,86 @@ namespace jet
 			vars.release();
 #endif
 		}
+
+		// An affine transform keeps the parameter of the points along the ray, so the distances
+		// found in model space hold in world space.
+		static Ray toModelSpace(const glm::mat4& invWorld, const Ray& ray)
+		{
+			return Ray(glm::vec3(invWorld * glm::vec4(ray.Origin, 1.0f)), glm::mat3(invWorld) * ray.Direction, ray.Limit);
+		}
+
+		int Geometry::collideWith(const Ray& ray, CollisionResults& results)
+		{
+			const BoundingVolume* pBound = getWorldBound().get();
+			if (m_pMesh == nullptr || (pBound && !pBound->intersects(ray)))
+			{
+				return 0;
+			}
+
+			// The tree is looked up, and built by the first ray, only once the bound is hit.
+			const TriangleBVH* pTree = TriangleBVH::get(m_pMesh.get());
+			if (pTree == nullptr)
+			{
+				return 0;
+			}
+
+			computeWorldMatrix();
+			const glm::mat4 invWorld = glm::inverse(getWorldMatrix());
+			std::vector<TriangleBVH::Hit> hits;
+			pTree->intersectAll(toModelSpace(invWorld, ray), hits);
+
+			const glm::mat3 normalMatrix = glm::transpose(glm::mat3(invWorld));
+			for (const TriangleBVH::Hit& hit : hits)
+			{
+				const glm::vec3 normal = glm::normalize(normalMatrix * pTree->getTriangleNormal(hit.Triangle));
+				results.addCollision(CollisionResult(this, ray.getPoint(hit.Distance), normal, hit.Distance, hit.Triangle));
+			}
+			return static_cast<int>(hits.size());
+		}
+
+		bool Geometry::intersectsAny(const Ray& ray)
+		{
+			const BoundingVolume* pBound = getWorldBound().get();
+			if (m_pMesh == nullptr || (pBound && !pBound->intersects(ray)))
+			{
+				return false;
+			}
+
+			const TriangleBVH* pTree = TriangleBVH::get(m_pMesh.get());
+			if (pTree == nullptr)
+			{
+				return false;
+			}
+
+			computeWorldMatrix();
+			return pTree->intersectAny(toModelSpace(glm::inverse(getWorldMatrix()), ray));
+		}
+
+		bool Geometry::intersectClosest(const Ray& ray, CollisionResult& result)
+		{
+			const BoundingVolume* pBound = getWorldBound().get();
+			if (m_pMesh == nullptr || (pBound && !pBound->intersects(ray)))
+			{
+				return false;
+			}
+
+			const TriangleBVH* pTree = TriangleBVH::get(m_pMesh.get());
+			if (pTree == nullptr)
+			{
+				return false;
+			}
+
+			computeWorldMatrix();
+			const glm::mat4 invWorld = glm::inverse(getWorldMatrix());
+			TriangleBVH::Hit hit;
+			if (!pTree->intersectClosest(toModelSpace(invWorld, ray), hit))
+			{
+				return false;
+			}
+
+			const glm::vec3 normal = glm::normalize(glm::transpose(glm::mat3(invWorld)) * pTree->getTriangleNormal(hit.Triangle));
+			result = CollisionResult(this, ray.getPoint(hit.Distance), normal, hit.Distance, hit.Triangle);
+			return true;
+		}
 	}
 }
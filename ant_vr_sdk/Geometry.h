@@ -16,6 +16,8 @@ namespace jet
 		class Geometry : public Spatial
 		{
 		public:
+			friend class TransformHierarchy;
+
 			/**
 			* Create a geometry node with mesh data.
 			* The material of the geometry is null, it cannot
@@ -24,7 +26,8 @@ namespace jet
 			* @param name The name of this geometry
 			* @param mesh The mesh data for this geometry
 			*/
-			Geometry(const std::string& name, ShapePtr pMesh) : Spatial(name)
+			Geometry(const std::string& name, ShapePtr pMesh) : Spatial(name, SpatialType::GEOMETRY),
+				m_iLodLevel(0), m_bIgnoreTransform(false), m_pGroupNode(nullptr), m_iStartIndex(0), m_bOccluder(false)
 			{
 				// For backwards compatibility, only clear the "requires
 				// update" flag if we are not a subclass of Geometry.
@@ -224,38 +227,18 @@ namespace jet
 				// this call useless!
 				//updateModelBound();
 			}
-#if 0
-			public int collideWith(Collidable other, CollisionResults results) {
-				// Force bound to update
-				checkDoBoundUpdate();
-				// Update transform, and compute cached world matrix
-				computeWorldMatrix();
-
-				assert(refreshFlags & (RF_BOUND | RF_TRANSFORM)) == 0;
-
-				if (mesh != null) {
-					// NOTE: BIHTree in mesh already checks collision with the
-					// mesh's bound
-					int prevSize = results.size();
-					int added = mesh.collideWith(other, cachedWorldMat, worldBound, results);
-					int newSize = results.size();
-					for (int i = prevSize; i < newSize; i++) {
-						results.getCollisionDirect(i).setGeometry(this);
-					}
-					return added;
-				}
-				return 0;
-			}
-
-			@Override
-				public void depthFirstTraversal(SceneGraphVisitor visitor, DFSMode mode) {
-				visitor.visit(this);
-			}
+			/**
+			* Adds every triangle of the mesh hit by the ray to the results. The triangles are
+			* found through the {@link TriangleBVH} of the mesh, in model space, and returned
+			* in world space. Only the meshes in the TRIANGLES mode can be hit.
+			*
+			* @return the number of collisions added.
+			*/
+			int collideWith(const Ray& ray, CollisionResults& results) override;
+			bool intersectsAny(const Ray& ray) override;
+			/// Finds the triangle of the mesh nearest to the origin of the ray.
+			bool intersectClosest(const Ray& ray, CollisionResult& result);
 
-			@Override
-				protected void breadthFirstTraversal(SceneGraphVisitor visitor, Queue<Spatial> queue) {
-			}
-#endif
 			/**
 			* Determine whether this <code>Geometry</code> is managed by a
 			* {@link GeometryGroupNode} or not.
@@ -264,6 +247,14 @@ namespace jet
 			*/
 			bool isGrouped() const { return m_pGroupNode != nullptr;}
 
+			/**
+			* Marks the geometry as an occluder. The occluders are rasterized by the
+			* {@link OcclusionCuller} of the {@link SpatialManager}, so use a few large,
+			* simple meshes such as walls and floors.
+			*/
+			void setOccluder(bool bOccluder) { m_bOccluder = bOccluder; }
+			bool isOccluder() const { return m_bOccluder; }
+
 			~Geometry();
 
 		protected:
@@ -274,6 +265,7 @@ namespace jet
 			bool     m_bIgnoreTransform;
 			class SpatialManager* m_pGroupNode;
 			int      m_iStartIndex;
+			bool     m_bOccluder;
 
 
 		};
@@ -16,7 +16,8 @@ namespace jet
 				const GLenum mappingBits = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
 				if (glBufferStorage)
 				{
-					return new BufferGLStorage < Target, storageBits, storageBits >;
+					// The pools upload with glBufferSubData, which the immutable storage only allows with GL_DYNAMIC_STORAGE_BIT.
+					return new BufferGLStorage < Target, storageBits | GL_DYNAMIC_STORAGE_BIT, storageBits >;
 				}
 				else
 				{
@@ -34,7 +35,8 @@ namespace jet
 		static BufferCreatorImpl<BufferTarget::ELEMENT> g_ElementBufferGLCreator;
 		static const uint32_t INIT_BUFFER_CAPACITY = 128 * 1024; // 128k
 
-		GeometryAttribBuffer::GeometryAttribBuffer(bool hasIndices, uint32_t count, GeometryBufferDesc* attribs) :m_bHaveIndices(hasIndices)
+		GeometryAttribBuffer::GeometryAttribBuffer(bool hasIndices, uint32_t count, GeometryBufferDesc* attribs) :m_bHaveIndices(hasIndices),
+			m_ElementBufferPool(nullptr), m_uiOffsetsVersion(0)
 		{
 			if (count)
 			{
@@ -43,16 +45,23 @@ namespace jet
 				for (uint32_t i = 0; i < count; i++)
 				{
 					m_AttribDescs[i] = attribs[i];
-					m_AttribBuffersPool[i] = new BufferGPUSharedNonUniformPool(&g_ArrayBufferGLCreator, INIT_BUFFER_CAPACITY);
+					m_AttribBuffersPool[i] = createPool(&g_ArrayBufferGLCreator);
 				}
 			}
 
 			if (hasIndices)
 			{
-				m_ElementBufferPool = new BufferGPUSharedNonUniformPool(&g_ElementBufferGLCreator, INIT_BUFFER_CAPACITY);
+				m_ElementBufferPool = createPool(&g_ElementBufferGLCreator);
 			}
 		}
 
+		BufferGPUSharedNonUniformPool* GeometryAttribBuffer::createPool(BufferCreator* pBufCreator)
+		{
+			BufferGPUSharedNonUniformPool* pPool = new BufferGPUSharedNonUniformPool(pBufCreator, INIT_BUFFER_CAPACITY);
+			pPool->addRelocationListener(this);
+			return pPool;
+		}
+
 
 		GeometryAttribBuffer::~GeometryAttribBuffer()
 		{
@@ -95,7 +104,7 @@ namespace jet
 				}
 #endif
 				m_AttribDescs.push_back(attrib);
-				m_AttribBuffersPool.push_back(new BufferGPUSharedNonUniformPool(&g_ArrayBufferGLCreator, INIT_BUFFER_CAPACITY));
+				m_AttribBuffersPool.push_back(createPool(&g_ArrayBufferGLCreator));
 				return true;
 			}
 		}
@@ -155,6 +164,7 @@ namespace jet
 					{
 						BufferBean bean = m_AttribBuffersPool[i]->add(data.AttribSize[i], data.AttribData[i]);
 						offset.BufferBeans[i] = bean;
+						m_BeanKeys[bean] = key;
 						uint32_t base_offset = m_AttribBuffersPool[i]->getOffset(bean);
 
 						const GeometryBufferDesc& bufferDesc = m_AttribDescs[i];
@@ -162,7 +172,7 @@ namespace jet
 						offset.BufferOffsets[i].AttribOffset = allocate<uint32_t>(bufferDesc.BufferDescs[i].AttribCount * sizeof(uint32_t));
 						for (uint32_t j = 0; j < bufferDesc.BufferDescs[i].AttribCount; j++)
 						{
-							offset.BufferOffsets[i].AttribOffset[j] = base_offset + reinterpret_cast<uint32_t>(bufferDesc.BufferDescs[i].AttribDescs[j].Pointer);
+							offset.BufferOffsets[i].AttribOffset[j] = base_offset + static_cast<uint32_t>(reinterpret_cast<uintptr_t>(bufferDesc.BufferDescs[i].AttribDescs[j].Pointer));
 						}
 					}
 					else
@@ -178,6 +188,7 @@ namespace jet
 					BufferBean bean = m_ElementBufferPool->add(data.ElementSize, data.ElementData);
 					offset.ElementOffset = m_ElementBufferPool->getOffset(bean);
 					offset.ElementBean = bean;
+					m_BeanKeys[bean] = key;
 				}
 				else
 				{
@@ -189,7 +200,10 @@ namespace jet
 				
 				auto value = std::pair<int32_t, GeometryBufferOffset>(key, offset);
 				m_AttribOffsets.insert(value);
+				return true;
 			}
+
+			return false;
 		}
 
 		bool GeometryAttribBuffer::remove(int32_t key)
@@ -210,11 +224,13 @@ namespace jet
 					const GeometryBufferOffset& offset = it->second;
 					for (uint32_t i = 0; i < offset.BufferCount; i++)
 					{
+						m_BeanKeys.erase(offset.BufferBeans[i]);
 						m_AttribBuffersPool[i]->remove(offset.BufferBeans[i]);
 					}
 
 					if (offset.ElementBean)
 					{
+						m_BeanKeys.erase(offset.ElementBean);
 						m_ElementBufferPool->remove(offset.ElementBean);
 					}
 
@@ -224,6 +240,72 @@ namespace jet
 			}
 		}
 
+		uint32_t GeometryAttribBuffer::defragment(uint32_t maxBytes)
+		{
+			uint32_t uiMoved = 0;
+			for (size_t i = 0; i < m_AttribBuffersPool.size() && uiMoved < maxBytes; i++)
+			{
+				uiMoved += m_AttribBuffersPool[i]->defragment(maxBytes - uiMoved);
+			}
+
+			if (m_ElementBufferPool && uiMoved < maxBytes)
+			{
+				uiMoved += m_ElementBufferPool->defragment(maxBytes - uiMoved);
+			}
+
+			return uiMoved;
+		}
+
+		float GeometryAttribBuffer::getFragmentation() const
+		{
+			float fragmentation = 0.0f;
+			for (size_t i = 0; i < m_AttribBuffersPool.size(); i++)
+			{
+				fragmentation = Numeric::max(fragmentation, m_AttribBuffersPool[i]->getFragmentation());
+			}
+
+			if (m_ElementBufferPool)
+			{
+				fragmentation = Numeric::max(fragmentation, m_ElementBufferPool->getFragmentation());
+			}
+
+			return fragmentation;
+		}
+
+		void GeometryAttribBuffer::onBeansRelocated(const BufferRelocation* pRelocations, uint32_t count)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const BufferRelocation& relocation = pRelocations[i];
+				auto key = m_BeanKeys.find(relocation.Bean);
+				if (key == m_BeanKeys.end())
+					continue;
+
+				GeometryBufferOffset& offset = m_AttribOffsets[key->second];
+				if (offset.ElementBean == relocation.Bean)
+				{
+					offset.ElementOffset = relocation.NewOffset;
+					continue;
+				}
+
+				for (uint32_t j = 0; j < offset.BufferCount; j++)
+				{
+					if (offset.BufferBeans[j] != relocation.Bean)
+						continue;
+
+					// The attrib offsets are relative to the start of the bean.
+					GeometryAttribOffset& attribOffset = offset.BufferOffsets[j];
+					for (uint32_t k = 0; k < attribOffset.AttribCount; k++)
+					{
+						attribOffset.AttribOffset[k] = attribOffset.AttribOffset[k] - relocation.OldOffset + relocation.NewOffset;
+					}
+					break;
+				}
+			}
+
+			m_uiOffsetsVersion++;
+		}
+
 		void GeometryAttribBuffer::setIndicesState(bool flag)
 		{
 			m_bHaveIndices = flag;
@@ -78,7 +78,7 @@ namespace jet
 #endif
 		}GeometryBufferOffset;
 
-		class GeometryAttribBuffer
+		class GeometryAttribBuffer : public BufferRelocationListener
 		{
 		public:
 
@@ -122,6 +122,23 @@ namespace jet
 
 			BufferGPUSharedNonUniformPool* getElementBuffer() { return m_ElementBufferPool; }
 
+			/**
+			 * Runs one incremental defragmentation step over all the pools, moving at most maxBytes
+			 * in total. The offsets returned by getBufferOffset() are patched afterwards, and
+			 * getOffsetsVersion() changes if anything moved.
+			 * @return The number of bytes moved.
+			 */
+			uint32_t defragment(uint32_t maxBytes);
+
+			/// Returns the worst fragmentation ratio of all the pools.
+			float getFragmentation() const;
+
+			/// Incremented whenever defragment() changes the offsets of some geometry, so cached draw
+			/// parameters (base vertex, first index) can be refreshed.
+			uint32_t getOffsetsVersion() const { return m_uiOffsetsVersion; }
+
+			void onBeansRelocated(const BufferRelocation* pRelocations, uint32_t count) override;
+
 			virtual ~GeometryAttribBuffer();
 
 		private:
@@ -134,6 +151,7 @@ namespace jet
 			}
 
 			void setIndicesState(bool flag);
+			BufferGPUSharedNonUniformPool* createPool(BufferCreator* pBufCreator);
 
 		private:
 			bool m_bHaveIndices;
@@ -145,6 +163,10 @@ namespace jet
 			std::unordered_map<int32_t, GeometryBufferOffset> m_AttribOffsets;
 			std::vector<int32_t> m_unusedKeys;
 
+			// Maps every bean back to the key of the geometry owning it.
+			std::unordered_map<BufferBean, int32_t> m_BeanKeys;
+			uint32_t m_uiOffsetsVersion;
+
 			Shape3D::Mode m_Mode;
 		};
 	}
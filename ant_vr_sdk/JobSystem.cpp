@@ -0,0 +1,429 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+namespace jet
+{
+	namespace util
+	{
+		// The index of the calling thread in the system, -1 outside of it.
+		static thread_local int32_t s_iThreadIndex = -1;
+		// The state of the random victim choice of the calling thread.
+		static thread_local uint32_t s_uiStealSeed = 0;
+
+		// The number of times an idle worker looks for a job before it goes to sleep.
+		static const uint32_t IDLE_SPIN_COUNT = 64;
+
+		/**
+		 * The Chase-Lev deque of "Correct and Efficient Work-Stealing for Weak Memory Models" with a
+		 * fixed capacity. push() and pop() are only called by the owner thread, steal() by any.
+		 */
+		class JobSystem::JobDeque
+		{
+		public:
+			static const int64_t CAPACITY = 4096;
+
+			JobDeque() : m_iTop(0), m_iBottom(0)
+			{
+				for (int64_t i = 0; i < CAPACITY; i++)
+				{
+					m_Jobs[i].store(nullptr, std::memory_order_relaxed);
+				}
+			}
+
+			// Returns false when the deque is full.
+			bool push(Job* pJob)
+			{
+				int64_t bottom = m_iBottom.load(std::memory_order_relaxed);
+				int64_t top = m_iTop.load(std::memory_order_acquire);
+				if (bottom - top >= CAPACITY)
+				{
+					return false;
+				}
+
+				m_Jobs[bottom & (CAPACITY - 1)].store(pJob, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				m_iBottom.store(bottom + 1, std::memory_order_relaxed);
+				return true;
+			}
+
+			Job* pop()
+			{
+				int64_t bottom = m_iBottom.load(std::memory_order_relaxed) - 1;
+				m_iBottom.store(bottom, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				int64_t top = m_iTop.load(std::memory_order_relaxed);
+
+				if (top > bottom)
+				{
+					// Empty.
+					m_iBottom.store(bottom + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+
+				Job* pJob = m_Jobs[bottom & (CAPACITY - 1)].load(std::memory_order_relaxed);
+				if (top == bottom)
+				{
+					// The last job, race the thieves for it.
+					if (!m_iTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					{
+						pJob = nullptr;
+					}
+					m_iBottom.store(bottom + 1, std::memory_order_relaxed);
+				}
+
+				return pJob;
+			}
+
+			Job* steal()
+			{
+				int64_t top = m_iTop.load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				int64_t bottom = m_iBottom.load(std::memory_order_acquire);
+				if (top >= bottom)
+				{
+					return nullptr;
+				}
+
+				Job* pJob = m_Jobs[top & (CAPACITY - 1)].load(std::memory_order_relaxed);
+				if (!m_iTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				{
+					// Another thread took it.
+					return nullptr;
+				}
+
+				return pJob;
+			}
+
+		private:
+			std::atomic<int64_t> m_iTop;
+			std::atomic<int64_t> m_iBottom;
+			std::atomic<Job*> m_Jobs[CAPACITY];
+		};
+
+		struct JobSystem::Worker
+		{
+			JobDeque Deque;
+			std::thread Thread;
+		};
+
+		JobSystem& JobSystem::get()
+		{
+			static JobSystem instance;
+			return instance;
+		}
+
+		JobSystem::JobSystem() : m_pMainDeque(new JobDeque()), m_iQueuedJobs(0), m_iSleepingWorkers(0), m_bQuit(false)
+		{
+		}
+
+		JobSystem::~JobSystem()
+		{
+			shutdown();
+		}
+
+		void JobSystem::init(int32_t workerCount)
+		{
+			assert(m_Workers.empty());
+			if (workerCount < 0)
+			{
+				workerCount = std::max(0, static_cast<int32_t>(std::thread::hardware_concurrency()) - 1);
+			}
+
+			s_iThreadIndex = 0;
+			m_bQuit = false;
+			m_Workers.reserve(workerCount);
+			for (int32_t i = 0; i < workerCount; i++)
+			{
+				m_Workers.push_back(std::unique_ptr<Worker>(new Worker()));
+			}
+
+			// Started once all the deques exist, the workers steal from each other right away.
+			for (int32_t i = 0; i < workerCount; i++)
+			{
+				m_Workers[i]->Thread = std::thread(&JobSystem::workerMain, this, i + 1);
+			}
+		}
+
+		void JobSystem::shutdown()
+		{
+			if (m_Workers.empty())
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_WakeMutex);
+				m_bQuit = true;
+			}
+			m_WakeCondition.notify_all();
+
+			for (std::unique_ptr<Worker>& pWorker : m_Workers)
+			{
+				pWorker->Thread.join();
+			}
+			m_Workers.clear();
+		}
+
+		int32_t JobSystem::getThreadIndex() const
+		{
+			return s_iThreadIndex;
+		}
+
+		void JobSystem::run(JobFunction pFunction, void* pData, JobCounter* pCounter, JobCounter* pDependency)
+		{
+			assert(pFunction);
+			if (pCounter)
+			{
+				pCounter->m_iPending.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			Job* pJob = new Job;
+			pJob->pFunction = pFunction;
+			pJob->pData = pData;
+			pJob->pCounter = pCounter;
+			pJob->pNext = nullptr;
+			pJob->bOwned = true;
+			submit(pJob, pDependency);
+		}
+
+		void JobSystem::run(const std::function<void()>& function, JobCounter* pCounter, JobCounter* pDependency)
+		{
+			run(&JobSystem::runFunction, new std::function<void()>(function), pCounter, pDependency);
+		}
+
+		void JobSystem::runFunction(void* pFunction)
+		{
+			std::function<void()>* pCall = static_cast<std::function<void()>*>(pFunction);
+			(*pCall)();
+			delete pCall;
+		}
+
+		void JobSystem::submit(Job* pJob, JobCounter* pDependency)
+		{
+			if (pDependency)
+			{
+				std::lock_guard<std::mutex> lock(pDependency->m_Mutex);
+				if (pDependency->m_iPending.load(std::memory_order_acquire) > 0)
+				{
+					// Queued by finish() when the last job of the dependency is done.
+					pJob->pNext = pDependency->m_pContinuations;
+					pDependency->m_pContinuations = pJob;
+					return;
+				}
+			}
+
+			if (m_Workers.empty())
+			{
+				execute(pJob);
+			}
+			else
+			{
+				push(pJob);
+			}
+		}
+
+		void JobSystem::push(Job* pJob)
+		{
+			m_iQueuedJobs.fetch_add(1, std::memory_order_seq_cst);
+
+			const int32_t threadIndex = s_iThreadIndex;
+			JobDeque* pDeque = threadIndex < 0 ? nullptr : (threadIndex == 0 ? m_pMainDeque.get() : &m_Workers[threadIndex - 1]->Deque);
+			if (pDeque == nullptr || !pDeque->push(pJob))
+			{
+				std::lock_guard<std::mutex> lock(m_SharedMutex);
+				m_SharedJobs.push_back(pJob);
+			}
+
+			if (m_iSleepingWorkers.load(std::memory_order_seq_cst) > 0)
+			{
+				std::lock_guard<std::mutex> lock(m_WakeMutex);
+				m_WakeCondition.notify_one();
+			}
+		}
+
+		Job* JobSystem::findJob(int32_t threadIndex)
+		{
+			Job* pJob = nullptr;
+			if (threadIndex == 0)
+			{
+				pJob = m_pMainDeque->pop();
+			}
+			else if (threadIndex > 0)
+			{
+				pJob = m_Workers[threadIndex - 1]->Deque.pop();
+			}
+
+			if (pJob == nullptr)
+			{
+				std::lock_guard<std::mutex> lock(m_SharedMutex);
+				if (!m_SharedJobs.empty())
+				{
+					pJob = m_SharedJobs.front();
+					m_SharedJobs.pop_front();
+				}
+			}
+
+			if (pJob == nullptr)
+			{
+				// Steal from the other threads, starting at a random one.
+				const uint32_t threadCount = getThreadCount();
+				s_uiStealSeed = s_uiStealSeed * 1664525u + 1013904223u;
+				const uint32_t start = (s_uiStealSeed >> 16) % threadCount;
+				for (uint32_t i = 0; i < threadCount && pJob == nullptr; i++)
+				{
+					const uint32_t victim = (start + i) % threadCount;
+					if (static_cast<int32_t>(victim) != threadIndex)
+					{
+						pJob = victim == 0 ? m_pMainDeque->steal() : m_Workers[victim - 1]->Deque.steal();
+					}
+				}
+			}
+
+			if (pJob)
+			{
+				m_iQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			}
+			return pJob;
+		}
+
+		void JobSystem::execute(Job* pJob)
+		{
+			pJob->pFunction(pJob->pData);
+
+			JobCounter* pCounter = pJob->pCounter;
+			if (pJob->bOwned)
+			{
+				delete pJob;
+			}
+
+			if (pCounter)
+			{
+				finish(pCounter);
+			}
+		}
+
+		void JobSystem::finish(JobCounter* pCounter)
+		{
+			Job* pContinuations = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(pCounter->m_Mutex);
+				if (pCounter->m_iPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					pContinuations = pCounter->m_pContinuations;
+					pCounter->m_pContinuations = nullptr;
+				}
+			}
+
+			while (pContinuations)
+			{
+				Job* pNext = pContinuations->pNext;
+				pContinuations->pNext = nullptr;
+				if (m_Workers.empty())
+				{
+					execute(pContinuations);
+				}
+				else
+				{
+					push(pContinuations);
+				}
+				pContinuations = pNext;
+			}
+		}
+
+		void JobSystem::wait(JobCounter* pCounter)
+		{
+			assert(pCounter);
+			const int32_t threadIndex = s_iThreadIndex;
+			while (!pCounter->isDone())
+			{
+				Job* pJob = findJob(threadIndex);
+				if (pJob)
+				{
+					execute(pJob);
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+
+			// The thread of the last job may still hold the lock, the counter can only go once it released it.
+			std::lock_guard<std::mutex> lock(pCounter->m_Mutex);
+		}
+
+		void JobSystem::runParallelFor(ParallelForTask& task)
+		{
+			const uint32_t rangeCount = (task.Count + task.GrainSize - 1) / task.GrainSize;
+			const uint32_t helperCount = std::min(rangeCount, getThreadCount()) - 1;
+
+			// The helpers live on this stack, wait() returns only after all of them ran.
+			JobCounter counter;
+			std::vector<Job> helpers(helperCount);
+			for (Job& helper : helpers)
+			{
+				helper.pFunction = &JobSystem::runParallelForRanges;
+				helper.pData = &task;
+				helper.pCounter = &counter;
+				helper.pNext = nullptr;
+				helper.bOwned = false;
+				counter.m_iPending.fetch_add(1, std::memory_order_relaxed);
+				push(&helper);
+			}
+
+			runParallelForRanges(&task);
+			wait(&counter);
+		}
+
+		void JobSystem::runParallelForRanges(void* pTask)
+		{
+			ParallelForTask* pFor = static_cast<ParallelForTask*>(pTask);
+			while (true)
+			{
+				const uint32_t first = pFor->Next.fetch_add(pFor->GrainSize, std::memory_order_relaxed);
+				if (first >= pFor->Count)
+				{
+					break;
+				}
+
+				pFor->pInvoke(pFor->pFunction, first, std::min(pFor->GrainSize, pFor->Count - first));
+			}
+		}
+
+		void JobSystem::workerMain(int32_t threadIndex)
+		{
+			s_iThreadIndex = threadIndex;
+			s_uiStealSeed = static_cast<uint32_t>(threadIndex) * 2654435761u;
+
+			uint32_t idleCount = 0;
+			while (true)
+			{
+				Job* pJob = findJob(threadIndex);
+				if (pJob)
+				{
+					execute(pJob);
+					idleCount = 0;
+					continue;
+				}
+
+				if (++idleCount < IDLE_SPIN_COUNT)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(m_WakeMutex);
+				m_iSleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+				m_WakeCondition.wait(lock, [this]{ return m_bQuit || m_iQueuedJobs.load(std::memory_order_seq_cst) > 0; });
+				m_iSleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+				idleCount = 0;
+
+				// Quit only once the queued jobs are done.
+				if (m_bQuit && m_iQueuedJobs.load(std::memory_order_seq_cst) <= 0)
+				{
+					break;
+				}
+			}
+		}
+	}
+}
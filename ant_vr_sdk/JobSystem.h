@@ -0,0 +1,173 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		typedef void(*JobFunction)(void* pData);
+
+		typedef struct Job
+		{
+			JobFunction pFunction;
+			void* pData;
+			// Decremented once the job ran, may be null.
+			class JobCounter* pCounter;
+			// The next job waiting for the same counter.
+			Job* pNext;
+			// The job was allocated by run() and is deleted once it ran.
+			bool bOwned;
+		}Job;
+
+		/**
+		 * Counts the jobs that are not finished yet. A counter can be waited on, or given as the
+		 * dependency of other jobs, which start once it drops to zero. It can be used again once
+		 * it is done.
+		 */
+		class JobCounter
+		{
+		public:
+			JobCounter() : m_iPending(0), m_pContinuations(nullptr){}
+			~JobCounter() { assert(isDone()); }
+
+			bool isDone() const { return m_iPending.load(std::memory_order_acquire) == 0; }
+
+		private:
+			JobCounter(const JobCounter&) = delete;
+			JobCounter& operator=(const JobCounter&) = delete;
+
+			friend class JobSystem;
+
+			std::atomic<int32_t> m_iPending;
+			// Guards the continuations and the last decrement.
+			std::mutex m_Mutex;
+			Job* m_pContinuations;
+		};
+
+		/**
+		 * A work-stealing job scheduler. Every worker thread owns a Chase-Lev deque: it pushes and
+		 * pops its own jobs at the bottom, and the idle workers steal from the top of the others.
+		 * The thread that called init() is thread 0 and takes part in the work whenever it waits,
+		 * the jobs of the threads outside the system go through a shared queue.<p>
+		 * Until init() is called, or with no worker, run() executes the jobs right away and
+		 * parallelFor() runs the whole range on the calling thread, so the systems using the
+		 * scheduler behave as before.
+		 */
+		class JobSystem
+		{
+		public:
+			static JobSystem& get();
+
+			/// Starts the workers. The default is one worker per hardware thread besides the calling one.
+			void init(int32_t workerCount = -1);
+			/// Finishes the queued jobs and stops the workers.
+			void shutdown();
+
+			/// The workers plus the thread that called init().
+			uint32_t getThreadCount() const { return static_cast<uint32_t>(m_Workers.size()) + 1; }
+			/// The index of the calling thread, 0 for the thread that called init() and -1 outside the system.
+			int32_t getThreadIndex() const;
+
+			/**
+			 * Queues a job. pCounter, if any, is incremented now and decremented once the job ran.
+			 * The job doesn't start before pDependency, if any, is done.
+			 */
+			void run(JobFunction pFunction, void* pData, JobCounter* pCounter = nullptr, JobCounter* pDependency = nullptr);
+			void run(const std::function<void()>& function, JobCounter* pCounter = nullptr, JobCounter* pDependency = nullptr);
+
+			/// Runs other jobs on the calling thread until the counter is done.
+			void wait(JobCounter* pCounter);
+
+			/**
+			 * Calls function(first, count) on ranges of at most grainSize items covering [0, count),
+			 * on all the threads, and returns once they are all done. The threads take the ranges
+			 * in order from a shared index, so uneven ranges still balance.
+			 */
+			template<typename Function>
+			void parallelFor(uint32_t count, uint32_t grainSize, const Function& function)
+			{
+				if (grainSize == 0)
+				{
+					grainSize = 1;
+				}
+
+				if (count <= grainSize || m_Workers.empty())
+				{
+					if (count > 0)
+					{
+						function(0, count);
+					}
+					return;
+				}
+
+				ParallelForTask task;
+				task.pInvoke = &invokeRange<Function>;
+				task.pFunction = &function;
+				task.Next.store(0, std::memory_order_relaxed);
+				task.Count = count;
+				task.GrainSize = grainSize;
+				runParallelFor(task);
+			}
+
+			~JobSystem();
+
+		private:
+			class JobDeque;
+			struct Worker;
+
+			typedef struct ParallelForTask
+			{
+				void(*pInvoke)(const void* pFunction, uint32_t first, uint32_t count);
+				const void* pFunction;
+				std::atomic<uint32_t> Next;
+				uint32_t Count;
+				uint32_t GrainSize;
+			}ParallelForTask;
+
+			template<typename Function>
+			static void invokeRange(const void* pFunction, uint32_t first, uint32_t count)
+			{
+				(*static_cast<const Function*>(pFunction))(first, count);
+			}
+
+			static void runParallelForRanges(void* pTask);
+			static void runFunction(void* pFunction);
+
+			JobSystem();
+
+			void runParallelFor(ParallelForTask& task);
+			void submit(Job* pJob, JobCounter* pDependency);
+			void push(Job* pJob);
+			Job* findJob(int32_t threadIndex);
+			void execute(Job* pJob);
+			void finish(JobCounter* pCounter);
+			void workerMain(int32_t threadIndex);
+
+		private:
+			// Indexed by thread index - 1, thread 0 has its own deque below.
+			std::vector<std::unique_ptr<Worker>> m_Workers;
+			std::unique_ptr<JobDeque> m_pMainDeque;
+
+			// The jobs queued by the threads outside the system, and the ones that didn't fit a deque.
+			std::mutex m_SharedMutex;
+			std::deque<Job*> m_SharedJobs;
+
+			// The idle workers sleep until a job is queued.
+			std::mutex m_WakeMutex;
+			std::condition_variable m_WakeCondition;
+			std::atomic<int32_t> m_iQueuedJobs;
+			std::atomic<int32_t> m_iSleepingWorkers;
+			bool m_bQuit;
+		};
+	}
+}
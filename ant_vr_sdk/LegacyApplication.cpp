@@ -1,7 +1,9 @@
 #include "LegacyApplication.h"
 #include <BaseApp.h>
 #include "Geometry.h"
+#include "BatchBuffer.h"
 #include "GLStates.h"
+#include "JobSystem.h"
 
 namespace jet
 {
@@ -50,117 +52,204 @@ namespace jet
 			InputAdapter* m_Input;
 		};
 
-		LegacyApplication::LegacyApplication()
+		LegacyApplication::LegacyApplication() : m_pMultiDrawProgram(nullptr), m_bOcclusionCulling(false), m_bStereo(false), m_fEyeSeparation(0.064f)
 		{
 			m_pScene = new Scene();
 			m_pRoot = new Node("Root");
+			// The geometries attached below the root are drawn by the manager.
+			m_pRoot->setSpatialManager(&m_SpatialManager);
+
+			m_pCamera = new Camera(1280, 720);
+			m_pCamera->setFrustumPerspective(60.0f, 1280.0f / 720.0f, 0.1f, 100.0f);
+			m_pCamera->setLookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+			m_pEyeCameras[0] = new Camera(640, 720);
+			m_pEyeCameras[1] = new Camera(640, 720);
 		}
 
 		LegacyApplication::~LegacyApplication()
 		{
 			delete m_pRoot;
+			delete m_pCamera;
+			delete m_pEyeCameras[0];
+			delete m_pEyeCameras[1];
+			SAFE_DELETE(m_pMultiDrawProgram);
 		}
 
 		void LegacyApplication::start(uint32_t width, uint32_t height)
 		{
+			// This thread runs the frames, it takes part in the jobs whenever it waits for them.
+			JobSystem::get().init();
+
 			AppWrapper app(this);
 			app.getConfig().IsOpenGLESContext = false;
 			jet::util::BaseApp::Run(&app, "LegacyApplication");
 
+			JobSystem::get().shutdown();
+
 //			app.~AppWrapper();
 		}
 
 		// Called When sample created 
 		void LegacyApplication::OnCreate()
 		{
-			GLStates& states = GLStates::get();
 			m_pProgram = GLSLProgram::createFromFiles("CommonVS.vert", "CommonPS.frag");
 
-			glGenBuffers(1, &m_ArrayBuffer);
-			glGenBuffers(1, &m_ElementBuffer);
-# if 0
-			states.bindBuffer(m_ArrayBuffer, BufferTarget::ARRAY);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * 1024, nullptr, GL_DYNAMIC_DRAW);
-			states.bindBuffer(m_ElementBuffer, BufferTarget::ELEMENT);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(uint16_t) * 1024, nullptr, GL_DYNAMIC_DRAW);
-#endif
+			glm::vec4 color_source[8] =
+			{
+				glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+				glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+				glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+				glm::vec4(1.0f, 1.0f, 0.0f, 1.0f),
+
+				glm::vec4(0.0f, 1.0f, 1.0f, 1.0f),
+				glm::vec4(1.0f, 0.0f, 1.0f, 1.0f),
+				glm::vec4(1.0f, 1.0f, 1.0f, 1.0f),
+				glm::vec4(0.5f, 0.5f, 0.5f, 1.0f),
+			};
+
+			glm::vec4 vertex_colors[24];
+			for (int i = 0; i < 24; i++)
+			{
+				vertex_colors[i] = color_source[i % 8];
+			}
+
+			CHECK_GL(glProgramUniform4fv(m_pProgram->getProgram(), m_pProgram->getUniformLocation("g_VertexColors"), 24, reinterpret_cast<const GLfloat*>(vertex_colors)));
+
 			initialize();
 
-			// TODO
-			renderNode(m_pRoot);
+			// The scene picks the batch in initialize().
+			if (m_SpatialManager.isMultiDrawBatch())
+			{
+				m_pMultiDrawProgram = GLSLProgram::createFromFiles("MultiDrawVS.vert", "CommonPS.frag");
+			}
 		}
 		// Called When the viewport changed!
 		void LegacyApplication::OnResize(int x, int y, int width, int height)
 		{
+			m_pCamera->resize(width, height);
+			m_pEyeCameras[0]->resize(width / 2, height, false);
+			m_pEyeCameras[1]->resize(width / 2, height, false);
+		}
 
+		void LegacyApplication::renderScene()
+		{
+			if (m_bStereo)
+			{
+				renderStereo();
+				return;
+			}
+
+			m_VisibleGeometries.clear();
+			m_SpatialManager.cullScene(m_pRoot, m_pCamera, m_VisibleGeometries);
+			if (m_bOcclusionCulling)
+			{
+				m_SpatialManager.cullOcclusion(m_pCamera, m_VisibleGeometries);
+			}
+
+			drawGeometries(m_pCamera, nullptr, 0);
 		}
 
-		void LegacyApplication::renderNode(Node* pNode)
+		void LegacyApplication::renderStereo()
 		{
-			GLStates& states = GLStates::get();
-			std::vector<Spatial*> pChildren = pNode->getChildren();
-			int count = pChildren.size();
-			for (int i = 0; i < count; i++)
+			updateEyeCameras();
+
+			// One walk of the scene for both eyes, the masks tell which eye sees each geometry.
+			m_VisibleGeometries.clear();
+			m_SpatialManager.cullScene(m_pRoot, m_pEyeCameras, 2, m_VisibleGeometries, m_EyeMasks);
+
+			const GLsizei eyeWidth = m_pCamera->getWidth() / 2;
+			const GLsizei height = m_pCamera->getHeight();
+			for (uint32_t eye = 0; eye < 2; eye++)
+			{
+				CHECK_GL(glViewport(eye * eyeWidth, 0, eyeWidth, height));
+				drawGeometries(m_pEyeCameras[eye], m_EyeMasks.data(), 1u << eye);
+			}
+			CHECK_GL(glViewport(0, 0, m_pCamera->getWidth(), height));
+		}
+
+		void LegacyApplication::updateEyeCameras()
+		{
+			// The eyes look the same way as the camera, with half its horizontal extent for half the window.
+			const glm::mat4 cameraToWorld = glm::inverse(m_pCamera->getViewMatrix());
+			const glm::vec3 right = glm::vec3(cameraToWorld[0]);
+			const glm::vec3 up = glm::vec3(cameraToWorld[1]);
+			const glm::vec3 forward = -glm::vec3(cameraToWorld[2]);
+			const glm::vec3 center = glm::vec3(cameraToWorld[3]);
+			for (uint32_t eye = 0; eye < 2; eye++)
 			{
-				Spatial* pChild = pChildren[i];
-				Node* _pNode = dynamic_cast<Node*>(pChild);
-				if (_pNode)
+				const glm::vec3 location = center + right * (eye == 0 ? -0.5f : 0.5f) * m_fEyeSeparation;
+				Camera* pEye = m_pEyeCameras[eye];
+				pEye->setParallelProjection(m_pCamera->isParallelProjection());
+				pEye->setFrustum(m_pCamera->getFrustumNear(), m_pCamera->getFrustumFar(), 0.5f * m_pCamera->getFrustumLeft(), 0.5f * m_pCamera->getFrustumRight(),
+					m_pCamera->getFrustumTop(), m_pCamera->getFrustumBottom());
+				pEye->setLookAt(location, location + forward, up);
+			}
+		}
+
+		void LegacyApplication::drawGeometries(Camera* pCam, const uint32_t* pMasks, uint32_t eyeBit)
+		{
+			// The visible geometries are drawn in the order of the queue, the ones sharing states together.
+			RenderQueue& queue = m_SpatialManager.getRenderQueue();
+			queue.clear();
+			queue.setCamera(pCam);
+			for (size_t i = 0; i < m_VisibleGeometries.size(); i++)
+			{
+				if (pMasks == nullptr || (pMasks[i] & eyeBit))
 				{
-					renderNode(_pNode);
+					queue.add(m_VisibleGeometries[i]);
 				}
-				else
+			}
+			queue.sort();
+
+			m_pProgram->enable();
+			GLint location = m_pProgram->getUniformLocation("g_MVP");
+			assert(location >= 0);
+			const glm::mat4& viewProj = pCam->getViewProjectionMatrix();
+			for (const RenderQueue::RenderItem& item : queue.getItems())
+			{
+				// The geometries of the MULTI_DRAW batch have no assembly of their own, they are drawn below.
+				Geometry* pGeom = item.pGeometry;
+				GeometryAssembly* pAssembly = m_SpatialManager.findGeometryAssembly(pGeom);
+				if (pAssembly == nullptr)
 				{
-					if (pChild->getVertexCount())
-					{
-						Geometry* pGeo = dynamic_cast<Geometry*>(pChild);
-						if (pGeo)
-						{
-							ShapePtr pShape =  pGeo->getMesh();
-							if (pShape.get())
-							{
-								MeteDataPtr arrayData = pShape->getVertexData(MeshAttrib::POSITION3);
-								MeteDataPtr elementData = pShape->getVertexData(MeshAttrib::INDICES);
-
-								states.bindBuffer(m_ArrayBuffer, BufferTarget::ARRAY);
-								glBufferData(GL_ARRAY_BUFFER, arrayData->uiLength, arrayData->pData, GL_STATIC_DRAW);
-								states.bindBuffer(m_ElementBuffer, BufferTarget::ELEMENT);
-								glBufferData(GL_ELEMENT_ARRAY_BUFFER, elementData->uiLength, elementData->pData, GL_STATIC_DRAW);
-
-								print_mete_data<glm::vec3>(arrayData.get(), "Box ArrayBuffer");
-								print_mete_data<uint16_t>(elementData.get(), "Box ElementBuffer");
-
-								glm::vec4 color_source[8] =
-								{
-									glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
-									glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
-									glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
-									glm::vec4(1.0f, 1.0f, 0.0f, 1.0f),
-
-									glm::vec4(0.0f, 1.0f, 1.0f, 1.0f),
-									glm::vec4(1.0f, 0.0f, 1.0f, 1.0f),
-									glm::vec4(1.0f, 1.0f, 1.0f, 1.0f),
-									glm::vec4(0.5f, 0.5f, 0.5f, 1.0f),
-								};
-
-								glm::vec4 vertex_colors[24];
-								const uint16_t* pIndices = reinterpret_cast<const uint16_t*>(elementData->pData);
-								for (int i = 0; i < 24; i++)
-								{
-									vertex_colors[i] = color_source[pIndices[i]%8];
-								}
-
-								CHECK_GL(glProgramUniform4fv(m_pProgram->getProgram(), m_pProgram->getUniformLocation("g_VertexColors"), 24, reinterpret_cast<const GLfloat*>(vertex_colors)));
-							}
-						}
-					}
+					continue;
 				}
+
+				glm::mat4 mvp = viewProj * pGeom->getWorldMatrix();
+				CHECK_GL(glUniformMatrix4fv(location, 1, false, reinterpret_cast<const GLfloat*>(&mvp)));
+				pAssembly->bind();
+				pAssembly->draw();
+				pAssembly->unbind();
 			}
+			m_pProgram->disable();
+
+			BatchBuffer* pBatch = m_SpatialManager.getMultiDrawBatch();
+			if (pBatch == nullptr || m_pMultiDrawProgram == nullptr)
+			{
+				return;
+			}
+
+			m_SpatialManager.cullBatches(pCam);
+			m_pMultiDrawProgram->enable();
+			CHECK_GL(glUniformMatrix4fv(m_pMultiDrawProgram->getUniformLocation("g_ViewProj"), 1, false, reinterpret_cast<const GLfloat*>(&viewProj)));
+			for (uint32_t i = 0; i < pBatch->getGeometryAssemblyCount(); i++)
+			{
+				GeometryAssembly* pAssembly = pBatch->getGeometryAssembly(i);
+				pAssembly->bind();
+				pAssembly->draw();
+				pAssembly->unbind();
+			}
+			m_pMultiDrawProgram->disable();
 		}
 
 		// Render Loop...
 		void LegacyApplication::OnRender(float elpsedTime)
 		{
 			update(elpsedTime);
+			m_pRoot->updateLogicalState(elpsedTime);
+			m_pRoot->updateGeometricState();
+			m_SpatialManager.updateBatches();
 
 			GLStates& states = GLStates::get();
 			states.setClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -176,35 +265,7 @@ namespace jet
 			rsstate.CullFaceEnable = false;
 			states.setRSState(&rsstate);
 
-			m_pProgram->enable();
-
-			static float x_rotate = 0.0f;
-			static float y_rotate = 0.0f;
-
-			Transform transform;
-			transform.setRotateFromEulerAngle(x_rotate, y_rotate, 0.0f);
-			transform.setScale(glm::vec3(0.7f));
-			transform.setTranslateX(1.0f);
-
-			x_rotate += 0.008f;
-			y_rotate += 0.009f;
-
-			glm::mat4 proj = glm::perspective(glm::radians(60.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
-			glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-			glm::mat4 mvp = proj * view * transform.getCombinedMatrix();
-
-			
-			GLint location = m_pProgram->getUniformLocation("g_MVP");
-			assert(location >= 0);
-			CHECK_GL(glUniformMatrix4fv(location, 1, false, reinterpret_cast<const GLfloat*>(&mvp)));
-			states.bindBuffer(m_ArrayBuffer, BufferTarget::ARRAY);
-			CHECK_GL(glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, reinterpret_cast<const GLvoid*>(0)));
-			CHECK_GL(glEnableVertexAttribArray(0));
-			states.bindBuffer(m_ElementBuffer, BufferTarget::ELEMENT);
-
-			CHECK_GL(glDrawElements(GL_TRIANGLES, 30, GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid*>(12)));
-//			CHECK_GL(glDrawRangeElements(GL_TRIANGLES, 6, 12, 12, GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid*>(0)));
-			CHECK_GL(glDisableVertexAttribArray(0));
+			renderScene();
 		}
 	}
 }
\ No newline at end of file
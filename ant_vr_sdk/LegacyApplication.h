@@ -4,6 +4,8 @@
 #include "GLSLProgram.h"
 #include "SpatialManager.h"
 #include "Scene.h"
+#include "Camera.h"
+#include <vector>
 
 namespace jet
 {
@@ -29,16 +31,39 @@ namespace jet
 			virtual void update(float elpsedTime = 0.0) = 0;
 
 		private:
-			void renderNode(Node* pNode);
+			// Culls the scene against the camera and draws the geometries left.
+			void renderScene();
+			// Culls the scene once for both eyes and draws each eye to its half of the window.
+			void renderStereo();
+			// Places the eye cameras on either side of m_pCamera.
+			void updateEyeCameras();
+			// Draws the geometries of the visible list seen by pCam, all of them when pMasks is null,
+			// otherwise the ones whose mask has eyeBit.
+			void drawGeometries(Camera* pCam, const uint32_t* pMasks, uint32_t eyeBit);
 
 		protected:
 			SpatialManager m_SpatialManager;
 			Node* m_pRoot;
 			Scene* m_pScene;
+			Camera* m_pCamera;
 
 			GLSLProgram* m_pProgram;
-			GLuint m_ArrayBuffer;
-			GLuint m_ElementBuffer;
+			// Draws the MULTI_DRAW batch, created when the manager uses one, see SpatialManager::setMultiDrawBatch().
+			GLSLProgram* m_pMultiDrawProgram;
+			// Tests the visible geometries against the occluders on the CPU, see SpatialManager::cullOcclusion().
+			// Set by initialize() for the scenes with Geometry::setOccluder() meshes, false by default.
+			bool m_bOcclusionCulling;
+			// Draws the scene side by side for the left and right eye, the eyes are m_fEyeSeparation apart
+			// along the right axis of m_pCamera. Set by initialize(), false by default. The occlusion
+			// culling only runs for the single camera.
+			bool m_bStereo;
+			float m_fEyeSeparation;
+
+			// The output of the culling, kept to avoid reallocating every frame.
+			std::vector<Geometry*> m_VisibleGeometries;
+			// The eyes seeing each visible geometry in stereo, bit 0 for the left eye.
+			std::vector<uint32_t> m_EyeMasks;
+			Camera* m_pEyeCameras[2];
 		};
 	}
 }
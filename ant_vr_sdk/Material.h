@@ -68,6 +68,8 @@ namespace jet
 			virtual const std::string& getUniqueName() = 0;
 			virtual bool isInstanceBatch() const { return false; }
 
+			GLSLProgram* getProgram() const { return m_Program; }
+
 		protected:
 			void createProgram(uint32_t count, const ShaderSourceItem* items);
 
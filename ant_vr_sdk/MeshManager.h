@@ -612,51 +612,38 @@ namespace jet
 		private:
 			void flushDirty()
 			{
-				Shape3D** deleteShapes = nullptr;
-				InstanceData** deleteInstances = nullptr;
-				if (m_uiInstanceRemovedCount)
-				{
-					deleteShapes = new Shape3D*[m_uiInstanceRemovedCount];
-					deleteInstances = new InstanceData*[m_uiInstanceRemovedCount];
-				}
-
-				int index = 0;
-				for (int i = 0; i < m_pShapes.size(); i++)
+				// The removed instances are compacted out in one pass instead of searched one by one.
+				size_t kept = 0;
+				for (size_t i = 0; i < m_pShapes.size(); i++)
 				{
 					if (m_InstanceData[i]->UpdateMethod == MeshUpdateMethod::REMOVE)
 					{
-						deleteShapes[index] = m_pShapes[i];
-						deleteInstances[index] = m_InstanceData[i];
-
 						auto it = m_MemoryData.find(m_pShapes[i]->getUniqueName());
 						assert(it != m_MemoryData.end());
-						assert(Numeric::remove(it->second->pShapes, m_pShapes[i]));
+						bool removed = Numeric::remove(it->second->pShapes, m_pShapes[i]);
+						assert(removed);
 						if (it->second->pShapes.empty())
 						{
 							delete it->second;
 							m_MemoryData.erase(it);
 						}
+
+						delete m_InstanceData[i];
+						continue;
 					}
 					else if (m_InstanceData[i]->UpdateMethod == MeshUpdateMethod::ADD)
 					{
 						m_InstanceData[i]->UpdateMethod = MeshUpdateMethod::UPDATE_ATTRIB;
 					}
-				}
-
-				if (m_uiInstanceRemovedCount)
-				{
-					for (int i = 0; i < m_uiInstanceRemovedCount; i++)
-					{
-						Numeric::remove(m_pShapes, deleteShapes[i]);
-						Numeric::remove(m_InstanceData, deleteInstances[i]);
-
-						delete deleteInstances[i];
-					}
 
-					delete[] deleteShapes;
-					delete[] deleteInstances;
+					m_pShapes[kept] = m_pShapes[i];
+					m_InstanceData[kept] = m_InstanceData[i];
+					kept++;
 				}
 
+				m_pShapes.resize(kept);
+				m_InstanceData.resize(kept);
+
 				clearBufferTag();
 			}
 
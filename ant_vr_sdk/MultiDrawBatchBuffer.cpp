@@ -0,0 +1,766 @@
+#include "BatchBuffer.h"
+#include <GLCapabilities.h>
+#include <algorithm>
+#include <string.h>
+
+namespace jet
+{
+	namespace util
+	{
+		// The bindings shared with cs_multiDrawCull.glcs and MultiDrawVS.vert.
+		static const GLuint INSTANCE_BINDING = 0;
+		static const GLuint MESH_BINDING = 1;
+		static const GLuint COMMAND_BINDING = 2;
+		static const GLuint DRAW_COUNT_BINDING = 3;
+		static const GLuint TRANSFORM_BINDING = 4;
+		static const GLuint INSTANCE_ATTRIB = 15;
+
+		static const uint32_t CULL_GROUP_SIZE = 64;
+		// The five uints of a DrawElementsIndirectCommand.
+		static const uint32_t COMMAND_SIZE = 5 * sizeof(GLuint);
+		// The extent of the geometries without a world bound, they are never culled.
+		static const float UNBOUNDED_EXTENT = 1e30f;
+
+		// The std430 layouts of cs_multiDrawCull.glcs.
+		typedef struct MultiDrawInstance
+		{
+			glm::vec4 Center;
+			glm::vec4 Extent;
+			uint32_t Mesh;
+			uint32_t Group;
+			// The first command of the group, the visible instances of the group are packed from there.
+			uint32_t CommandBase;
+			uint32_t Padding;
+		}MultiDrawInstance;
+
+		typedef struct MultiDrawMeshRange
+		{
+			uint32_t Count;
+			uint32_t FirstIndex;
+			int32_t BaseVertex;
+			uint32_t Padding;
+		}MultiDrawMeshRange;
+
+		typedef BufferGL<BufferTarget::SHADER_STORAGE, BufferUsage::DYNAMIC_DRAW, 0> StorageBufferGL;
+		typedef BufferGL<BufferTarget::DRAW_INDIRECT, BufferUsage::DYNAMIC_COPY, 0> IndirectBufferGL;
+		typedef ArrayBufferGL<BufferUsage::STATIC_DRAW, 0> MultiDrawArrayBufferGL;
+		typedef ElementBufferGL<BufferUsage::STATIC_DRAW, 0> MultiDrawElementBufferGL;
+
+		// The culling shader, shared by the batches and released with the last one.
+		static ComputeShader* g_MultiDrawCullCS = nullptr;
+		static GLint g_PlanesLocation = -1;
+		static GLint g_InstanceCountLocation = -1;
+		static GLint g_CompactLocation = -1;
+		static uint32_t g_MultiDrawBatchCount = 0;
+
+		static bool initCullShader()
+		{
+			if (g_MultiDrawCullCS)
+			{
+				return true;
+			}
+
+#if !ENABLE_PROGRAM_PIPELINE
+			// The shader files compile to shader objects then, which can't be dispatched. The batch draws unculled.
+			return false;
+#endif
+
+			const GLCapabilities* pCap = GLCapabilities::get();
+			if (!pCap->OpenGL43 && !(pCap->ARB_compute_shader && pCap->ARB_shader_storage_buffer_object))
+			{
+				return false;
+			}
+
+			g_MultiDrawCullCS = new ComputeShader;
+			GLSLProgram::createShaderFromFile("cs_multiDrawCull.glcs", g_MultiDrawCullCS);
+			g_PlanesLocation = g_MultiDrawCullCS->getUniformLocation("g_Planes");
+			g_InstanceCountLocation = g_MultiDrawCullCS->getUniformLocation("g_InstanceCount");
+			g_CompactLocation = g_MultiDrawCullCS->getUniformLocation("g_Compact");
+			return true;
+		}
+
+		// Makes the buffer hold at least size bytes. A grown buffer loses its content.
+		template<typename BufferType>
+		static void reserveBuffer(BufferType*& pBuffer, uint32_t size)
+		{
+			if (pBuffer == nullptr)
+			{
+				pBuffer = new BufferType;
+			}
+
+			if (pBuffer->getSize() < size)
+			{
+				pBuffer->init(std::max(size + size / 2, 256u));
+			}
+		}
+
+		static void setInstanceBound(Geometry* pGeometry, MultiDrawInstance& instance)
+		{
+			const BoundingVolume* pBound = pGeometry->getWorldBound().get();
+			if (pBound == nullptr)
+			{
+				instance.Center = glm::vec4(0.0f);
+				instance.Extent = glm::vec4(UNBOUNDED_EXTENT);
+			}
+			else if (pBound->getType() == BoundingVolume::Type::AABB)
+			{
+				instance.Center = glm::vec4(pBound->getCenter(), 0.0f);
+				instance.Extent = glm::vec4(static_cast<const BoundingBox*>(pBound)->getExtent(), 0.0f);
+			}
+			else
+			{
+				instance.Center = glm::vec4(pBound->getCenter(), 0.0f);
+				instance.Extent = glm::vec4(glm::vec3(static_cast<const BoundingSphere*>(pBound)->getRadius()), 0.0f);
+			}
+		}
+
+		class MultiDrawBatchBuffer;
+
+		// The geometries of one material and vertex layout. Its shapes are packed once each in one
+		// vertex and one index buffer, so one multi draw submits all of them.
+		class MultiDrawGeometryAssembly : public GeometryAssembly
+		{
+		public:
+			MultiDrawGeometryAssembly(MultiDrawBatchBuffer* pOwner, Material* pMaterial, MeshAttrib layout, GLenum indicesType, GLenum primitive) :
+				m_pOwner(pOwner), m_pMaterial(pMaterial), m_Layout(layout), m_IndicesType(indicesType), m_Primitive(primitive),
+				m_pVertices(nullptr), m_pIndices(nullptr), m_pVAO(nullptr), m_uiIndex(0), m_uiMeshBase(0), m_uiFirstInstance(0), m_uiInstanceCount(0){}
+
+			~MultiDrawGeometryAssembly()
+			{
+				SAFE_DELETE(m_pVAO);
+				SAFE_DELETE(m_pVertices);
+				SAFE_DELETE(m_pIndices);
+			}
+
+			bool matches(Material* pMaterial, MeshAttrib layout, GLenum indicesType, GLenum primitive) const
+			{
+				return m_pMaterial == pMaterial && m_Layout == layout && m_IndicesType == indicesType && m_Primitive == primitive;
+			}
+
+			bool contain(Geometry* pGeo) const override;
+
+			void bind() override;
+			void unbind() override;
+			// Draws the instances left by the last cull of the batch.
+			void draw() override;
+
+			bool isEmpty() override { return m_uiInstanceCount == 0; }
+
+			Material* getMaterial() const { return m_pMaterial; }
+
+		private:
+			// Packs the shapes into the vertex and index buffers and records their ranges.
+			void buildBuffers(const std::vector<const Shape3D*>& shapes, BufferGPU* pInstanceIds);
+
+			MultiDrawBatchBuffer* m_pOwner;
+			Material* m_pMaterial;
+			MeshAttrib m_Layout;
+			GLenum m_IndicesType;
+			GLenum m_Primitive;
+
+			// The shapes packed in the buffers and the ranges of their indices.
+			std::vector<const Shape3D*> m_Shapes;
+			std::vector<MultiDrawMeshRange> m_Ranges;
+			MultiDrawArrayBufferGL* m_pVertices;
+			MultiDrawElementBufferGL* m_pIndices;
+			VertexArrayGL* m_pVAO;
+
+			// The position of the group in the batch, its meshes in the mesh ranges and its instances.
+			uint32_t m_uiIndex;
+			uint32_t m_uiMeshBase;
+			uint32_t m_uiFirstInstance;
+			uint32_t m_uiInstanceCount;
+
+			friend class MultiDrawBatchBuffer;
+		};
+
+		/**
+		 * The MULTI_DRAW batch: the geometries are culled and drawn on the GPU. The bounds, the transforms
+		 * and the mesh of every geometry live in shader storage buffers, cull() runs cs_multiDrawCull.glcs
+		 * against the camera planes and the shader writes the DrawElementsIndirectCommand records. Every
+		 * group of geometries sharing a material and a vertex layout is then drawn with one
+		 * glMultiDrawElementsIndirectCountARB, or glMultiDrawElementsIndirect with the culled commands
+		 * drawing no instance when ARB_indirect_parameters is missing.<p>
+		 * The CPU work of a frame is the upload of the geometries that moved, the dispatch and one draw per
+		 * group, it doesn't grow with the number of geometries. Adding or removing geometries, or changing
+		 * their material or mesh, regroups the whole batch on the next update().<p>
+		 * Only indexed shapes with a combined, non quantized vertex layout can be batched. Their vertex
+		 * shader reads the transform of the instance from the buffer at binding 4, indexed by the integer
+		 * attribute 15, see MultiDrawVS.vert.
+		 */
+		class MultiDrawBatchBuffer : public BatchBuffer
+		{
+		public:
+			MultiDrawBatchBuffer(SpatialManager* pManager) : BatchBuffer(pManager), m_pInstanceBuffer(nullptr), m_pTransformBuffer(nullptr),
+				m_pMeshBuffer(nullptr), m_pDrawCountBuffer(nullptr), m_pCommandBuffer(nullptr), m_pInstanceIdBuffer(nullptr),
+				m_bLayoutDirty(false), m_bCompactCommands(false), m_bCulled(false)
+			{
+				g_MultiDrawBatchCount++;
+
+				const GLCapabilities* pCap = GLCapabilities::get();
+				m_bCountSupported = pCap->ARB_indirect_parameters && glMultiDrawElementsIndirectCountARB != nullptr;
+			}
+
+			~MultiDrawBatchBuffer()
+			{
+				for (MultiDrawGeometryAssembly* pGroup : m_Groups)
+				{
+					delete pGroup;
+				}
+
+				SAFE_DELETE(m_pInstanceBuffer);
+				SAFE_DELETE(m_pTransformBuffer);
+				SAFE_DELETE(m_pMeshBuffer);
+				SAFE_DELETE(m_pDrawCountBuffer);
+				SAFE_DELETE(m_pCommandBuffer);
+				SAFE_DELETE(m_pInstanceIdBuffer);
+
+				if (--g_MultiDrawBatchCount == 0)
+				{
+					SAFE_DELETE(g_MultiDrawCullCS);
+				}
+			}
+
+			bool addGeometry(Geometry* pGeo) override
+			{
+				if (pGeo == nullptr || m_Slots.find(pGeo) != m_Slots.end() || !isBatchable(pGeo))
+				{
+					return false;
+				}
+
+				m_Slots.insert(std::pair<Geometry*, uint32_t>(pGeo, static_cast<uint32_t>(m_Geometries.size())));
+				m_Geometries.push_back(pGeo);
+				m_bLayoutDirty = true;
+				return true;
+			}
+
+			bool removeGeometry(Geometry* pGeo) override
+			{
+				auto it = m_Slots.find(pGeo);
+				if (it == m_Slots.end())
+				{
+					return false;
+				}
+
+				// The order is rebuilt by the next update, swap the last geometry in.
+				const uint32_t slot = it->second;
+				m_Slots.erase(it);
+				if (slot + 1 != m_Geometries.size())
+				{
+					m_Geometries[slot] = m_Geometries.back();
+					m_Slots[m_Geometries[slot]] = slot;
+				}
+				m_Geometries.pop_back();
+				m_bLayoutDirty = true;
+				return true;
+			}
+
+			size_t getGeometryAssemblyCount() const override { return m_Groups.size(); }
+
+			GeometryAssembly* getGeometryAssembly(uint32_t index) override
+			{
+				return index < m_Groups.size() ? m_Groups[index] : nullptr;
+			}
+
+			GeometryAssembly* getGeometryAttribData(Geometry* pGeo) override
+			{
+				if (m_bLayoutDirty)
+				{
+					return nullptr;
+				}
+
+				auto it = m_Slots.find(pGeo);
+				return it != m_Slots.end() ? m_Groups[m_Instances[it->second].Group] : nullptr;
+			}
+
+			// The manager forwards the moves from the thread updating the batch, see SpatialManager::updateSpatialTree().
+			void onTransformChange(Geometry* pGeom) override
+			{
+				m_DirtyGeometries.push_back(pGeom);
+			}
+
+			void onMaterialChange(Geometry* pGeom) override { m_bLayoutDirty = true; }
+
+			void onMeshChange(Geometry* pGeom) override { m_bLayoutDirty = true; }
+
+			void onGeometryUnassociated(Geometry* pGeom) override { removeGeometry(pGeom); }
+
+			void update(/*arguments */) override
+			{
+				if (m_bLayoutDirty)
+				{
+					rebuildLayout();
+				}
+				else
+				{
+					uploadMovedInstances();
+				}
+			}
+
+			void cull(Camera* pCam) override
+			{
+				assert(pCam);
+				const uint32_t instanceCount = static_cast<uint32_t>(m_Instances.size());
+				if (instanceCount == 0 || m_bLayoutDirty || !initCullShader())
+				{
+					return;
+				}
+
+				const Planef* pPlanes = pCam->getWorldPlanes();
+				assert(pCam->getWorldPlaneCount() == 6);
+				glm::vec4 planes[6];
+				for (int i = 0; i < 6; i++)
+				{
+					planes[i] = glm::vec4(pPlanes[i].f3Normal, pPlanes[i].fConstant);
+				}
+
+				if (m_bCountSupported)
+				{
+					m_pDrawCountBuffer->update(0, static_cast<uint32_t>(m_ZeroCounts.size() * sizeof(GLuint)), reinterpret_cast<const uint8_t*>(m_ZeroCounts.data()));
+				}
+
+				const GLuint program = g_MultiDrawCullCS->getProgram();
+				glProgramUniform4fv(program, g_PlanesLocation, 6, reinterpret_cast<const GLfloat*>(planes));
+				glProgramUniform1ui(program, g_InstanceCountLocation, instanceCount);
+				glProgramUniform1i(program, g_CompactLocation, m_bCountSupported ? 1 : 0);
+
+				g_MultiDrawCullCS->enable();
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BINDING, m_pInstanceBuffer->getBufferID());
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_BINDING, m_pMeshBuffer->getBufferID());
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, m_pCommandBuffer->getBufferID());
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COUNT_BINDING, m_pDrawCountBuffer->getBufferID());
+				CHECK_GL(glDispatchCompute((instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1));
+				g_MultiDrawCullCS->disable();
+
+				// The draws read the commands and the counts the shader wrote.
+				glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+				m_bCompactCommands = m_bCountSupported;
+				m_bCulled = true;
+			}
+
+			bool readCullResults(std::vector<uint32_t>& commands, std::vector<uint32_t>& drawCounts) override
+			{
+				if (!m_bCulled || m_bLayoutDirty)
+				{
+					return false;
+				}
+
+				glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+				const uint32_t commandBytes = static_cast<uint32_t>(m_Instances.size()) * COMMAND_SIZE;
+				commands.resize(m_Instances.size() * 5);
+				memcpy(commands.data(), m_pCommandBuffer->map(0, commandBytes, MappingBits::READ), commandBytes);
+				m_pCommandBuffer->unmap();
+
+				drawCounts.clear();
+				if (m_bCompactCommands)
+				{
+					const uint32_t countBytes = static_cast<uint32_t>(m_Groups.size() * sizeof(GLuint));
+					drawCounts.resize(m_Groups.size());
+					memcpy(drawCounts.data(), m_pDrawCountBuffer->map(0, countBytes, MappingBits::READ), countBytes);
+					m_pDrawCountBuffer->unmap();
+				}
+				return true;
+			}
+
+		private:
+			static bool isBatchable(Geometry* pGeo)
+			{
+				const Shape3D* pShape = pGeo->getMesh().get();
+				if (pShape == nullptr)
+				{
+					return false;
+				}
+
+				// The meshes are packed as indexed ranges of one buffer, the restart indices would need
+				// the restart state of the single draws.
+				switch (pShape->getMode())
+				{
+				case Shape3D::Mode::POINTS:
+				case Shape3D::Mode::TRIANGLE_STRIP_RESTART:
+				case Shape3D::Mode::TRIANGLE_FAN_RESTART:
+					return false;
+				default:
+					break;
+				}
+
+				if (pShape->getIndiceCount() <= 0 || pShape->getVertexCount(true) <= 0)
+				{
+					return false;
+				}
+
+				// The quantized positions are decoded with a scale per shape, which one draw can't vary.
+				const MeshAttrib layout = pShape->getSupportCombinedAttrib();
+				return layout != MeshAttrib::NONE && layout != MeshAttrib::P3NT2_U16 && layout != MeshAttrib::P3N_U16;
+			}
+
+			uint32_t findGroup(Geometry* pGeo)
+			{
+				const Shape3D* pShape = pGeo->getMesh().get();
+				Material* pMaterial = pGeo->getMaterial().get();
+				const MeshAttrib layout = pShape->getSupportCombinedAttrib();
+				const GLenum indicesType = ConvertDataTypeToGLenum(pShape->getIndiceType());
+				const GLenum primitive = Shape3D::convertModeToGLenum(pShape->getMode());
+
+				for (uint32_t i = 0; i < m_Groups.size(); i++)
+				{
+					if (m_Groups[i]->matches(pMaterial, layout, indicesType, primitive))
+					{
+						return i;
+					}
+				}
+
+				m_Groups.push_back(new MultiDrawGeometryAssembly(this, pMaterial, layout, indicesType, primitive));
+				m_GroupShapes.push_back(std::vector<const Shape3D*>());
+				return static_cast<uint32_t>(m_Groups.size() - 1);
+			}
+
+			// Sorts the geometries by group, repacks the groups whose shapes changed and uploads everything.
+			void rebuildLayout()
+			{
+				for (std::vector<const Shape3D*>& shapes : m_GroupShapes)
+				{
+					shapes.clear();
+				}
+
+				// The group of every geometry and the index of its shape in the group. A shape is packed once,
+				// the first geometry using it decides its place.
+				const uint32_t geometryCount = static_cast<uint32_t>(m_Geometries.size());
+				std::vector<uint32_t> groups(geometryCount), meshes(geometryCount);
+				std::vector<std::unordered_map<std::string, uint32_t>> shapeIndices;
+				for (uint32_t i = 0; i < geometryCount; i++)
+				{
+					const uint32_t group = findGroup(m_Geometries[i]);
+					shapeIndices.resize(m_Groups.size());
+
+					const Shape3D* pShape = m_Geometries[i]->getMesh().get();
+					std::vector<const Shape3D*>& shapes = m_GroupShapes[group];
+					auto it = shapeIndices[group].insert(std::pair<std::string, uint32_t>(pShape->getUniqueName(), static_cast<uint32_t>(shapes.size())));
+					if (it.second)
+					{
+						shapes.push_back(pShape);
+					}
+
+					groups[i] = group;
+					meshes[i] = it.first->second;
+				}
+
+				// Drop the groups left without geometries.
+				std::vector<uint32_t> groupRemap(m_Groups.size());
+				uint32_t groupCount = 0;
+				for (uint32_t i = 0; i < m_Groups.size(); i++)
+				{
+					if (m_GroupShapes[i].empty())
+					{
+						delete m_Groups[i];
+						continue;
+					}
+
+					groupRemap[i] = groupCount;
+					m_Groups[groupCount] = m_Groups[i];
+					m_GroupShapes[groupCount].swap(m_GroupShapes[i]);
+					groupCount++;
+				}
+				m_Groups.resize(groupCount);
+				m_GroupShapes.resize(groupCount);
+
+				// The instance ids are the vertex attribute read at the base instance of every draw.
+				if (m_pInstanceIdBuffer == nullptr || m_pInstanceIdBuffer->getSize() < geometryCount * sizeof(GLuint))
+				{
+					std::vector<GLuint> ids(std::max(geometryCount + geometryCount / 2, 64u));
+					for (uint32_t i = 0; i < ids.size(); i++)
+					{
+						ids[i] = i;
+					}
+					reserveBuffer(m_pInstanceIdBuffer, static_cast<uint32_t>(ids.size() * sizeof(GLuint)));
+					m_pInstanceIdBuffer->update(0, static_cast<uint32_t>(ids.size() * sizeof(GLuint)), reinterpret_cast<const uint8_t*>(ids.data()));
+				}
+
+				m_MeshRanges.clear();
+				for (uint32_t i = 0; i < groupCount; i++)
+				{
+					MultiDrawGeometryAssembly* pGroup = m_Groups[i];
+					if (pGroup->m_Shapes != m_GroupShapes[i])
+					{
+						pGroup->buildBuffers(m_GroupShapes[i], m_pInstanceIdBuffer);
+					}
+
+					pGroup->m_uiIndex = i;
+					pGroup->m_uiMeshBase = static_cast<uint32_t>(m_MeshRanges.size());
+					pGroup->m_uiInstanceCount = 0;
+					m_MeshRanges.insert(m_MeshRanges.end(), pGroup->m_Ranges.begin(), pGroup->m_Ranges.end());
+				}
+
+				// Counting sort of the geometries by group.
+				for (uint32_t i = 0; i < geometryCount; i++)
+				{
+					groups[i] = groupRemap[groups[i]];
+					m_Groups[groups[i]]->m_uiInstanceCount++;
+				}
+
+				uint32_t firstInstance = 0;
+				for (MultiDrawGeometryAssembly* pGroup : m_Groups)
+				{
+					pGroup->m_uiFirstInstance = firstInstance;
+					firstInstance += pGroup->m_uiInstanceCount;
+				}
+
+				std::vector<uint32_t> nextSlots(groupCount);
+				for (uint32_t i = 0; i < groupCount; i++)
+				{
+					nextSlots[i] = m_Groups[i]->m_uiFirstInstance;
+				}
+
+				std::vector<Geometry*> sorted(geometryCount);
+				m_Instances.resize(geometryCount);
+				m_Transforms.resize(geometryCount);
+				for (uint32_t i = 0; i < geometryCount; i++)
+				{
+					const uint32_t slot = nextSlots[groups[i]]++;
+					MultiDrawGeometryAssembly* pGroup = m_Groups[groups[i]];
+					Geometry* pGeo = m_Geometries[i];
+
+					MultiDrawInstance& instance = m_Instances[slot];
+					setInstanceBound(pGeo, instance);
+					instance.Mesh = pGroup->m_uiMeshBase + meshes[i];
+					instance.Group = groups[i];
+					instance.CommandBase = pGroup->m_uiFirstInstance;
+					instance.Padding = 0;
+					m_Transforms[slot] = pGeo->getWorldMatrix();
+
+					sorted[slot] = pGeo;
+					m_Slots[pGeo] = slot;
+				}
+				m_Geometries.swap(sorted);
+
+				// Everything is uploaded below, the moves queued so far are in.
+				m_DirtyGeometries.clear();
+
+				uploadAll();
+				m_bLayoutDirty = false;
+			}
+
+			void uploadAll()
+			{
+				const uint32_t instanceCount = static_cast<uint32_t>(m_Instances.size());
+				if (instanceCount == 0)
+				{
+					return;
+				}
+
+				const uint32_t instanceBytes = instanceCount * sizeof(MultiDrawInstance);
+				const uint32_t transformBytes = instanceCount * sizeof(glm::mat4);
+				const uint32_t meshBytes = static_cast<uint32_t>(m_MeshRanges.size() * sizeof(MultiDrawMeshRange));
+				reserveBuffer(m_pInstanceBuffer, instanceBytes);
+				reserveBuffer(m_pTransformBuffer, transformBytes);
+				reserveBuffer(m_pMeshBuffer, meshBytes);
+				m_pInstanceBuffer->update(0, instanceBytes, reinterpret_cast<const uint8_t*>(m_Instances.data()));
+				m_pTransformBuffer->update(0, transformBytes, reinterpret_cast<const uint8_t*>(m_Transforms.data()));
+				m_pMeshBuffer->update(0, meshBytes, reinterpret_cast<const uint8_t*>(m_MeshRanges.data()));
+
+				m_ZeroCounts.assign(m_Groups.size(), 0);
+				reserveBuffer(m_pDrawCountBuffer, static_cast<uint32_t>(m_ZeroCounts.size() * sizeof(GLuint)));
+
+				// Until the first cull every instance is drawn, so the batch draws without a GPU cull too.
+				std::vector<GLuint> commands(instanceCount * 5);
+				for (uint32_t i = 0; i < instanceCount; i++)
+				{
+					const MultiDrawMeshRange& mesh = m_MeshRanges[m_Instances[i].Mesh];
+					GLuint* pCommand = &commands[i * 5];
+					pCommand[0] = mesh.Count;
+					pCommand[1] = 1;
+					pCommand[2] = mesh.FirstIndex;
+					pCommand[3] = static_cast<GLuint>(mesh.BaseVertex);
+					pCommand[4] = i;
+				}
+				reserveBuffer(m_pCommandBuffer, instanceCount * COMMAND_SIZE);
+				m_pCommandBuffer->update(0, instanceCount * COMMAND_SIZE, reinterpret_cast<const uint8_t*>(commands.data()));
+				m_bCompactCommands = false;
+				m_bCulled = false;
+			}
+
+			// Uploads the bounds and the transforms of the geometries that moved, the neighbour slots in one call.
+			void uploadMovedInstances()
+			{
+				m_MovedGeometries.swap(m_DirtyGeometries);
+				if (m_MovedGeometries.empty())
+				{
+					return;
+				}
+
+				m_MovedSlots.clear();
+				for (Geometry* pGeo : m_MovedGeometries)
+				{
+					auto it = m_Slots.find(pGeo);
+					if (it != m_Slots.end())
+					{
+						m_MovedSlots.push_back(it->second);
+					}
+				}
+				m_MovedGeometries.clear();
+
+				std::sort(m_MovedSlots.begin(), m_MovedSlots.end());
+				m_MovedSlots.erase(std::unique(m_MovedSlots.begin(), m_MovedSlots.end()), m_MovedSlots.end());
+				for (uint32_t slot : m_MovedSlots)
+				{
+					setInstanceBound(m_Geometries[slot], m_Instances[slot]);
+					m_Transforms[slot] = m_Geometries[slot]->getWorldMatrix();
+				}
+
+				for (size_t i = 0; i < m_MovedSlots.size();)
+				{
+					const uint32_t first = m_MovedSlots[i];
+					uint32_t count = 1;
+					while (i + count < m_MovedSlots.size() && m_MovedSlots[i + count] == first + count)
+					{
+						count++;
+					}
+
+					m_pInstanceBuffer->update(first * sizeof(MultiDrawInstance), count * sizeof(MultiDrawInstance), reinterpret_cast<const uint8_t*>(&m_Instances[first]));
+					m_pTransformBuffer->update(first * sizeof(glm::mat4), count * sizeof(glm::mat4), reinterpret_cast<const uint8_t*>(&m_Transforms[first]));
+					i += count;
+				}
+			}
+
+			// The geometries, in the order of their slots once the layout is up to date.
+			std::vector<Geometry*> m_Geometries;
+			std::unordered_map<Geometry*, uint32_t> m_Slots;
+			std::vector<MultiDrawGeometryAssembly*> m_Groups;
+			// The shapes of every group found by the last rebuild.
+			std::vector<std::vector<const Shape3D*>> m_GroupShapes;
+
+			// The CPU copies of the storage buffers.
+			std::vector<MultiDrawInstance> m_Instances;
+			std::vector<glm::mat4> m_Transforms;
+			std::vector<MultiDrawMeshRange> m_MeshRanges;
+			std::vector<GLuint> m_ZeroCounts;
+
+			StorageBufferGL* m_pInstanceBuffer;
+			StorageBufferGL* m_pTransformBuffer;
+			StorageBufferGL* m_pMeshBuffer;
+			StorageBufferGL* m_pDrawCountBuffer;
+			IndirectBufferGL* m_pCommandBuffer;
+			MultiDrawArrayBufferGL* m_pInstanceIdBuffer;
+
+			std::vector<Geometry*> m_DirtyGeometries;
+			// Scratch of uploadMovedInstances(), kept to avoid reallocating every frame.
+			std::vector<Geometry*> m_MovedGeometries;
+			std::vector<uint32_t> m_MovedSlots;
+
+			bool m_bLayoutDirty;
+			bool m_bCountSupported;
+			// The last cull packed the commands, the draws take their count from the draw count buffer.
+			bool m_bCompactCommands;
+			// cull() ran since the layout was last rebuilt.
+			bool m_bCulled;
+
+			friend class MultiDrawGeometryAssembly;
+		};
+
+		bool MultiDrawGeometryAssembly::contain(Geometry* pGeo) const
+		{
+			auto it = m_pOwner->m_Slots.find(pGeo);
+			return it != m_pOwner->m_Slots.end() && !m_pOwner->m_bLayoutDirty && m_pOwner->m_Instances[it->second].Group == m_uiIndex;
+		}
+
+		void MultiDrawGeometryAssembly::buildBuffers(const std::vector<const Shape3D*>& shapes, BufferGPU* pInstanceIds)
+		{
+			std::vector<uint8_t> vertices, indices;
+			uint32_t vertexStride = 0;
+			m_Ranges.clear();
+			for (const Shape3D* pShape : shapes)
+			{
+				const MeteData* pVertexData = SpatialManager::getGeometryMemoryData(pShape, m_Layout, true).MemoryData.get();
+				const MeteData* pIndexData = SpatialManager::getGeometryMemoryData(pShape, MeshAttrib::INDICES, true).MemoryData.get();
+				assert(pVertexData && pIndexData);
+
+				const uint32_t vertexCount = static_cast<uint32_t>(pShape->getVertexCount(true));
+				const uint32_t indexCount = static_cast<uint32_t>(pShape->getIndiceCount());
+				assert(vertexCount && indexCount);
+
+				const uint32_t stride = pVertexData->uiLength / vertexCount;
+				assert(vertexStride == 0 || vertexStride == stride);
+				vertexStride = stride;
+
+				MultiDrawMeshRange range;
+				range.Count = indexCount;
+				range.FirstIndex = static_cast<uint32_t>(indices.size() / (pIndexData->uiLength / indexCount));
+				range.BaseVertex = static_cast<int32_t>(vertices.size() / stride);
+				range.Padding = 0;
+				m_Ranges.push_back(range);
+
+				vertices.insert(vertices.end(), pVertexData->pData, pVertexData->pData + pVertexData->uiLength);
+				indices.insert(indices.end(), pIndexData->pData, pIndexData->pData + pIndexData->uiLength);
+			}
+			m_Shapes = shapes;
+
+			reserveBuffer(m_pVertices, static_cast<uint32_t>(vertices.size()));
+			m_pVertices->update(0, static_cast<uint32_t>(vertices.size()), vertices.data());
+			reserveBuffer(m_pIndices, static_cast<uint32_t>(indices.size()));
+			m_pIndices->update(0, static_cast<uint32_t>(indices.size()), indices.data());
+
+			std::vector<AttribDesc> attribDescs;
+			const uint32_t attribCount = ParseMeshAttrib(m_Layout, attribDescs);
+			GeometryAttribDesc arrayBufferDesc = { attribCount, attribDescs.data() };
+			BufferGPU* pArrayBuffer = m_pVertices;
+
+			BufferData bufferData;
+			bufferData.ArrayBufferCount = 1;
+			bufferData.ArrayBufferDescs = &arrayBufferDesc;
+			bufferData.ArrayBuffers = &pArrayBuffer;
+			bufferData.ElementBuffer = m_pIndices;
+
+			if (m_pVAO == nullptr)
+			{
+				m_pVAO = new VertexArrayGL;
+			}
+			m_pVAO->bind();
+			m_pVAO->load(&bufferData);
+
+			// One id per instance, the draws start it at their base instance.
+			pInstanceIds->bind();
+			glEnableVertexAttribArray(INSTANCE_ATTRIB);
+			glVertexAttribIPointer(INSTANCE_ATTRIB, 1, GL_UNSIGNED_INT, 0, nullptr);
+			glVertexAttribDivisor(INSTANCE_ATTRIB, 1);
+			m_pVAO->unbind();
+		}
+
+		void MultiDrawGeometryAssembly::bind()
+		{
+			m_pVAO->bind();
+			m_pOwner->m_pCommandBuffer->bind();
+			if (m_pOwner->m_bCompactCommands)
+			{
+				glBindBuffer(GL_PARAMETER_BUFFER_ARB, m_pOwner->m_pDrawCountBuffer->getBufferID());
+			}
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORM_BINDING, m_pOwner->m_pTransformBuffer->getBufferID());
+		}
+
+		void MultiDrawGeometryAssembly::unbind()
+		{
+			m_pVAO->unbind();
+		}
+
+		void MultiDrawGeometryAssembly::draw()
+		{
+			if (m_uiInstanceCount == 0)
+			{
+				return;
+			}
+
+			const GLvoid* pCommands = reinterpret_cast<const GLvoid*>(static_cast<uintptr_t>(m_uiFirstInstance) * COMMAND_SIZE);
+			if (m_pOwner->m_bCompactCommands)
+			{
+				CHECK_GL(glMultiDrawElementsIndirectCountARB(m_Primitive, m_IndicesType, pCommands, static_cast<GLintptr>(m_uiIndex * sizeof(GLuint)), m_uiInstanceCount, 0));
+			}
+			else
+			{
+				CHECK_GL(glMultiDrawElementsIndirect(m_Primitive, m_IndicesType, pCommands, m_uiInstanceCount, 0));
+			}
+		}
+
+		BatchBuffer* CreateMultiDrawBatchBuffer(SpatialManager* pManager)
+		{
+			return new MultiDrawBatchBuffer(pManager);
+		}
+	}
+}
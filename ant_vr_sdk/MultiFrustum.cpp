@@ -0,0 +1,152 @@
+#include "MultiFrustum.h"
+#include <algorithm>
+#include <float.h>
+
+namespace jet
+{
+	namespace util
+	{
+		// The point on the three planes, dot(n, p) = d for each of them.
+		static glm::vec3 intersectPlanes(const Planef& p1, const Planef& p2, const Planef& p3)
+		{
+			const glm::vec3 n23 = glm::cross(p2.f3Normal, p3.f3Normal);
+			const glm::vec3 n31 = glm::cross(p3.f3Normal, p1.f3Normal);
+			const glm::vec3 n12 = glm::cross(p1.f3Normal, p2.f3Normal);
+			const float denominator = glm::dot(p1.f3Normal, n23);
+			assert(denominator != 0.0f);
+			return (p1.fConstant * n23 + p2.fConstant * n31 + p3.fConstant * n12) / denominator;
+		}
+
+		// The side of a box to the plane: -1 fully negative, 1 fully positive, 0 crossing it.
+		static int32_t whichSide(const Planef& plane, const glm::vec3& center, const glm::vec3& extent)
+		{
+			const float distance = glm::dot(plane.f3Normal, center) - plane.fConstant;
+			const float radius = glm::dot(glm::abs(plane.f3Normal), extent);
+			return distance < -radius ? -1 : (distance > radius ? 1 : 0);
+		}
+
+		void MultiFrustum::set(Camera* const* pCams, uint32_t count)
+		{
+			assert(count > 0 && count <= MAX_CAMERAS);
+			assert(pCams[0]->getWorldPlaneCount() == PLANE_COUNT);
+
+			m_uiCount = count;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				std::copy(pCams[i]->getWorldPlanes(), pCams[i]->getWorldPlanes() + PLANE_COUNT, m_Planes[i]);
+			}
+
+			// The planes of a camera are left, right, bottom, top, far, near, a corner is on one of each pair.
+			const Planef* pFirst = m_Planes[0];
+			float constants[PLANE_COUNT];
+			std::fill(constants, constants + PLANE_COUNT, FLT_MAX);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const Planef* pPlanes = m_Planes[i];
+				for (int32_t corner = 0; corner < 8; corner++)
+				{
+					const glm::vec3 point = intersectPlanes(pPlanes[corner & 1], pPlanes[2 + ((corner >> 1) & 1)], pPlanes[4 + ((corner >> 2) & 1)]);
+					for (uint32_t j = 0; j < PLANE_COUNT; j++)
+					{
+						constants[j] = std::min(constants[j], glm::dot(pFirst[j].f3Normal, point));
+					}
+				}
+			}
+
+			for (uint32_t j = 0; j < PLANE_COUNT; j++)
+			{
+				m_CombinedPlanes[j] = Planef(pFirst[j].f3Normal, constants[j]);
+			}
+		}
+
+		MultiFrustum::State MultiFrustum::getRootState() const
+		{
+			State state;
+			state.VisibleMask = getAllMask();
+			state.InsideMask = 0;
+			state.CombinedPlanes = 0;
+			std::fill(state.Planes, state.Planes + MAX_CAMERAS, static_cast<uint8_t>(0));
+			return state;
+		}
+
+		bool MultiFrustum::test(const glm::vec3& center, const glm::vec3& extent, State& state) const
+		{
+			const uint8_t allPlanes = (1u << PLANE_COUNT) - 1;
+			const uint32_t testMask = state.VisibleMask & ~state.InsideMask;
+			if (testMask == 0)
+			{
+				return state.VisibleMask != 0;
+			}
+
+			// A camera containing the bound means it is inside the combined frustum as well.
+			if (state.InsideMask == 0 && state.CombinedPlanes != allPlanes)
+			{
+				for (uint32_t j = 0; j < PLANE_COUNT; j++)
+				{
+					if (state.CombinedPlanes & (1u << j))
+						continue;
+
+					const int32_t side = whichSide(m_CombinedPlanes[j], center, extent);
+					if (side < 0)
+					{
+						state.VisibleMask = 0;
+						return false;
+					}
+					else if (side > 0)
+					{
+						state.CombinedPlanes |= 1u << j;
+					}
+				}
+			}
+
+			for (uint32_t i = 0; i < m_uiCount; i++)
+			{
+				const uint32_t bit = 1u << i;
+				if ((testMask & bit) == 0)
+					continue;
+
+				uint8_t planes = state.Planes[i];
+				for (uint32_t j = 0; j < PLANE_COUNT; j++)
+				{
+					if (planes & (1u << j))
+						continue;
+
+					const int32_t side = whichSide(m_Planes[i][j], center, extent);
+					if (side < 0)
+					{
+						state.VisibleMask &= ~bit;
+						break;
+					}
+					else if (side > 0)
+					{
+						planes |= 1u << j;
+					}
+				}
+
+				state.Planes[i] = planes;
+				if (planes == allPlanes)
+				{
+					state.InsideMask |= bit;
+				}
+			}
+
+			return state.VisibleMask != 0;
+		}
+
+		bool MultiFrustum::test(const BoundingVolume* pBound, State& state) const
+		{
+			if (pBound == nullptr)
+			{
+				return state.VisibleMask != 0;
+			}
+			else if (pBound->getType() == BoundingVolume::Type::AABB)
+			{
+				return test(pBound->getCenter(), static_cast<const BoundingBox*>(pBound)->getExtent(), state);
+			}
+			else
+			{
+				return test(pBound->getCenter(), glm::vec3(static_cast<const BoundingSphere*>(pBound)->getRadius()), state);
+			}
+		}
+	}
+}
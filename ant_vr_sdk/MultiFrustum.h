@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Camera.h"
+#include <stdint.h>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * The frusta of several cameras culled together, e.g. the two eyes of a stereo pair or the
+		 * cascades of a shadow map, so a scene walk tests every bound once for all of them.<p>
+		 * The combined frustum encloses the frusta of all the cameras: its planes have the normals of
+		 * the first camera, each moved out to the farthest corner of any frustum. A bound outside of it
+		 * is outside of every camera and is rejected by one test, the other ones are then tested
+		 * against the planes of each camera. The results are masks with the bit i set for camera i.
+		 */
+		class MultiFrustum
+		{
+		public:
+			static const uint32_t MAX_CAMERAS = 32;
+			static const uint32_t PLANE_COUNT = 6;
+
+			MultiFrustum() : m_uiCount(0){}
+
+			/// Copies the world planes of the cameras, call it again once they moved.
+			void set(Camera* const* pCams, uint32_t count);
+
+			uint32_t getCameraCount() const { return m_uiCount; }
+			/// The mask with the bits of all the cameras.
+			uint32_t getAllMask() const { return m_uiCount == 32 ? 0xFFFFFFFFu : (1u << m_uiCount) - 1; }
+
+			const Planef* getCombinedPlanes() const { return m_CombinedPlanes; }
+			const Planef* getPlanes(uint32_t camera) const { assert(camera < m_uiCount); return m_Planes[camera]; }
+
+			/**
+			 * The result of a bound for all the cameras, which its children start from. The planes a
+			 * bound is fully inside of are skipped for them, and a camera containing it entirely isn't
+			 * tested any more.
+			 */
+			typedef struct State
+			{
+				// The cameras seeing the bound, fully or in part.
+				uint32_t VisibleMask;
+				// The cameras fully containing the bound.
+				uint32_t InsideMask;
+				// The planes of the combined frustum, and of each camera, fully containing the bound.
+				uint8_t CombinedPlanes;
+				uint8_t Planes[MAX_CAMERAS];
+			}State;
+
+			/// The state of the root of a walk, every camera is tested.
+			State getRootState() const;
+
+			/**
+			 * Tests the box against the cameras still seeing its parent, state holds the result of the
+			 * parent on input and the one of the box on output. Returns false if no camera sees the box.
+			 */
+			bool test(const glm::vec3& center, const glm::vec3& extent, State& state) const;
+			/// The same with the box enclosing the bound, a missing bound is seen by the cameras of its parent.
+			bool test(const BoundingVolume* pBound, State& state) const;
+
+		private:
+			Planef m_CombinedPlanes[PLANE_COUNT];
+			Planef m_Planes[MAX_CAMERAS][PLANE_COUNT];
+			uint32_t m_uiCount;
+		};
+	}
+}
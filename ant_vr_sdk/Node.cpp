@@ -1,11 +1,15 @@
 #include "Node.h"
 #include "Geometry.h"
 #include "SpatialManager.h"
+#include "JobSystem.h"
+#include "ControlRegistry.h"
 
 namespace jet
 {
 	namespace util
 	{
+		// The children of a node updated by one job when its update is parallel, see Node::setParallelGeometricUpdate().
+		static const uint32_t CHILDREN_PER_JOB = 32;
 		
 		/**
 		* Constructor instantiates a new <code>Node</code> with a default empty
@@ -14,7 +18,7 @@ namespace jet
 		* @param name the name of the scene element. This is required for
 		* identification and comparison purposes.
 		*/
-		Node::Node(const std::string& name) : Spatial(name), m_pSpatialManager(nullptr)
+		Node::Node(const std::string& name) : Spatial(name, SpatialType::NODE), m_pSpatialManager(nullptr)
 		{
 			// For backwards compatibility, only clear the "requires
 			// update" flag if we are not a subclass of Node.
@@ -25,6 +29,11 @@ namespace jet
 			setRequiresUpdates(strcmp(pName, "Node") != 0);
 		}
 
+		Node::~Node()
+		{
+			delete m_pControlRegistry;
+		}
+
 		void Node::updateLogicalState(float tpf)
 		{
 			Spatial::updateLogicalState(tpf);
@@ -37,9 +46,11 @@ namespace jet
 				return;
 			}
 
-			for (Spatial* s : getUpdateList()) {
-				s->updateLogicalState(tpf);
+			if (m_pControlRegistry == nullptr)
+			{
+				m_pControlRegistry = new ControlRegistry();
 			}
+			m_pControlRegistry->update(this, tpf, m_bParallelLogicalUpdate);
 		}
 
 		void Node::updateGeometricState()
@@ -72,8 +83,34 @@ namespace jet
 				// a round-trip later on.
 				// NOTE 9/19/09
 				// Although it does save a round trip,
-				for (Spatial* pChild : m_pChildren) {
-					pChild->updateGeometricState();
+
+				if (m_bParallelGeometricUpdate && m_pChildren.size() > CHILDREN_PER_JOB)
+				{
+					// The manager keeps the geometries moved by every worker apart until the jobs are done.
+					if (m_pSpatialManager)
+					{
+						m_pSpatialManager->beginParallelUpdate();
+					}
+
+					JobSystem::get().parallelFor(static_cast<uint32_t>(m_pChildren.size()), CHILDREN_PER_JOB, [this](uint32_t first, uint32_t count)
+					{
+						for (uint32_t i = first; i < first + count; i++)
+						{
+							m_pChildren[i]->updateGeometricState();
+						}
+					});
+
+					if (m_pSpatialManager)
+					{
+						m_pSpatialManager->endParallelUpdate();
+					}
+				}
+				else
+				{
+					for (Spatial* pChild : m_pChildren)
+					{
+						pChild->updateGeometricState();
+					}
 				}
 			}
 
@@ -139,21 +176,8 @@ namespace jet
 			//					throw new NullPointerException();
 			assert(pChild);
 
-			if (pChild->getParent() != this && pChild != this)
+			if (insertChild(pChild, index))
 			{
-				if (pChild->getParent() != nullptr)
-				{
-					pChild->getParent()->detachChild(pChild);
-				}
-				pChild->setParent(this);
-				//					m_pChildren.add(index, pChild);
-				m_pChildren.insert(m_pChildren.begin() + index, pChild);
-				// XXX: Not entirely correct? Forces bound update up the
-				// tree stemming from the attached child. Also forces
-				// transform update down the tree-
-				pChild->setTransformRefresh();
-				pChild->setLightListRefresh();
-				pChild->setMatParamOverrideRefresh();
 #if 0
 				if (logger.isLoggable(Level.FINE)) {
 					logger.log(Level.FINE, "Child ({0}) attached to this node ({1})",
@@ -164,10 +188,9 @@ namespace jet
 				{
 					m_pSpatialManager->addSpatial(pChild);
 
-					Node* pNode = dynamic_cast<Node*>(pChild);
-					if (pNode)
+					if (pChild->isNode())
 					{
-						pNode->m_pSpatialManager = m_pSpatialManager;
+						static_cast<Node*>(pChild)->m_pSpatialManager = m_pSpatialManager;
 					}
 				}
 
@@ -176,6 +199,66 @@ namespace jet
 			return m_pChildren.size();
 		}
 
+		size_t Node::attachChildren(Spatial* const* pChildren, uint32_t count)
+		{
+			const size_t first = m_pChildren.size();
+			m_pChildren.reserve(first + count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				assert(pChildren[i]);
+				insertChild(pChildren[i], static_cast<uint32_t>(m_pChildren.size()));
+			}
+
+			const uint32_t attached = static_cast<uint32_t>(m_pChildren.size() - first);
+			if (attached == 0)
+			{
+				return m_pChildren.size();
+			}
+
+			if (m_pSpatialManager)
+			{
+				m_pSpatialManager->addSpatials(&m_pChildren[first], attached);
+
+				for (size_t i = first; i < m_pChildren.size(); i++)
+				{
+					if (m_pChildren[i]->isNode())
+					{
+						static_cast<Node*>(m_pChildren[i])->m_pSpatialManager = m_pSpatialManager;
+					}
+				}
+			}
+
+			invalidateUpdateList();
+			return m_pChildren.size();
+		}
+
+		bool Node::insertChild(Spatial* pChild, uint32_t index)
+		{
+			if (pChild->getParent() == this || pChild == this)
+			{
+				return false;
+			}
+
+			if (pChild->getParent() != nullptr)
+			{
+				pChild->getParent()->detachChild(pChild);
+			}
+			pChild->setParent(this);
+			//					m_pChildren.add(index, pChild);
+			m_pChildren.insert(m_pChildren.begin() + index, pChild);
+			for (size_t i = index; i < m_pChildren.size(); i++)
+			{
+				m_pChildren[i]->m_uiChildIndex = static_cast<uint32_t>(i);
+			}
+			// XXX: Not entirely correct? Forces bound update up the
+			// tree stemming from the attached child. Also forces
+			// transform update down the tree-
+			pChild->setTransformRefresh();
+			pChild->setLightListRefresh();
+			pChild->setMatParamOverrideRefresh();
+			return true;
+		}
+
 		/**
 		* <code>detachChild</code> removes a given child from the node's list.
 		* This child will no longer be maintained.
@@ -192,17 +275,45 @@ namespace jet
 
 			if (pChild->getParent() == this)
 			{
-				int index = Numeric::indexOf(m_pChildren, pChild);
-				if (index != -1)
-				{
-					detachChildAt(index);
-				}
+				int index = static_cast<int>(pChild->m_uiChildIndex);
+				assert(m_pChildren[index] == pChild);
+				detachChildAt(index);
 				return index;
 			}
 
 			return -1;
 		}
 
+		uint32_t Node::detachChildren(Spatial* const* pChildren, uint32_t count)
+		{
+			std::vector<Spatial*> detached;
+			detached.reserve(count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				Spatial* pChild = pChildren[i];
+				assert(pChild);
+				if (pChild->getParent() == this)
+				{
+					removeChild(pChild->m_uiChildIndex);
+					detached.push_back(pChild);
+				}
+			}
+
+			if (detached.empty())
+			{
+				return 0;
+			}
+
+			setBoundRefresh();
+			if (m_pSpatialManager)
+			{
+				m_pSpatialManager->removeSpatials(detached.data(), static_cast<uint32_t>(detached.size()));
+			}
+
+			invalidateUpdateList();
+			return static_cast<uint32_t>(detached.size());
+		}
+
 		/**
 		* <code>detachChild</code> removes a given child from the node's list.
 		* This child will no longe be maintained. Only the first child with a
@@ -240,17 +351,36 @@ namespace jet
 		*/
 		Spatial* Node::detachChildAt(int index)
 		{
-			Spatial* pChild = m_pChildren[index];
-			m_pChildren.erase(m_pChildren.begin() + index);
+			Spatial* pChild = removeChild(index);
 			if (pChild != nullptr)
 			{
-				pChild->setParent(nullptr);
 				//					logger.log(Level.FINE, "{0}: Child removed.", this.toString());
 
 				// since a child with a bound was detached;
 				// our own bound will probably change.
 				setBoundRefresh();
 
+				if (m_pSpatialManager)
+				{
+					m_pSpatialManager->removeSpatial(pChild);
+				}
+
+				invalidateUpdateList();
+			}
+			return pChild;
+		}
+
+		Spatial* Node::removeChild(uint32_t index)
+		{
+			// The last child fills the hole, nothing else moves.
+			Spatial* pChild = m_pChildren[index];
+			m_pChildren[index] = m_pChildren.back();
+			m_pChildren[index]->m_uiChildIndex = index;
+			m_pChildren.pop_back();
+			if (pChild != nullptr)
+			{
+				pChild->setParent(nullptr);
+
 				// our world transform no longer influences the child.
 				// XXX: Not neccessary? Since child will have transform updated
 				// when attached anyway.
@@ -258,13 +388,6 @@ namespace jet
 				// lights are also inherited from parent
 				pChild->setLightListRefresh();
 				pChild->setMatParamOverrideRefresh();
-
-				if (m_pSpatialManager)
-				{
-					m_pSpatialManager->removeSpatial(pChild);
-				}
-
-				invalidateUpdateList();
 			}
 			return pChild;
 		}
@@ -276,12 +399,9 @@ namespace jet
 		*/
 		void Node::detachAllChildren() 
 		{
-			// Note: this could be a bit more efficient if it delegated
-			// to a private method that avoided setBoundRefresh(), etc.
-			// for every child and instead did one in here at the end.
-			for (int i = m_pChildren.size() - 1; i >= 0; i--) {
-				detachChildAt(i);
-			}
+			// The children are removed from the end, the list is copied since the batch removes them from it.
+			std::vector<Spatial*> children(m_pChildren.rbegin(), m_pChildren.rend());
+			detachChildren(children.data(), static_cast<uint32_t>(children.size()));
 			//				logger.log(Level.FINE, "{0}: All children removed.", this.toString());
 		}
 
@@ -293,13 +413,9 @@ namespace jet
 		*/
 		void Node::swapChildren(int index1, int index2)
 		{
-#if 0
-			Spatial c2 = children.get(index2);
-			Spatial c1 = children.remove(index1);
-			children.add(index1, c2);
-			children.remove(index2);
-			children.add(index2, c1);
-#endif
+			std::swap(m_pChildren[index1], m_pChildren[index2]);
+			m_pChildren[index1]->m_uiChildIndex = index1;
+			m_pChildren[index2]->m_uiChildIndex = index2;
 		}
 
 		/*
@@ -352,14 +468,10 @@ namespace jet
 		*/
 		bool Node::hasChild(Spatial* spat)
 		{
-			//				if (m_pChildren.contains(spat))
-			if (Numeric::indexOf(m_pChildren, spat) >= 0)
-				return true;
-
-			for (Spatial* pChild : m_pChildren) 
+			// The descendants are found by walking up from the spatial, not down the whole branch.
+			for (Node* pNode = spat ? spat->getParent() : nullptr; pNode != nullptr; pNode = pNode->getParent())
 			{
-				Node* pNode = static_cast<Node*>(pChild);
-				if (pNode && pNode->hasChild(spat))
+				if (pNode == this)
 				{
 					return true;
 				}
@@ -399,6 +511,41 @@ namespace jet
 			}
 		}
 
+		int Node::collideWith(const Ray& ray, CollisionResults& results)
+		{
+			// The bound of a node encloses its children, a ray missing it misses all of them.
+			const BoundingVolume* pBound = getWorldBound().get();
+			if (pBound && !pBound->intersects(ray))
+			{
+				return 0;
+			}
+
+			int total = 0;
+			for (Spatial* pChild : m_pChildren)
+			{
+				total += pChild->collideWith(ray, results);
+			}
+			return total;
+		}
+
+		bool Node::intersectsAny(const Ray& ray)
+		{
+			const BoundingVolume* pBound = getWorldBound().get();
+			if (pBound && !pBound->intersects(ray))
+			{
+				return false;
+			}
+
+			for (Spatial* pChild : m_pChildren)
+			{
+				if (pChild->intersectsAny(ray))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
 		void Node::updateModelBound()
 		{
 			for (Spatial* pChild : m_pChildren)
@@ -450,30 +597,40 @@ namespace jet
 		void Node::updateWorldBound()
 		{
 			Spatial::updateWorldBound();
-#if 0
+
 			// for a node, the world bound is a combination of all it's children
 			// bounds
 			BoundingVolume* pResultBound = nullptr;
 			for (Spatial* pChild : m_pChildren)
 			{
 				// child bound is assumed to be updated
-				assert(pChild->m_iRefreshFlags & RF_BOUND) == 0;
+				assert((pChild->m_iRefreshFlags & RF_BOUND) == 0);
+				BoundingVolume* pChildBound = pChild->getWorldBound().get();
+				if (pChildBound == nullptr)
+				{
+					continue;
+				}
+
 				if (pResultBound)
 				{
 					// merge current world bound with child world bound
-					pResultBound->mergeLocal(pChild->getWorldBound());
+					pResultBound->mergeLocal(pChildBound);
 				}
 				else
 				{
-					// set world bound to first non-null child world bound
-					if (pChild->getWorldBound())
+					// set world bound to first non-null child world bound, reusing our own storage when the types match
+					pResultBound = pChildBound->clone(m_pWorldBound.get());
+					if (pResultBound != m_pWorldBound.get())
 					{
-						resultBound = child.getWorldBound().clone(this.worldBound);
+						m_pWorldBound.reset(pResultBound);
 					}
 				}
 			}
-			this.worldBound = resultBound;
-#endif
+
+			if (pResultBound == nullptr)
+			{
+				m_pWorldBound.reset();
+			}
 		}
 
 		void Node::setParent(Node* parent)
@@ -484,36 +641,14 @@ namespace jet
 				// we had an updateList then we clear it completely to
 				// avoid holding the dead array.
 				//					updateList = null;
-				m_pUpdateList.clear();
-				m_bUpdateListValid = false;
+				delete m_pControlRegistry;
+				m_pControlRegistry = nullptr;
 			}
 			Spatial::setParent(parent);
 		}
 
 //	private:
 
-		void Node::addUpdateChildren(std::vector<Spatial*> results)
-		{
-			for (Spatial* pChild : m_pChildren)
-			{
-				if (pChild->requiresUpdates())
-				{
-					results.push_back(pChild);
-				}
-				/*
-				if (child instanceof Node) {
-				((Node)child).addUpdateChildren(results);
-				}
-				*/
-
-				Node* pNode = dynamic_cast<Node*>(pChild);
-				if (pNode)
-				{
-					pNode->addUpdateChildren(results);
-				}
-			}
-		}
-
 		/**
 		*  Called to invalidate the root node's update list.  This is
 		*  called whenever a spatial is attached/detached as well as
@@ -522,26 +657,14 @@ namespace jet
 		*/
 		void Node::invalidateUpdateList()
 		{
-			m_bUpdateListValid = false;
-			if (m_pParent)
+			if (m_pControlRegistry)
 			{
-				m_pParent->invalidateUpdateList();
+				m_pControlRegistry->invalidate();
 			}
-		}
-
-		std::vector<Spatial*>& Node::getUpdateList()
-		{
-			if (m_bUpdateListValid)
+			if (m_pParent)
 			{
-				return m_pUpdateList;
+				m_pParent->invalidateUpdateList();
 			}
-
-			m_pUpdateList.clear();
-
-			// Build the list
-			addUpdateChildren(m_pUpdateList);
-			m_bUpdateListValid = true;
-			return m_pUpdateList;
 		}
 	}
 }
@@ -18,6 +18,7 @@ namespace jet
 		{
 		public:
 			friend class SceneManager;
+			friend class Spatial;
 			/**
 			* Constructor instantiates a new <code>Node</code> with a default empty
 			* list for containing children.
@@ -27,6 +28,8 @@ namespace jet
 			*/
 			Node(const std::string& name);
 
+			~Node();
+
 			/**
 			*
 			* <code>getQuantity</code> returns the number of children this node
@@ -38,6 +41,24 @@ namespace jet
 
 			void updateLogicalState(float tpf) override;
 
+			/**
+			* Lets the root call updateLogicalState() of the spatials requiring it as jobs of
+			* the {@link JobSystem}. Only turn it on when their updates only change their own
+			* spatial, and don't attach or detach spatials. Off by default. The controls
+			* declare it themselves with {@link Control#isIndependent()}.
+			*/
+			void setParallelLogicalUpdate(bool bParallel) { m_bParallelLogicalUpdate = bParallel; }
+			bool isParallelLogicalUpdate() const { return m_bParallelLogicalUpdate; }
+
+			/**
+			* Lets updateGeometricState() refresh the children of this node as jobs of the
+			* {@link JobSystem}, each branch on one thread. Only worth it for a node whose
+			* children hold large branches, the small ones cost more to hand out than to
+			* update. Off by default.
+			*/
+			void setParallelGeometricUpdate(bool bParallel) { m_bParallelGeometricUpdate = bParallel; }
+			bool isParallelGeometricUpdate() const { return m_bParallelGeometricUpdate; }
+
 			void updateGeometricState() override;
 
 			/**
@@ -80,6 +101,7 @@ namespace jet
 			* returned.
 			* <br>
 			* If the child already had a parent it is detached from that former parent.
+			* The children after the index are moved, attachChild() is cheaper.
 			*
 			* @param child
 			*            the child to attach to this node.
@@ -88,9 +110,19 @@ namespace jet
 			*/
 			size_t attachChildAt(Spatial* pChild, int index);
 
+			/**
+			* <code>attachChildren</code> attaches the spatials after the children of this
+			* node, as attachChild() does for each of them, but the update list is
+			* invalidated and the {@link SpatialManager} notified once for the batch.
+			*
+			* @return the number of children maintained by this node.
+			*/
+			size_t attachChildren(Spatial* const* pChildren, uint32_t count);
+
 			/**
 			* <code>detachChild</code> removes a given child from the node's list.
-			* This child will no longer be maintained.
+			* This child will no longer be maintained. The last child takes its
+			* index, so the child is removed in constant time.
 			*
 			* @param child
 			*            the child to remove.
@@ -98,6 +130,16 @@ namespace jet
 			*/
 			int detachChild(Spatial* pChild);
 
+			/**
+			* <code>detachChildren</code> removes the given children, as detachChild() does
+			* for each of them, but the update list is invalidated and the
+			* {@link SpatialManager} notified once for the batch. The spatials that are
+			* not children of this node are skipped.
+			*
+			* @return the number of detached children.
+			*/
+			uint32_t detachChildren(Spatial* const* pChildren, uint32_t count);
+
 			/**
 			* <code>detachChild</code> removes a given child from the node's list.
 			* This child will no longe be maintained. Only the first child with a
@@ -112,7 +154,7 @@ namespace jet
 			/**
 			*
 			* <code>detachChildAt</code> removes a child at a given index. That child
-			* is returned for saving purposes.
+			* is returned for saving purposes. The last child takes the index.
 			*
 			* @param index
 			*            the index of the child to be removed.
@@ -136,7 +178,7 @@ namespace jet
 			*          The index of the spatial in the node's children, or -1
 			*          if the spatial is not attached to this node
 			*/
-			int getChildIndex(Spatial* sp) { return Numeric::indexOf(m_pChildren, sp); }
+			int getChildIndex(Spatial* sp) { return (sp && sp->m_pParent == this) ? static_cast<int>(sp->m_uiChildIndex) : -1; }
 
 			/**
 			* More efficient than e.g detaching and attaching as no updates are needed.
@@ -189,79 +231,21 @@ namespace jet
 
 			void setLodLevel(int lod) override;
 
-#if 0
-			int collideWith(Collidable other, CollisionResults results){
-				int total = 0;
-				// optimization: try collideWith BoundingVolume to avoid possibly redundant tests on children
-				// number 4 in condition is somewhat arbitrary. When there is only one child, the boundingVolume test is redundant at all.
-				// The idea is when there are few children, it can be too expensive to test boundingVolume first.
-				/*
-				I'm removing this change until some issues can be addressed and I really
-				think it needs to be implemented a better way anyway.
-				First, it causes issues for anyone doing collideWith() with BoundingVolumes
-				and expecting it to trickle down to the children.  For example, children
-				with BoundingSphere bounding volumes and collideWith(BoundingSphere).  Doing
-				a collision check at the parent level then has to do a BoundingSphere to BoundingBox
-				collision which isn't resolved.  (Having to come up with a collision point in that
-				case is tricky and the first sign that this is the wrong approach.)
-				Second, the rippling changes this caused to 'optimize' collideWith() for this
-				special use-case are another sign that this approach was a bit dodgy.  The whole
-				idea of calculating a full collision just to see if the two shapes collide at all
-				is very wasteful.
-				A proper implementation should support a simpler boolean check that doesn't do
-				all of that calculation.  For example, if 'other' is also a BoundingVolume (ie: 99.9%
-				of all non-Ray cases) then a direct BV to BV intersects() test can be done.  So much
-				faster.  And if 'other' _is_ a Ray then the BV.intersects(Ray) call can be done.
-				I don't have time to do it right now but I'll at least un-break a bunch of peoples'
-				code until it can be 'optimized' properly.  Hopefully it's not too late to back out
-				the other dodgy ripples this caused.  -pspeed (hindsight-expert ;))
-				Note: the code itself is relatively simple to implement but I don't have time to
-				a) test it, and b) see if '> 4' is still a decent check for it.  Could be it's fast
-				enough to do all the time for > 1.
-				if (children.size() > 4)
-				{
-				BoundingVolume bv = this.getWorldBound();
-				if (bv==null) return 0;
-
-				// collideWith without CollisionResults parameter used to avoid allocation when possible
-				if (bv.collideWith(other) == 0) return 0;
-				}
-				*/
-				for (Spatial* pChild : m_pChildren){
-					total += pChild->collideWith(other, results);
-				}
-				return total;
-			}
-#endif
+			int collideWith(const Ray& ray, CollisionResults& results) override;
+			bool intersectsAny(const Ray& ray) override;
+
 			void setModelBound(BoundingVolumePtr modelBound) override;
 			virtual void updateModelBound() override;
 			virtual bool isBatchNode() const { return false; }
 
-#if 0
-			void depthFirstTraversal(SceneGraphVisitor visitor, DFSMode mode) {
-				if (mode == DFSMode.POST_ORDER) {
-					for (Spatial child : children.getArray()) {
-						child.depthFirstTraversal(visitor);
-					}
-					visitor.visit(this);
-				}
-				else { //pre order
-					visitor.visit(this);
-					for (Spatial child : children.getArray()) {
-						child.depthFirstTraversal(visitor);
-					}
-				}
-			}
-#endif
-		protected:
+			/**
+			* Lets the manager draw the geometries attached below this root from now on.
+			* Set it before attaching the children, the ones already attached are not added.
+			*/
+			void setSpatialManager(class SpatialManager* pManager);
 
-#if 0
-			void breadthFirstTraversal(SceneGraphVisitor visitor, Queue<Spatial> queue) {
-				queue.addAll(children);
-			}
-#endif
+		protected:
 
-			void setSpatialManager(class SpatialManager* pManager);
 			void setTransformRefresh() override;
 			void setLightListRefresh() override;
 			void setMatParamOverrideRefresh() override;
@@ -272,7 +256,10 @@ namespace jet
 
 		private:
 
-			void addUpdateChildren(std::vector<Spatial*> results);
+			// The list part of attaching and detaching, the callers notify the manager and the update list.
+			// Returns false when the spatial can't be attached here.
+			bool insertChild(Spatial* pChild, uint32_t index);
+			Spatial* removeChild(uint32_t index);
 
 			/**
 			*  Called to invalidate the root node's update list.  This is
@@ -281,26 +268,17 @@ namespace jet
 			*  that would change state.
 			*/
 			void invalidateUpdateList();
-			std::vector<Spatial*>& getUpdateList();
 			
 		protected:
 			// This node's children.
 			std::vector<Spatial*> m_pChildren;
-			
-			// If this node is a root, this list will contain the current
-			// set of children (and children of children) that require
-			// updateLogicalState() to be called as indicated by their
-			// requiresUpdate() method.
-			std::vector<Spatial*> m_pUpdateList;
 
 		private:
-			/**
-			* False if the update list requires rebuilding.  This is Node.class
-			* specific and therefore not included as part of the Spatial update flags.
-			* A flag is used instead of nulling the updateList to avoid reallocating
-			* a whole list every time the scene graph changes.
-			*/
-			bool m_bUpdateListValid = false;
+			// The controls and the spatials requiring updates under this node, created
+			// by the first logical update of the node as a root.
+			class ControlRegistry* m_pControlRegistry = nullptr;
+			bool m_bParallelLogicalUpdate = false;
+			bool m_bParallelGeometricUpdate = false;
 
 //			class SceneManager* m_pSceneManager;
 			class SpatialManager* m_pSpatialManager;
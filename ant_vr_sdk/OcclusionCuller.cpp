@@ -0,0 +1,330 @@
+#include "OcclusionCuller.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <float.h>
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#define OCCLUSION_CULLER_SIMD 1
+#include <emmintrin.h>
+#else
+#define OCCLUSION_CULLER_SIMD 0
+#endif
+
+namespace jet
+{
+	namespace util
+	{
+		// Vertices closer to the eye than this w are treated as crossing the near plane.
+		static const float NEAR_W = 1e-4f;
+		// The largest screen rectangle, in texels of the chosen level, a test reads.
+		static const uint32_t MAX_TEST_TEXELS = 4;
+
+		OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height) :
+			m_uiWidth(0), m_uiHeight(0)
+		{
+			resize(width, height);
+		}
+
+		void OcclusionCuller::resize(uint32_t width, uint32_t height)
+		{
+			assert(width > 0 && height > 0);
+			width = (width + 3) & ~3u;
+			if (width == m_uiWidth && height == m_uiHeight)
+			{
+				return;
+			}
+
+			m_uiWidth = width;
+			m_uiHeight = height;
+
+			m_Levels.clear();
+			uint32_t levelWidth = width;
+			uint32_t levelHeight = height;
+			while (true)
+			{
+				DepthLevel level;
+				level.Width = levelWidth;
+				level.Height = levelHeight;
+				level.Depths.assign(levelWidth * levelHeight, 1.0f);
+				m_Levels.push_back(level);
+
+				if (levelWidth == 1 && levelHeight == 1)
+					break;
+
+				levelWidth = glm::max(1u, (levelWidth + 1) / 2);
+				levelHeight = glm::max(1u, (levelHeight + 1) / 2);
+			}
+		}
+
+		void OcclusionCuller::beginFrame(const glm::mat4& viewProj)
+		{
+			m_ViewProj = viewProj;
+			m_Triangles.clear();
+		}
+
+		void OcclusionCuller::addOccluder(const glm::vec3* pPositions, uint32_t vertexCount, const uint16_t* pIndices, uint32_t indexCount, const glm::mat4& world)
+		{
+			addTriangles(pPositions, vertexCount, pIndices, indexCount, world);
+		}
+
+		void OcclusionCuller::addOccluder(const glm::vec3* pPositions, uint32_t vertexCount, const uint32_t* pIndices, uint32_t indexCount, const glm::mat4& world)
+		{
+			addTriangles(pPositions, vertexCount, pIndices, indexCount, world);
+		}
+
+		template<typename IndexType>
+		void OcclusionCuller::addTriangles(const glm::vec3* pPositions, uint32_t vertexCount, const IndexType* pIndices, uint32_t indexCount, const glm::mat4& world)
+		{
+			const glm::mat4 mvp = m_ViewProj * world;
+			const float halfWidth = 0.5f * m_uiWidth;
+			const float halfHeight = 0.5f * m_uiHeight;
+
+			// Screen space xy in pixels and depth in [0, 1], w < NEAR_W marks the vertices behind the near plane.
+			m_ClipPositions.resize(vertexCount);
+			for (uint32_t i = 0; i < vertexCount; i++)
+			{
+				const glm::vec4 clip = mvp * glm::vec4(pPositions[i], 1.0f);
+				if (clip.w < NEAR_W)
+				{
+					m_ClipPositions[i] = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+					continue;
+				}
+
+				const float invW = 1.0f / clip.w;
+				m_ClipPositions[i] = glm::vec4((clip.x * invW + 1.0f) * halfWidth, (clip.y * invW + 1.0f) * halfHeight, (clip.z * invW) * 0.5f + 0.5f, clip.w);
+			}
+
+			for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+			{
+				glm::vec4 v0 = m_ClipPositions[pIndices[i]];
+				glm::vec4 v1 = m_ClipPositions[pIndices[i + 1]];
+				glm::vec4 v2 = m_ClipPositions[pIndices[i + 2]];
+				if (v0.w < 0.0f || v1.w < 0.0f || v2.w < 0.0f)
+				{
+					continue;
+				}
+
+				// Orient the triangle counter clockwise so the inside is where all edges are positive.
+				float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+				if (area < 0.0f)
+				{
+					std::swap(v1, v2);
+					area = -area;
+				}
+				if (area < 1e-6f)
+				{
+					continue;
+				}
+
+				ScreenTriangle tri;
+				tri.MinX = glm::max(0, static_cast<int32_t>(glm::floor(glm::min(v0.x, glm::min(v1.x, v2.x)))));
+				tri.MaxX = glm::min(static_cast<int32_t>(m_uiWidth) - 1, static_cast<int32_t>(glm::floor(glm::max(v0.x, glm::max(v1.x, v2.x)))));
+				tri.MinY = glm::max(0, static_cast<int32_t>(glm::floor(glm::min(v0.y, glm::min(v1.y, v2.y)))));
+				tri.MaxY = glm::min(static_cast<int32_t>(m_uiHeight) - 1, static_cast<int32_t>(glm::floor(glm::max(v0.y, glm::max(v1.y, v2.y)))));
+				if (tri.MinX > tri.MaxX || tri.MinY > tri.MaxY)
+				{
+					continue;
+				}
+
+				// edge(a, b)(p) = cross(a - p, b - p) = A * p.x + B * p.y + C
+				const glm::vec4* pEdges[3][2] = { { &v0, &v1 }, { &v1, &v2 }, { &v2, &v0 } };
+				for (int e = 0; e < 3; e++)
+				{
+					const glm::vec4& a = *pEdges[e][0];
+					const glm::vec4& b = *pEdges[e][1];
+					tri.EdgeA[e] = a.y - b.y;
+					tri.EdgeB[e] = b.x - a.x;
+					tri.EdgeC[e] = a.x * b.y - a.y * b.x;
+				}
+
+				// depth(p) = DepthX * p.x + DepthY * p.y + DepthC, z / w is linear on the screen.
+				const float invArea = 1.0f / area;
+				tri.DepthX = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+				tri.DepthY = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * invArea;
+				tri.DepthC = v0.z - tri.DepthX * v0.x - tri.DepthY * v0.y;
+
+				m_Triangles.push_back(tri);
+			}
+		}
+
+		void OcclusionCuller::rasterizeBand(uint32_t band)
+		{
+			assert(band < getBandCount());
+			const int32_t bandMinY = static_cast<int32_t>(band * BAND_HEIGHT);
+			const int32_t bandMaxY = glm::min(bandMinY + static_cast<int32_t>(BAND_HEIGHT), static_cast<int32_t>(m_uiHeight)) - 1;
+			float* pDepths = m_Levels[0].Depths.data();
+
+			std::fill(pDepths + bandMinY * m_uiWidth, pDepths + (bandMaxY + 1) * m_uiWidth, 1.0f);
+
+			for (const ScreenTriangle& tri : m_Triangles)
+			{
+				const int32_t minY = glm::max(tri.MinY, bandMinY);
+				const int32_t maxY = glm::min(tri.MaxY, bandMaxY);
+				// The rows are stored in multiples of 4 pixels, the SSE path reads 4 at once.
+				const int32_t minX = tri.MinX & ~3;
+
+				for (int32_t y = minY; y <= maxY; y++)
+				{
+					float* pRow = pDepths + y * m_uiWidth;
+					const float py = y + 0.5f;
+#if OCCLUSION_CULLER_SIMD
+					const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+					const __m128 zero = _mm_setzero_ps();
+					__m128 edgeRow[3], edgeStep[3];
+					for (int e = 0; e < 3; e++)
+					{
+						edgeRow[e] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.EdgeA[e]), _mm_add_ps(_mm_set1_ps(static_cast<float>(minX)), offsets)),
+											_mm_set1_ps(tri.EdgeB[e] * py + tri.EdgeC[e]));
+						edgeStep[e] = _mm_set1_ps(tri.EdgeA[e] * 4.0f);
+					}
+					__m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.DepthX), _mm_add_ps(_mm_set1_ps(static_cast<float>(minX)), offsets)),
+											_mm_set1_ps(tri.DepthY * py + tri.DepthC));
+					const __m128 depthStep = _mm_set1_ps(tri.DepthX * 4.0f);
+
+					for (int32_t x = minX; x <= tri.MaxX; x += 4)
+					{
+						const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edgeRow[0], zero), _mm_cmpge_ps(edgeRow[1], zero)), _mm_cmpge_ps(edgeRow[2], zero));
+						if (_mm_movemask_ps(inside))
+						{
+							const __m128 old = _mm_loadu_ps(pRow + x);
+							const __m128 nearest = _mm_min_ps(old, depth);
+							_mm_storeu_ps(pRow + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+						}
+
+						for (int e = 0; e < 3; e++)
+						{
+							edgeRow[e] = _mm_add_ps(edgeRow[e], edgeStep[e]);
+						}
+						depth = _mm_add_ps(depth, depthStep);
+					}
+#else
+					for (int32_t x = tri.MinX; x <= tri.MaxX; x++)
+					{
+						const float px = x + 0.5f;
+						bool bInside = true;
+						for (int e = 0; e < 3; e++)
+						{
+							bInside = bInside && (tri.EdgeA[e] * px + tri.EdgeB[e] * py + tri.EdgeC[e] >= 0.0f);
+						}
+
+						if (bInside)
+						{
+							pRow[x] = glm::min(pRow[x], tri.DepthX * px + tri.DepthY * py + tri.DepthC);
+						}
+					}
+#endif
+				}
+			}
+		}
+
+		void OcclusionCuller::buildHierarchy()
+		{
+			for (size_t i = 1; i < m_Levels.size(); i++)
+			{
+				const DepthLevel& src = m_Levels[i - 1];
+				DepthLevel& dst = m_Levels[i];
+				for (uint32_t y = 0; y < dst.Height; y++)
+				{
+					const uint32_t y0 = y * 2;
+					const uint32_t y1 = glm::min(y0 + 1, src.Height - 1);
+					for (uint32_t x = 0; x < dst.Width; x++)
+					{
+						const uint32_t x0 = x * 2;
+						const uint32_t x1 = glm::min(x0 + 1, src.Width - 1);
+						const float* pSrc = src.Depths.data();
+						dst.Depths[y * dst.Width + x] = glm::max(glm::max(pSrc[y0 * src.Width + x0], pSrc[y0 * src.Width + x1]),
+																glm::max(pSrc[y1 * src.Width + x0], pSrc[y1 * src.Width + x1]));
+					}
+				}
+			}
+		}
+
+		void OcclusionCuller::rasterize()
+		{
+			JobSystem::get().parallelFor(getBandCount(), 1, [this](uint32_t first, uint32_t count)
+			{
+				for (uint32_t band = first; band < first + count; band++)
+				{
+					rasterizeBand(band);
+				}
+			});
+
+			buildHierarchy();
+		}
+
+		float OcclusionCuller::getDepth(uint32_t x, uint32_t y, uint32_t level) const
+		{
+			const DepthLevel& depths = m_Levels[level];
+			assert(x < depths.Width && y < depths.Height);
+			return depths.Depths[y * depths.Width + x];
+		}
+
+		bool OcclusionCuller::isVisible(const BoundingVolume* pBound) const
+		{
+			if (pBound == nullptr)
+			{
+				return true;
+			}
+
+			glm::vec3 extent;
+			if (pBound->getType() == BoundingVolume::Type::AABB)
+				extent = static_cast<const BoundingBox*>(pBound)->getExtent();
+			else
+				extent = glm::vec3(static_cast<const BoundingSphere*>(pBound)->getRadius());
+
+			// Project the corners of the box, the nearest depth and the screen rectangle bound the object.
+			const glm::vec3& center = pBound->getCenter();
+			glm::vec2 screenMin(FLT_MAX), screenMax(-FLT_MAX);
+			float minDepth = FLT_MAX;
+			for (int i = 0; i < 8; i++)
+			{
+				const glm::vec3 corner = center + extent * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+				const glm::vec4 clip = m_ViewProj * glm::vec4(corner, 1.0f);
+				if (clip.w < NEAR_W)
+				{
+					return true;
+				}
+
+				const float invW = 1.0f / clip.w;
+				const glm::vec2 screen((clip.x * invW + 1.0f) * 0.5f * m_uiWidth, (clip.y * invW + 1.0f) * 0.5f * m_uiHeight);
+				screenMin = glm::min(screenMin, screen);
+				screenMax = glm::max(screenMax, screen);
+				minDepth = glm::min(minDepth, clip.z * invW * 0.5f + 0.5f);
+			}
+
+			if (screenMax.x < 0.0f || screenMax.y < 0.0f || screenMin.x >= m_uiWidth || screenMin.y >= m_uiHeight || minDepth <= 0.0f)
+			{
+				return true;
+			}
+
+			int32_t x0 = glm::max(0, static_cast<int32_t>(screenMin.x));
+			int32_t y0 = glm::max(0, static_cast<int32_t>(screenMin.y));
+			int32_t x1 = glm::min(static_cast<int32_t>(m_uiWidth) - 1, static_cast<int32_t>(screenMax.x));
+			int32_t y1 = glm::min(static_cast<int32_t>(m_uiHeight) - 1, static_cast<int32_t>(screenMax.y));
+
+			// Go up the hierarchy until the rectangle covers a few texels, each texel keeps the
+			// farthest occluder depth under it.
+			uint32_t level = 0;
+			while (level + 1 < m_Levels.size() && static_cast<uint32_t>(glm::max(x1 - x0, y1 - y0)) >= MAX_TEST_TEXELS)
+			{
+				x0 >>= 1; y0 >>= 1;
+				x1 >>= 1; y1 >>= 1;
+				level++;
+			}
+
+			const DepthLevel& depths = m_Levels[level];
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				for (int32_t x = x0; x <= x1; x++)
+				{
+					if (depths.Depths[y * depths.Width + x] >= minDepth)
+					{
+						return true;
+					}
+				}
+			}
+
+			return false;
+		}
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "BoundingVolume.h"
+#include <stdint.h>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * Software occlusion culling on the CPU. A few occluder meshes are rasterized into a small
+		 * depth buffer, then the screen rectangle of every candidate bound is tested against a
+		 * max-depth hierarchy of that buffer.<p>
+		 * A frame is:
+		 * <pre>
+		 * beginFrame(viewProj);
+		 * addOccluder(...);              // for every occluder
+		 * rasterizeBand(i);              // for every band, the bands may run on different threads
+		 * buildHierarchy();
+		 * isVisible(pBound);             // for every candidate, from any thread
+		 * </pre>
+		 * rasterize() runs the bands as jobs of the {@link JobSystem} and builds the hierarchy.<p>
+		 * Every test is conservative. Occluder triangles that cross the near plane are skipped, and
+		 * a bound that reaches behind the camera or out of the screen is visible.
+		 */
+		class OcclusionCuller
+		{
+		public:
+			/// The rows rasterized by one rasterizeBand() call.
+			static const uint32_t BAND_HEIGHT = 16;
+
+			/// The width is rounded up to a multiple of 4 for the SSE rasterizer.
+			OcclusionCuller(uint32_t width = 256, uint32_t height = 128);
+
+			void resize(uint32_t width, uint32_t height);
+			uint32_t getWidth() const { return m_uiWidth; }
+			uint32_t getHeight() const { return m_uiHeight; }
+
+			/// Clears the occluders of the last frame and sets the view projection matrix of the new one.
+			void beginFrame(const glm::mat4& viewProj);
+
+			/// Transforms the triangles of an occluder to the screen and keeps them for the rasterization.
+			void addOccluder(const glm::vec3* pPositions, uint32_t vertexCount, const uint16_t* pIndices, uint32_t indexCount, const glm::mat4& world);
+			void addOccluder(const glm::vec3* pPositions, uint32_t vertexCount, const uint32_t* pIndices, uint32_t indexCount, const glm::mat4& world);
+
+			uint32_t getBandCount() const { return (m_uiHeight + BAND_HEIGHT - 1) / BAND_HEIGHT; }
+			/// Clears and rasterizes the occluders into the rows of one band.
+			void rasterizeBand(uint32_t band);
+			/// Builds the max-depth levels from the rasterized depth buffer.
+			void buildHierarchy();
+			/// Rasterizes all the bands and builds the hierarchy.
+			void rasterize();
+
+			/// Returns false when the bound is fully behind the occluders.
+			bool isVisible(const BoundingVolume* pBound) const;
+
+			uint32_t getTriangleCount() const { return static_cast<uint32_t>(m_Triangles.size()); }
+			uint32_t getLevelCount() const { return static_cast<uint32_t>(m_Levels.size()); }
+			/// The depth in [0, 1] of a texel of a level, level 0 is the rasterized buffer.
+			float getDepth(uint32_t x, uint32_t y, uint32_t level = 0) const;
+
+		private:
+			// A screen space triangle as three edge functions and a depth plane.
+			typedef struct ScreenTriangle
+			{
+				float EdgeA[3];
+				float EdgeB[3];
+				float EdgeC[3];
+				float DepthX;
+				float DepthY;
+				float DepthC;
+				int32_t MinX, MaxX;
+				int32_t MinY, MaxY;
+			}ScreenTriangle;
+
+			typedef struct DepthLevel
+			{
+				uint32_t Width;
+				uint32_t Height;
+				std::vector<float> Depths;
+			}DepthLevel;
+
+			template<typename IndexType>
+			void addTriangles(const glm::vec3* pPositions, uint32_t vertexCount, const IndexType* pIndices, uint32_t indexCount, const glm::mat4& world);
+
+		private:
+			uint32_t m_uiWidth;
+			uint32_t m_uiHeight;
+			glm::mat4 m_ViewProj;
+			std::vector<ScreenTriangle> m_Triangles;
+			std::vector<DepthLevel> m_Levels;
+			// Scratch of addTriangles().
+			std::vector<glm::vec4> m_ClipPositions;
+		};
+	}
+}
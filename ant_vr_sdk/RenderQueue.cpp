@@ -1,16 +1,224 @@
 #include "RenderQueue.h"
+#include "Geometry.h"
+#include "Camera.h"
+#include <string.h>
 
 namespace jet
 {
 	namespace util
 	{
-		RenderQueue::RenderQueue()
+		static const uint32_t STATE_BITS = 12;
+		static const uint32_t STATE_MASK = (1u << STATE_BITS) - 1;
+		static const uint32_t DEPTH_MAX = 0xFFFF;
+		static const uint32_t LAYER_MASK = 0x1F;
+		// makeKey() leaves the low 4 bits clear, the other 60 are sorted by 6 passes of 10 bits.
+		static const uint32_t RADIX_FIRST_BIT = 4;
+		static const uint32_t RADIX_BITS = 10;
+		static const uint32_t RADIX_PASSES = 6;
+		static const uint32_t RADIX_SIZE = 1u << RADIX_BITS;
+
+		// The drawing order of the buckets.
+		static uint64_t getBucketRank(Bucket bucket)
 		{
+			switch (bucket)
+			{
+			case Bucket::OPAQUEA:     return 0;
+			case Bucket::SKY:         return 1;
+			case Bucket::TRANSPARENT: return 2;
+			case Bucket::TRANSLUCENT: return 3;
+			case Bucket::GUI:         return 4;
+			default:
+				assert(false);
+				return 0;
+			}
 		}
 
+		RenderQueue::RenderQueue() : m_ViewMatrix(1.0f), m_fDepthNear(0.0f), m_fDepthScale(1.0f)
+		{
+			memset(&m_Statistics, 0, sizeof(Statistics));
+		}
 
 		RenderQueue::~RenderQueue()
 		{
 		}
+
+		void RenderQueue::setCamera(Camera* pCam)
+		{
+			assert(pCam);
+			m_ViewMatrix = pCam->getViewMatrix();
+			setDepthRange(pCam->getFrustumNear(), pCam->getFrustumFar());
+		}
+
+		void RenderQueue::setDepthRange(float fNear, float fFar)
+		{
+			m_fDepthNear = fNear;
+			m_fDepthScale = fFar > fNear ? 1.0f / (fFar - fNear) : 1.0f;
+		}
+
+		uint64_t RenderQueue::makeKey(Bucket bucket, uint32_t layer, uint32_t program, uint32_t material, uint32_t vertexArray, uint32_t depth)
+		{
+			assert(depth <= DEPTH_MAX);
+			const uint64_t states = (static_cast<uint64_t>(program & STATE_MASK) << (2 * STATE_BITS)) |
+				(static_cast<uint64_t>(material & STATE_MASK) << STATE_BITS) | (vertexArray & STATE_MASK);
+
+			uint64_t key = (getBucketRank(bucket) << 61) | (static_cast<uint64_t>(layer & LAYER_MASK) << 56);
+			switch (bucket)
+			{
+			case Bucket::TRANSPARENT:
+			case Bucket::TRANSLUCENT:
+				// The farthest first.
+				key |= (static_cast<uint64_t>(DEPTH_MAX - depth) << 40) | (states << 4);
+				break;
+			case Bucket::GUI:
+				key |= (static_cast<uint64_t>(depth) << 40) | (states << 4);
+				break;
+			default:
+				key |= (states << 20) | (static_cast<uint64_t>(depth) << 4);
+				break;
+			}
+
+			return key;
+		}
+
+		uint32_t RenderQueue::getStateId(std::unordered_map<const void*, uint32_t>& ids, const void* pState)
+		{
+			auto it = ids.find(pState);
+			if (it != ids.end())
+			{
+				return it->second;
+			}
+
+			const uint32_t id = static_cast<uint32_t>(ids.size());
+			ids.insert(std::pair<const void*, uint32_t>(pState, id));
+			return id;
+		}
+
+		uint32_t RenderQueue::quantizeDepth(Bucket bucket, float depth) const
+		{
+			// The gui spatials are placed in [-1, 1] along z.
+			const float t = bucket == Bucket::GUI ? (depth + 1.0f) * 0.5f : (depth - m_fDepthNear) * m_fDepthScale;
+			return static_cast<uint32_t>(glm::clamp(t, 0.0f, 1.0f) * DEPTH_MAX);
+		}
+
+		void RenderQueue::add(Geometry* pGeom, Bucket bucket, uint32_t layer, const void* pProgram, const void* pMaterial, const void* pVertexArray, float depth)
+		{
+			assert(pGeom);
+			RenderItem item;
+			item.pGeometry = pGeom;
+			item.Program = getStateId(m_ProgramIds, pProgram);
+			item.Material = getStateId(m_MaterialIds, pMaterial);
+			item.VertexArray = getStateId(m_VertexArrayIds, pVertexArray);
+			item.Key = makeKey(bucket, layer, item.Program, item.Material, item.VertexArray, quantizeDepth(bucket, depth));
+			m_Items.push_back(item);
+		}
+
+		void RenderQueue::add(Geometry* pGeom, uint32_t layer)
+		{
+			assert(pGeom);
+			const Bucket bucket = pGeom->getQueueBucket();
+
+			float depth;
+			const BoundingVolume* pBound = pGeom->getWorldBound().get();
+			const glm::vec3 center = pBound ? pBound->getCenter() : pGeom->getWorldTranslation();
+			if (bucket == Bucket::GUI)
+			{
+				depth = center.z;
+			}
+			else
+			{
+				// The view space looks down -z.
+				depth = -(m_ViewMatrix * glm::vec4(center, 1.0f)).z;
+			}
+
+			// The geometries with the same shape share the GPU mesh of the SpatialManager, so the
+			// interned name of the shape stands for the vertex array.
+			Material* pMaterial = pGeom->getMaterial().get();
+			const Shape3D* pShape = pGeom->getMesh().get();
+			add(pGeom, bucket, layer, pMaterial ? pMaterial->getProgram() : nullptr, pMaterial,
+				pShape ? pShape->getInternedName() : nullptr, depth);
+		}
+
+		uint32_t RenderQueue::countStateChanges(const std::vector<RenderItem>& items)
+		{
+			uint32_t changes = 0;
+			for (size_t i = 1; i < items.size(); i++)
+			{
+				changes += items[i].Program != items[i - 1].Program;
+				changes += items[i].Material != items[i - 1].Material;
+				changes += items[i].VertexArray != items[i - 1].VertexArray;
+			}
+			return changes;
+		}
+
+		void RenderQueue::sort()
+		{
+			const uint32_t count = static_cast<uint32_t>(m_Items.size());
+			m_Statistics.ItemCount = count;
+			m_Statistics.UnsortedStateChanges = countStateChanges(m_Items);
+
+			// LSD radix sort of the keys with the indices of their items, the items are moved once
+			// at the end. The counts of all the passes are taken in one walk, and a pass is skipped
+			// when all the keys share its digit, as the bucket and layer bits often do.
+			m_SortEntries.resize(count);
+			m_SortBuffer.resize(count);
+			m_RadixCounts.assign(RADIX_PASSES * RADIX_SIZE, 0);
+			uint32_t* counts = m_RadixCounts.data();
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const uint64_t key = m_Items[i].Key;
+				m_SortEntries[i].Key = key;
+				m_SortEntries[i].Index = i;
+				for (uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+				{
+					counts[pass * RADIX_SIZE + ((key >> (RADIX_FIRST_BIT + pass * RADIX_BITS)) & (RADIX_SIZE - 1))]++;
+				}
+			}
+
+			SortEntry* pSource = m_SortEntries.data();
+			SortEntry* pDestination = m_SortBuffer.data();
+			for (uint32_t pass = 0; pass < RADIX_PASSES && count > 0; pass++)
+			{
+				const uint32_t shift = RADIX_FIRST_BIT + pass * RADIX_BITS;
+				uint32_t* pCounts = &counts[pass * RADIX_SIZE];
+				if (pCounts[(pSource[0].Key >> shift) & (RADIX_SIZE - 1)] == count)
+				{
+					continue;
+				}
+
+				uint32_t offset = 0;
+				for (uint32_t i = 0; i < RADIX_SIZE; i++)
+				{
+					const uint32_t binCount = pCounts[i];
+					pCounts[i] = offset;
+					offset += binCount;
+				}
+
+				for (uint32_t i = 0; i < count; i++)
+				{
+					pDestination[pCounts[(pSource[i].Key >> shift) & (RADIX_SIZE - 1)]++] = pSource[i];
+				}
+				std::swap(pSource, pDestination);
+			}
+
+			m_SortedItems.resize(count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				m_SortedItems[i] = m_Items[pSource[i].Index];
+			}
+			m_Items.swap(m_SortedItems);
+
+			m_Statistics.StateChanges = countStateChanges(m_Items);
+		}
+
+		void RenderQueue::clear()
+		{
+			m_Items.clear();
+
+			// The ids only have to group the states of one frame, starting over keeps them dense
+			// and the maps don't hold the states released since.
+			m_ProgramIds.clear();
+			m_MaterialIds.clear();
+			m_VertexArrayIds.clear();
+		}
 	}
 }
@@ -4,6 +4,7 @@
 #include <string>
 #include "Transform.h"
 #include <memory>
+#include <unordered_map>
 
 namespace jet
 {
@@ -17,7 +18,7 @@ namespace jet
 		* bucket the spatial is placed. A spatial's queue bucket can be set
 		* via {@link Spatial#setQueueBucket(com.jme3.renderer.queue.RenderQueue.Bucket) }.
 		*/
-		enum class Bucket {
+		enum class Bucket : uint8_t {
 			/**
 			* The renderer will try to find the optimal order for rendering all
 			* objects using this mode.
@@ -75,7 +76,7 @@ namespace jet
 		* <code>ShadowMode</code> is a marker used to specify how shadow
 		* effects should treat the spatial.
 		*/
-		enum class ShadowMode {
+		enum class ShadowMode : uint8_t {
 			/**
 			* Disable both shadow casting and shadow receiving for this spatial.
 			* Generally used for special effects like particle emitters.
@@ -103,18 +104,111 @@ namespace jet
 			INHERIT
 		};
 
+		class Geometry;
+		class Camera;
+
+		/**
+		* <code>RenderQueue</code> orders the geometries of a frame for drawing. Every queued
+		* geometry gets a 64 bit key and the keys are sorted with a radix sort, so the order
+		* comes from the key layout of each bucket:
+		* <ul>
+		* <li>bits 63-61: the bucket, drawn OPAQUEA, SKY, TRANSPARENT, TRANSLUCENT then GUI.</li>
+		* <li>bits 60-56: the layer, lower layers first within a bucket.</li>
+		* <li>OPAQUEA and SKY: the program, the material and the vertex array ids, 12 bits
+		* each, then the depth on 16 bits front to back. The draws sharing states are adjacent,
+		* the depth only orders the draws of the same states for the early depth test.</li>
+		* <li>TRANSPARENT and TRANSLUCENT: the depth back to front first, for the blending,
+		* then the states. GUI: the z of the spatial, lower first.</li>
+		* </ul>
+		* The ids are given by the queue in the order it first sees the states within a frame, an
+		* id wrapping past 12 bits only costs some grouping, never the bucket or depth order.
+		*/
 		class RenderQueue
 		{
 		public:
+			typedef struct RenderItem
+			{
+				uint64_t Key;
+				Geometry* pGeometry;
+				// The full state ids, the key only keeps their low bits.
+				uint32_t Program;
+				uint32_t Material;
+				uint32_t VertexArray;
+			}RenderItem;
+
+			typedef struct Statistics
+			{
+				uint32_t ItemCount;
+				// The program, material and vertex array changes drawing the items in the sorted
+				// order, and in the order they were queued.
+				uint32_t StateChanges;
+				uint32_t UnsortedStateChanges;
+
+				// Negative when the sort added changes, as the depth order of the blended buckets may.
+				int32_t getAvoidedStateChanges() const { return static_cast<int32_t>(UnsortedStateChanges) - static_cast<int32_t>(StateChanges); }
+			}Statistics;
+
 			RenderQueue();
 			~RenderQueue();
 
-		protected:
-			std::vector<GeometryAssembly*> m_CastShadowObjs;
-			std::vector<GeometryAssembly*> m_OpaqueObjsWithDepth;
-			std::vector<GeometryAssembly*> m_OpaqueObjsWithoutDepth;
-			std::vector<GeometryAssembly*> m_TranslucentObjsWithDepth;
-			std::vector<GeometryAssembly*> m_TranslucentObjsWithoutDepth;
+			/**
+			* Sets the camera the depths are measured from, the view depths between its near and
+			* far planes are quantized to 16 bits.
+			*/
+			void setCamera(Camera* pCam);
+			/// Sets the view depths mapped to the first and the last of the 16 bit depths.
+			void setDepthRange(float fNear, float fFar);
+
+			/**
+			* Queues the geometry, the states are taken from its material and its mesh, the depth
+			* from the center of its world bound.
+			*/
+			void add(Geometry* pGeom, uint32_t layer = 0);
+			/// Queues the item with the given states and view depth, for the draws the queue can't look into.
+			void add(Geometry* pGeom, Bucket bucket, uint32_t layer, const void* pProgram, const void* pMaterial, const void* pVertexArray, float depth);
+
+			/// Sorts the queued items by their keys, the items of equal keys keep the order they were queued.
+			void sort();
+
+			const std::vector<RenderItem>& getItems() const { return m_Items; }
+			uint32_t size() const { return static_cast<uint32_t>(m_Items.size()); }
+			/// The statistics of the last sort().
+			const Statistics& getStatistics() const { return m_Statistics; }
+
+			/// Empties the queue for the next frame, the state ids start over.
+			void clear();
+
+			/// Builds the key of an item, see the class comment for the layout.
+			static uint64_t makeKey(Bucket bucket, uint32_t layer, uint32_t program, uint32_t material, uint32_t vertexArray, uint32_t depth);
+
+		private:
+			uint32_t getStateId(std::unordered_map<const void*, uint32_t>& ids, const void* pState);
+			uint32_t quantizeDepth(Bucket bucket, float depth) const;
+			static uint32_t countStateChanges(const std::vector<RenderItem>& items);
+
+		private:
+			typedef struct SortEntry
+			{
+				uint64_t Key;
+				uint32_t Index;
+			}SortEntry;
+
+			std::vector<RenderItem> m_Items;
+			// The scratch of the radix sort, the keys are sorted with the indices of their items.
+			std::vector<SortEntry> m_SortEntries;
+			std::vector<SortEntry> m_SortBuffer;
+			std::vector<uint32_t> m_RadixCounts;
+			std::vector<RenderItem> m_SortedItems;
+
+			std::unordered_map<const void*, uint32_t> m_ProgramIds;
+			std::unordered_map<const void*, uint32_t> m_MaterialIds;
+			std::unordered_map<const void*, uint32_t> m_VertexArrayIds;
+
+			glm::mat4 m_ViewMatrix;
+			float m_fDepthNear;
+			float m_fDepthScale;
+
+			Statistics m_Statistics;
 		};
 	}
 }
@@ -2,6 +2,7 @@
 #include <GL\glew.h>
 #include "TextureUtil.h"
 #include "Util.h"
+#include "BufferStatistics.h"
 
 namespace jet
 {
@@ -195,6 +196,7 @@ namespace jet
 			m_Timer->stop();
 			float elpsedTime = m_Timer->getTime() * timeScale;
 			m_Transformer->update(elpsedTime);
+			BufferStatistics::get().beginFrame();
 			OnRender(elpsedTime);
 
 			m_Timer->reset();
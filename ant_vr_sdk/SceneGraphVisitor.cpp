@@ -0,0 +1,18 @@
+#include "SceneGraphVisitor.h"
+
+namespace jet
+{
+	namespace util
+	{
+		void SceneGraphTraverser::depthFirst(Spatial* pRoot, SceneGraphVisitor& visitor)
+		{
+			depthFirst(pRoot, [&visitor](Spatial* pSpatial) { return visitor.enter(pSpatial); },
+				[&visitor](Spatial* pSpatial) { visitor.leave(pSpatial); });
+		}
+
+		void SceneGraphTraverser::breadthFirst(Spatial* pRoot, SceneGraphVisitor& visitor)
+		{
+			breadthFirst(pRoot, [&visitor](Spatial* pSpatial) { return visitor.enter(pSpatial); });
+		}
+	}
+}
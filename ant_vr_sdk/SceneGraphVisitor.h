@@ -0,0 +1,126 @@
+#pragma once
+
+#include "Node.h"
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * Receives the spatials of a scene walk. enter() is called before the children of a spatial
+		 * and leave() after them, so one walk can do the pre-order and the post-order work.
+		 * Returning false from enter() prunes the spatial: its children and its leave() are skipped.
+		 */
+		class SceneGraphVisitor
+		{
+		public:
+			virtual bool enter(Spatial* pSpatial) = 0;
+			virtual void leave(Spatial* pSpatial) {}
+
+			virtual ~SceneGraphVisitor() {}
+		};
+
+		/**
+		 * Walks a scene with an explicit stack instead of recursion. The stack and the queue keep
+		 * their memory between the walks, so a traverser kept by its owner stops allocating once
+		 * they are large enough. A walk may start another one on the same traverser from its
+		 * callbacks, but the scene must not be changed while it is walked.<p>
+		 * The walks taking functions inline the callbacks, the ones taking a {@link SceneGraphVisitor}
+		 * call them through it.
+		 */
+		class SceneGraphTraverser
+		{
+		public:
+			/**
+			 * Calls enter(pSpatial) before and leave(pSpatial) after the children of every spatial
+			 * under pRoot, children in order. enter() returns false to skip the subtree.
+			 */
+			template<typename Enter, typename Leave>
+			void depthFirst(Spatial* pRoot, const Enter& enter, const Leave& leave)
+			{
+				assert(pRoot);
+
+				// The entries below belong to the walks this one was started from.
+				const size_t base = m_Stack.size();
+				m_Stack.push_back(StackEntry(pRoot));
+				while (m_Stack.size() > base)
+				{
+					Spatial* pSpatial = m_Stack.back().pSpatial;
+					if (m_Stack.back().bEntered)
+					{
+						m_Stack.pop_back();
+						leave(pSpatial);
+						continue;
+					}
+
+					if (!enter(pSpatial))
+					{
+						m_Stack.pop_back();
+						continue;
+					}
+
+					if (!pSpatial->isNode())
+					{
+						m_Stack.pop_back();
+						leave(pSpatial);
+						continue;
+					}
+
+					// The callback may have grown the stack, the entry is found again.
+					m_Stack.back().bEntered = true;
+					std::vector<Spatial*>& children = static_cast<Node*>(pSpatial)->getChildren();
+					for (size_t i = children.size(); i > 0; i--)
+					{
+						m_Stack.push_back(StackEntry(children[i - 1]));
+					}
+				}
+			}
+
+			/// Pre-order walk, enter() returns false to skip the subtree.
+			template<typename Enter>
+			void depthFirst(Spatial* pRoot, const Enter& enter)
+			{
+				depthFirst(pRoot, enter, [](Spatial*){});
+			}
+
+			/// Calls enter() for every spatial under pRoot, level by level. enter() returns false to skip the subtree.
+			template<typename Enter>
+			void breadthFirst(Spatial* pRoot, const Enter& enter)
+			{
+				assert(pRoot);
+
+				const size_t base = m_Queue.size();
+				m_Queue.push_back(pRoot);
+				for (size_t head = base; head < m_Queue.size(); head++)
+				{
+					Spatial* pSpatial = m_Queue[head];
+					if (enter(pSpatial) && pSpatial->isNode())
+					{
+						std::vector<Spatial*>& children = static_cast<Node*>(pSpatial)->getChildren();
+						m_Queue.insert(m_Queue.end(), children.begin(), children.end());
+					}
+				}
+				m_Queue.resize(base);
+			}
+
+			void depthFirst(Spatial* pRoot, SceneGraphVisitor& visitor);
+			void breadthFirst(Spatial* pRoot, SceneGraphVisitor& visitor);
+
+		private:
+			typedef struct StackEntry
+			{
+				Spatial* pSpatial;
+				// enter() returned true, the children are above this entry.
+				bool bEntered;
+
+				StackEntry(Spatial* spatial) : pSpatial(spatial), bEntered(false){}
+			}StackEntry;
+
+			std::vector<StackEntry> m_Stack;
+			std::vector<Spatial*> m_Queue;
+		};
+	}
+}
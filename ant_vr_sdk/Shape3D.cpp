@@ -1,5 +1,6 @@
 #include "Shape3D.h"
 #include "Material.h"
+#include "StringTable.h"
 
 namespace jet
 {
@@ -15,7 +16,7 @@ namespace jet
 			Shape3D::Mode::TRIANGLE_FAN_RESTART,
 		};
 
-		Shape3D::Shape3D(Mode mode) : m_Mode(mode)
+		Shape3D::Shape3D(Mode mode) : m_Mode(mode), m_pInternedName(StringTable::get().getEmpty()), m_pTriangleBVH(nullptr), m_uiTriangleBVHGeneration(0)
 		{
 			if (Numeric::indexOf(_countof(BOX_MODES), BOX_MODES, mode) < 0)
 			{
@@ -28,6 +29,10 @@ namespace jet
 			char name[128];
 			sprintf_s(name, "%s_%s", getShapeName(), getModeName(m_Mode));
 			m_strName = name;
+			m_pInternedName = StringTable::get().intern(m_strName);
+
+			// The tree of the previous name is not the one of the shape anymore.
+			m_uiTriangleBVHGeneration.store(0, std::memory_order_relaxed);
 		}
 
 		void Shape3D::setMode(Mode mode)
@@ -394,6 +399,45 @@ namespace jet
 			return out;
 		}
 
+		// Packs a P3NT2 or P3N float vertex stream into one of the quantized layouts.
+		static MeteDataPtr packVertexData(const MeteDataPtr& source, MeshAttrib attrib, const VertexQuantization& quantization)
+		{
+			const bool hasTexcoord = attrib != MeshAttrib::P3N_U16;
+			const uint32_t srcStride = hasTexcoord ? 8 : 6;
+			const uint32_t dstStride = hasTexcoord ? 16 : 12;
+			const uint32_t vertexCount = source->uiLength / (srcStride * sizeof(float));
+
+			MeteDataPtr out = MeteDataPtr(new MeteData);
+			out->uiLength = vertexCount * dstStride;
+			uint8_t* pData = new uint8_t[out->uiLength];
+
+			const float* pSrc = reinterpret_cast<const float*>(source->pData);
+			uint8_t* pDst = pData;
+			for (uint32_t i = 0; i < vertexCount; i++)
+			{
+				const glm::vec3 position(pSrc[0], pSrc[1], pSrc[2]);
+				const glm::vec3 normal(pSrc[3], pSrc[4], pSrc[5]);
+
+				const uint64_t packedPosition = (attrib == MeshAttrib::P3NT2_HALF) ? VertexPacking::packPositionHalf(position)
+																				   : VertexPacking::packPositionUnorm16(position, quantization);
+				const uint32_t packedNormal = VertexPacking::packNormalOctahedral(normal);
+				memcpy(pDst, &packedPosition, 8);
+				memcpy(pDst + 8, &packedNormal, 4);
+
+				if (hasTexcoord)
+				{
+					const uint32_t packedTexcoord = VertexPacking::packTexcoordUnorm16(glm::vec2(pSrc[6], pSrc[7]));
+					memcpy(pDst + 12, &packedTexcoord, 4);
+				}
+
+				pSrc += srcStride;
+				pDst += dstStride;
+			}
+
+			out->pData = pData;
+			return out;
+		}
+
 		MeteDataPtr Box::getVertexData(MeshAttrib attrib, bool indexed) const
 		{
 			switch (attrib)
@@ -433,12 +477,25 @@ namespace jet
 			case jet::util::MeshAttrib::P4N:
 				return getBoxVertex<4, 3, 0>(m_Mode, indexed);
 				break;
+
+			case jet::util::MeshAttrib::P3NT2_HALF:
+			case jet::util::MeshAttrib::P3NT2_U16:
+				return packVertexData(getBoxVertex<3, 3, 2>(m_Mode, indexed), attrib, getVertexQuantization());
+				break;
+			case jet::util::MeshAttrib::P3N_U16:
+				return packVertexData(getBoxVertex<3, 3, 0>(m_Mode, indexed), attrib, getVertexQuantization());
+				break;
 			
 			default:
 				break;
 			}
 		}
 
+		VertexQuantization Box::getVertexQuantization() const
+		{
+			return VertexPacking::computeQuantization(reinterpret_cast<const glm::vec3*>(CUBE_POSITIONS), _countof(CUBE_POSITIONS) / 3);
+		}
+
 		const char* Box::getShapeName() const
 		{
 			static const char* name = "Box";
@@ -493,11 +550,7 @@ namespace jet
 #endif
 		void Box::getBound(BoundingVolume* pBound) const
 		{
-			const glm::vec3* pSources = (glm::vec3*)CUBE_POSITIONS;
-			for (int i = 0; i < 8; i++)
-			{
-				// TODO
-			}
+			pBound->computeFromPoints(reinterpret_cast<const glm::vec3*>(CUBE_POSITIONS), _countof(CUBE_POSITIONS) / 3);
 		}
 
 		extern "C" uint32_t ParseMeshAttrib(MeshAttrib attrib, std::vector<AttribDesc>& descs)
@@ -632,6 +685,32 @@ namespace jet
 				return 3;
 			}
 				break;
+			case jet::util::MeshAttrib::P3NT2_HALF:
+			case jet::util::MeshAttrib::P3NT2_U16:
+			{
+				const DataType posType = (attrib == MeshAttrib::P3NT2_HALF) ? DataType::HALF : DataType::UINT16;
+				const GLuint posSize = (attrib == MeshAttrib::P3NT2_HALF) ? 4 : 3;
+				AttribDesc pos_desc = { static_cast<uint32_t>(AttribLocationDef::POSITION), posSize, posType, posType == DataType::UINT16, 16, };
+				descs.push_back(pos_desc);
+
+				AttribDesc nor_desc = { static_cast<uint32_t>(AttribLocationDef::NORMAL), 2, DataType::INT16, true, 16, 0, reinterpret_cast<GLvoid*>(8) };
+				descs.push_back(nor_desc);
+
+				AttribDesc tex_desc = { static_cast<uint32_t>(AttribLocationDef::TEXCOORD), 2, DataType::UINT16, true, 16, 0, reinterpret_cast<GLvoid*>(12) };
+				descs.push_back(tex_desc);
+				return 3;
+			}
+				break;
+			case jet::util::MeshAttrib::P3N_U16:
+			{
+				AttribDesc pos_desc = { static_cast<uint32_t>(AttribLocationDef::POSITION), 3, DataType::UINT16, true, 12, };
+				descs.push_back(pos_desc);
+
+				AttribDesc nor_desc = { static_cast<uint32_t>(AttribLocationDef::NORMAL), 2, DataType::INT16, true, 12, 0, reinterpret_cast<GLvoid*>(8) };
+				descs.push_back(nor_desc);
+				return 2;
+			}
+				break;
 			case jet::util::MeshAttrib::COUNT:
 			default:
 				return 0;
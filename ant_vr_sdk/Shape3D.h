@@ -2,7 +2,9 @@
 
 #include "Node.h"
 #include "gl_state_define.h"
+#include "VertexPacking.h"
 #include <sstream>
+#include <atomic>
 
 namespace jet
 {
@@ -82,11 +84,21 @@ namespace jet
 			P4NT2,
 			P4N,
 			P4NT3,
+
+			// Quantized layouts, 16 bytes per vertex instead of 32. The normals are octahedral encoded
+			// (see VertexPacking) and the texcoords are unorm16.
+			// Half positions with w = 1.0.
+			P3NT2_HALF,
+			// Unorm16 positions, decoded with the VertexQuantization of the shape.
+			P3NT2_U16,
+			P3N_U16,
 			COUNT
 		};
 
 		extern "C" uint32_t ParseMeshAttrib(MeshAttrib attrib, std::vector<AttribDesc>& desc);
 
+		class TriangleBVH;
+
 		class Shape3D
 		{
 		public:
@@ -180,7 +192,11 @@ namespace jet
 			virtual const MeshAttrib getSupportCombinedAttrib() const = 0;
 			virtual MeteDataPtr getVertexData(MeshAttrib attrib, bool indexed = true) const = 0;
 			virtual const std::string& getUniqueName() const { return m_strName; }
+			// The unique name kept by the StringTable, the shapes of the same name share the pointer.
+			const std::string* getInternedName() const { return m_pInternedName; }
 			virtual int getNumLodLevels() const { return 1; }
+			// Return the scale and bias of the unorm16 positions of the quantized layouts, pass them to the vertex shader.
+			virtual VertexQuantization getVertexQuantization() const { return VertexQuantization(); }
 
 			// Return the vertex count about the specified primitives of the shape , when indexed is false, return the count of the fully expand vertexs.
 			virtual int getVertexCount(bool indexed = true) const = 0;
@@ -204,6 +220,14 @@ namespace jet
 		protected:
 			Mode m_Mode;
 			std::string m_strName;
+			const std::string* m_pInternedName;
+
+		private:
+			friend class TriangleBVH;
+
+			// The tree TriangleBVH::get found for the shape, valid while the generation matches the trees.
+			mutable std::atomic<const TriangleBVH*> m_pTriangleBVH;
+			mutable std::atomic<uint32_t> m_uiTriangleBVHGeneration;
 		};
 
 		typedef std::shared_ptr<Shape3D> ShapePtr;
@@ -220,6 +244,7 @@ namespace jet
 //			const std::string& getUniqueName() const override;
 			int getVertexCount(bool indexed = true) const override;
 			int getIndiceCount() const override;
+			VertexQuantization getVertexQuantization() const override;
 //			int getTriangleCount(bool indexed = true) const override;
 			void getBound(BoundingVolume* pBound) const override;
 		protected:
@@ -6,7 +6,7 @@ namespace jet
 	{
 		static const std::string BOX_NAME = "BoxNode";
 
-		SimpleScene::SimpleScene()
+		SimpleScene::SimpleScene() : m_pBoxNode(nullptr), m_fXRotate(0.0f), m_fYRotate(0.0f)
 		{
 			
 		}
@@ -21,12 +21,16 @@ namespace jet
 		{
 			m_pBox = ShapePtr(new Box(Box::Mode::TRIANGLES));
 			m_pBoxNode = new Geometry(BOX_NAME, m_pBox);
+			m_pBoxNode->setLocalScale(0.7f);
+			m_pBoxNode->setLocalTranslation(1.0f, 0.0f, 0.0f);
 			m_pRoot->attachChild(m_pBoxNode);
 		}
 
 		void SimpleScene::update(float elpsedTime)
 		{
-
+			m_pBoxNode->setLocalRotation(glm::quat(glm::vec3(m_fXRotate, m_fYRotate, 0.0f)));
+			m_fXRotate += 0.008f;
+			m_fYRotate += 0.009f;
 		}
 	}
 }
@@ -20,6 +20,8 @@ namespace jet
 		private:
 			Geometry* m_pBoxNode;
 			ShapePtr  m_pBox;
+			float m_fXRotate;
+			float m_fYRotate;
 		};
 	}
 }
@@ -7,42 +7,21 @@ namespace jet
 		class SingleGeometryGeometryAssembly : public GeometryAssembly
 		{
 		public:
-			SingleGeometryGeometryAssembly(const GeometryAttribData& data, const GeometryAttribDesc* pDescs, GLuint vertexCount, GLenum primitives = GL_TRIANGLES) :m_pVAO(nullptr), m_pGeometry(nullptr),
-				m_pElementBuffer(nullptr), m_IndicesType(0)
+			SingleGeometryGeometryAssembly(SpatialManager* pManager, Geometry* pGeometry) : m_pManager(pManager), m_pMesh(nullptr), m_pGeometry(pGeometry)
 			{
-				init(data, pDescs, vertexCount, primitives);
+				init();
 			}
 
-			void init(const GeometryAttribData& data, const GeometryAttribDesc* pDescs, GLuint vertexCount, GLenum primitives = GL_TRIANGLES)
+			// Pick up the shared mesh of the current shape of the geometry.
+			void init()
 			{
 				release();
 
-				m_VertexCount = vertexCount;
-				m_Primitve = primitives;
-				for (uint32_t i = 0; i < data.AttribCount; i++)
+				Shape3D* pShape = m_pGeometry ? m_pGeometry->getMesh().get() : nullptr;
+				if (pShape)
 				{
-					ArrayBufferGL<BufferUsage::STATIC_DRAW, 0>* pArrayBuffer = new ArrayBufferGL < BufferUsage::STATIC_DRAW, 0 >;
-					pArrayBuffer->init(data.AttribSize[i], data.AttribData[i]);
-					m_pArrayBuffers.push_back(pArrayBuffer);
-
-					//						attribDesc[i] = pDescs->BufferDescs[i];
-				}
-
-				if (data.ElementSize)
-				{
-					m_pElementBuffer = new ElementBufferGL< BufferUsage::STATIC_DRAW, 0 >;
-					m_pElementBuffer->init(data.ElementSize, data.ElementData);
-					m_IndicesType = ConvertDataTypeToGLenum(data.ElementDataType);
+					m_pMesh = m_pManager->acquireGeometryMesh(pShape);
 				}
-
-				BufferData bufferData;
-				bufferData.ArrayBufferCount = data.AttribCount;
-				bufferData.ArrayBufferDescs = const_cast<GeometryAttribDesc*>(pDescs);
-				bufferData.ArrayBuffers = &m_pArrayBuffers[0];
-				bufferData.ElementBuffer = m_pElementBuffer;
-
-				m_pVAO = new VertexArrayGL;
-				m_pVAO->load(&bufferData);
 			}
 
 			~SingleGeometryGeometryAssembly()
@@ -52,16 +31,8 @@ namespace jet
 
 			void release()
 			{
-				for (size_t i = 0; i < m_pArrayBuffers.size(); i++)
-				{
-					delete m_pArrayBuffers[i];
-				}
-				m_pArrayBuffers.clear();
-
-				SAFE_DELETE(m_pElementBuffer);
-				SAFE_DELETE(m_pVAO);
-
-				m_IndicesType = 0;
+				m_pManager->releaseGeometryMesh(m_pMesh);
+				m_pMesh = nullptr;
 			}
 
 			bool contain(Geometry* pGeo) const override
@@ -72,48 +43,48 @@ namespace jet
 			// Bind the geometries buffer data
 			void bind() override
 			{
-				if (m_pGeometry && m_pVAO)
+				if (m_pGeometry && m_pMesh)
 				{
-					m_pVAO->bind();
+					m_pMesh->VAO->bind();
 				}
 			}
 			// Unbind the buffer data
 			void unbind() override
 			{
-				if (m_pGeometry && m_pVAO)
+				if (m_pGeometry && m_pMesh)
 				{
-					m_pVAO->unbind();
+					m_pMesh->VAO->unbind();
 				}
 			}
 
 			// Invoking the opengl draw command.
 			void draw() override
 			{
-				if (m_pGeometry && m_pVAO)
+				if (m_pGeometry && m_pMesh)
 				{
-					if (m_IndicesType != 0)
+					if (m_pMesh->IndicesType != 0)
 					{
-						glDrawElements(m_Primitve, m_VertexCount, m_IndicesType, reinterpret_cast<void*>(0));
+						glDrawElements(m_pMesh->Primitive, m_pMesh->VertexCount, m_pMesh->IndicesType, reinterpret_cast<void*>(0));
 					}
 					else
 					{
-						glDrawArrays(m_Primitve, 0, m_VertexCount);
+						glDrawArrays(m_pMesh->Primitive, 0, m_pMesh->VertexCount);
 					}
 				}
 			}
 
 			bool isEmpty() override
 			{
-				return m_pGeometry != nullptr;
+				return m_pMesh == nullptr;
 			}
 
-			VertexArrayGL* m_pVAO;
-			std::vector<BufferGPU*> m_pArrayBuffers;
-			BufferGPU* m_pElementBuffer;
-			GLenum m_IndicesType;
+			const GeometryMesh* getMesh() const { return m_pMesh; }
+
+		private:
+			SpatialManager* m_pManager;
+			// Shared with the other geometries drawing the same shape, see SpatialManager::acquireGeometryMesh().
+			GeometryMesh* m_pMesh;
 			Geometry* m_pGeometry;
-			GLenum m_Primitve;
-			GLuint m_VertexCount;
 		};
 		
 		class SingleGeometryBatchBuffer : public BatchBuffer
@@ -121,7 +92,12 @@ namespace jet
 		public:
 
 			SingleGeometryBatchBuffer(SpatialManager* pManager) : BatchBuffer(pManager), 
-				m_pGeometry(nullptr), m_pGeometryAssembly(nullptr){}
+				m_pGeometry(nullptr), m_pGeometryAssembly(nullptr), m_bMeshChanged(false){}
+
+			~SingleGeometryBatchBuffer()
+			{
+				SAFE_DELETE(m_pGeometryAssembly);
+			}
 
 			bool addGeometry(Geometry* pGeo) override
 			{
@@ -140,6 +116,8 @@ namespace jet
 			{
 				if (pGeo && pGeo == m_pGeometry)
 				{
+					// Give the shared mesh back right away, so it is freed with its last geometry.
+					SAFE_DELETE(m_pGeometryAssembly);
 					m_pGeometry = nullptr;
 					return true;
 				}
@@ -168,100 +146,12 @@ namespace jet
 				return 1;
 			}
 
-			static void initIndicesData(Shape3D* pShape, GeometryAttribData& attribData)
+			void initGeometryAssembly()
 			{
-				const bool indexed = pShape->getMode() != Shape3D::Mode::POINTS;
-				if (indexed)
-				{
-					const GeometryMemoryData& indicesData = SpatialManager::getGeometryMemoryData(pShape, MeshAttrib::INDICES, indexed);
-					attribData.ElementDataType == pShape->getIndiceType();
-					attribData.ElementData = const_cast<uint8_t*>(indicesData.MemoryData->pData);
-					attribData.ElementSize = indicesData.MemoryData->uiLength;
-				}
+				if (m_pGeometryAssembly == nullptr)
+					m_pGeometryAssembly = new SingleGeometryGeometryAssembly(m_SpatialManager, m_pGeometry);
 				else
-				{
-					attribData.ElementDataType == DataType::UNKOWN;
-					attribData.ElementData = nullptr;
-					attribData.ElementSize = 0;
-				}
-			}
-
-			void initGeometryAssembly(Shape3D* pShape)
-			{
-				if (pShape == nullptr)
-				{
-					return;
-				}
-
-//				ShapeKey key = ShapeKey(pShape->getUniqueName(), (pShape->getMode() != Shape3D::Mode::POINTS));
-				MeshAttrib combinedAttrib = pShape->getSupportCombinedAttrib();
-				const bool indexed = pShape->getMode() != Shape3D::Mode::POINTS;
-				
-				std::vector<AttribDesc> attribDescs;
-
-				if (combinedAttrib != MeshAttrib::NONE)
-				{
-					const GeometryMemoryData& memoryData = SpatialManager::getGeometryMemoryData(pShape, combinedAttrib, indexed);
-					assert(memoryData.MemoryData.get());
-
-					GeometryAttribData attribData;
-					initIndicesData(pShape, attribData);
-
-					attribData.AttribCount = 1;
-					attribData.AttribData = const_cast<uint8_t**>(&memoryData.MemoryData->pData);
-					attribData.AttribSize = &memoryData.MemoryData->uiLength;
-					ParseMeshAttrib(combinedAttrib, attribDescs);
-
-					GeometryAttribDesc bufferDesc = { attribDescs.size(), &attribDescs[0] };
-
-					if (m_pGeometryAssembly == nullptr)
-						m_pGeometryAssembly = new SingleGeometryGeometryAssembly(attribData, &bufferDesc, 
-						indexed ? pShape->getIndiceCount(): pShape->getVertexCount(false), 
-						Shape3D::convertModeToGLenum(pShape->getMode()));
-					else
-						m_pGeometryAssembly->init(attribData, &bufferDesc, 
-						indexed ? pShape->getIndiceCount() : pShape->getVertexCount(false), 
-						Shape3D::convertModeToGLenum(pShape->getMode()));
-				}
-				else
-				{
-					uint32_t attribCount = 0;
-					const MeshAttrib* pMeshAttribs=pShape->getSupportAttribs(attribCount);
-					assert(attribCount);
-					std::vector<GeometryMemoryData> memoryData(attribCount);
-
-					for (uint32_t i = 0; i < attribCount; i++)
-					{
-						memoryData[i] = SpatialManager::getGeometryMemoryData(pShape, pMeshAttribs[i], indexed);
-					}
-
-					std::vector<uint32_t> arrayBufferSize;
-					std::vector<const uint8_t*> arrayBufferData;
-					std::vector<GeometryAttribDesc> arrayBufferDesc;
-					GeometryAttribData attribData;
-					initIndicesData(pShape, attribData);
-
-					for (uint32_t i = 0; i < attribCount; i++)
-					{
-						size_t start_loc = attribDescs.size();
-						uint32_t count = ParseMeshAttrib(memoryData[i].Attrib, attribDescs);
-						MeteData* pData = memoryData[i].MemoryData.get();
-
-						arrayBufferSize.push_back(pData->uiLength);
-						arrayBufferData.push_back(pData->pData);
-						arrayBufferDesc.push_back(GeometryAttribDesc{ count, &attribDescs[start_loc] });
-					}
-					attribData.AttribCount = static_cast<uint32_t>(arrayBufferDesc.size());
-					attribData.AttribData = const_cast<uint8_t**>(&arrayBufferData[0]);
-					attribData.AttribSize = &arrayBufferSize[0];
-					uint32_t vertexCount = indexed ? pShape->getIndiceCount() : pShape->getVertexCount(false);
-
-					if (m_pGeometryAssembly == nullptr)
-						m_pGeometryAssembly = new SingleGeometryGeometryAssembly(attribData, &arrayBufferDesc[0], vertexCount, Shape3D::convertModeToGLenum(pShape->getMode()));
-					else
-						m_pGeometryAssembly->init(attribData, &arrayBufferDesc[0], vertexCount, Shape3D::convertModeToGLenum(pShape->getMode()));
-				}
-				
+					m_pGeometryAssembly->init();
 			}
 
 			GeometryAssembly* getGeometryAssembly(uint32_t index) override
@@ -283,13 +173,7 @@ namespace jet
 						return pSharedGeometryAssembly;
 					}
 
-					Shape3D* pShape = m_pGeometry->getMesh().get();
-					if (!pShape)
-					{
-						return nullptr;
-					}
-
-					initGeometryAssembly(pShape);
+					initGeometryAssembly();
 					return m_pGeometryAssembly;
 				}
 			}
@@ -362,7 +246,7 @@ namespace jet
 						}
 						else
 						{
-							initGeometryAssembly(m_pGeometry->getMesh().get());
+							initGeometryAssembly();
 						}
 					}
 //					else if (m_pGeometry != nullptr && )
@@ -1,17 +1,213 @@
 #include "Spatial.h"
 #include "Node.h"
+#include "SceneGraphVisitor.h"
+#include "ControlRegistry.h"
+#include <mutex>
+#include <vector>
+#include <atomic>
 
 namespace jet
 {
 	namespace util
 	{
-		
+		// The side table of Spatial::SparseData. The entries are kept in chunks which never move once
+		// created, a spatial reads its own entry at the slot it holds without locking. Only handing out
+		// and releasing a slot take the mutex.
+		static const uint32_t SPARSE_CHUNK_BITS = 10;
+		static const uint32_t SPARSE_CHUNK_SIZE = 1u << SPARSE_CHUNK_BITS;
+		static const uint32_t SPARSE_MAX_CHUNKS = 4096;
+
+		static std::mutex g_SparseMutex;
+		static std::atomic<void**> g_SparseChunks[SPARSE_MAX_CHUNKS];
+		static uint32_t g_uiSparseSlotCount = 0;
+		static std::vector<uint32_t> g_FreeSparseSlots;
+
+		static void*& sparseEntry(uint32_t slot)
+		{
+			void** pChunk = g_SparseChunks[slot >> SPARSE_CHUNK_BITS].load(std::memory_order_acquire);
+			return pChunk[slot & (SPARSE_CHUNK_SIZE - 1)];
+		}
+
 		Spatial::~Spatial()
 		{
+			// A control may delete the spatial while the root updates, the registries must not reach it anymore.
+			ControlRegistry::onSpatialDestroyed(this);
+			if (m_pParent)
+			{
+				m_pParent->invalidateUpdateList();
+			}
+
+			if (m_uiSparseSlot)
+			{
+				const uint32_t slot = m_uiSparseSlot - 1;
+				delete static_cast<SparseData*>(sparseEntry(slot));
+				sparseEntry(slot) = nullptr;
+
+				std::lock_guard<std::mutex> lock(g_SparseMutex);
+				g_FreeSparseSlots.push_back(slot);
+			}
+		}
+
+		Spatial::Spatial(const std::string& name, SpatialType type) : m_pParent(nullptr), m_iRefreshFlags(0), m_uiChildIndex(0), m_SpatialType(type),
+			m_CullHint(CullHint::INHERIT), m_BatchHint(BatchHint::INHERIT), m_FrustumeIntersects(FrustumIntersect::INTERSECTS),
+			m_QueueBucket(Bucket::INHERIT), m_ShadowMode(ShadowMode::INHERIT), m_bRequiresUpdates(false),
+			m_pName(StringTable::get().intern(name)), m_uiSparseFlags(0), m_AttachState(AttachState::NONE), m_uiSparseSlot(0)
+		{
+		}
+
+		Spatial::SparseData* Spatial::getSparseData() const
+		{
+			return m_uiSparseSlot ? static_cast<SparseData*>(sparseEntry(m_uiSparseSlot - 1)) : nullptr;
 		}
 
-		Spatial::Spatial(const std::string& name) : m_strName(name), m_pParent(nullptr), m_iRefreshFlags(0), m_bRequiresUpdates(false)
+		Spatial::SparseData& Spatial::acquireSparseData()
 		{
+			SparseData* pData = getSparseData();
+			if (pData == nullptr)
+			{
+				pData = new SparseData();
+
+				uint32_t slot;
+				{
+					std::lock_guard<std::mutex> lock(g_SparseMutex);
+					if (!g_FreeSparseSlots.empty())
+					{
+						slot = g_FreeSparseSlots.back();
+						g_FreeSparseSlots.pop_back();
+					}
+					else
+					{
+						slot = g_uiSparseSlotCount++;
+						std::atomic<void**>& chunk = g_SparseChunks[slot >> SPARSE_CHUNK_BITS];
+						if ((slot & (SPARSE_CHUNK_SIZE - 1)) == 0)
+						{
+							assert((slot >> SPARSE_CHUNK_BITS) < SPARSE_MAX_CHUNKS);
+							chunk.store(new void*[SPARSE_CHUNK_SIZE](), std::memory_order_release);
+						}
+					}
+				}
+
+				sparseEntry(slot) = pData;
+				m_uiSparseSlot = slot + 1;
+			}
+			return *pData;
+		}
+
+		LightListPtr Spatial::getLocalLightList()
+		{
+			SparseData* pData = getSparseData();
+			return pData ? pData->pLocalLights : nullptr;
+		}
+
+		ControlPtr Spatial::getControl(int index)
+		{
+			SparseData* pData = getSparseData();
+			assert(pData);
+			return pData->Controls.at(index);
+		}
+
+		uint32_t Spatial::getNumControls() const
+		{
+			SparseData* pData = getSparseData();
+			return pData ? static_cast<uint32_t>(pData->Controls.size()) : 0;
+		}
+
+		void Spatial::addControl(ControlPtr control)
+		{
+			assert(control);
+			if (ControlRegistry::deferAddControl(this, control))
+			{
+				return;
+			}
+
+			acquireSparseData().Controls.push_back(control);
+			m_uiSparseFlags |= SPARSE_CONTROLS;
+			control->setSpatial(this);
+			invalidateControlRegistry();
+		}
+
+		bool Spatial::removeControl(const ControlPtr& control)
+		{
+			// Added during the update, the control is not in the list yet.
+			if (ControlRegistry::cancelAddControl(this, control))
+			{
+				return true;
+			}
+
+			SparseData* pData = getSparseData();
+			if (pData == nullptr)
+			{
+				return false;
+			}
+
+			auto it = std::find(pData->Controls.begin(), pData->Controls.end(), control);
+			if (it == pData->Controls.end())
+			{
+				return false;
+			}
+
+			// The registry updating holds the control, it is released after the update.
+			if (ControlRegistry::deferRemoveControl(this, control))
+			{
+				return true;
+			}
+
+			pData->Controls.erase(it);
+			control->setSpatial(nullptr);
+			if (pData->Controls.empty())
+			{
+				m_uiSparseFlags &= ~SPARSE_CONTROLS;
+			}
+			invalidateControlRegistry();
+			return true;
+		}
+
+		void Spatial::invalidateControlRegistry()
+		{
+			if (isNode())
+			{
+				static_cast<Node*>(this)->invalidateUpdateList();
+			}
+			else if (m_pParent)
+			{
+				m_pParent->invalidateUpdateList();
+			}
+		}
+
+		void Spatial::setUserData(const std::string& key, void* pData)
+		{
+			if (pData == nullptr)
+			{
+				SparseData* pSparse = getSparseData();
+				if (pSparse)
+				{
+					pSparse->UserData.erase(key);
+				}
+				return;
+			}
+
+			acquireSparseData().UserData[key] = pData;
+		}
+
+		void* Spatial::getUserData(const std::string& key) const
+		{
+			SparseData* pData = getSparseData();
+			if (pData == nullptr)
+			{
+				return nullptr;
+			}
+
+			auto it = pData->UserData.find(key);
+			return it != pData->UserData.end() ? it->second : nullptr;
+		}
+
+		size_t Spatial::getSparseDataBytes()
+		{
+			std::lock_guard<std::mutex> lock(g_SparseMutex);
+			const uint32_t chunks = (g_uiSparseSlotCount + SPARSE_CHUNK_SIZE - 1) >> SPARSE_CHUNK_BITS;
+			const size_t entries = g_uiSparseSlotCount - g_FreeSparseSlots.size();
+			return chunks * SPARSE_CHUNK_SIZE * sizeof(void*) + entries * sizeof(SparseData) +
+				g_FreeSparseSlots.capacity() * sizeof(uint32_t);
 		}
 
 		void Spatial::forceRefresh(bool transforms, bool bounds, bool lights)
@@ -39,9 +235,7 @@ namespace jet
 			}
 #endif
 			assert(m_iRefreshFlags == 0);
-			return true;
 
-#if 0
 			CullHint cm = getCullHint();
 			assert(cm != CullHint::INHERIT);
 
@@ -56,7 +250,8 @@ namespace jet
 				return true;
 			}
 
-			// check to see if we can cull this node
+			// check to see if we can cull this node. A parent fully inside the frustum
+			// is inherited as is, so none of its descendants touch the planes again.
 			m_FrustumeIntersects = (m_pParent ? m_pParent->m_FrustumeIntersects
 				: FrustumIntersect::INTERSECTS);
 
@@ -64,16 +259,16 @@ namespace jet
 			{
 				if (getQueueBucket() == Bucket::GUI)
 				{
-					return cam.containsGui(getWorldBound());
+					// The gui bounds are in screen space, there is no frustum to test them against.
+					return true;
 				}
 				else
 				{
-					m_FrustumeIntersects = cam.contains(getWorldBound());
+					m_FrustumeIntersects = pCam->contains(getWorldBound().get());
 				}
 			}
 
 			return m_FrustumeIntersects != FrustumIntersect::OUTSIDE;
-#endif
 		}
 
 		void Spatial::rotateUpTo(const glm::vec3& newUp) 
@@ -368,9 +563,9 @@ namespace jet
 			checkDoTransformUpdate();
 
 			// Go to children recursively and update their bound
-			if (dynamic_cast<Node*>(this))
+			if (isNode())
 			{
-				Node* node = (Node*) this;
+				Node* node = static_cast<Node*>(this);
 				int len = node->getQuantity();
 				for (int i = 0; i < len; i++) {
 					Spatial* child = node->getChild(i);
@@ -390,5 +585,22 @@ namespace jet
 			}
 			return false;
 		}
+
+		// One traverser per thread, the walks started from the callbacks stack on top of the running one.
+		static SceneGraphTraverser& getThreadTraverser()
+		{
+			static thread_local SceneGraphTraverser traverser;
+			return traverser;
+		}
+
+		void Spatial::depthFirstTraversal(SceneGraphVisitor& visitor)
+		{
+			getThreadTraverser().depthFirst(this, visitor);
+		}
+
+		void Spatial::breadthFirstTraversal(SceneGraphVisitor& visitor)
+		{
+			getThreadTraverser().breadthFirst(this, visitor);
+		}
 	}
 }
@@ -5,8 +5,11 @@
 #include "RenderQueue.h"
 #include <map>
 #include <algorithm>
+#include <atomic>
 #include "Util.h"
 #include "Material.h"
+#include "StringTable.h"
+#include "CollisionResults.h"
 
 namespace jet
 {
@@ -51,6 +54,15 @@ namespace jet
 			* @param vp
 			*/
 			virtual void render(class RenderManager* pRM, class ViewPort& vp) = 0;
+
+			/**
+			* Returns true if update() only changes this control and its spatial, and
+			* doesn't attach or detach spatials. The root then updates the control in
+			* parallel with the other independent ones.
+			*/
+			virtual bool isIndependent() const { return false; }
+
+			virtual ~Control() {}
 		};
 
 		typedef std::shared_ptr<Control> ControlPtr;
@@ -59,7 +71,7 @@ namespace jet
 		* Specifies how frustum culling should be handled by
 		* this spatial.
 		*/
-		enum class CullHint 
+		enum class CullHint : uint8_t
 		{
 
 			/**
@@ -87,7 +99,7 @@ namespace jet
 		/**
 		* Specifies if this spatial should be batched
 		*/
-		enum class BatchHint 
+		enum class BatchHint : uint8_t
 		{
 			/**
 			* Do whatever our parent does. If no parent, default to {@link #Always}.
@@ -103,10 +115,22 @@ namespace jet
 			NEVER
 		};
 
+		/**
+		* The concrete kind of a spatial. It lets the scene walks tell the nodes
+		* from the geometries without RTTI.
+		*/
+		enum class SpatialType : uint8_t
+		{
+			NODE,
+			GEOMETRY
+		};
+
 		class Spatial
 		{
 		public:
 			friend class Node;
+			friend class TransformHierarchy;
+			friend class ControlRegistry;
 
 			/**
 			* (Internal use only) Forces a refresh of the given types of data.
@@ -130,21 +154,36 @@ namespace jet
 			*/
 			virtual bool checkCulling(Camera* pCam);
 
+			/**
+			* <code>collideWith</code> adds the triangles of the geometries under this
+			* spatial that the ray hits to the results, see {@link Geometry#collideWith}.
+			*
+			* @return the number of collisions added.
+			*/
+			virtual int collideWith(const Ray& ray, CollisionResults& results) { return 0; }
+
+			/**
+			* Returns true if the ray hits any triangle under this spatial, the walk stops
+			* at the first one found. Meant for the line of sight tests.
+			*/
+			virtual bool intersectsAny(const Ray& ray) { return false; }
+
 			/**
 			* Sets the name of this spatial.
 			*
 			* @param name
 			*            The spatial's new name.
 			*/
-			void setName(const std::string& name) { m_strName = name; }
-			void setName(const char* pName)       { m_strName = pName; }
+			void setName(const std::string& name) { m_pName = StringTable::get().intern(name); }
+			void setName(const char* pName)       { m_pName = StringTable::get().intern(pName); }
 
 			/**
-			* Returns the name of this spatial.
+			* Returns the name of this spatial. The names are interned, the spatials
+			* with the same name share it.
 			*
 			* @return This spatial's name.
 			*/
-			const std::string& getName() const{ return m_strName; }
+			const std::string& getName() const{ return *m_pName; }
 
 			/**
 			* Returns the local {@link LightList}, which are the lights
@@ -154,7 +193,7 @@ namespace jet
 			*
 			* @return The local light list
 			*/
-			LightListPtr getLocalLightList() { return m_pLocalLights;}
+			LightListPtr getLocalLightList();
 
 			/**
 			* Returns the world {@link LightList}, containing the lights
@@ -422,33 +461,56 @@ namespace jet
 			*
 			* @see Spatial#addControl(com.jme3.scene.control.Control)
 			*/
-			ControlPtr getControl(int index) 
-			{
-				return m_pControls.at(index);
-			}
+			ControlPtr getControl(int index);
 
 			/**
 			* @return The number of controls attached to this Spatial.
 			* @see Spatial#addControl(com.jme3.scene.control.Control)
 			* @see Spatial#removeControl(java.lang.Class)
 			*/
-			uint32_t getNumControls() 
-			{
-				return (uint32_t)m_pControls.size();
-			}
+			uint32_t getNumControls() const;
+
+			/**
+			* Add a control to the list of controls. While the root updates
+			* the controls, the control is added after the update.
+			* @param control The control to add.
+			*/
+			void addControl(ControlPtr control);
+
+			/**
+			* Removes the given control from this spatial's controls. While the root
+			* updates the controls, the control is removed after the update, and a
+			* control whose add is still queued is dropped from the queue.
+			*
+			* @param control The control to remove
+			* @return True if the control was successfully removed. False if the
+			* control is not assigned to this spatial.
+			*/
+			bool removeControl(const ControlPtr& control);
+
+			/**
+			* Sets the user data of the key, a null pointer removes it.
+			* The spatial doesn't own the data.
+			*/
+			void setUserData(const std::string& key, void* pData);
+
+			/// Returns the user data of the key, or null.
+			void* getUserData(const std::string& key) const;
+
+			/// The heap held by the side table of the controls, user data and local lights, for the memory reports.
+			/// The vectors and maps inside the entries are not followed.
+			static size_t getSparseDataBytes();
 
 			/**
-			* <code>updateLogicalState</code> calls the <code>update()</code> method
-			* for all controls attached to this Spatial.
+			* <code>updateLogicalState</code> is called every frame for the spatials
+			* that require it. The controls attached to this Spatial are not updated
+			* here, the {@link ControlRegistry} of the root node updates them.
 			*
 			* @param tpf Time per frame.
 			*
 			* @see Spatial#addControl(com.jme3.scene.control.Control)
 			*/
-			virtual void updateLogicalState(float tpf) 
-			{
-				runControlUpdate(tpf);
-			}
+			virtual void updateLogicalState(float tpf) {}
 
 			/**
 			* <code>updateGeometricState</code> updates the lightlist,
@@ -979,62 +1041,28 @@ namespace jet
 				return m_WorldTransform.getCombinedMatrix();
 			}
 
-#if 0
-			/**
-			* Visit each scene graph element ordered by DFS with the default post order mode.
-			* @param visitor
-			* @see #depthFirstTraversal(com.jme3.scene.SceneGraphVisitor, com.jme3.scene.Spatial.DFSMode)
-			*/
-			void depthFirstTraversal(SceneGraphVisitor visitor) {
-				depthFirstTraversal(visitor, DFSMode.POST_ORDER);
-			}
+			SpatialType getSpatialType() const { return m_SpatialType; }
+			bool isNode() const { return m_SpatialType == SpatialType::NODE; }
+			bool isGeometry() const { return m_SpatialType == SpatialType::GEOMETRY; }
 
 			/**
-			* Specifies the mode of the depth first search.
+			* Visits this spatial and its descendants depth first. The visitor's enter() runs
+			* before the children of a spatial and leave() after them.
+			* @see SceneGraphVisitor
 			*/
-			enum class DFSMode {
-				/**
-				* Pre order: the current spatial is visited first, then its children.
-				*/
-				PRE_ORDER,
-				/**
-				* Post order: the children are visited first, then the parent.
-				*/
-				POST_ORDER;
-			}
+			void depthFirstTraversal(class SceneGraphVisitor& visitor);
 
 			/**
-			* Visit each scene graph element ordered by DFS.
-			* There are two modes: pre order and post order.
-			* @param visitor
-			* @param mode the traversal mode: pre order or post order
+			* Visits this spatial and its descendants level by level, only enter() is called.
 			*/
-			virtual void depthFirstTraversal(SceneGraphVisitor visitor, DFSMode mode) = 0;
-
-			/**
-			* Visit each scene graph element ordered by BFS
-			* @param visitor
-			*/
-			void breadthFirstTraversal(SceneGraphVisitor visitor) {
-				Queue<Spatial> queue = new LinkedList<Spatial>();
-				queue.add(this);
-
-				while (!queue.isEmpty()) {
-					Spatial s = queue.poll();
-					visitor.visit(s);
-					s.breadthFirstTraversal(visitor, queue);
-				}
-			}
-
-			virtual void breadthFirstTraversal(SceneGraphVisitor visitor, Queue<Spatial> queue) = 0;
-#endif
+			void breadthFirstTraversal(class SceneGraphVisitor& visitor);
 
 			virtual ~Spatial();
 
 		protected:
 //			Spatial() : Spatial(""){}
 
-			Spatial(const std::string& name);
+			Spatial(const std::string& name, SpatialType type);
 
 			/**
 			* Returns true if this spatial requires updateLogicalState() to
@@ -1042,7 +1070,7 @@ namespace jet
 			* or because the spatial has controls.  This is package private to
 			* avoid exposing it to the public API since it is only used by Node.
 			*/
-			bool requiresUpdates() { return m_bRequiresUpdates | !m_pControls.empty();}
+			bool requiresUpdates() { return m_bRequiresUpdates | ((m_uiSparseFlags & SPARSE_CONTROLS) != 0);}
 			/**
 			* Subclasses can call this with true to denote that they require
 			* updateLogicalState() to be called even if they contain no controls.
@@ -1118,6 +1146,8 @@ namespace jet
 
 			virtual void updateWorldLightList() 
 			{
+				// The lights are not supported yet, there is nothing to combine.
+				m_iRefreshFlags &= ~RF_LIGHTLIST;
 #if 0
 				if (m_pParent) 
 				{
@@ -1179,22 +1209,26 @@ namespace jet
 			virtual void setParent(Node* pParent) { m_pParent = pParent; }
 
 		private:
-			void runControlUpdate(float tpf) {
-				if (m_pControls.empty()) {
-					return;
-				}
-#if 0
-				for (Control c : controls.getArray()) {
-					c.update(tpf);
-				}
-#endif
+			// Lets the registry of the root rebuild its controls.
+			void invalidateControlRegistry();
 
-				std::vector<ControlPtr> arr(m_pControls);
-				for (auto it = arr.begin(); it != arr.end(); it++)
-				{
-					it->get()->update(tpf);
-				}
-			}
+			/**
+			* The members few spatials use. They live in a side table keyed by the
+			* spatial and are created with the first one set, so the others don't
+			* pay for them.
+			*/
+			typedef struct SparseData
+			{
+				std::vector<ControlPtr>      Controls;
+				std::map<std::string, void*> UserData;
+				LightListPtr                 pLocalLights;
+			}SparseData;
+
+			// Bits of m_uiSparseFlags.
+			static const uint8_t SPARSE_CONTROLS = 0x01;
+
+			SparseData* getSparseData() const;
+			SparseData& acquireSparseData();
 
 		public:
 			float m_fQueueDistance;
@@ -1208,33 +1242,30 @@ namespace jet
 			static const int RF_CHILD_LIGHTLIST = 0x08; //some child need geometry update
 			static const int RF_MATPARAM_OVERRIDE = 0x10;
 
-			std::string m_strName;
-
-			CullHint m_CullHint;
-			BatchHint m_BatchHint;
-
-			BoundingVolumePtr m_pWorldBound;
-
-			LightListPtr m_pLocalLights;
-			LightListPtr m_pWorldLights;
-
-			FrustumIntersect m_FrustumeIntersects;
-			Bucket           m_QueueBucket;
-			ShadowMode       m_ShadowMode;
-			
+			// The fields read by the update and culling passes come first and together,
+			// the rarely used ones are in the side table of SparseData.
 			Transform        m_LocalTransform;
 			Transform        m_WorldTransform;
-
-			std::vector<ControlPtr>      m_pControls;
-			std::map<std::string, void*> m_pUserData;
 			// Spatial's parent, or null if it has none.
 			class Node*            m_pParent;
+			BoundingVolumePtr m_pWorldBound;
 
 			/**
 			* Refresh flags. Indicate what data of the spatial need to be
-			* updated to reflect the correct state.
+			* updated to reflect the correct state. Atomic, since the controls
+			* run in parallel mark the bounds of their shared parents.
 			*/
-			int m_iRefreshFlags;
+			std::atomic<int> m_iRefreshFlags;
+			// The index in the children of m_pParent, kept by the parent so a child is detached without a search.
+			uint32_t               m_uiChildIndex;
+			// Set by the subclass, never changes.
+			const SpatialType      m_SpatialType;
+
+			CullHint m_CullHint;
+			BatchHint m_BatchHint;
+			FrustumIntersect m_FrustumeIntersects;
+			Bucket           m_QueueBucket;
+			ShadowMode       m_ShadowMode;
 
 			/**
 			* Set to true if a subclass requires updateLogicalState() even
@@ -1246,9 +1277,14 @@ namespace jet
 			*/
 			bool m_bRequiresUpdates;
 
+			// Interned, see StringTable.
+			const std::string* m_pName;
+			LightListPtr m_pWorldLights;
+
 		private:
+			uint8_t m_uiSparseFlags;
 
-			enum class AttachState
+			enum class AttachState : uint8_t
 			{
 				NONE, 
 				ATTACH,
@@ -1262,6 +1298,9 @@ namespace jet
 			// When it dettacehd from a Node, the value became DEATTACH.
 			// When it parsed by SceneManager with DEATTACH state, the value became NONE
 			AttachState m_AttachState;
+			// One past the slot of the spatial in the side table of SparseData, 0 if it has no entry.
+			// It fits in the padding at the end of the object.
+			uint32_t m_uiSparseSlot;
 		};
 	}
 }
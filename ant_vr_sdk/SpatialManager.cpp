@@ -1,11 +1,15 @@
 #include "SpatialManager.h"
 #include "BatchBuffer.h"
+#include "SceneGraphVisitor.h"
+#include "TriangleBVH.h"
+#include "JobSystem.h"
+#include <algorithm>
 
 namespace jet
 {
 	namespace util
 	{
-		SpatialManager::SpatialManager()
+		SpatialManager::SpatialManager() : m_pMultiDrawBatch(nullptr), m_bMultiDrawBatch(false), m_iParallelUpdates(0)
 		{
 		}
 
@@ -25,6 +29,17 @@ namespace jet
 			}
 
 			m_BatchedBuffers.clear();
+			SAFE_DELETE(m_pMultiDrawBatch);
+			m_MultiDrawGeometries.clear();
+
+			// The batch buffers give their meshes back above, anything left was leaked by a user.
+			assert(m_GeometryMeshes.empty());
+			for (auto it : m_GeometryMeshes)
+			{
+				delete it.second;
+			}
+
+			m_GeometryMeshes.clear();
 		}
 
 		struct MeshMomeryNode
@@ -154,6 +169,7 @@ namespace jet
 			}
 
 			g_GeometryMemoryData.clear();
+			TriangleBVH::releaseAll();
 		}
 
 		struct BatchedGeometries
@@ -164,25 +180,34 @@ namespace jet
 			BatchedGeometries(Node* node = nullptr) :pNode(node){}
 		};
 
-		static void recursiveSearchNode(Spatial* pNode, std::vector<Geometry*>& geometries, std::vector<BatchedGeometries>& batchGeometries)
+		void SpatialManager::recursiveSearchNode(Spatial* pNode, std::vector<Geometry*>& geometries, std::vector<BatchedGeometries>& batchGeometries)
 		{
-			Geometry* pGeo = dynamic_cast<Geometry*>(pNode);
-			if (pGeo)
+			std::vector<size_t>& batchStarts = m_BatchStarts;
+			batchStarts.clear();
+			m_Traverser.depthFirst(pNode, [&](Spatial* pSpatial)
 			{
-				geometries.push_back(pGeo);
-				return;
-			}
+				if (pSpatial->isGeometry())
+				{
+					geometries.push_back(static_cast<Geometry*>(pSpatial));
+					return false;
+				}
 
-			Node* pCurrentNode = dynamic_cast<Node*>(pNode);
-			assert(pCurrentNode);
-			if (pCurrentNode->isBatchNode())
+				if (static_cast<Node*>(pSpatial)->isBatchNode())
+				{
+					batchStarts.push_back(geometries.size());
+				}
+				return true;
+			},
+			[&](Spatial* pSpatial)
 			{
-				size_t curr_loc = geometries.size();
-				std::vector<Spatial*>& pChildren = pCurrentNode->getChildren();
-				for (size_t i = 0; i < pChildren.size(); i++)
+				Node* pCurrentNode = static_cast<Node*>(pSpatial);
+				if (!pCurrentNode->isBatchNode())
 				{
-					recursiveSearchNode(pChildren[i], geometries, batchGeometries);
+					return;
 				}
+
+				size_t curr_loc = batchStarts.back();
+				batchStarts.pop_back();
 				size_t end_loc = geometries.size();
 
 				assert(end_loc >= curr_loc);
@@ -194,15 +219,127 @@ namespace jet
 					geometryList.insert(geometryList.end(), geometries.begin() + curr_loc, geometries.end());
 					geometries.erase(geometries.begin() + curr_loc, geometries.end());
 				}
+			});
+		}
+
+		GeometryMesh::~GeometryMesh()
+		{
+			for (size_t i = 0; i < ArrayBuffers.size(); i++)
+			{
+				delete ArrayBuffers[i];
+			}
+			ArrayBuffers.clear();
+
+			SAFE_DELETE(ElementBuffer);
+			SAFE_DELETE(VAO);
+		}
+
+		// The shapes without indices, as the strips may be, are drawn from their expanded vertices.
+		static bool isIndexedMesh(const Shape3D* pShape)
+		{
+			return pShape->getMode() != Shape3D::Mode::POINTS && pShape->getIndiceCount() > 0;
+		}
+
+		static void createGeometryMesh(const Shape3D* pShape, GeometryMesh* pMesh)
+		{
+			const bool indexed = isIndexedMesh(pShape);
+			const MeshAttrib combinedAttrib = pMesh->Key.Layout;
+
+			// One vertex stream for the combined attribute, otherwise one per supported attribute.
+			std::vector<GeometryMemoryData> memoryData;
+			if (combinedAttrib != MeshAttrib::NONE)
+			{
+				memoryData.push_back(SpatialManager::getGeometryMemoryData(pShape, combinedAttrib, indexed));
 			}
 			else
 			{
-				std::vector<Spatial*>& pChildren = pCurrentNode->getChildren();
-				for (size_t i = 0; i < pChildren.size(); i++)
+				uint32_t attribCount = 0;
+				const MeshAttrib* pMeshAttribs = pShape->getSupportAttribs(attribCount);
+				assert(attribCount);
+
+				for (uint32_t i = 0; i < attribCount; i++)
 				{
-					recursiveSearchNode(pChildren[i], geometries, batchGeometries);
+					memoryData.push_back(SpatialManager::getGeometryMemoryData(pShape, pMeshAttribs[i], indexed));
 				}
 			}
+
+			std::vector<AttribDesc> attribDescs;
+			std::vector<uint32_t> attribCounts;
+			for (size_t i = 0; i < memoryData.size(); i++)
+			{
+				const MeteData* pData = memoryData[i].MemoryData.get();
+				assert(pData);
+
+				attribCounts.push_back(ParseMeshAttrib(memoryData[i].Attrib, attribDescs));
+
+				ArrayBufferGL<BufferUsage::STATIC_DRAW, 0>* pArrayBuffer = new ArrayBufferGL < BufferUsage::STATIC_DRAW, 0 >;
+				pArrayBuffer->init(pData->uiLength, pData->pData);
+				pMesh->ArrayBuffers.push_back(pArrayBuffer);
+			}
+
+			// The descriptors point into attribDescs, so take the pointers once it stops growing.
+			std::vector<GeometryAttribDesc> arrayBufferDescs;
+			uint32_t start_loc = 0;
+			for (size_t i = 0; i < attribCounts.size(); i++)
+			{
+				arrayBufferDescs.push_back(GeometryAttribDesc{ attribCounts[i], &attribDescs[start_loc] });
+				start_loc += attribCounts[i];
+			}
+
+			if (indexed)
+			{
+				const GeometryMemoryData& indicesData = SpatialManager::getGeometryMemoryData(pShape, MeshAttrib::INDICES, indexed);
+				pMesh->ElementBuffer = new ElementBufferGL< BufferUsage::STATIC_DRAW, 0 >;
+				pMesh->ElementBuffer->init(indicesData.MemoryData->uiLength, indicesData.MemoryData->pData);
+				pMesh->IndicesType = ConvertDataTypeToGLenum(pShape->getIndiceType());
+			}
+
+			pMesh->Primitive = Shape3D::convertModeToGLenum(pShape->getMode());
+			pMesh->VertexCount = indexed ? pShape->getIndiceCount() : pShape->getVertexCount(false);
+
+			BufferData bufferData;
+			bufferData.ArrayBufferCount = static_cast<uint32_t>(pMesh->ArrayBuffers.size());
+			bufferData.ArrayBufferDescs = &arrayBufferDescs[0];
+			bufferData.ArrayBuffers = &pMesh->ArrayBuffers[0];
+			bufferData.ElementBuffer = pMesh->ElementBuffer;
+
+			pMesh->VAO = new VertexArrayGL;
+			pMesh->VAO->bind();
+			pMesh->VAO->load(&bufferData);
+			pMesh->VAO->unbind();
+		}
+
+		GeometryMesh* SpatialManager::acquireGeometryMesh(const Shape3D* pShape)
+		{
+			assert(pShape);
+			const bool indexed = isIndexedMesh(pShape);
+			const GeometryMeshKey key(ShapeKey(pShape->getUniqueName(), indexed), pShape->getSupportCombinedAttrib());
+
+			auto it = m_GeometryMeshes.find(key);
+			if (it == m_GeometryMeshes.end())
+			{
+				GeometryMesh* pMesh = new GeometryMesh(key);
+				createGeometryMesh(pShape, pMesh);
+				it = m_GeometryMeshes.insert(std::pair<GeometryMeshKey, GeometryMesh*>(key, pMesh)).first;
+			}
+
+			it->second->RefCount++;
+			return it->second;
+		}
+
+		void SpatialManager::releaseGeometryMesh(GeometryMesh* pMesh)
+		{
+			if (pMesh == nullptr)
+			{
+				return;
+			}
+
+			assert(pMesh->RefCount > 0);
+			if (--pMesh->RefCount == 0)
+			{
+				m_GeometryMeshes.erase(pMesh->Key);
+				delete pMesh;
+			}
 		}
 
 		// Find the geometry attribute data by the specified Geometry.
@@ -212,74 +349,440 @@ namespace jet
 			return nullptr;
 		}
 
-		void SpatialManager::addSpatial(Spatial* pSpatial)
+		GeometryAssembly* SpatialManager::findGeometryAssembly(Geometry* pGeom)
 		{
-			Geometry* pGeoNode = dynamic_cast<Geometry*>(pSpatial);
-			if (pGeoNode)
-			{
-				auto it = m_NonbatchedBuffers.find(pGeoNode);
-				if (it == m_NonbatchedBuffers.end())
-				{
-					pGeoNode->associateWithSpatialManager(this, static_cast<int>(m_NonbatchedBuffers.size()));
-					BatchBuffer* pBatch = BatchBuffer::create(this, BatchBuffer::SINGLE);
-					m_NonbatchedBuffers.insert(std::pair<Geometry*, BatchBuffer*>(pGeoNode, pBatch));
-					pBatch->addGeometry(pGeoNode);
-				}
+			auto it = m_NonbatchedBuffers.find(pGeom);
+			return it != m_NonbatchedBuffers.end() ? it->second->getGeometryAssembly(0) : nullptr;
+		}
 
-				return;
-			}
+		void SpatialManager::addSpatial(Spatial* pSpatial)
+		{
+			addSpatials(&pSpatial, 1);
+		}
 
-			Node* pNode = dynamic_cast<Node*>(pSpatial);
-			if (pNode)
+		void SpatialManager::addSpatials(Spatial* const* pSpatials, uint32_t count)
+		{
+			auto addGeometry = [this](Spatial* pCurrent)
 			{
-				if (pNode->isBatchNode())
+				if (pCurrent->isNode())
 				{
-					assert(false);
-					//Not implemented so far.
+					// Not implemented so far.
+					assert(!static_cast<Node*>(pCurrent)->isBatchNode());
+					return true;
 				}
-				else
+
+				Geometry* pGeoNode = static_cast<Geometry*>(pCurrent);
+				if (m_TreeProxies.find(pGeoNode) == m_TreeProxies.end())
 				{
-					std::vector<Spatial*>& pChildren = pNode->getChildren();
-					for (size_t i = 0; i < pChildren.size(); i++)
+					pGeoNode->associateWithSpatialManager(this, static_cast<int>(m_TreeProxies.size()));
+					if (m_bMultiDrawBatch && m_pMultiDrawBatch == nullptr)
+					{
+						m_pMultiDrawBatch = BatchBuffer::create(this, BatchBuffer::MULTI_DRAW);
+					}
+
+					if (m_bMultiDrawBatch && m_pMultiDrawBatch->addGeometry(pGeoNode))
 					{
-						addSpatial(pChildren[i]);
+						m_MultiDrawGeometries.insert(pGeoNode);
 					}
+					else
+					{
+						BatchBuffer* pBatch = BatchBuffer::create(this, BatchBuffer::SINGLE);
+						m_NonbatchedBuffers.insert(std::pair<Geometry*, BatchBuffer*>(pGeoNode, pBatch));
+						pBatch->addGeometry(pGeoNode);
+					}
+
+					// The world bound may not be computed yet, the proxy is made by the next tree update.
+					m_TreeProxies.insert(std::pair<Geometry*, int32_t>(pGeoNode, DynamicAABBTree::NULL_NODE));
+					m_DirtyGeometries.push_back(pGeoNode);
 				}
+				return false;
+			};
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				m_Traverser.depthFirst(pSpatials[i], addGeometry);
 			}
 		}
 
 		void SpatialManager::removeSpatial(Spatial* pSpatial)
 		{
-			Geometry* pGeoNode = dynamic_cast<Geometry*>(pSpatial);
-			if (pGeoNode)
+			removeSpatials(&pSpatial, 1);
+		}
+
+		void SpatialManager::removeSpatials(Spatial* const* pSpatials, uint32_t count)
+		{
+			bool bRemoved = false;
+			auto removeGeometry = [this, &bRemoved](Spatial* pCurrent)
 			{
+				if (pCurrent->isNode())
+				{
+					// Not implemented so far.
+					assert(!static_cast<Node*>(pCurrent)->isBatchNode());
+					return true;
+				}
+
+				Geometry* pGeoNode = static_cast<Geometry*>(pCurrent);
 				auto it = m_NonbatchedBuffers.find(pGeoNode);
 				if (it != m_NonbatchedBuffers.end())
 				{
 					delete it->second;
 					m_NonbatchedBuffers.erase(it);
 				}
+				else if (m_MultiDrawGeometries.erase(pGeoNode))
+				{
+					m_pMultiDrawBatch->removeGeometry(pGeoNode);
+				}
 
-				return;
+				auto proxy = m_TreeProxies.find(pGeoNode);
+				if (proxy != m_TreeProxies.end())
+				{
+					if (proxy->second != DynamicAABBTree::NULL_NODE)
+					{
+						m_SpatialTree.destroyProxy(proxy->second);
+					}
+					m_TreeProxies.erase(proxy);
+					bRemoved = true;
+				}
+				return false;
+			};
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				m_Traverser.depthFirst(pSpatials[i], removeGeometry);
 			}
 
-			Node* pNode = dynamic_cast<Node*>(pSpatial);
-			if (pNode)
+			// One pass for the whole batch, the removed geometries no longer have a proxy entry.
+			if (bRemoved && !m_DirtyGeometries.empty())
 			{
-				if (pNode->isBatchNode())
+				m_DirtyGeometries.erase(std::remove_if(m_DirtyGeometries.begin(), m_DirtyGeometries.end(), [this](Geometry* pGeom)
 				{
-					assert(false);
-					//Not implemented so far.
-				}
-				else
+					return m_TreeProxies.find(pGeom) == m_TreeProxies.end();
+				}), m_DirtyGeometries.end());
+			}
+		}
+
+		void SpatialManager::cullScene(Spatial* pScene, Camera* pCam, std::vector<Geometry*>& visible)
+		{
+			assert(pScene && pCam);
+
+			// The planes a node is fully inside of stay skipped for all its children, but what one
+			// child learns must not leak into its siblings, so every node keeps the state it left.
+			m_PlaneStates.clear();
+			m_PlaneStates.push_back(0);
+			m_Traverser.depthFirst(pScene, [this, pCam, &visible](Spatial* pSpatial)
+			{
+				pCam->setPlaneState(m_PlaneStates.back());
+
+				// The geometries grouped into a manager refuse Geometry::checkCulling since the
+				// manager draws them, so their bounds are tested here directly.
+				if (pSpatial->isGeometry())
 				{
-					std::vector<Spatial*>& pChildren = pNode->getChildren();
-					for (size_t i = 0; i < pChildren.size(); i++)
+					if (pSpatial->Spatial::checkCulling(pCam))
 					{
-						removeSpatial(pChildren[i]);
+						visible.push_back(static_cast<Geometry*>(pSpatial));
 					}
+					return false;
+				}
+
+				if (!pSpatial->checkCulling(pCam))
+				{
+					return false;
+				}
+
+				m_PlaneStates.push_back(pCam->getPlaneState());
+				return true;
+			},
+			[this](Spatial*)
+			{
+				m_PlaneStates.pop_back();
+			});
+		}
+
+		void SpatialManager::cullScene(Spatial* pScene, Camera* const* pCams, uint32_t camCount, std::vector<Geometry*>& visible, std::vector<uint32_t>& cameraMasks)
+		{
+			assert(pScene && pCams && camCount > 0);
+			m_MultiFrustum.set(pCams, camCount);
+
+			m_CameraStates.clear();
+			m_CameraStates.push_back(m_MultiFrustum.getRootState());
+			m_Traverser.depthFirst(pScene, [this, &visible, &cameraMasks](Spatial* pSpatial)
+			{
+				MultiFrustum::State state = m_CameraStates.back();
+				const CullHint hint = pSpatial->getCullHint();
+				if (hint == CullHint::ALWAYS)
+				{
+					return false;
+				}
+
+				// The same rules as Spatial::checkCulling(): the gui bounds are in screen space and
+				// the NEVER hint keeps the spatial, its children are tested as usual.
+				if (hint != CullHint::NEVER && pSpatial->getQueueBucket() != Bucket::GUI &&
+					!m_MultiFrustum.test(pSpatial->getWorldBound().get(), state))
+				{
+					return false;
+				}
+
+				if (pSpatial->isGeometry())
+				{
+					visible.push_back(static_cast<Geometry*>(pSpatial));
+					cameraMasks.push_back(state.VisibleMask);
+					return false;
+				}
+
+				m_CameraStates.push_back(state);
+				return true;
+			},
+			[this](Spatial*)
+			{
+				m_CameraStates.pop_back();
+			});
+		}
+
+		void SpatialManager::cullGeometries(Camera* pCam, std::vector<Geometry*>& visible)
+		{
+			assert(pCam);
+			m_FrustumCuller.clear();
+			m_FrustumCuller.reserve(static_cast<uint32_t>(m_NonbatchedBuffers.size()));
+			m_CullGeometries.clear();
+
+			for (auto it = m_NonbatchedBuffers.begin(); it != m_NonbatchedBuffers.end(); it++)
+			{
+				Geometry* pGeom = it->first;
+				BoundingVolume* pBound = pGeom->getWorldBound().get();
+				if (pBound)
+				{
+					m_FrustumCuller.add(pBound);
+					m_CullGeometries.push_back(pGeom);
+				}
+				else
+				{
+					visible.push_back(pGeom);
+				}
+			}
+
+			m_FrustumCuller.cull(pCam->getWorldPlanes(), pCam->getWorldPlaneCount(), m_CullVisible);
+			for (uint32_t index : m_CullVisible)
+			{
+				visible.push_back(m_CullGeometries[index]);
+			}
+		}
+
+		void SpatialManager::updateBatches()
+		{
+			// Hands the moved geometries to the batch too.
+			updateSpatialTree();
+			if (m_pMultiDrawBatch)
+			{
+				m_pMultiDrawBatch->update();
+			}
+		}
+
+		void SpatialManager::cullBatches(Camera* pCam)
+		{
+			if (m_pMultiDrawBatch)
+			{
+				m_pMultiDrawBatch->cull(pCam);
+			}
+		}
+
+		void SpatialManager::updateSpatialTree()
+		{
+			std::lock_guard<std::mutex> lock(m_DirtyMutex);
+			for (Geometry* pGeom : m_DirtyGeometries)
+			{
+				// The batch takes the moves here rather than from onTransformChange(), which the workers call.
+				if (m_pMultiDrawBatch && m_MultiDrawGeometries.find(pGeom) != m_MultiDrawGeometries.end())
+				{
+					m_pMultiDrawBatch->onTransformChange(pGeom);
+				}
+
+				auto it = m_TreeProxies.find(pGeom);
+				BoundingVolume* pBound = pGeom->getWorldBound().get();
+				if (it == m_TreeProxies.end() || pBound == nullptr)
+				{
+					continue;
+				}
+
+				if (it->second == DynamicAABBTree::NULL_NODE)
+				{
+					it->second = m_SpatialTree.createProxy(pBound, pGeom);
+				}
+				else
+				{
+					m_SpatialTree.moveProxy(it->second, pBound);
+				}
+			}
+
+			m_DirtyGeometries.clear();
+		}
+
+		void SpatialManager::cullSpatialTree(Camera* pCam, std::vector<Geometry*>& visible)
+		{
+			assert(pCam);
+			updateSpatialTree();
+
+			m_TreeResults.clear();
+			m_SpatialTree.queryFrustum(pCam->getWorldPlanes(), pCam->getWorldPlaneCount(), m_TreeResults);
+			for (void* pUserData : m_TreeResults)
+			{
+				visible.push_back(static_cast<Geometry*>(pUserData));
+			}
+		}
+
+		void SpatialManager::cullSpatialTree(Camera* const* pCams, uint32_t camCount, std::vector<Geometry*>& visible, std::vector<uint32_t>& cameraMasks)
+		{
+			assert(pCams && camCount > 0);
+			updateSpatialTree();
+			m_MultiFrustum.set(pCams, camCount);
+
+			m_TreeResults.clear();
+			m_TreeMasks.clear();
+			m_SpatialTree.queryFrustums(m_MultiFrustum, m_TreeResults, m_TreeMasks);
+			for (size_t i = 0; i < m_TreeResults.size(); i++)
+			{
+				visible.push_back(static_cast<Geometry*>(m_TreeResults[i]));
+				cameraMasks.push_back(m_TreeMasks[i]);
+			}
+		}
+
+		void SpatialManager::pickGeometries(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<Geometry*>& hits)
+		{
+			updateSpatialTree();
+
+			m_RayHits.clear();
+			m_SpatialTree.queryRay(origin, direction, maxDistance, m_RayHits);
+			for (const DynamicAABBTree::RayHit& hit : m_RayHits)
+			{
+				hits.push_back(static_cast<Geometry*>(hit.pUserData));
+			}
+		}
+
+		int SpatialManager::collideWith(const Ray& ray, CollisionResults& results)
+		{
+			updateSpatialTree();
+
+			m_RayHits.clear();
+			m_SpatialTree.queryRay(ray.Origin, ray.Direction, ray.Limit, m_RayHits);
+			int total = 0;
+			for (const DynamicAABBTree::RayHit& hit : m_RayHits)
+			{
+				total += static_cast<Geometry*>(hit.pUserData)->collideWith(ray, results);
+			}
+			return total;
+		}
+
+		bool SpatialManager::pickClosest(const Ray& ray, CollisionResult& result)
+		{
+			updateSpatialTree();
+
+			m_RayHits.clear();
+			m_SpatialTree.queryRay(ray.Origin, ray.Direction, ray.Limit, m_RayHits);
+
+			// The boxes come nearest first, the ones entered beyond the closest hit can't hold a nearer one.
+			Ray closestRay = ray;
+			bool bFound = false;
+			for (const DynamicAABBTree::RayHit& hit : m_RayHits)
+			{
+				if (hit.Distance > closestRay.Limit)
+				{
+					break;
+				}
+
+				if (static_cast<Geometry*>(hit.pUserData)->intersectClosest(closestRay, result))
+				{
+					closestRay.Limit = result.Distance;
+					bFound = true;
 				}
 			}
+			return bFound;
+		}
+
+		bool SpatialManager::intersectsAny(const Ray& ray)
+		{
+			updateSpatialTree();
+
+			m_RayHits.clear();
+			m_SpatialTree.queryRay(ray.Origin, ray.Direction, ray.Limit, m_RayHits);
+			for (const DynamicAABBTree::RayHit& hit : m_RayHits)
+			{
+				if (static_cast<Geometry*>(hit.pUserData)->intersectsAny(ray))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void SpatialManager::queryGeometries(const BoundingVolume* pBound, std::vector<Geometry*>& results)
+		{
+			assert(pBound);
+			updateSpatialTree();
+
+			m_TreeResults.clear();
+			m_SpatialTree.queryOverlap(pBound, m_TreeResults);
+			for (void* pUserData : m_TreeResults)
+			{
+				results.push_back(static_cast<Geometry*>(pUserData));
+			}
+		}
+
+		void SpatialManager::cullOcclusion(Camera* pCam, std::vector<Geometry*>& visible)
+		{
+			assert(pCam);
+			m_OcclusionCuller.beginFrame(pCam->getViewProjectionMatrix());
+
+			for (Geometry* pGeom : visible)
+			{
+				Shape3D* pShape = pGeom->isOccluder() ? pGeom->getMesh().get() : nullptr;
+				if (pShape == nullptr)
+				{
+					continue;
+				}
+
+				auto it = m_OccluderMeshes.find(pShape->getUniqueName());
+				if (it == m_OccluderMeshes.end())
+				{
+					OccluderMesh mesh;
+					mesh.Positions = pShape->getVertexData(MeshAttrib::POSITION3, true);
+					mesh.Indices = pShape->getVertexData(MeshAttrib::INDICES, true);
+					it = m_OccluderMeshes.insert(std::pair<std::string, OccluderMesh>(pShape->getUniqueName(), mesh)).first;
+				}
+
+				const MeteData* positions = it->second.Positions.get();
+				const MeteData* indices = it->second.Indices.get();
+				if (!positions || !indices)
+				{
+					continue;
+				}
+
+				const glm::vec3* pPositions = reinterpret_cast<const glm::vec3*>(positions->pData);
+				const uint32_t vertexCount = positions->uiLength / sizeof(glm::vec3);
+				if (pShape->getIndiceType() == DataType::UINT32)
+				{
+					m_OcclusionCuller.addOccluder(pPositions, vertexCount, reinterpret_cast<const uint32_t*>(indices->pData), indices->uiLength / sizeof(uint32_t), pGeom->getWorldMatrix());
+				}
+				else
+				{
+					m_OcclusionCuller.addOccluder(pPositions, vertexCount, reinterpret_cast<const uint16_t*>(indices->pData), indices->uiLength / sizeof(uint16_t), pGeom->getWorldMatrix());
+				}
+			}
+
+			if (m_OcclusionCuller.getTriangleCount() == 0)
+			{
+				return;
+			}
+
+			m_OcclusionCuller.rasterize();
+
+			size_t count = 0;
+			for (Geometry* pGeom : visible)
+			{
+				if (pGeom->isOccluder() || m_OcclusionCuller.isVisible(pGeom->getWorldBound().get()))
+				{
+					visible[count++] = pGeom;
+				}
+			}
+			visible.resize(count);
 		}
 
 		/**
@@ -290,7 +793,46 @@ namespace jet
 		*/
 		void SpatialManager::onTransformChange(Geometry* pGeom)
 		{
-			// We just only support non-batched geometry buffer so far 
+			// The world bound is updated after the transform, the tree picks it up on the next query.
+			const int32_t thread = JobSystem::get().getThreadIndex();
+			if (thread > 0 && m_iParallelUpdates.load(std::memory_order_acquire) > 0 && static_cast<size_t>(thread) <= m_WorkerDirtyGeometries.size())
+			{
+				m_WorkerDirtyGeometries[thread - 1].push_back(pGeom);
+			}
+			else
+			{
+				// The render thread, or a job moving the geometry outside a parallel update.
+				std::lock_guard<std::mutex> lock(m_DirtyMutex);
+				m_DirtyGeometries.push_back(pGeom);
+			}
+		}
+
+		void SpatialManager::beginParallelUpdate()
+		{
+			// The lists are sized before the count is raised, a worker seeing the count finds its list.
+			if (m_iParallelUpdates.load(std::memory_order_acquire) == 0)
+			{
+				const uint32_t workerCount = JobSystem::get().getThreadCount() - 1;
+				if (m_WorkerDirtyGeometries.size() != workerCount)
+				{
+					m_WorkerDirtyGeometries.resize(workerCount);
+				}
+			}
+			m_iParallelUpdates.fetch_add(1, std::memory_order_acq_rel);
+		}
+
+		void SpatialManager::endParallelUpdate()
+		{
+			// The jobs of the outermost update are all done here, no worker touches the lists.
+			if (m_iParallelUpdates.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				std::lock_guard<std::mutex> lock(m_DirtyMutex);
+				for (std::vector<Geometry*>& geometries : m_WorkerDirtyGeometries)
+				{
+					m_DirtyGeometries.insert(m_DirtyGeometries.end(), geometries.begin(), geometries.end());
+					geometries.clear();
+				}
+			}
 		}
 
 		/**
@@ -305,7 +847,11 @@ namespace jet
 		*/
 		void SpatialManager::onMaterialChange(Geometry * pGeom)
 		{
-			// Nothing need todo so far.
+			// The SINGLE batches draw with any material, the MULTI_DRAW one groups by it.
+			if (m_MultiDrawGeometries.find(pGeom) != m_MultiDrawGeometries.end())
+			{
+				m_pMultiDrawBatch->onMaterialChange(pGeom);
+			}
 		}
 
 		/**
@@ -328,6 +874,10 @@ namespace jet
 			{
 				it->second->onMeshChange(pGeom);
 			}
+			else if (m_MultiDrawGeometries.find(pGeom) != m_MultiDrawGeometries.end())
+			{
+				m_pMultiDrawBatch->onMeshChange(pGeom);
+			}
 		}
 
 		/**
@@ -5,10 +5,18 @@
 #include "Geometry.h"
 #include "BufferGL.h"
 #include "RenderQueue.h"
+#include "FrustumCuller.h"
+#include "DynamicAABBTree.h"
+#include "MultiFrustum.h"
+#include "OcclusionCuller.h"
+#include "SceneGraphVisitor.h"
 
 #include <sstream>
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #if 0
@@ -24,6 +32,7 @@ namespace jet
 	{
 
 		class BatchBuffer;
+		struct BatchedGeometries;
 		struct GeometryMemoryData
 		{
 			// Attrib Type: Mode Type: Indexed
@@ -70,6 +79,45 @@ namespace jet
 			}
 		}GeometryMemoryBuffer;
 
+		typedef struct GeometryMeshKey
+		{
+			ShapeKey Shape;
+			// The combined attribute of the shape, or NONE for one buffer per supported attribute.
+			MeshAttrib Layout;
+
+			GeometryMeshKey(const ShapeKey& shape, MeshAttrib layout) : Shape(shape), Layout(layout){}
+
+			bool operator == (const GeometryMeshKey& o) const
+			{
+				return Layout == o.Layout && Shape == o.Shape;
+			}
+		}GeometryMeshKey;
+
+		struct GeometryMeshKeyHash
+		{
+			size_t operator()(const GeometryMeshKey& key) const
+			{
+				return std::hash<ShapeKey>{}(key.Shape) ^ (static_cast<size_t>(key.Layout) << 3);
+			}
+		};
+
+		// The GPU buffers and the vertex array of a shape, shared by all the geometries drawing it with the same layout.
+		typedef struct GeometryMesh
+		{
+			GeometryMeshKey Key;
+			std::vector<BufferGPU*> ArrayBuffers;
+			BufferGPU* ElementBuffer;
+			VertexArrayGL* VAO;
+			GLenum IndicesType;
+			GLenum Primitive;
+			GLuint VertexCount;
+			uint32_t RefCount;
+
+			GeometryMesh(const GeometryMeshKey& key) : Key(key), ElementBuffer(nullptr), VAO(nullptr),
+				IndicesType(0), Primitive(GL_TRIANGLES), VertexCount(0), RefCount(0){}
+			~GeometryMesh();
+		}GeometryMesh;
+
 		class GeometryAssembly
 		{
 		public:
@@ -109,18 +157,124 @@ namespace jet
 
 			// Find the geometry attribute data by the specified Geometry.
 			virtual GeometryAssembly* getGeometryAttribData(Geometry*);
+			// The assembly drawing a geometry added to the manager, NULL if it has no mesh.
+			GeometryAssembly* findGeometryAssembly(Geometry* pGeom);
+
+			// Return the shared GPU mesh of the shape and add a reference to it. The mesh is created on the first call.
+			GeometryMesh* acquireGeometryMesh(const Shape3D* pShape);
+			// Drop a reference to the mesh, the buffers are released with the last one.
+			void releaseGeometryMesh(GeometryMesh* pMesh);
+			size_t getGeometryMeshCount() const { return m_GeometryMeshes.size(); }
+
+			/**
+			* Puts the geometries added from now on into one MULTI_DRAW batch, culled and drawn on the
+			* GPU, instead of a SINGLE batch each. The geometries the batch can't draw still get their
+			* own. The batch needs GL 4.3 or the compute shader and storage buffer extensions.
+			*/
+			void setMultiDrawBatch(bool bEnable) { m_bMultiDrawBatch = bEnable; }
+			bool isMultiDrawBatch() const { return m_bMultiDrawBatch; }
+			/// The batch of setMultiDrawBatch(), NULL until a geometry goes into it. Draw its assemblies after cullBatches().
+			BatchBuffer* getMultiDrawBatch() { return m_pMultiDrawBatch; }
+
+			/**
+			* Brings the batches up to date with the geometries added, removed, moved or changed
+			* since the last call. Call it once a frame after Node::updateGeometricState().
+			*/
+			void updateBatches();
+			/// Culls the geometries of the batches culling on the GPU, after updateBatches().
+			void cullBatches(Camera* pCam);
 
 			void addSpatial(Spatial* pGeom);
 			void removeSpatial(Spatial* pGeom);
+			// The batches of Node::attachChildren() and Node::detachChildren(), the dirty list is compacted once.
+			void addSpatials(Spatial* const* pSpatials, uint32_t count);
+			void removeSpatials(Spatial* const* pSpatials, uint32_t count);
+
+			/**
+			* Collects the geometries of the scene that are not culled by the camera. The frustum
+			* results and the plane mask of the camera are inherited from parent to child, so a
+			* node fully inside the frustum skips the tests of all its descendants and a node fully
+			* on the positive side of a plane skips that plane for its children. The world bounds
+			* of the scene must be up to date.
+			*/
+			void cullScene(Spatial* pScene, Camera* pCam, std::vector<Geometry*>& visible);
+
+			/**
+			* cullScene() for several cameras at once, e.g. stereo eyes or shadow cascades, walking the
+			* scene a single time. Every bound is tested against the frustum enclosing all the cameras
+			* first and only then against the cameras that still see its parent. visible receives the
+			* geometries seen by any camera, cameraMasks the cameras seeing each of them, bit i for
+			* pCams[i]. The last frustum intersection of the spatials is left untouched.
+			*/
+			void cullScene(Spatial* pScene, Camera* const* pCams, uint32_t camCount, std::vector<Geometry*>& visible, std::vector<uint32_t>& cameraMasks);
+
+			/**
+			* Culls the world bounds of all the geometries added to the manager as one flat list
+			* with the {@link FrustumCuller}, without walking the scene. Geometries without a world
+			* bound are always visible. The world bounds must be up to date. The geometries of the
+			* MULTI_DRAW batch are left to cullBatches().
+			*/
+			void cullGeometries(Camera* pCam, std::vector<Geometry*>& visible);
+
+			/**
+			* Brings the spatial tree and the MULTI_DRAW batch up to date with the world bounds of the
+			* geometries whose transform changed since the last call. The queries below call it themselves.
+			*/
+			void updateSpatialTree();
+
+			/**
+			* Collects the geometries in the camera frustum through the spatial tree, so the cost
+			* grows with the log of the geometry count and the number of visible geometries. The
+			* tree keeps enlarged boxes, a few geometries just outside the frustum may be returned.
+			*/
+			void cullSpatialTree(Camera* pCam, std::vector<Geometry*>& visible);
+			/// cullSpatialTree() for several cameras in one walk of the tree, with the masks of cullScene().
+			void cullSpatialTree(Camera* const* pCams, uint32_t camCount, std::vector<Geometry*>& visible, std::vector<uint32_t>& cameraMasks);
+
+			/// Collects the geometries whose boxes the ray hits within maxDistance, nearest first.
+			void pickGeometries(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<Geometry*>& hits);
+
+			/**
+			* Adds the triangles hit by the ray of all the geometries added to the manager to the
+			* results. Only the geometries whose boxes in the spatial tree the ray passes through
+			* are tested against their triangles.
+			*/
+			int collideWith(const Ray& ray, CollisionResults& results);
+			/// Finds the triangle nearest to the origin of the ray, the geometries are tested nearest box first.
+			bool pickClosest(const Ray& ray, CollisionResult& result);
+			/// Returns true if the ray hits any triangle, for the line of sight tests.
+			bool intersectsAny(const Ray& ray);
+
+			/// Collects the geometries whose boxes overlap the bound.
+			void queryGeometries(const BoundingVolume* pBound, std::vector<Geometry*>& results);
+
+			const DynamicAABBTree& getSpatialTree() const { return m_SpatialTree; }
+
+			/**
+			* Removes the geometries hidden behind the occluders from the visible list, e.g. the
+			* output of a frustum culling pass. The occluders among the visible geometries are
+			* rasterized first and always stay visible. The world bounds must be up to date.
+			*/
+			void cullOcclusion(Camera* pCam, std::vector<Geometry*>& visible);
+			OcclusionCuller& getOcclusionCuller() { return m_OcclusionCuller; }
 
 			/**
 			* Called by {@link Geometry geom} to specify that its world transform
-			* has been changed.
+			* has been changed. Any thread may call it, the workers of a parallel update record
+			* the geometry without a lock.
 			*
 			* @param geom The Geometry whose transform changed.
 			*/
 			void onTransformChange(Geometry* pGeom);
 
+			/**
+			* Bracket the jobs of a parallel Node::updateGeometricState(), so the workers record
+			* their moved geometries without a lock. The calls may nest, the lists are merged
+			* by the outermost end.
+			*/
+			void beginParallelUpdate();
+			void endParallelUpdate();
+
 			/**
 			* Called by {@link Geometry geom} to specify that its
 			* {@link Geometry#setMaterial(com.jme3.material.Material) material}
@@ -166,6 +320,9 @@ namespace jet
 			static void releaseGeometryMomeries();
 
 		private:
+			// Collects the geometries under the node, the ones below a batch node are grouped by it.
+			void recursiveSearchNode(Spatial* pNode, std::vector<Geometry*>& geometries, std::vector<BatchedGeometries>& batchGeometries);
+
 			enum class SpatialType
 			{
 				BATCH_NODE,
@@ -184,10 +341,56 @@ namespace jet
 			std::unordered_map<Geometry*, BatchBuffer*> m_NonbatchedBuffers;
 			// contain the batched nodes.
 			std::unordered_map<void*, BatchBuffer*> m_BatchedBuffers;
+			// The geometries drawn by the MULTI_DRAW batch, see setMultiDrawBatch().
+			BatchBuffer* m_pMultiDrawBatch;
+			std::unordered_set<Geometry*> m_MultiDrawGeometries;
+			bool m_bMultiDrawBatch;
 				 
 			std::unordered_map<void*, bool> m_NodeMap;
 
+			std::unordered_map<GeometryMeshKey, GeometryMesh*, GeometryMeshKeyHash> m_GeometryMeshes;
+
 			RenderQueue m_RenderQueue;
+
+			// All the managed geometries, with their proxy in the tree or NULL_NODE until they have a world bound.
+			DynamicAABBTree m_SpatialTree;
+			std::unordered_map<Geometry*, int32_t> m_TreeProxies;
+			// The geometries whose transform changed since the last updateSpatialTree(). m_DirtyMutex
+			// guards the list against the workers moving geometries outside a parallel update.
+			std::vector<Geometry*> m_DirtyGeometries;
+			std::mutex m_DirtyMutex;
+			// The geometries moved by the workers of a parallel Node::updateGeometricState(), one list
+			// per worker, merged into the dirty list once the outermost parallel update ends.
+			std::vector<std::vector<Geometry*>> m_WorkerDirtyGeometries;
+			std::atomic<int32_t> m_iParallelUpdates;
+			std::vector<void*> m_TreeResults;
+			std::vector<uint32_t> m_TreeMasks;
+			std::vector<DynamicAABBTree::RayHit> m_RayHits;
+
+			OcclusionCuller m_OcclusionCuller;
+			// The positions and the indices of the occluder shapes by their unique name, read once per shape.
+			typedef struct OccluderMesh
+			{
+				MeteDataPtr Positions;
+				MeteDataPtr Indices;
+			}OccluderMesh;
+			std::unordered_map<std::string, OccluderMesh> m_OccluderMeshes;
+
+			// Scratch of cullGeometries(), kept to avoid reallocating every frame.
+			FrustumCuller m_FrustumCuller;
+			std::vector<Geometry*> m_CullGeometries;
+			std::vector<uint32_t> m_CullVisible;
+
+			// The scene walks of addSpatial(), removeSpatial(), cullScene() and recursiveSearchNode().
+			SceneGraphTraverser m_Traverser;
+			// Where the geometries of every batch node being walked by recursiveSearchNode() start in its list.
+			std::vector<size_t> m_BatchStarts;
+			// The plane state of every node on the path walked by cullScene().
+			std::vector<int32_t> m_PlaneStates;
+
+			// The cameras of the multi camera cullScene() and the state of every node on its path.
+			MultiFrustum m_MultiFrustum;
+			std::vector<MultiFrustum::State> m_CameraStates;
 		};
 	}
 }
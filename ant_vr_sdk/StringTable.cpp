@@ -0,0 +1,101 @@
+#include "StringTable.h"
+#include <functional>
+
+namespace jet
+{
+	namespace util
+	{
+		static const size_t INITIAL_SLOT_COUNT = 1024;
+
+		StringTable& StringTable::get()
+		{
+			static StringTable instance;
+			return instance;
+		}
+
+		StringTable::StringTable() : m_uiBytes(0)
+		{
+			m_Strings.push_back(std::string());
+			m_pEmpty = &m_Strings.back();
+			m_Slots.resize(INITIAL_SLOT_COUNT);
+		}
+
+		const std::string* StringTable::intern(const std::string& str)
+		{
+			if (str.empty())
+			{
+				return m_pEmpty;
+			}
+
+			const size_t hash = std::hash<std::string>()(str);
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			const size_t mask = m_Slots.size() - 1;
+			size_t index = hash & mask;
+			while (m_Slots[index].pString != nullptr)
+			{
+				const Slot& slot = m_Slots[index];
+				if (slot.Hash == hash && *slot.pString == str)
+				{
+					return slot.pString;
+				}
+				index = (index + 1) & mask;
+			}
+
+			m_Strings.push_back(str);
+			m_Slots[index].Hash = hash;
+			m_Slots[index].pString = &m_Strings.back();
+			m_uiBytes += str.size() + 1;
+
+			// The empty string has no slot.
+			if ((m_Strings.size() - 1) * 2 > m_Slots.size())
+			{
+				grow();
+			}
+			return &m_Strings.back();
+		}
+
+		const std::string* StringTable::intern(const char* str)
+		{
+			if (str == nullptr || str[0] == '\0')
+			{
+				return m_pEmpty;
+			}
+
+			return intern(std::string(str));
+		}
+
+		void StringTable::grow()
+		{
+			std::vector<Slot> slots(m_Slots.size() * 2);
+			const size_t mask = slots.size() - 1;
+			for (const Slot& slot : m_Slots)
+			{
+				if (slot.pString == nullptr)
+				{
+					continue;
+				}
+
+				size_t index = slot.Hash & mask;
+				while (slots[index].pString != nullptr)
+				{
+					index = (index + 1) & mask;
+				}
+				slots[index] = slot;
+			}
+			m_Slots.swap(slots);
+		}
+
+		uint32_t StringTable::getCount()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return static_cast<uint32_t>(m_Strings.size());
+		}
+
+		size_t StringTable::getBytes()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_uiBytes;
+		}
+	}
+}
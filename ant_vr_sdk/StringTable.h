@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * Keeps one copy of every string given to it, so the objects naming themselves with
+		 * the same strings share them and hold a pointer instead of a whole std::string.
+		 * The copies are never released and never move, the pointers stay valid for the whole run.
+		 * Thread safe.
+		 */
+		class StringTable
+		{
+		public:
+			static StringTable& get();
+
+			const std::string* intern(const std::string& str);
+			const std::string* intern(const char* str);
+
+			/// The shared empty string, returned without a lookup.
+			const std::string* getEmpty() const { return m_pEmpty; }
+
+			uint32_t getCount();
+			/// The characters held by the table, to account the names in the memory reports.
+			size_t getBytes();
+
+		private:
+			typedef struct Slot
+			{
+				size_t Hash;
+				const std::string* pString;
+			}Slot;
+
+			StringTable();
+
+			StringTable(const StringTable&) = delete;
+			StringTable& operator=(const StringTable&) = delete;
+
+			void grow();
+
+			std::mutex m_Mutex;
+			// The strings, a deque keeps their address when it grows.
+			std::deque<std::string> m_Strings;
+			// Open addressing with linear probing, at most half full. The hashes are kept
+			// so the probes and the growth rarely touch the strings.
+			std::vector<Slot> m_Slots;
+			size_t m_uiBytes;
+			const std::string* m_pEmpty;
+		};
+	}
+}
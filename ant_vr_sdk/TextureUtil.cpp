@@ -1,6 +1,7 @@
 #include "TextureUtil.h"
 #include "Numeric.h"
 #include "GLUtil.h"
+#include "JobSystem.h"
 
 #define STB_IMAGE_IMPLEMENTATION 1
 #include <stb_image.h>
@@ -955,6 +956,40 @@ namespace jet
 			return true;
 		}
 
+		bool TextureUtil::createTextures2DFromFiles(const char* const* filenames, uint32_t count, Texture2D* pOut, bool flip)
+		{
+			static const int internal_formats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+			stbi_set_flip_vertically_on_load(flip);
+
+			std::vector<TextureData> initDatas(count);
+			std::vector<int> widths(count);
+			std::vector<int> heights(count);
+			std::vector<char> results(count);
+			JobSystem::get().parallelFor(count, 1, [&](uint32_t first, uint32_t size)
+			{
+				for (uint32_t i = first; i < first + size; i++)
+				{
+					results[i] = loadTextureDataFromFile(filenames[i], &initDatas[i], &widths[i], &heights[i]);
+				}
+			});
+
+			bool result = true;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				if (!results[i])
+				{
+					result = false;
+					continue;
+				}
+
+				int cmp = measureCompCountPerPixel(initDatas[i].Format);
+				Texture2DDesc desc = Texture2DDesc(widths[i], heights[i], internal_formats[cmp - 1]);
+				createTexture2D(&desc, &initDatas[i], &pOut[i]);
+			}
+
+			return result;
+		}
+
 		static GLint glGetTexLevelParameteri(int target, int level, GLenum pname)
 		{
 			GLint result;
@@ -16,6 +16,9 @@ namespace jet
 
 			static void createTexture2D(const Texture2DDesc* pDesc, const TextureData* pInitData, Texture2D* pOut);
 			static bool createTexture2DFromFile(const char* filename, Texture2D* pOut, bool flip = true);
+			// Decodes the files as jobs of the JobSystem, then creates the textures on the calling thread, which owns the GL context.
+			// Returns false when a file couldn't be read, its texture is left untouched.
+			static bool createTextures2DFromFiles(const char* const* filenames, uint32_t count, Texture2D* pOut, bool flip = true);
 			static bool createTexture2D(GLint target, GLuint textureID, Texture2D* pOut);
 
 			static void createTexture1D(const Texture1DDesc* pDesc, const TextureData* pInitData, Texture1D* pOut);
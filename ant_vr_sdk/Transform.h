@@ -19,8 +19,8 @@ namespace jet
 		class Transform
 		{
 		public:
-			Transform(const glm::vec3& f3translate = glm::vec3(0.0f, 0.0f, 0.0f), const glm::quat& f4rotate = glm::quat(0,0,0,1), const glm::vec3& f3scale = glm::vec3(1,1,1)) :
-				m_f3Translate(f3translate), m_f4Rotate(f4rotate), m_f3Scale(f3scale){}
+			Transform(const glm::vec3& f3translate = glm::vec3(0.0f, 0.0f, 0.0f), const glm::quat& f4rotate = glm::quat(1,0,0,0), const glm::vec3& f3scale = glm::vec3(1,1,1)) :
+				m_f3Translate(f3translate), m_f4Rotate(f4rotate), m_f3Scale(f3scale), m_bDirty(true){}
 
 			void setFromMatrix(const glm::mat4& mat);
 			const glm::mat4& getCombinedMatrix();
@@ -208,6 +208,20 @@ namespace jet
 
 			bool isDirty() const{ return m_bDirty; }
 
+			/**
+			* Sets the translation, rotation and scale together with the matrix combining them, so
+			* getCombinedMatrix() doesn't rebuild it. Used by the {@link TransformHierarchy}, which
+			* computes the world matrices in bulk.
+			*/
+			void setCombined(const glm::vec3& f3Translate, const glm::quat& f4Rotate, const glm::vec3& f3Scale, const glm::mat4& combined)
+			{
+				m_f3Translate = f3Translate;
+				m_f4Rotate = f4Rotate;
+				m_f3Scale = f3Scale;
+				m_CombinedMatrix = combined;
+				m_bDirty = false;
+			}
+
 			static glm::vec3 transform(const Transform& trans, const glm::vec3& v)
 			{
 				return trans.m_f4Rotate * (v * trans.m_f3Scale) + trans.m_f3Translate;
@@ -0,0 +1,406 @@
+#include "TransformHierarchy.h"
+#include "Node.h"
+#include "Geometry.h"
+#include "SpatialManager.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace jet
+{
+	namespace util
+	{
+		// The slots of a level updated by one job.
+		static const uint32_t SLOTS_PER_JOB = 2048;
+		static const uint32_t PENDING_SLOT = 0xFFFFFFFF;
+
+		// A node of the level was moved since the last update.
+		static const uint8_t LEVEL_MOVED = 0x01;
+		// The level has spatials, whose changes are only found by looking at them.
+		static const uint8_t LEVEL_MIRRORED = 0x02;
+
+		TransformHierarchy::TransformHierarchy() : m_uiFrame(0)
+		{
+			m_LevelStarts.push_back(0);
+		}
+
+		uint32_t TransformHierarchy::addNode(int32_t parent, const glm::vec3& f3Translate, const glm::quat& f4Rotate, const glm::vec3& f3Scale)
+		{
+			assert(parent == NULL_INDEX || static_cast<uint32_t>(parent) < m_NodeSlots.size());
+
+			PendingNode pending;
+			pending.Parent = parent;
+			pending.pSpatial = nullptr;
+			pending.Translate = f3Translate;
+			pending.Rotate = f4Rotate;
+			pending.Scale = f3Scale;
+			m_PendingNodes.push_back(pending);
+
+			m_NodeDepths.push_back(parent == NULL_INDEX ? 0 : m_NodeDepths[parent] + 1);
+			m_NodeSlots.push_back(PENDING_SLOT);
+			return static_cast<uint32_t>(m_NodeSlots.size() - 1);
+		}
+
+		uint32_t TransformHierarchy::build(Spatial* pRoot)
+		{
+			clear();
+			if (pRoot == nullptr)
+			{
+				return 0;
+			}
+
+			// Breadth first, so the siblings end up next to each other in their level.
+			std::vector<Spatial*> spatials(1, pRoot);
+			addNode(NULL_INDEX);
+			for (uint32_t i = 0; i < spatials.size(); i++)
+			{
+				Spatial* pSpatial = spatials[i];
+				PendingNode& pending = m_PendingNodes[i];
+				pending.pSpatial = pSpatial;
+				pending.Translate = pSpatial->m_LocalTransform.getTranslate();
+				pending.Rotate = pSpatial->m_LocalTransform.getRotate();
+				pending.Scale = pSpatial->m_LocalTransform.getScale();
+
+				if (pSpatial->isNode())
+				{
+					for (Spatial* pChild : static_cast<Node*>(pSpatial)->getChildren())
+					{
+						spatials.push_back(pChild);
+						addNode(static_cast<int32_t>(i));
+					}
+				}
+			}
+
+			return getNodeCount();
+		}
+
+		void TransformHierarchy::clear()
+		{
+			m_NodeSlots.clear();
+			m_NodeDepths.clear();
+			m_PendingNodes.clear();
+
+			m_SlotNodes.clear();
+			m_Parents.clear();
+			m_Spatials.clear();
+			m_Stamps.clear();
+			m_LocalTranslates.clear();
+			m_LocalRotates.clear();
+			m_LocalScales.clear();
+			m_WorldTranslates.clear();
+			m_WorldRotates.clear();
+			m_WorldScales.clear();
+			m_WorldMatrices.clear();
+
+			m_LevelStarts.assign(1, 0);
+			m_LevelFlags.clear();
+			m_GeometrySlots.clear();
+		}
+
+		void TransformHierarchy::setLocal(uint32_t node, const glm::vec3& f3Translate, const glm::quat& f4Rotate, const glm::vec3& f3Scale)
+		{
+			uint32_t slot = m_NodeSlots[node];
+			if (slot == PENDING_SLOT)
+			{
+				PendingNode& pending = m_PendingNodes[node - (m_NodeSlots.size() - m_PendingNodes.size())];
+				pending.Translate = f3Translate;
+				pending.Rotate = f4Rotate;
+				pending.Scale = f3Scale;
+				return;
+			}
+
+			m_LocalTranslates[slot] = f3Translate;
+			m_LocalRotates[slot] = f4Rotate;
+			m_LocalScales[slot] = f3Scale;
+			markDirty(node);
+		}
+
+		void TransformHierarchy::setLocalTranslate(uint32_t node, const glm::vec3& f3Translate)
+		{
+			uint32_t slot = m_NodeSlots[node];
+			if (slot == PENDING_SLOT)
+			{
+				m_PendingNodes[node - (m_NodeSlots.size() - m_PendingNodes.size())].Translate = f3Translate;
+				return;
+			}
+
+			m_LocalTranslates[slot] = f3Translate;
+			markDirty(node);
+		}
+
+		void TransformHierarchy::markDirty(uint32_t node)
+		{
+			m_Stamps[m_NodeSlots[node]] = m_uiFrame + 1;
+			m_LevelFlags[m_NodeDepths[node]] |= LEVEL_MOVED;
+		}
+
+		void TransformHierarchy::sortNodes()
+		{
+			if (m_PendingNodes.empty())
+			{
+				return;
+			}
+
+			const uint32_t nodeCount = getNodeCount();
+			const uint32_t sortedCount = nodeCount - static_cast<uint32_t>(m_PendingNodes.size());
+			const uint32_t levelCount = *std::max_element(m_NodeDepths.begin(), m_NodeDepths.end()) + 1;
+
+			// Counting sort by depth, the nodes of a level keep the order they were added in.
+			m_LevelStarts.assign(levelCount + 1, 0);
+			for (uint32_t depth : m_NodeDepths)
+			{
+				m_LevelStarts[depth + 1]++;
+			}
+			for (uint32_t i = 0; i < levelCount; i++)
+			{
+				m_LevelStarts[i + 1] += m_LevelStarts[i];
+			}
+
+			std::vector<uint32_t> cursors(m_LevelStarts.begin(), m_LevelStarts.end() - 1);
+			std::vector<uint32_t> newSlots(nodeCount);
+			for (uint32_t node = 0; node < nodeCount; node++)
+			{
+				newSlots[node] = cursors[m_NodeDepths[node]]++;
+			}
+
+			std::vector<uint32_t> slotNodes(nodeCount);
+			std::vector<int32_t> parents(nodeCount);
+			std::vector<Spatial*> spatials(nodeCount);
+			std::vector<uint32_t> stamps(nodeCount);
+			std::vector<glm::vec3> localTranslates(nodeCount);
+			std::vector<glm::quat> localRotates(nodeCount);
+			std::vector<glm::vec3> localScales(nodeCount);
+			std::vector<glm::vec3> worldTranslates(nodeCount);
+			std::vector<glm::quat> worldRotates(nodeCount);
+			std::vector<glm::vec3> worldScales(nodeCount);
+			std::vector<glm::mat4> worldMatrices(nodeCount);
+
+			for (uint32_t node = 0; node < sortedCount; node++)
+			{
+				uint32_t oldSlot = m_NodeSlots[node];
+				uint32_t slot = newSlots[node];
+				int32_t oldParent = m_Parents[oldSlot];
+
+				slotNodes[slot] = node;
+				parents[slot] = oldParent == NULL_INDEX ? NULL_INDEX : static_cast<int32_t>(newSlots[m_SlotNodes[oldParent]]);
+				spatials[slot] = m_Spatials.empty() ? nullptr : m_Spatials[oldSlot];
+				stamps[slot] = m_Stamps[oldSlot];
+				localTranslates[slot] = m_LocalTranslates[oldSlot];
+				localRotates[slot] = m_LocalRotates[oldSlot];
+				localScales[slot] = m_LocalScales[oldSlot];
+				worldTranslates[slot] = m_WorldTranslates[oldSlot];
+				worldRotates[slot] = m_WorldRotates[oldSlot];
+				worldScales[slot] = m_WorldScales[oldSlot];
+				worldMatrices[slot] = m_WorldMatrices[oldSlot];
+			}
+
+			for (uint32_t node = sortedCount; node < nodeCount; node++)
+			{
+				const PendingNode& pending = m_PendingNodes[node - sortedCount];
+				uint32_t slot = newSlots[node];
+
+				slotNodes[slot] = node;
+				parents[slot] = pending.Parent == NULL_INDEX ? NULL_INDEX : static_cast<int32_t>(newSlots[pending.Parent]);
+				spatials[slot] = pending.pSpatial;
+				// The new nodes are computed by the coming update.
+				stamps[slot] = m_uiFrame + 1;
+				localTranslates[slot] = pending.Translate;
+				localRotates[slot] = pending.Rotate;
+				localScales[slot] = pending.Scale;
+			}
+
+			m_SlotNodes.swap(slotNodes);
+			m_Parents.swap(parents);
+			m_Spatials.swap(spatials);
+			m_Stamps.swap(stamps);
+			m_LocalTranslates.swap(localTranslates);
+			m_LocalRotates.swap(localRotates);
+			m_LocalScales.swap(localScales);
+			m_WorldTranslates.swap(worldTranslates);
+			m_WorldRotates.swap(worldRotates);
+			m_WorldScales.swap(worldScales);
+			m_WorldMatrices.swap(worldMatrices);
+			m_NodeSlots.swap(newSlots);
+			m_PendingNodes.clear();
+
+			m_LevelFlags.assign(levelCount, 0);
+			m_GeometrySlots.clear();
+			bool bMirrored = false;
+			for (uint32_t level = 0; level < levelCount; level++)
+			{
+				for (uint32_t slot = m_LevelStarts[level]; slot < m_LevelStarts[level + 1]; slot++)
+				{
+					if (m_Stamps[slot] == m_uiFrame + 1)
+					{
+						m_LevelFlags[level] |= LEVEL_MOVED;
+					}
+					if (m_Spatials[slot])
+					{
+						m_LevelFlags[level] |= LEVEL_MIRRORED;
+						bMirrored = true;
+						if (m_Spatials[slot]->isGeometry())
+						{
+							m_GeometrySlots.push_back(slot);
+						}
+					}
+				}
+			}
+
+			// Without spatials updateRange() doesn't have to look at them.
+			if (!bMirrored)
+			{
+				m_Spatials.clear();
+			}
+		}
+
+		void TransformHierarchy::beginUpdate()
+		{
+			sortNodes();
+			m_uiFrame++;
+		}
+
+		uint32_t TransformHierarchy::updateRange(uint32_t first, uint32_t count)
+		{
+			const uint32_t frame = m_uiFrame;
+			const uint32_t last = first + count;
+			const bool bMirrored = !m_Spatials.empty();
+			uint32_t updated = 0;
+			for (uint32_t i = first; i < last; i++)
+			{
+				Spatial* pSpatial = bMirrored ? m_Spatials[i] : nullptr;
+				if (pSpatial && (pSpatial->m_iRefreshFlags & Spatial::RF_TRANSFORM) != 0)
+				{
+					const Transform& local = pSpatial->m_LocalTransform;
+					m_LocalTranslates[i] = local.getTranslate();
+					m_LocalRotates[i] = local.getRotate();
+					m_LocalScales[i] = local.getScale();
+					m_Stamps[i] = frame;
+				}
+
+				const int32_t parent = m_Parents[i];
+				glm::vec3 translate;
+				glm::quat rotate;
+				glm::vec3 scale;
+				if (parent != NULL_INDEX)
+				{
+					if (m_Stamps[i] != frame && m_Stamps[parent] != frame)
+					{
+						continue;
+					}
+
+					// Same as Transform::combineWithParent().
+					const glm::quat& parentRotate = m_WorldRotates[parent];
+					const glm::vec3& parentScale = m_WorldScales[parent];
+					scale = m_LocalScales[i] * parentScale;
+					rotate = parentRotate * m_LocalRotates[i];
+					translate = parentRotate * (m_LocalTranslates[i] * parentScale) + m_WorldTranslates[parent];
+					m_Stamps[i] = frame;
+				}
+				else
+				{
+					if (m_Stamps[i] != frame)
+					{
+						continue;
+					}
+
+					translate = m_LocalTranslates[i];
+					rotate = m_LocalRotates[i];
+					scale = m_LocalScales[i];
+					// The root of a mirrored subtree still follows the parent of the subtree.
+					if (pSpatial && pSpatial->m_pParent)
+					{
+						const Transform& parentWorld = pSpatial->m_pParent->getWorldTransform();
+						scale *= parentWorld.getScale();
+						rotate = parentWorld.getRotate() * rotate;
+						translate = parentWorld.getRotate() * (m_LocalTranslates[i] * parentWorld.getScale()) + parentWorld.getTranslate();
+					}
+				}
+
+				updated++;
+				m_WorldTranslates[i] = translate;
+				m_WorldRotates[i] = rotate;
+				m_WorldScales[i] = scale;
+
+				// Same as Transform::getCombinedMatrix().
+				glm::mat3 rotateMat = glm::mat3_cast(rotate);
+				glm::mat4& world = m_WorldMatrices[i];
+				world[0] = glm::vec4(rotateMat[0] * scale.x, 0.0f);
+				world[1] = glm::vec4(rotateMat[1] * scale.y, 0.0f);
+				world[2] = glm::vec4(rotateMat[2] * scale.z, 0.0f);
+				world[3] = glm::vec4(translate, 1.0f);
+
+				if (pSpatial)
+				{
+					pSpatial->m_WorldTransform.setCombined(translate, rotate, scale, world);
+					pSpatial->m_iRefreshFlags &= ~Spatial::RF_TRANSFORM;
+				}
+			}
+
+			return updated;
+		}
+
+		void TransformHierarchy::endUpdate()
+		{
+			for (uint8_t& flags : m_LevelFlags)
+			{
+				flags &= ~LEVEL_MOVED;
+			}
+
+			// What Geometry::updateWorldTransforms() does after the transform, kept on one thread
+			// since the manager collects the moved geometries in a list.
+			for (uint32_t slot : m_GeometrySlots)
+			{
+				if (m_Stamps[slot] != m_uiFrame)
+				{
+					continue;
+				}
+
+				Geometry* pGeom = static_cast<Geometry*>(m_Spatials[slot]);
+				if (pGeom->isGrouped())
+				{
+					pGeom->m_pGroupNode->onTransformChange(pGeom);
+				}
+				if (pGeom->m_pWorldLights)
+				{
+					pGeom->m_pWorldLights->sort(true);
+				}
+			}
+		}
+
+		void TransformHierarchy::update()
+		{
+			beginUpdate();
+
+			JobSystem& jobs = JobSystem::get();
+			bool bParentChanged = false;
+			for (uint32_t level = 0; level < getLevelCount(); level++)
+			{
+				if (!isLevelDirty(level, bParentChanged))
+				{
+					bParentChanged = false;
+					continue;
+				}
+
+				const uint32_t first = getLevelFirst(level);
+				std::atomic<uint32_t> updated(0);
+				jobs.parallelFor(getLevelSize(level), SLOTS_PER_JOB, [this, first, &updated](uint32_t begin, uint32_t count)
+				{
+					uint32_t rangeUpdated = updateRange(first + begin, count);
+					if (rangeUpdated)
+					{
+						updated.fetch_add(rangeUpdated, std::memory_order_relaxed);
+					}
+				});
+				bParentChanged = updated.load(std::memory_order_relaxed) != 0;
+			}
+
+			endUpdate();
+		}
+
+		uint32_t TransformHierarchy::getUpdatedCount() const
+		{
+			return static_cast<uint32_t>(std::count(m_Stamps.begin(), m_Stamps.end(), m_uiFrame));
+		}
+	}
+}
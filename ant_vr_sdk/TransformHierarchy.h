@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Transform.h"
+#include <stdint.h>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		class Spatial;
+
+		/**
+		 * The world transforms of a whole hierarchy, computed from flat arrays instead of a walk
+		 * over the scene graph. The local and world transforms are stored in contiguous arrays
+		 * sorted by depth, every level follows the one of the parents, so a level only reads the
+		 * results of the level above it and its slots can be split across threads.<p>
+		 * The nodes are either added with addNode() and moved with setLocal(), or mirrored from a
+		 * scene with build(). A mirrored spatial whose transform was changed through the
+		 * {@link Spatial} API is picked up by the next update, which writes its world transform
+		 * back, so getWorldTransform() and updateGeometricState() keep working and only the bounds
+		 * are left to updateGeometricState(). The scene must be built again after attaching or
+		 * detaching spatials.<p>
+		 * A frame is:
+		 * <pre>
+		 * beginUpdate();
+		 * updateRange(first, count);     // for every level in order, the slots of a level may run on different threads
+		 * endUpdate();
+		 * </pre>
+		 * update() runs them, splitting the larger levels between the threads of the {@link JobSystem}.
+		 */
+		class TransformHierarchy
+		{
+		public:
+			static const int32_t NULL_INDEX = -1;
+
+			TransformHierarchy();
+
+			/// Adds a node and returns its id. The parent must be added before its children.
+			uint32_t addNode(int32_t parent, const glm::vec3& f3Translate = glm::vec3(0), const glm::quat& f4Rotate = glm::quat(1, 0, 0, 0), const glm::vec3& f3Scale = glm::vec3(1));
+			/// Clears the hierarchy and adds the spatial and all its descendants. Returns the node count.
+			uint32_t build(Spatial* pRoot);
+			void clear();
+
+			void setLocal(uint32_t node, const glm::vec3& f3Translate, const glm::quat& f4Rotate, const glm::vec3& f3Scale);
+			void setLocalTranslate(uint32_t node, const glm::vec3& f3Translate);
+
+			const glm::vec3& getLocalTranslate(uint32_t node) const { return m_LocalTranslates[m_NodeSlots[node]]; }
+			const glm::mat4& getWorldMatrix(uint32_t node) const { return m_WorldMatrices[m_NodeSlots[node]]; }
+			const glm::vec3& getWorldTranslate(uint32_t node) const { return m_WorldTranslates[m_NodeSlots[node]]; }
+			const glm::quat& getWorldRotate(uint32_t node) const { return m_WorldRotates[m_NodeSlots[node]]; }
+			const glm::vec3& getWorldScale(uint32_t node) const { return m_WorldScales[m_NodeSlots[node]]; }
+
+			uint32_t getNodeCount() const { return static_cast<uint32_t>(m_NodeSlots.size()); }
+			/// The levels are only known after beginUpdate().
+			uint32_t getLevelCount() const { return static_cast<uint32_t>(m_LevelStarts.size()) - 1; }
+			uint32_t getLevelFirst(uint32_t level) const { return m_LevelStarts[level]; }
+			uint32_t getLevelSize(uint32_t level) const { return m_LevelStarts[level + 1] - m_LevelStarts[level]; }
+
+			/// Sorts the nodes added since the last update and starts a new frame.
+			void beginUpdate();
+			/**
+			 * Returns false when no slot of the level can change: none of its nodes was moved, none
+			 * of them mirrors a spatial and no world transform of the level above changed.
+			 */
+			bool isLevelDirty(uint32_t level, bool bParentLevelChanged) const { return bParentLevelChanged || m_LevelFlags[level] != 0; }
+			/// Updates the world transforms of the slots [first, first + count), which must be in one level. Returns the number of updated slots.
+			uint32_t updateRange(uint32_t first, uint32_t count);
+			/// Notifies the {@link SpatialManager} of the mirrored geometries that moved.
+			void endUpdate();
+
+			/// Updates all the levels, splitting the larger ones into jobs.
+			void update();
+
+			/// Returns the number of world transforms computed by the last update.
+			uint32_t getUpdatedCount() const;
+
+		private:
+			// A node added since the last sort.
+			typedef struct PendingNode
+			{
+				int32_t Parent;
+				Spatial* pSpatial;
+				glm::vec3 Translate;
+				glm::quat Rotate;
+				glm::vec3 Scale;
+			}PendingNode;
+
+			void sortNodes();
+			void markDirty(uint32_t node);
+
+		private:
+			// Indexed by node id.
+			std::vector<uint32_t> m_NodeSlots;
+			std::vector<uint32_t> m_NodeDepths;
+			std::vector<PendingNode> m_PendingNodes;
+
+			// Indexed by slot, sorted by depth.
+			std::vector<uint32_t> m_SlotNodes;
+			std::vector<int32_t> m_Parents;
+			std::vector<Spatial*> m_Spatials;
+			// The frame of the last change of every slot. A slot is dirty when its stamp is the current frame.
+			std::vector<uint32_t> m_Stamps;
+			std::vector<glm::vec3> m_LocalTranslates;
+			std::vector<glm::quat> m_LocalRotates;
+			std::vector<glm::vec3> m_LocalScales;
+			std::vector<glm::vec3> m_WorldTranslates;
+			std::vector<glm::quat> m_WorldRotates;
+			std::vector<glm::vec3> m_WorldScales;
+			std::vector<glm::mat4> m_WorldMatrices;
+
+			std::vector<uint32_t> m_LevelStarts;
+			// LEVEL_MOVED and LEVEL_MIRRORED bits of every level.
+			std::vector<uint8_t> m_LevelFlags;
+			// The slots of the mirrored geometries.
+			std::vector<uint32_t> m_GeometrySlots;
+			uint32_t m_uiFrame;
+		};
+	}
+}
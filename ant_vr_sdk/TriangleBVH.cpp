@@ -0,0 +1,510 @@
+#include "TriangleBVH.h"
+#include "Shape3D.h"
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <mutex>
+#include <string.h>
+#include <unordered_map>
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#define TRIANGLE_BVH_SIMD 1
+#include <emmintrin.h>
+#else
+#define TRIANGLE_BVH_SIMD 0
+#endif
+
+namespace jet
+{
+	namespace util
+	{
+		// The centroid bins tested per axis for the split of a node.
+		static const uint32_t SAH_BINS = 16;
+		// Deeper nodes are split at the median, so the tree is at most about 32 levels deeper
+		// than that and the walks fit in STACK_SIZE.
+		static const uint32_t SAH_MAX_DEPTH = 32;
+		static const uint32_t STACK_SIZE = 64;
+
+		static std::unordered_map<ShapeKey, TriangleBVHPtr> g_ShapeTrees;
+		static std::mutex g_ShapeTreesMutex;
+		// Bumped by releaseAll, the trees cached on the shapes before are stale. Never 0, the shapes start there.
+		static std::atomic<uint32_t> g_uiShapeTreesGeneration(1);
+
+		static float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+		{
+			const glm::vec3 d = max - min;
+			return d.x * d.y + d.y * d.z + d.z * d.x;
+		}
+
+		TriangleBVH::TriangleBVH() : m_uiTriangleCount(0)
+		{
+		}
+
+		void TriangleBVH::build(const glm::vec3* pPositions, uint32_t vertexCount, const void* pIndices, uint32_t indexCount, bool b32BitIndices)
+		{
+			m_Nodes.clear();
+			m_Leaves.clear();
+			m_Normals.clear();
+			m_uiTriangleCount = (pIndices ? indexCount : vertexCount) / 3;
+			if (m_uiTriangleCount == 0)
+			{
+				return;
+			}
+
+			std::vector<glm::vec3> corners(m_uiTriangleCount * 3);
+			for (uint32_t i = 0; i < m_uiTriangleCount * 3; i++)
+			{
+				uint32_t index = i;
+				if (pIndices)
+				{
+					index = b32BitIndices ? static_cast<const uint32_t*>(pIndices)[i] : static_cast<const uint16_t*>(pIndices)[i];
+				}
+
+				assert(index < vertexCount);
+				corners[i] = pPositions[index];
+			}
+
+			std::vector<BuildTriangle> triangles(m_uiTriangleCount);
+			m_Normals.resize(m_uiTriangleCount);
+			for (uint32_t i = 0; i < m_uiTriangleCount; i++)
+			{
+				const glm::vec3* pCorner = &corners[i * 3];
+				BuildTriangle& triangle = triangles[i];
+				triangle.Min = glm::min(glm::min(pCorner[0], pCorner[1]), pCorner[2]);
+				triangle.Max = glm::max(glm::max(pCorner[0], pCorner[1]), pCorner[2]);
+				triangle.Centroid = (pCorner[0] + pCorner[1] + pCorner[2]) * (1.0f / 3.0f);
+				triangle.Index = i;
+
+				const glm::vec3 normal = glm::cross(pCorner[1] - pCorner[0], pCorner[2] - pCorner[0]);
+				const float length = glm::length(normal);
+				m_Normals[i] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+			}
+
+			m_Nodes.reserve(2 * m_uiTriangleCount / LEAF_TRIANGLES + 1);
+			m_Leaves.reserve(m_uiTriangleCount / LEAF_TRIANGLES + 1);
+			subdivide(triangles, corners.data());
+		}
+
+		void TriangleBVH::subdivide(std::vector<BuildTriangle>& triangles, const glm::vec3* pCorners)
+		{
+			typedef struct Bin
+			{
+				glm::vec3 Min;
+				glm::vec3 Max;
+				uint32_t Count;
+			}Bin;
+
+			typedef struct Task
+			{
+				uint32_t Node;
+				uint32_t First;
+				uint32_t Count;
+				uint32_t Depth;
+			}Task;
+
+			m_Nodes.push_back(TreeNode());
+			std::vector<Task> tasks;
+			tasks.push_back({ 0, 0, static_cast<uint32_t>(triangles.size()), 0 });
+
+			while (!tasks.empty())
+			{
+				const Task task = tasks.back();
+				tasks.pop_back();
+
+				glm::vec3 boundMin(FLT_MAX), boundMax(-FLT_MAX);
+				glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+				for (uint32_t i = task.First; i < task.First + task.Count; i++)
+				{
+					boundMin = glm::min(boundMin, triangles[i].Min);
+					boundMax = glm::max(boundMax, triangles[i].Max);
+					centroidMin = glm::min(centroidMin, triangles[i].Centroid);
+					centroidMax = glm::max(centroidMax, triangles[i].Centroid);
+				}
+
+				m_Nodes[task.Node].Min = boundMin;
+				m_Nodes[task.Node].Max = boundMax;
+				if (task.Count <= LEAF_TRIANGLES)
+				{
+					makeLeaf(m_Nodes[task.Node], triangles, pCorners, task.First, task.Count);
+					continue;
+				}
+
+				// The split of the lowest cost, the surface area of each side times its triangles.
+				int32_t bestAxis = -1;
+				uint32_t bestBin = 0;
+				float bestCost = FLT_MAX;
+				if (task.Depth < SAH_MAX_DEPTH)
+				{
+					for (int32_t axis = 0; axis < 3; axis++)
+					{
+						const float extent = centroidMax[axis] - centroidMin[axis];
+						if (extent <= 0.0f)
+							continue;
+
+						Bin bins[SAH_BINS];
+						for (Bin& bin : bins)
+						{
+							bin.Min = glm::vec3(FLT_MAX);
+							bin.Max = glm::vec3(-FLT_MAX);
+							bin.Count = 0;
+						}
+
+						const float scale = SAH_BINS / extent;
+						for (uint32_t i = task.First; i < task.First + task.Count; i++)
+						{
+							const uint32_t b = std::min(SAH_BINS - 1, static_cast<uint32_t>((triangles[i].Centroid[axis] - centroidMin[axis]) * scale));
+							bins[b].Min = glm::min(bins[b].Min, triangles[i].Min);
+							bins[b].Max = glm::max(bins[b].Max, triangles[i].Max);
+							bins[b].Count++;
+						}
+
+						// The costs of the right sides swept from the last bin, then the left ones from the first.
+						float rightCosts[SAH_BINS];
+						glm::vec3 sideMin(FLT_MAX), sideMax(-FLT_MAX);
+						uint32_t sideCount = 0;
+						for (uint32_t b = SAH_BINS - 1; b > 0; b--)
+						{
+							sideMin = glm::min(sideMin, bins[b].Min);
+							sideMax = glm::max(sideMax, bins[b].Max);
+							sideCount += bins[b].Count;
+							rightCosts[b] = sideCount ? surfaceArea(sideMin, sideMax) * sideCount : 0.0f;
+						}
+
+						sideMin = glm::vec3(FLT_MAX);
+						sideMax = glm::vec3(-FLT_MAX);
+						sideCount = 0;
+						for (uint32_t b = 0; b < SAH_BINS - 1; b++)
+						{
+							sideMin = glm::min(sideMin, bins[b].Min);
+							sideMax = glm::max(sideMax, bins[b].Max);
+							sideCount += bins[b].Count;
+							if (sideCount == 0 || sideCount == task.Count)
+								continue;
+
+							const float cost = surfaceArea(sideMin, sideMax) * sideCount + rightCosts[b + 1];
+							if (cost < bestCost)
+							{
+								bestCost = cost;
+								bestAxis = axis;
+								bestBin = b;
+							}
+						}
+					}
+				}
+
+				uint32_t leftCount;
+				if (bestAxis >= 0)
+				{
+					const float extent = centroidMax[bestAxis] - centroidMin[bestAxis];
+					const float scale = SAH_BINS / extent;
+					const float origin = centroidMin[bestAxis];
+					auto middle = std::partition(triangles.begin() + task.First, triangles.begin() + task.First + task.Count,
+						[bestAxis, bestBin, scale, origin](const BuildTriangle& triangle)
+					{
+						return std::min(SAH_BINS - 1, static_cast<uint32_t>((triangle.Centroid[bestAxis] - origin) * scale)) <= bestBin;
+					});
+					leftCount = static_cast<uint32_t>(middle - (triangles.begin() + task.First));
+				}
+				else
+				{
+					// No usable split, or too deep: halve the triangles along the longest centroid axis.
+					const glm::vec3 extent = centroidMax - centroidMin;
+					const int32_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+					leftCount = task.Count / 2;
+					std::nth_element(triangles.begin() + task.First, triangles.begin() + task.First + leftCount, triangles.begin() + task.First + task.Count,
+						[axis](const BuildTriangle& a, const BuildTriangle& b) { return a.Centroid[axis] < b.Centroid[axis]; });
+				}
+
+				const uint32_t child = static_cast<uint32_t>(m_Nodes.size());
+				m_Nodes[task.Node].Offset = child;
+				m_Nodes[task.Node].Count = 0;
+				m_Nodes.push_back(TreeNode());
+				m_Nodes.push_back(TreeNode());
+				tasks.push_back({ child, task.First, leftCount, task.Depth + 1 });
+				tasks.push_back({ child + 1, task.First + leftCount, task.Count - leftCount, task.Depth + 1 });
+			}
+		}
+
+		void TriangleBVH::makeLeaf(TreeNode& node, const std::vector<BuildTriangle>& triangles, const glm::vec3* pCorners, uint32_t first, uint32_t count)
+		{
+			LeafBlock block;
+			memset(&block, 0, sizeof(LeafBlock));
+			for (uint32_t lane = 0; lane < count; lane++)
+			{
+				const uint32_t triangle = triangles[first + lane].Index;
+				const glm::vec3* pCorner = pCorners + triangle * 3;
+				const glm::vec3 e1 = pCorner[1] - pCorner[0];
+				const glm::vec3 e2 = pCorner[2] - pCorner[0];
+				for (int32_t i = 0; i < 3; i++)
+				{
+					block.V0[i][lane] = pCorner[0][i];
+					block.E1[i][lane] = e1[i];
+					block.E2[i][lane] = e2[i];
+				}
+				block.Triangles[lane] = triangle;
+			}
+
+			node.Offset = static_cast<uint32_t>(m_Leaves.size());
+			node.Count = count;
+			m_Leaves.push_back(block);
+		}
+
+		template<typename LeafTest>
+		void TriangleBVH::traverse(const Ray& ray, LeafTest test) const
+		{
+			if (m_Nodes.empty())
+			{
+				return;
+			}
+
+			// Slab test, the infinities of the zero components compare as expected.
+			const glm::vec3 invDirection = 1.0f / ray.Direction;
+			float tMax = ray.Limit;
+			if (BoundingBox::intersectRay(m_Nodes[0].Min, m_Nodes[0].Max, ray.Origin, invDirection, tMax) == FLT_MAX)
+			{
+				return;
+			}
+
+			// The children are tested before they are pushed, with their entry distances, so the
+			// nearer one is walked first and a farther one is dropped once a closer hit is found.
+			struct Entry { uint32_t Node; float Distance; };
+			Entry stack[STACK_SIZE];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = { 0, 0.0f };
+
+			while (stackSize > 0)
+			{
+				const Entry entry = stack[--stackSize];
+				if (entry.Distance > tMax)
+					continue;
+
+				const TreeNode& node = m_Nodes[entry.Node];
+				if (node.isLeaf())
+				{
+					tMax = test(m_Leaves[node.Offset], tMax);
+					if (tMax < 0.0f)
+						return;
+					continue;
+				}
+
+				const TreeNode& child1 = m_Nodes[node.Offset];
+				const TreeNode& child2 = m_Nodes[node.Offset + 1];
+				float distance1 = BoundingBox::intersectRay(child1.Min, child1.Max, ray.Origin, invDirection, tMax);
+				float distance2 = BoundingBox::intersectRay(child2.Min, child2.Max, ray.Origin, invDirection, tMax);
+				uint32_t nearChild = node.Offset, farChild = node.Offset + 1;
+				if (distance2 < distance1)
+				{
+					std::swap(distance1, distance2);
+					std::swap(nearChild, farChild);
+				}
+
+				assert(stackSize + 2 <= STACK_SIZE);
+				if (distance2 != FLT_MAX)
+					stack[stackSize++] = { farChild, distance2 };
+				if (distance1 != FLT_MAX)
+					stack[stackSize++] = { nearChild, distance1 };
+			}
+		}
+
+		uint32_t TriangleBVH::intersectLeaf(const Ray& ray, const LeafBlock& block, float tMax, float* pDistances, float* pU, float* pV) const
+		{
+			// Moller-Trumbore for the four lanes at once, both faces of the triangles are hit.
+#if TRIANGLE_BVH_SIMD
+			const __m128 dx = _mm_set1_ps(ray.Direction.x);
+			const __m128 dy = _mm_set1_ps(ray.Direction.y);
+			const __m128 dz = _mm_set1_ps(ray.Direction.z);
+			const __m128 e1x = _mm_loadu_ps(block.E1[0]);
+			const __m128 e1y = _mm_loadu_ps(block.E1[1]);
+			const __m128 e1z = _mm_loadu_ps(block.E1[2]);
+			const __m128 e2x = _mm_loadu_ps(block.E2[0]);
+			const __m128 e2y = _mm_loadu_ps(block.E2[1]);
+			const __m128 e2z = _mm_loadu_ps(block.E2[2]);
+
+			// p = d x e2, det = e1 . p
+			const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+			// s = o - v0, u = (s . p) / det
+			const __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.Origin.x), _mm_loadu_ps(block.V0[0]));
+			const __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.Origin.y), _mm_loadu_ps(block.V0[1]));
+			const __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.Origin.z), _mm_loadu_ps(block.V0[2]));
+			const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+			// q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+			const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+			// The degenerate lanes divide by zero, their infinities and NaNs fail the compares.
+			const __m128 zero = _mm_setzero_ps();
+			__m128 hit = _mm_cmpneq_ps(det, zero);
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(t, zero));
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
+
+			_mm_storeu_ps(pDistances, t);
+			_mm_storeu_ps(pU, u);
+			_mm_storeu_ps(pV, v);
+			return static_cast<uint32_t>(_mm_movemask_ps(hit));
+#else
+			uint32_t mask = 0;
+			for (uint32_t lane = 0; lane < LEAF_TRIANGLES; lane++)
+			{
+				const glm::vec3 e1(block.E1[0][lane], block.E1[1][lane], block.E1[2][lane]);
+				const glm::vec3 e2(block.E2[0][lane], block.E2[1][lane], block.E2[2][lane]);
+				const glm::vec3 p = glm::cross(ray.Direction, e2);
+				const float det = glm::dot(e1, p);
+				if (det == 0.0f)
+					continue;
+
+				const float invDet = 1.0f / det;
+				const glm::vec3 s = ray.Origin - glm::vec3(block.V0[0][lane], block.V0[1][lane], block.V0[2][lane]);
+				const glm::vec3 q = glm::cross(s, e1);
+				pU[lane] = glm::dot(s, p) * invDet;
+				pV[lane] = glm::dot(ray.Direction, q) * invDet;
+				pDistances[lane] = glm::dot(e2, q) * invDet;
+				if (pU[lane] >= 0.0f && pV[lane] >= 0.0f && pU[lane] + pV[lane] <= 1.0f && pDistances[lane] >= 0.0f && pDistances[lane] < tMax)
+				{
+					mask |= 1u << lane;
+				}
+			}
+
+			return mask;
+#endif
+		}
+
+		bool TriangleBVH::intersectClosest(const Ray& ray, Hit& hit) const
+		{
+			bool bFound = false;
+			traverse(ray, [this, &ray, &hit, &bFound](const LeafBlock& block, float tMax)
+			{
+				float distances[LEAF_TRIANGLES], u[LEAF_TRIANGLES], v[LEAF_TRIANGLES];
+				const uint32_t mask = intersectLeaf(ray, block, tMax, distances, u, v);
+				for (uint32_t lane = 0; lane < LEAF_TRIANGLES; lane++)
+				{
+					if ((mask & (1u << lane)) && distances[lane] < tMax)
+					{
+						tMax = distances[lane];
+						hit = { distances[lane], block.Triangles[lane], u[lane], v[lane] };
+						bFound = true;
+					}
+				}
+
+				return tMax;
+			});
+
+			return bFound;
+		}
+
+		bool TriangleBVH::intersectAny(const Ray& ray) const
+		{
+			bool bFound = false;
+			traverse(ray, [this, &ray, &bFound](const LeafBlock& block, float tMax)
+			{
+				float distances[LEAF_TRIANGLES], u[LEAF_TRIANGLES], v[LEAF_TRIANGLES];
+				bFound = intersectLeaf(ray, block, tMax, distances, u, v) != 0;
+				return bFound ? -1.0f : tMax;
+			});
+
+			return bFound;
+		}
+
+		uint32_t TriangleBVH::intersectAll(const Ray& ray, std::vector<Hit>& hits) const
+		{
+			const size_t firstHit = hits.size();
+			traverse(ray, [this, &ray, &hits](const LeafBlock& block, float tMax)
+			{
+				float distances[LEAF_TRIANGLES], u[LEAF_TRIANGLES], v[LEAF_TRIANGLES];
+				const uint32_t mask = intersectLeaf(ray, block, tMax, distances, u, v);
+				for (uint32_t lane = 0; lane < LEAF_TRIANGLES; lane++)
+				{
+					if (mask & (1u << lane))
+					{
+						hits.push_back({ distances[lane], block.Triangles[lane], u[lane], v[lane] });
+					}
+				}
+
+				return tMax;
+			});
+
+			return static_cast<uint32_t>(hits.size() - firstHit);
+		}
+
+		glm::vec3 TriangleBVH::getTriangleNormal(uint32_t triangle) const
+		{
+			assert(triangle < m_uiTriangleCount);
+			return m_Normals[triangle];
+		}
+
+		BoundingBox TriangleBVH::getBound() const
+		{
+			return m_Nodes.empty() ? BoundingBox() : BoundingBox::fromMinMax(m_Nodes[0].Min, m_Nodes[0].Max);
+		}
+
+		const TriangleBVH* TriangleBVH::get(const Shape3D* pShape)
+		{
+			assert(pShape);
+			if (pShape->getMode() != Shape3D::Mode::TRIANGLES)
+			{
+				return nullptr;
+			}
+
+			// The shape keeps the tree once found, the lookups by name and the lock are only paid the first time.
+			if (pShape->m_uiTriangleBVHGeneration.load(std::memory_order_acquire) == g_uiShapeTreesGeneration.load(std::memory_order_relaxed))
+			{
+				return pShape->m_pTriangleBVH.load(std::memory_order_relaxed);
+			}
+
+			const ShapeKey key = ShapeKey(pShape->getUniqueName());
+			{
+				std::lock_guard<std::mutex> lock(g_ShapeTreesMutex);
+				auto it = g_ShapeTrees.find(key);
+				if (it != g_ShapeTrees.end())
+				{
+					cacheTree(pShape, it->second.get());
+					return it->second.get();
+				}
+			}
+
+			const bool bIndexed = pShape->getIndiceCount() > 0;
+			MeteDataPtr positions = pShape->getVertexData(MeshAttrib::POSITION3, bIndexed);
+			MeteDataPtr indices = bIndexed ? pShape->getVertexData(MeshAttrib::INDICES, true) : MeteDataPtr();
+			const bool b32BitIndices = pShape->getIndiceType() == DataType::UINT32;
+
+			TriangleBVHPtr pTree = TriangleBVHPtr(new TriangleBVH());
+			if (positions.get() && positions->pData)
+			{
+				const uint32_t vertexCount = positions->uiLength / sizeof(glm::vec3);
+				const uint32_t indexCount = indices.get() ? indices->uiLength / (b32BitIndices ? 4 : 2) : 0;
+				pTree->build(reinterpret_cast<const glm::vec3*>(positions->pData), vertexCount, indices.get() ? indices->pData : nullptr, indexCount, b32BitIndices);
+			}
+
+			// The tree was built outside of the lock, keep the one of another thread that was faster.
+			std::lock_guard<std::mutex> lock(g_ShapeTreesMutex);
+			auto result = g_ShapeTrees.insert(std::pair<ShapeKey, TriangleBVHPtr>(key, pTree));
+			cacheTree(pShape, result.first->second.get());
+			return result.first->second.get();
+		}
+
+		void TriangleBVH::cacheTree(const Shape3D* pShape, const TriangleBVH* pTree)
+		{
+			// Called under g_ShapeTreesMutex, so the generation can't move on meanwhile.
+			pShape->m_pTriangleBVH.store(pTree, std::memory_order_relaxed);
+			pShape->m_uiTriangleBVHGeneration.store(g_uiShapeTreesGeneration.load(std::memory_order_relaxed), std::memory_order_release);
+		}
+
+		void TriangleBVH::releaseAll()
+		{
+			std::lock_guard<std::mutex> lock(g_ShapeTreesMutex);
+			g_ShapeTrees.clear();
+			g_uiShapeTreesGeneration.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
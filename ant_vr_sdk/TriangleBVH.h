@@ -0,0 +1,117 @@
+#pragma once
+
+#include "BoundingVolume.h"
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace jet
+{
+	namespace util
+	{
+		class Shape3D;
+
+		/**
+		 * A bounding volume hierarchy over the triangles of a mesh, in model space, for ray picking
+		 * and line of sight tests. The nodes are split by the surface area heuristic over binned
+		 * centroids, and every leaf keeps up to four triangles side by side so one SIMD test covers
+		 * the whole leaf.<p>
+		 * The shapes share one tree per {@link ShapeKey}, built on the first {@link #get} call and
+		 * then cached on the shape.
+		 */
+		class TriangleBVH
+		{
+		public:
+			static const uint32_t LEAF_TRIANGLES = 4;
+
+			typedef struct Hit
+			{
+				// The distance along the ray, in units of its direction.
+				float Distance;
+				// The index of the triangle in the mesh, and the barycentric coordinates of the hit.
+				uint32_t Triangle;
+				float U, V;
+			}Hit;
+
+			TriangleBVH();
+
+			/**
+			 * Builds the tree over the triangles of a triangle list. pIndices holds three indices
+			 * per triangle, 16 or 32 bit, or is NULL when the positions are the expanded triangles.
+			 */
+			void build(const glm::vec3* pPositions, uint32_t vertexCount, const void* pIndices, uint32_t indexCount, bool b32BitIndices);
+
+			/// Returns the nearest hit within the limit of the ray.
+			bool intersectClosest(const Ray& ray, Hit& hit) const;
+			/// Returns true on the first hit found within the limit of the ray, for the line of sight tests.
+			bool intersectAny(const Ray& ray) const;
+			/// Collects every hit within the limit of the ray, in no particular order.
+			uint32_t intersectAll(const Ray& ray, std::vector<Hit>& hits) const;
+
+			uint32_t getTriangleCount() const { return m_uiTriangleCount; }
+			/// The normal of the triangle, by the winding of its vertices.
+			glm::vec3 getTriangleNormal(uint32_t triangle) const;
+			BoundingBox getBound() const;
+
+			/**
+			 * Returns the tree of the shape, built on the first call. Only the TRIANGLES mode is
+			 * supported, NULL is returned for the other ones.
+			 */
+			static const TriangleBVH* get(const Shape3D* pShape);
+			/// Drops the trees of all the shapes, no query may run meanwhile.
+			static void releaseAll();
+
+		private:
+			static void cacheTree(const Shape3D* pShape, const TriangleBVH* pTree);
+
+			typedef struct TreeNode
+			{
+				glm::vec3 Min;
+				// The first child of a node, the second one follows it, or the leaf block of a leaf.
+				uint32_t Offset;
+				glm::vec3 Max;
+				// The triangles of a leaf, zero for a node.
+				uint32_t Count;
+
+				bool isLeaf() const { return Count != 0; }
+			}TreeNode;
+
+			// The triangles of a leaf as structure of arrays, the first vertex and the two edges.
+			// The unused lanes are degenerate and never hit.
+			typedef struct LeafBlock
+			{
+				float V0[3][LEAF_TRIANGLES];
+				float E1[3][LEAF_TRIANGLES];
+				float E2[3][LEAF_TRIANGLES];
+				uint32_t Triangles[LEAF_TRIANGLES];
+			}LeafBlock;
+
+			typedef struct BuildTriangle
+			{
+				glm::vec3 Min;
+				glm::vec3 Max;
+				glm::vec3 Centroid;
+				uint32_t Index;
+			}BuildTriangle;
+
+			// pCorners holds the three vertices of every triangle of the mesh.
+			void subdivide(std::vector<BuildTriangle>& triangles, const glm::vec3* pCorners);
+			void makeLeaf(TreeNode& node, const std::vector<BuildTriangle>& triangles, const glm::vec3* pCorners, uint32_t first, uint32_t count);
+
+			// Walks the leaves hit by the ray nearest first, test(leaf block, tMax) returns the new tMax,
+			// a negative one ends the walk.
+			template<typename LeafTest>
+			void traverse(const Ray& ray, LeafTest test) const;
+			// Returns the lanes hit in front of tMax, with their distances and barycentrics.
+			uint32_t intersectLeaf(const Ray& ray, const LeafBlock& block, float tMax, float* pDistances, float* pU, float* pV) const;
+
+		private:
+			std::vector<TreeNode> m_Nodes;
+			std::vector<LeafBlock> m_Leaves;
+			std::vector<glm::vec3> m_Normals;
+			uint32_t m_uiTriangleCount;
+		};
+
+		typedef std::shared_ptr<TriangleBVH> TriangleBVHPtr;
+	}
+}
@@ -0,0 +1,88 @@
+#include "VertexPacking.h"
+#include <packing.hpp>
+#include <gtc/packing.hpp>
+
+namespace jet
+{
+	namespace util
+	{
+		VertexQuantization VertexPacking::computeQuantization(const glm::vec3* pPositions, uint32_t count)
+		{
+			if (count == 0)
+			{
+				return VertexQuantization();
+			}
+
+			glm::vec3 minPos = pPositions[0];
+			glm::vec3 maxPos = pPositions[0];
+			for (uint32_t i = 1; i < count; i++)
+			{
+				minPos = glm::min(minPos, pPositions[i]);
+				maxPos = glm::max(maxPos, pPositions[i]);
+			}
+
+			// Keep flat axes decodable, any scale maps them to the bias.
+			glm::vec3 scale = maxPos - minPos;
+			for (int i = 0; i < 3; i++)
+			{
+				if (scale[i] <= 0.0f)
+					scale[i] = 1.0f;
+			}
+
+			return VertexQuantization(scale, minPos);
+		}
+
+		uint64_t VertexPacking::packPositionHalf(const glm::vec3& position)
+		{
+			return glm::packHalf4x16(glm::vec4(position, 1.0f));
+		}
+
+		uint64_t VertexPacking::packPositionUnorm16(const glm::vec3& position, const VertexQuantization& quantization)
+		{
+			const glm::vec3 normalized = (position - quantization.Bias) / quantization.Scale;
+			return glm::packUnorm4x16(glm::vec4(normalized, 0.0f));
+		}
+
+		glm::vec3 VertexPacking::unpackPositionUnorm16(uint64_t packed, const VertexQuantization& quantization)
+		{
+			return glm::vec3(glm::unpackUnorm4x16(packed)) * quantization.Scale + quantization.Bias;
+		}
+
+		static glm::vec2 signNotZero(const glm::vec2& v)
+		{
+			return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+		}
+
+		uint32_t VertexPacking::packNormalOctahedral(const glm::vec3& normal)
+		{
+			// Project onto the octahedron, then fold the lower hemisphere over the upper one.
+			const float l1 = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+			glm::vec2 e = (l1 > 0.0f) ? glm::vec2(normal.x, normal.y) / l1 : glm::vec2(0.0f);
+			if (normal.z < 0.0f)
+			{
+				e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * signNotZero(e);
+			}
+
+			return glm::packSnorm2x16(e);
+		}
+
+		glm::vec3 VertexPacking::unpackNormalOctahedral(uint32_t packed)
+		{
+			const glm::vec2 e = glm::unpackSnorm2x16(packed);
+			glm::vec3 n(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+			if (n.z < 0.0f)
+			{
+				const glm::vec2 folded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signNotZero(glm::vec2(n.x, n.y));
+				n.x = folded.x;
+				n.y = folded.y;
+			}
+
+			return glm::normalize(n);
+		}
+
+		uint32_t VertexPacking::packTexcoordUnorm16(const glm::vec2& texcoord)
+		{
+			return glm::packUnorm2x16(texcoord);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glm.hpp>
+#include <stdint.h>
+
+namespace jet
+{
+	namespace util
+	{
+		/**
+		 * Maps the 16-bit normalized positions of a mesh back to its space:
+		 * <code>position = attrib.xyz * Scale + Bias</code>. Scale and Bias are the size and the
+		 * minimum corner of the bounding box of the positions.
+		 */
+		typedef struct VertexQuantization
+		{
+			glm::vec3 Scale;
+			glm::vec3 Bias;
+
+			VertexQuantization() : Scale(1.0f), Bias(0.0f){}
+			VertexQuantization(const glm::vec3& scale, const glm::vec3& bias) : Scale(scale), Bias(bias){}
+		}VertexQuantization;
+
+		/**
+		 * Packs vertex attributes into the compact formats of the quantized MeshAttrib layouts.<p>
+		 * Normals are octahedral encoded into two snorm16, the vertex shader decodes them with:
+		 * <pre>
+		 * vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+		 * if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+		 * n = normalize(n);
+		 * </pre>
+		 */
+		class VertexPacking
+		{
+		public:
+			/// Computes the quantization that maps the bounding box of the positions onto [0, 1].
+			static VertexQuantization computeQuantization(const glm::vec3* pPositions, uint32_t count);
+
+			/// Packs xyz into four halfs, w is 1.0.
+			static uint64_t packPositionHalf(const glm::vec3& position);
+			/// Packs xyz into four unorm16 relative to the quantization, w is 0.
+			static uint64_t packPositionUnorm16(const glm::vec3& position, const VertexQuantization& quantization);
+			static glm::vec3 unpackPositionUnorm16(uint64_t packed, const VertexQuantization& quantization);
+
+			/// Octahedral encodes a unit vector into two snorm16.
+			static uint32_t packNormalOctahedral(const glm::vec3& normal);
+			static glm::vec3 unpackNormalOctahedral(uint32_t packed);
+
+			/// Packs a texcoord into two unorm16. Texcoords outside [0, 1] are clamped, so tiled
+			/// meshes have to stay on the float layouts.
+			static uint32_t packTexcoordUnorm16(const glm::vec2& texcoord);
+		};
+	}
+}
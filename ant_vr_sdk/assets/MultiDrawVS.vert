@@ -0,0 +1,20 @@
+layout(location = 0) in vec4 In_f4Position;
+layout(location = 1) in vec3 In_f3Normal;
+layout(location = 2) in vec2 In_f2Texcoord;
+// The index of the instance in the MULTI_DRAW batch, fetched at the base instance of the draw.
+layout(location = 15) in uint In_uiInstance;
+
+layout(std430, binding = 4) readonly buffer Transforms { mat4 g_Transforms[]; };
+
+uniform mat4 g_ViewProj;
+
+out vec3 m_f3Normal;
+out vec2 m_f2Texcoord;
+
+void main()
+{
+	mat4 world = g_Transforms[In_uiInstance];
+	gl_Position = g_ViewProj * (world * In_f4Position);
+	m_f3Normal = mat3(world) * In_f3Normal;
+	m_f2Texcoord = In_f2Texcoord;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <glm.hpp>
+#include <float.h>
 
 namespace jet
 {
@@ -48,7 +49,7 @@ namespace jet
 			static Side whichSide(const glm::tvec3<Type, glm::highp>& point, const Plane<Type>& plane)
 			{
 				Type zero = static_cast<Type>(0);
-				Type dis = pseudoDistance(point);
+				Type dis = pseudoDistance(point, plane);
 				if (dis < zero) 
 				{
 					return Side::NEGATIVE;
@@ -69,5 +70,25 @@ namespace jet
 
 		typedef Plane<float> Planef;
 		typedef Plane<double> Planed;
+
+		/**
+		* <code>Ray</code> defines a line segment which has an origin and a direction.
+		* That is, a point and an infinite ray is cast from this point. The ray is
+		* defined by the following equation: R(t) = origin + t*direction for t >= 0,
+		* cut at t = Limit. The direction doesn't have to be normalized, the distances
+		* along the ray are then in units of its length.
+		*/
+		typedef struct Ray
+		{
+			glm::vec3 Origin;
+			glm::vec3 Direction;
+			float Limit;
+
+			Ray() : Origin(0.0f), Direction(0.0f, 0.0f, 1.0f), Limit(FLT_MAX){}
+			Ray(const glm::vec3& origin, const glm::vec3& direction, float limit = FLT_MAX) :
+				Origin(origin), Direction(direction), Limit(limit){}
+
+			glm::vec3 getPoint(float t) const { return Origin + Direction * t; }
+		}Ray;
 	}
 }
\ No newline at end of file
@@ -0,0 +1,368 @@
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <Buffer.h>
+#include <GeometryAttribBuffer.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace jet::util;
+
+// Headless benchmark of the CPU buffer pools. BufferMemory stands in for the GPU buffer, wrapped
+// so that the traffic the pools generate on their proxy buffer can be counted.
+
+struct BufferBenchCounters
+{
+	uint64_t InitCount;
+	uint64_t ResizeCount;
+	uint64_t UpdateBytes;
+	uint64_t CopyCalls;
+	uint64_t CopyBytes;
+	uint32_t PeakSize;
+
+	void reset() { memset(this, 0, sizeof(BufferBenchCounters)); }
+};
+
+static BufferBenchCounters g_BenchCounters;
+
+class CountingBufferMemory : public BufferMemory
+{
+public:
+	bool init(uint32_t size, const uint8_t* pData = nullptr) override
+	{
+		g_BenchCounters.InitCount++;
+		if (size > g_BenchCounters.PeakSize)
+			g_BenchCounters.PeakSize = size;
+		return BufferMemory::init(size, pData);
+	}
+
+	bool resize(uint32_t size) override
+	{
+		g_BenchCounters.ResizeCount++;
+		if (size > g_BenchCounters.PeakSize)
+			g_BenchCounters.PeakSize = size;
+		return BufferMemory::resize(size);
+	}
+
+	bool update(uint32_t offset, uint32_t size, const uint8_t* pData) override
+	{
+		g_BenchCounters.UpdateBytes += size;
+		return BufferMemory::update(offset, size, pData);
+	}
+
+	void memoryCpy(uint32_t dst_offset, uint32_t src_offset, uint32_t size) override
+	{
+		g_BenchCounters.CopyCalls++;
+		g_BenchCounters.CopyBytes += size;
+		BufferMemory::memoryCpy(dst_offset, src_offset, size);
+	}
+};
+
+class CountingBufferCreator : public BufferCreator
+{
+public:
+	Buffer* create() override { return new CountingBufferMemory; }
+	void release(Buffer* pBuffer) override { delete pBuffer; }
+};
+
+// Small deterministic generator, so every run replays the same trace.
+class BenchRandom
+{
+public:
+	BenchRandom(uint32_t seed) : m_State(seed){}
+
+	uint32_t next()
+	{
+		m_State ^= m_State << 13;
+		m_State ^= m_State >> 17;
+		m_State ^= m_State << 5;
+		return m_State;
+	}
+
+	uint32_t range(uint32_t count) { return next() % count; }
+
+	// Mesh sizes spread evenly over the powers of two between 64 bytes and 32KB.
+	uint32_t meshSize() { return (64u << range(10)) + range(64) * 4; }
+
+private:
+	uint32_t m_State;
+};
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+static double secondsSince(BenchClock::time_point start)
+{
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+static void printResult(const char* name, uint64_t ops, double seconds, const BufferSharedNonUniformPool* pPool)
+{
+	printf("%-24s %10llu ops %8.3f s %12.0f ops/s | peak %8.2f MB | memoryCpy %8llu calls %10.2f MB | init %4llu resize %4llu",
+		name, (unsigned long long)ops, seconds, seconds > 0.0 ? ops / seconds : 0.0,
+		g_BenchCounters.PeakSize / (1024.0 * 1024.0),
+		(unsigned long long)g_BenchCounters.CopyCalls, g_BenchCounters.CopyBytes / (1024.0 * 1024.0),
+		(unsigned long long)g_BenchCounters.InitCount, (unsigned long long)g_BenchCounters.ResizeCount);
+
+	if (pPool)
+	{
+		printf(" | frag %.3f free blocks %u", pPool->getFragmentation(), pPool->getAllocator().getFreeBlockCount());
+	}
+
+	printf("\n");
+}
+
+// Load a level worth of meshes, then unload them in random order.
+static void benchLoadUnload(uint32_t meshCount)
+{
+	g_BenchCounters.reset();
+	CountingBufferCreator creator;
+	BufferSharedNonUniformPool pool(&creator, 1024 * 1024);
+	BenchRandom random(1);
+
+	std::vector<uint8_t> data(64 * 1024, 0x5a);
+	std::vector<BufferBean> beans;
+	beans.reserve(meshCount);
+
+	BenchClock::time_point start = BenchClock::now();
+	for (uint32_t i = 0; i < meshCount; i++)
+	{
+		beans.push_back(pool.add(random.meshSize(), data.data()));
+	}
+	for (uint32_t i = meshCount; i > 0; i--)
+	{
+		const uint32_t index = random.range(i);
+		pool.remove(beans[index]);
+		beans[index] = beans[i - 1];
+	}
+
+	printResult("load/unload", meshCount * 2ull, secondsSince(start), &pool);
+}
+
+// Streamed geometry: a steady set of live meshes where some are swapped and updated every frame,
+// with a bounded defragmentation step at the end of each frame.
+static void benchStreaming(uint32_t liveCount, uint32_t frames, uint32_t churnPerFrame, uint32_t defragBudget)
+{
+	g_BenchCounters.reset();
+	CountingBufferCreator creator;
+	BufferSharedNonUniformPool pool(&creator, 1024 * 1024);
+	BenchRandom random(2);
+
+	std::vector<uint8_t> data(64 * 1024, 0xa5);
+	std::vector<BufferBean> beans;
+	std::vector<uint32_t> sizes;
+	for (uint32_t i = 0; i < liveCount; i++)
+	{
+		sizes.push_back(random.meshSize());
+		beans.push_back(pool.add(sizes.back(), data.data()));
+	}
+
+	g_BenchCounters.CopyCalls = 0;
+	g_BenchCounters.CopyBytes = 0;
+
+	uint64_t ops = 0;
+	BenchClock::time_point start = BenchClock::now();
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		for (uint32_t i = 0; i < churnPerFrame; i++)
+		{
+			const uint32_t index = random.range(liveCount);
+			pool.remove(beans[index]);
+			sizes[index] = random.meshSize();
+			beans[index] = pool.add(sizes[index], data.data());
+
+			const uint32_t updated = random.range(liveCount);
+			pool.update(beans[updated], 0, sizes[updated] / 2, data.data());
+			ops += 3;
+		}
+
+		if (defragBudget)
+		{
+			pool.defragment(defragBudget);
+		}
+	}
+
+	char name[64];
+	sprintf(name, "streaming (defrag %uK)", defragBudget / 1024);
+	printResult(name, ops, secondsSince(start), &pool);
+}
+
+// Per-object constants written into the ring of a uniform pool every frame.
+static void benchUniformRing(uint32_t objectCount, uint32_t objectSize, uint32_t frames)
+{
+	g_BenchCounters.reset();
+	CountingBufferCreator creator;
+	BufferSharedUniformPool pool(&creator);
+	pool.init(objectSize, objectCount, 3);
+
+	std::vector<uint8_t> data(objectSize, 0x3c);
+
+	BenchClock::time_point start = BenchClock::now();
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		pool.beginUpdate();
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			memcpy(pool.map(i), data.data(), objectSize);
+		}
+		pool.endUpdate();
+		pool.doneRendering();
+	}
+
+	printResult("uniform ring", uint64_t(objectCount) * frames, secondsSince(start), nullptr);
+}
+
+// Streamed meshes of a GeometryAttribBuffer in GL buffers, defragmented with a budget at the end of
+// every frame. The draws cache the offsets of their meshes and refresh them when getOffsetsVersion()
+// moves, then every live mesh is read back at its cached offset.
+static void benchGeometryStreaming(uint32_t liveCount, uint32_t frames, uint32_t churnPerFrame, uint32_t defragBudget)
+{
+	typedef struct CachedDraw
+	{
+		int32_t Key;
+		uint32_t Size;
+		uint32_t VertexOffset;
+		uint32_t ElementOffset;
+	}CachedDraw;
+
+	AttribDesc position(0, 3, DataType::FLOAT);
+	GeometryAttribDesc attribDesc = { 1, &position };
+	GeometryBufferDesc bufferDesc = { 1, &attribDesc };
+	GeometryAttribBuffer geometries(true, 1, &bufferDesc);
+	BenchRandom random(3);
+
+	std::vector<uint8_t> data(64 * 1024);
+	uint16_t indices[6] = { 0, 1, 2, 2, 1, 3 };
+	std::vector<CachedDraw> draws(liveCount);
+
+	// Every mesh is filled with the low byte of its key, so the read back can tell them apart.
+	auto addMesh = [&](CachedDraw& draw)
+	{
+		draw.Key = geometries.generateKey();
+		draw.Size = random.meshSize();
+		memset(data.data(), draw.Key & 0xFF, draw.Size);
+
+		uint8_t* pAttribData = data.data();
+		GeometryAttribData attribData = { 1, &draw.Size, &pAttribData, DataType::UINT16, sizeof(indices), reinterpret_cast<uint8_t*>(indices) };
+		geometries.add(draw.Key, attribData);
+	};
+
+	auto refreshDraws = [&]()
+	{
+		for (CachedDraw& draw : draws)
+		{
+			const GeometryBufferOffset& offset = geometries.getBufferOffset(draw.Key);
+			draw.VertexOffset = offset.BufferOffsets[0].AttribOffset[0];
+			draw.ElementOffset = offset.ElementOffset;
+		}
+	};
+
+	for (CachedDraw& draw : draws)
+	{
+		addMesh(draw);
+	}
+	refreshDraws();
+
+	uint32_t version = geometries.getOffsetsVersion();
+	uint32_t refreshCount = 0;
+	uint64_t movedBytes = 0;
+	BenchClock::time_point start = BenchClock::now();
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		for (uint32_t i = 0; i < churnPerFrame; i++)
+		{
+			CachedDraw& draw = draws[random.range(liveCount)];
+			geometries.remove(draw.Key);
+			addMesh(draw);
+			const GeometryBufferOffset& offset = geometries.getBufferOffset(draw.Key);
+			draw.VertexOffset = offset.BufferOffsets[0].AttribOffset[0];
+			draw.ElementOffset = offset.ElementOffset;
+		}
+
+		movedBytes += geometries.defragment(defragBudget);
+		if (geometries.getOffsetsVersion() != version)
+		{
+			version = geometries.getOffsetsVersion();
+			refreshDraws();
+			refreshCount++;
+		}
+	}
+	const double seconds = secondsSince(start);
+	const float fragmentation = geometries.getFragmentation();
+
+	// Closing all the holes at the end goes through the same listeners.
+	geometries.getAttribBuffer(0)->compact();
+	geometries.getElementBuffer()->compact();
+	const bool bCompacted = geometries.getOffsetsVersion() != version;
+	refreshDraws();
+
+	BufferGPUSharedNonUniformPool* pVertices = geometries.getAttribBuffer(0);
+	uint32_t readBackSize = 0;
+	for (const CachedDraw& draw : draws)
+	{
+		readBackSize = std::max(readBackSize, draw.VertexOffset + draw.Size);
+	}
+
+	std::vector<uint8_t> readBack(readBackSize);
+	glBindBuffer(GL_COPY_READ_BUFFER, pVertices->getBufferID());
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, readBack.size(), readBack.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	uint32_t stale = 0;
+	for (const CachedDraw& draw : draws)
+	{
+		stale += draw.VertexOffset != pVertices->getOffset(geometries.getBufferOffset(draw.Key).BufferBeans[0]);
+		stale += readBack[draw.VertexOffset] != (draw.Key & 0xFF) || readBack[draw.VertexOffset + draw.Size - 1] != (draw.Key & 0xFF);
+	}
+
+	char name[64];
+	sprintf(name, "geometry (defrag %uK)", defragBudget / 1024);
+	printf("%-24s %10u frames %8.3f s | moved %10.2f MB | offset refreshes %4u | frag %.3f | compacted %s | stale draws %u\n",
+		name, frames, seconds, movedBytes / (1024.0 * 1024.0), refreshCount, fragmentation, bCompacted ? "yes" : "no", stale);
+
+	for (const CachedDraw& draw : draws)
+	{
+		geometries.remove(draw.Key);
+	}
+}
+
+// The GeometryAttribBuffer keeps its meshes in GL buffers, a hidden window provides the context.
+static void benchGeometryStreamingGL()
+{
+	if (!glfwInit())
+	{
+		printf("geometry streaming: glfwInit failed, skipped\n");
+		return;
+	}
+
+	glfwWindowHint(GLFW_VISIBLE, 0);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow* pWindow = glfwCreateWindow(64, 64, "BufferPoolBenchmark", nullptr, nullptr);
+	if (pWindow)
+	{
+		glfwMakeContextCurrent(pWindow);
+		glewExperimental = GL_TRUE;
+		glewInit();
+
+		benchGeometryStreaming(2000, 300, 16, 256 * 1024);
+		glfwDestroyWindow(pWindow);
+	}
+	else
+	{
+		printf("geometry streaming: no GL 4.3 context, skipped\n");
+	}
+
+	glfwTerminate();
+}
+
+void buffer_pool_benchmark()
+{
+	benchLoadUnload(20000);
+	benchStreaming(10000, 600, 64, 0);
+	benchStreaming(10000, 600, 64, 256 * 1024);
+	benchUniformRing(4096, 256, 1000);
+	benchGeometryStreamingGL();
+}
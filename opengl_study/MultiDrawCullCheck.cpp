@@ -0,0 +1,236 @@
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <SpatialManager.h>
+#include <BatchBuffer.h>
+#include <AssetLoader.h>
+#include <GLCapabilities.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+using namespace jet::util;
+
+// Headless check of the MULTI_DRAW batch: a row of boxes is culled on the GPU in a hidden window,
+// the commands and the draw counts read back must keep exactly the boxes the camera sees on the CPU.
+
+static const uint32_t BOX_COUNT = 200;
+
+// A zigzag line strip without indices, the MULTI_DRAW batch must leave it to a SINGLE one.
+class StripShape : public Shape3D
+{
+public:
+	StripShape() : Shape3D(Mode::LINE_STRIP) { createShapeName(); }
+
+	const Mode* getSupportedModes(int& length) const override
+	{
+		static const Mode modes[] = { Mode::LINE_STRIP };
+		length = 1;
+		return modes;
+	}
+
+	const MeshAttrib* getSupportAttribs(uint32_t& length) const override
+	{
+		static const MeshAttrib attribs[] = { MeshAttrib::P3NT2 };
+		length = 1;
+		return attribs;
+	}
+
+	const MeshAttrib getSupportCombinedAttrib() const override { return MeshAttrib::P3NT2; }
+
+	MeteDataPtr getVertexData(MeshAttrib attrib, bool indexed = true) const override
+	{
+		if (attrib != MeshAttrib::P3NT2)
+		{
+			return MeteDataPtr();
+		}
+
+		// position, normal, texcoord
+		const uint32_t floatCount = VERTEX_COUNT * 8;
+		float* pVertices = new float[floatCount];
+		memset(pVertices, 0, floatCount * sizeof(float));
+		for (uint32_t i = 0; i < VERTEX_COUNT; i++)
+		{
+			pVertices[i * 8 + 0] = float(i) - 1.5f;
+			pVertices[i * 8 + 1] = (i & 1) ? 0.5f : -0.5f;
+			pVertices[i * 8 + 5] = 1.0f;
+		}
+		return MeteDataPtr(new MeteData(floatCount * sizeof(float), reinterpret_cast<const uint8_t*>(pVertices)));
+	}
+
+	int getVertexCount(bool indexed = true) const override { return VERTEX_COUNT; }
+	int getIndiceCount() const override { return 0; }
+
+	void getBound(BoundingVolume* pBound) const override
+	{
+		const glm::vec3 points[] = { glm::vec3(-1.5f, -0.5f, 0.0f), glm::vec3(1.5f, 0.5f, 0.0f) };
+		pBound->computeFromPoints(points, 2);
+	}
+
+protected:
+	const char* getShapeName() const override { return "CullCheckStrip"; }
+
+private:
+	static const uint32_t VERTEX_COUNT = 4;
+};
+
+// The boxes the camera sees, tested on the CPU with the same bounds the batch uploaded.
+static uint32_t countVisibleBoxes(Camera* pCam, const std::vector<Geometry*>& boxes)
+{
+	uint32_t visible = 0;
+	for (Geometry* pBox : boxes)
+	{
+		pCam->setPlaneState(0);
+		if (pCam->contains(pBox->getWorldBound().get()) != FrustumIntersect::OUTSIDE)
+		{
+			visible++;
+		}
+	}
+	return visible;
+}
+
+// Culls the batch and compares what the GPU kept with the CPU count.
+static bool checkCull(const char* pTitle, SpatialManager& manager, Camera* pCam, const std::vector<Geometry*>& boxes, uint32_t indexCount)
+{
+	manager.updateBatches();
+	manager.cullBatches(pCam);
+
+	std::vector<uint32_t> commands, drawCounts;
+	BatchBuffer* pBatch = manager.getMultiDrawBatch();
+	if (pBatch == nullptr || !pBatch->readCullResults(commands, drawCounts))
+	{
+		printf("%-16s the batch was not culled on the GPU\n", pTitle);
+		return false;
+	}
+
+	// The packed commands of every group start at the first instance of the group, here a single one.
+	const bool bCompact = !drawCounts.empty();
+	const uint32_t commandCount = static_cast<uint32_t>(commands.size() / 5);
+	uint32_t gpuVisible = 0;
+	bool bValid = commandCount == boxes.size();
+	for (uint32_t i = 0; i < commandCount && bValid; i++)
+	{
+		const uint32_t* pCommand = &commands[i * 5];
+		if (bCompact && i >= drawCounts[0])
+		{
+			break;
+		}
+
+		// count, instanceCount, firstIndex, baseVertex, baseInstance
+		bValid = pCommand[0] == indexCount && pCommand[1] <= 1 && pCommand[4] < commandCount;
+		gpuVisible += pCommand[1];
+	}
+
+	const uint32_t cpuVisible = countVisibleBoxes(pCam, boxes);
+	const bool bPassed = bValid && gpuVisible == cpuVisible && (!bCompact || drawCounts[0] == cpuVisible);
+	printf("%-16s %s | %u boxes | GPU kept %u (%s) | CPU sees %u\n", pTitle, bPassed ? "passed" : "FAILED",
+		static_cast<uint32_t>(boxes.size()), gpuVisible, bCompact ? "draw count buffer" : "zero instance commands", cpuVisible);
+	return bPassed;
+}
+
+static bool runMultiDrawCullCheck()
+{
+	const GLCapabilities* pCap = GLCapabilities::get();
+	if (!pCap->OpenGL43 && !(pCap->ARB_compute_shader && pCap->ARB_shader_storage_buffer_object))
+	{
+		printf("multi draw cull check: no compute shaders, skipped\n");
+		return true;
+	}
+
+	AssetLoaderAddSearchPath("../ant_vr_sdk");
+
+	SpatialManager manager;
+	manager.setMultiDrawBatch(true);
+
+	Camera camera(64, 64);
+	camera.setFrustumPerspective(60.0f, 1.0f, 0.1f, 100.0f);
+	camera.setLookAt(glm::vec3(0.0f, 0.0f, 10.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	bool bPassed = true;
+	{
+		Node root("root");
+		root.setSpatialManager(&manager);
+
+		// A row along x, a few boxes around the origin are in the frustum.
+		ShapePtr pShape = ShapePtr(new Box(Box::Mode::TRIANGLES));
+		std::vector<Geometry*> boxes;
+		for (uint32_t i = 0; i < BOX_COUNT; i++)
+		{
+			Geometry* pBox = new Geometry("cull_check_box", pShape);
+			pBox->setLocalTranslation(3.0f * (float(i) - BOX_COUNT / 2.0f), 0.0f, 0.0f);
+			root.attachChild(pBox);
+			boxes.push_back(pBox);
+		}
+
+		// A strip has no index ranges to pack, it must fall back to a batch of its own.
+		Geometry* pStrip = new Geometry("cull_check_strip", ShapePtr(new StripShape()));
+		root.attachChild(pStrip);
+		root.updateGeometricState();
+
+		const bool bStripSingle = manager.findGeometryAssembly(pStrip) != nullptr;
+		printf("%-16s %s | a line strip without indices %s\n", "fallback", bStripSingle ? "passed" : "FAILED", bStripSingle ? "got a SINGLE batch" : "has no batch");
+		bPassed &= bStripSingle;
+		bPassed &= manager.getMultiDrawBatch() != nullptr;
+		bPassed &= checkCull("initial", manager, &camera, boxes, pShape->getIndiceCount());
+
+		// Only the moved boxes are uploaded, the batch must see them through the manager.
+		for (uint32_t i = 0; i < BOX_COUNT; i += 7)
+		{
+			boxes[i]->setLocalTranslation(0.0f, 3.0f * float(i % 3), 0.0f);
+		}
+		root.updateGeometricState();
+		bPassed &= checkCull("moved", manager, &camera, boxes, pShape->getIndiceCount());
+
+		// Removing regroups the batch on the next update.
+		for (uint32_t i = 0; i < BOX_COUNT; i += 2)
+		{
+			root.detachChild(boxes[i]);
+			delete boxes[i];
+			boxes[i] = nullptr;
+		}
+		boxes.erase(std::remove(boxes.begin(), boxes.end(), nullptr), boxes.end());
+		bPassed &= checkCull("removed", manager, &camera, boxes, pShape->getIndiceCount());
+
+		for (Geometry* pBox : boxes)
+		{
+			root.detachChild(pBox);
+			delete pBox;
+		}
+		root.detachChild(pStrip);
+		delete pStrip;
+	}
+
+	SpatialManager::releaseGeometryMomeries();
+	return bPassed;
+}
+
+int multi_draw_cull_check()
+{
+	if (!glfwInit())
+	{
+		printf("multi draw cull check: glfwInit failed\n");
+		return 1;
+	}
+
+	glfwWindowHint(GLFW_VISIBLE, 0);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow* pWindow = glfwCreateWindow(64, 64, "MultiDrawCullCheck", nullptr, nullptr);
+	if (pWindow == nullptr)
+	{
+		printf("multi draw cull check: no GL 4.3 context\n");
+		glfwTerminate();
+		return 1;
+	}
+
+	glfwMakeContextCurrent(pWindow);
+	glewExperimental = GL_TRUE;
+	glewInit();
+
+	const bool bPassed = runMultiDrawCullCheck();
+
+	glfwDestroyWindow(pWindow);
+	glfwTerminate();
+	return bPassed ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <Node.h>
+#include <SceneGraphVisitor.h>
+#include <StringTable.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+
+using namespace jet::util;
+
+// Headless benchmark of the scene graph footprint: builds trees of a million nodes and reports
+// the bytes every node costs and the time of the usual passes over them.
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+static double millisecondsSince(BenchClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+// The bytes held by the nodes: the objects, their child lists and world bounds. The names are counted
+// from the string table and the controls and user data from the side table of the spatials.
+static size_t accountNodeBytes(const std::vector<Node*>& nodes)
+{
+	size_t bytes = 0;
+	for (Node* pNode : nodes)
+	{
+		bytes += sizeof(Node) + pNode->getChildren().capacity() * sizeof(Spatial*);
+
+		const BoundingVolume* pBound = pNode->getWorldBound().get();
+		if (pBound)
+		{
+			bytes += pBound->getType() == BoundingVolume::Type::AABB ? sizeof(BoundingBox) : sizeof(BoundingSphere);
+		}
+	}
+	return bytes;
+}
+
+// nameCount distinct names are spread over the nodes, 0 gives every node its own name.
+// Every userDataStride-th node carries a user data entry, 0 gives none.
+static void benchTree(const char* title, uint32_t nodeCount, uint32_t fanout, uint32_t nameCount, uint32_t userDataStride = 0)
+{
+	const size_t nameBytes = StringTable::get().getBytes();
+	const uint32_t names = StringTable::get().getCount();
+	const size_t sparseBytes = Spatial::getSparseDataBytes();
+
+	std::vector<Node*> nodes;
+	nodes.reserve(nodeCount);
+
+	BenchClock::time_point start = BenchClock::now();
+	char name[64];
+	Node* pRoot = new Node("root");
+	nodes.push_back(pRoot);
+	for (uint32_t parent = 0; nodes.size() < nodeCount; parent++)
+	{
+		for (uint32_t k = 0; k < fanout && nodes.size() < nodeCount; k++)
+		{
+			const uint32_t index = static_cast<uint32_t>(nodes.size());
+			sprintf(name, "scene_node_%u", nameCount ? index % nameCount : index);
+			Node* pNode = new Node(name);
+			pNode->setLocalTranslation(glm::vec3(float(k), 0.0f, 0.0f));
+			if (userDataStride && index % userDataStride == 0)
+			{
+				pNode->setUserData("bench", pNode);
+			}
+			nodes[parent]->attachChild(pNode);
+			nodes.push_back(pNode);
+		}
+	}
+	const double buildTime = millisecondsSince(start);
+
+	start = BenchClock::now();
+	pRoot->updateGeometricState();
+	const double updateTime = millisecondsSince(start);
+
+	SceneGraphTraverser traverser;
+	uint32_t visited = 0;
+	start = BenchClock::now();
+	traverser.depthFirst(pRoot, [&visited](Spatial*) { visited++; return true; });
+	const double walkTime = millisecondsSince(start);
+
+	const size_t nodeBytes = accountNodeBytes(nodes);
+	const size_t tableBytes = (StringTable::get().getBytes() - nameBytes) +
+		(StringTable::get().getCount() - names) * sizeof(std::string);
+	const size_t sideBytes = Spatial::getSparseDataBytes() - sparseBytes;
+
+	printf("%-20s %8u nodes | sizeof(Node) %4u | %6.1f bytes/node (names %5.1f, side table %5.1f) | build %7.1f ms | update %7.1f ms | walk %6.1f ms (%u)\n",
+		title, nodeCount, (uint32_t)sizeof(Node), double(nodeBytes + tableBytes + sideBytes) / nodeCount, double(tableBytes) / nodeCount,
+		double(sideBytes) / nodeCount, buildTime, updateTime, walkTime, visited);
+
+	for (Node* pNode : nodes)
+	{
+		delete pNode;
+	}
+}
+
+void scene_memory_benchmark()
+{
+	benchTree("shared names", 1000000, 10, 100);
+	benchTree("unique names", 1000000, 10, 0);
+	benchTree("wide", 1000000, 100000, 100);
+	benchTree("user data 1/16", 1000000, 10, 100, 16);
+}
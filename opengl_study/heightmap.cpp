@@ -16,6 +16,9 @@ static GLSLProgram* m_ScreenProgram;
 static Texture2D*   m_TestTexture;
 
 extern void rect_pack_test();
+extern void buffer_pool_benchmark();
+extern void scene_memory_benchmark();
+extern int multi_draw_cull_check();
 
 void HeightmapDemo::onCreate()
 {
@@ -278,6 +281,23 @@ void HeightmapDemo::onDispose()
 
 int main(int argc, char** argv)
 {
+	if (argc > 1 && strcmp(argv[1], "-bufferbench") == 0)
+	{
+		buffer_pool_benchmark();
+		return 0;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "-scenebench") == 0)
+	{
+		scene_memory_benchmark();
+		return 0;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "-multidrawcheck") == 0)
+	{
+		return multi_draw_cull_check();
+	}
+
 #if 1
 	HeightmapDemo demo;
 	demo.getConfig().IsOpenGLESContext = false;